@@ -0,0 +1,480 @@
+/*
+ * Microbenchmarks for asmase's own hot paths.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "Assembler.h"
+#include "Builtins.h"
+#include "Inputter.h"
+#include "Profiler.h"
+#include "SymbolTable.h"
+#include "TemplateTable.h"
+#include "Tracee.h"
+
+/** Version of the output format. */
+static const int OUTPUT_VERSION = 1;
+
+/** Stop measuring a benchmark after this many iterations... */
+static const size_t MAX_ITERATIONS = 20000;
+
+/** ...or after this many nanoseconds, whichever comes first. */
+static const uint64_t MAX_DURATION_NS = UINT64_C(500000000);
+
+/** Iterations to run before measuring anything. */
+static const size_t WARMUP_ITERATIONS = 10;
+
+/** Number of lines in the script for the end-to-end benchmark. */
+static const int SCRIPT_LINES = 200;
+
+static const char *progname;
+
+/** A single benchmark. */
+class Benchmark {
+public:
+    std::string name;
+
+    /**
+     * Run one iteration of the benchmark.
+     * @return Zero on success, nonzero on failure.
+     */
+    std::function<int()> run;
+};
+
+/** Measurements for a benchmark. */
+class BenchmarkResult {
+public:
+    std::string name;
+    size_t iterations;
+    double opsPerSec;
+    uint64_t meanNs, p50Ns, p99Ns;
+};
+
+/** Get a monotonic timestamp in nanoseconds. */
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+/**
+ * Keeps stdout pointed at /dev/null while benchmarks print, so that the
+ * terminal isn't part of what's being measured.
+ */
+class QuietStdout {
+    int savedFd;
+
+public:
+    QuietStdout()
+    {
+        fflush(stdout);
+        savedFd = dup(STDOUT_FILENO);
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        close(devNull);
+    }
+
+    ~QuietStdout()
+    {
+        fflush(stdout);
+        dup2(savedFd, STDOUT_FILENO);
+        close(savedFd);
+    }
+};
+
+/**
+ * Run a benchmark and collect its latency distribution.
+ * @return Zero on success, nonzero on failure.
+ */
+static int runBenchmark(const Benchmark &benchmark, BenchmarkResult &resultOut)
+{
+    std::vector<uint64_t> samples;
+    samples.reserve(MAX_ITERATIONS);
+
+    {
+        QuietStdout quiet;
+
+        for (size_t i = 0; i < WARMUP_ITERATIONS; ++i) {
+            if (benchmark.run())
+                return 1;
+        }
+
+        uint64_t start = nowNs();
+        while (samples.size() < MAX_ITERATIONS &&
+               nowNs() - start < MAX_DURATION_NS) {
+            uint64_t before = nowNs();
+            if (benchmark.run())
+                return 1;
+            samples.push_back(nowNs() - before);
+        }
+    }
+
+    uint64_t total = 0;
+    for (uint64_t sample : samples)
+        total += sample;
+    std::sort(samples.begin(), samples.end());
+
+    resultOut.name = benchmark.name;
+    resultOut.iterations = samples.size();
+    resultOut.meanNs = total / samples.size();
+    resultOut.p50Ns = samples[samples.size() / 2];
+    resultOut.p99Ns = samples[samples.size() * 99 / 100];
+    resultOut.opsPerSec = total ? samples.size() * 1e9 / total : 0.0;
+    return 0;
+}
+
+/**
+ * Run a line through the REPL binary end-to-end.
+ * @return Zero on success, nonzero on failure.
+ */
+static int runScript(const std::string &asmase, const std::string &script)
+{
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return 1;
+    }
+
+    if (pid == 0) {
+        int in = open(script.c_str(), O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in == -1 || out == -1)
+            _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        execl(asmase.c_str(), asmase.c_str(), (char *) nullptr);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) {
+        perror("waitpid");
+        return 1;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s did not exit cleanly\n", asmase.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+/** Write a script for the end-to-end benchmark. */
+static int writeScript(const std::string &filename)
+{
+    std::ofstream script{filename};
+    for (int i = 0; i < SCRIPT_LINES; ++i) {
+        switch (i % 4) {
+            case 0: script << "addq $1, %rax\n"; break;
+            case 1: script << "xorq %rbx, %rbx\n"; break;
+            case 2: script << ":print ($rax + 1)\n"; break;
+            case 3: script << "leaq 8(%rsp), %rcx\n"; break;
+        }
+    }
+    script << ":quit\n";
+    return !script;
+}
+
+/** Print results in the output format. */
+static void printResults(FILE *file, const std::vector<BenchmarkResult> &results)
+{
+    fprintf(file, "# asmase-bench %d\n", OUTPUT_VERSION);
+    fprintf(file, "# name\titerations\tops_per_sec\tmean_ns\tp50_ns\tp99_ns\n");
+    for (const BenchmarkResult &result : results) {
+        fprintf(file, "%s\t%zu\t%.1f\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+                result.name.c_str(), result.iterations, result.opsPerSec,
+                result.meanNs, result.p50Ns, result.p99Ns);
+    }
+}
+
+/**
+ * Read the median latencies from a previous run.
+ * @return Zero on success, nonzero on failure.
+ */
+static int readBaseline(const std::string &filename,
+                        std::map<std::string, uint64_t> &p50Out)
+{
+    std::ifstream file{filename};
+    if (!file) {
+        fprintf(stderr, "could not open %s\n", filename.c_str());
+        return 1;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream fields{line};
+        std::string name;
+        size_t iterations;
+        double opsPerSec;
+        uint64_t meanNs, p50Ns;
+        if (!(fields >> name >> iterations >> opsPerSec >> meanNs >> p50Ns)) {
+            fprintf(stderr, "%s: malformed line: %s\n", filename.c_str(),
+                    line.c_str());
+            return 1;
+        }
+        p50Out[name] = p50Ns;
+    }
+
+    return 0;
+}
+
+static void usage(bool error)
+{
+    fprintf(error ? stderr : stdout,
+            "Usage: %s [--asmase=PATH] [--output=FILE] [--baseline=FILE]\n"
+            "          [--threshold=PERCENT] [--mock]\n", progname);
+}
+
+enum LongOption {
+    OPT_ASMASE = 256,
+    OPT_OUTPUT,
+    OPT_BASELINE,
+    OPT_THRESHOLD,
+    OPT_MOCK,
+};
+
+int main(int argc, char *argv[])
+{
+    std::string asmase, outputFile, baselineFile;
+    double threshold = 20.0;
+    bool mock = false;
+
+    static struct option long_options[] = {
+        {"help",      no_argument,       nullptr, 'h'},
+        {"asmase",    required_argument, nullptr, OPT_ASMASE},
+        {"output",    required_argument, nullptr, OPT_OUTPUT},
+        {"baseline",  required_argument, nullptr, OPT_BASELINE},
+        {"threshold", required_argument, nullptr, OPT_THRESHOLD},
+        {"mock",      no_argument,       nullptr, OPT_MOCK},
+        {nullptr,     0,                 nullptr, 0},
+    };
+
+    progname = argv[0];
+
+    for (;;) {
+        int c = getopt_long(argc, argv, "h", long_options, nullptr);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'h':
+            usage(false);
+            return 0;
+        case OPT_ASMASE:
+            asmase = optarg;
+            break;
+        case OPT_OUTPUT:
+            outputFile = optarg;
+            break;
+        case OPT_BASELINE:
+            baselineFile = optarg;
+            break;
+        case OPT_THRESHOLD:
+            threshold = atof(optarg);
+            break;
+        case OPT_MOCK:
+            mock = true;
+            break;
+        default:
+            usage(true);
+            return 2;
+        }
+    }
+
+    // A mock tracee leaves ptrace out of everything but can't run code, so
+    // there is nothing to compare the end-to-end script against
+    if (mock)
+        asmase.clear();
+
+    std::shared_ptr<Tracee> tracee{mock ? Tracee::createMockTracee() :
+                                          Tracee::createTracee()};
+    if (!tracee)
+        return 1;
+
+    std::shared_ptr<AssemblerContext>
+        assemblerContext{Assembler::createAssemblerContext()};
+    if (!assemblerContext)
+        return 1;
+    Assembler assembler{assemblerContext};
+    Inputter inputter;
+    SymbolTable symbols;
+    Profiler profiler;
+    TemplateTable templates;
+
+    // A single nop which stays in place to be executed over and over
+    AssembledCode nop;
+    if (assembler.assembleInstruction("nop", nop, inputter))
+        return 1;
+    void *nopAddress = tracee->writeInstruction(nop.machineCode);
+    if (!nopAddress)
+        return 1;
+
+    std::vector<Benchmark> benchmarks;
+    AssembledCode code;
+    bytestring state;
+
+    benchmarks.push_back({"assemble_line", [&]() {
+        return assembler.assembleInstruction("addq $1, %rax", code, inputter);
+    }});
+    benchmarks.push_back({"assemble_data_line", [&]() {
+        return assembler.assembleInstruction(".quad 1, 2, 3, 4", code,
+                                             inputter);
+    }});
+
+    // The same line as a template, patched instead of assembled
+    AssembledCode templateCode;
+    if (assembler.assembleInstruction("addq $n, %rax", templateCode,
+                                      inputter) ||
+        templates.define(*tracee, symbols, "add", {"n"}, templateCode))
+        return 1;
+    std::vector<uint64_t> templateArgs{1};
+    benchmarks.push_back({"patch_template", [&]() {
+        return templates.instantiate(*tracee, "add", templateArgs);
+    }});
+    if (!mock) {
+        benchmarks.push_back({"execute_round_trip", [&]() {
+            return tracee->executeInstruction(nopAddress);
+        }});
+    }
+    benchmarks.push_back({"register_fetch", [&]() {
+        return tracee->getRegisterState(state);
+    }});
+
+    // Dump the scratch region so that the same memory is read every time
+    const void *scratch = tracee->getMemory().scratch.address;
+    for (int units : {1, 64, 1024}) {
+        std::ostringstream command;
+        command << ":memory " << reinterpret_cast<uintptr_t>(scratch) << " "
+                << units << " x g";
+        std::string line = command.str();
+        benchmarks.push_back({"memory_dump_" + std::to_string(units * 8) + "b",
+                              [&, line]() {
+            return runBuiltin(line, *tracee, symbols, profiler, templates,
+                              &assembler, inputter);
+        }});
+    }
+
+    benchmarks.push_back({"builtin_print_expr", [&]() {
+        return runBuiltin(":print ((1 + 2) * 3 << 4)", *tracee, symbols,
+                          profiler, templates, &assembler, inputter);
+    }});
+    benchmarks.push_back({"builtin_print_register", [&]() {
+        return runBuiltin(":print $rax", *tracee, symbols, profiler,
+                          templates, &assembler, inputter);
+    }});
+
+    char scriptFile[] = "/tmp/asmase-bench-XXXXXX";
+    if (!asmase.empty()) {
+        int fd = mkstemp(scriptFile);
+        if (fd == -1) {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+        if (writeScript(scriptFile)) {
+            fprintf(stderr, "could not write %s\n", scriptFile);
+            unlink(scriptFile);
+            return 1;
+        }
+        benchmarks.push_back({"repl_script_" + std::to_string(SCRIPT_LINES) +
+                              "_lines", [&]() {
+            return runScript(asmase, scriptFile);
+        }});
+    }
+
+    std::vector<BenchmarkResult> results;
+    int error = 0;
+    for (const Benchmark &benchmark : benchmarks) {
+        BenchmarkResult result;
+        if (runBenchmark(benchmark, result)) {
+            fprintf(stderr, "%s failed\n", benchmark.name.c_str());
+            error = 1;
+            break;
+        }
+        results.push_back(result);
+    }
+
+    if (!asmase.empty())
+        unlink(scriptFile);
+    if (error)
+        return 1;
+
+    printResults(stdout, results);
+    if (!outputFile.empty()) {
+        FILE *file = fopen(outputFile.c_str(), "w");
+        if (!file) {
+            perror("fopen");
+            fprintf(stderr, "could not create %s\n", outputFile.c_str());
+            return 1;
+        }
+        printResults(file, results);
+        fclose(file);
+    }
+
+    if (baselineFile.empty())
+        return 0;
+
+    std::map<std::string, uint64_t> baseline;
+    if (readBaseline(baselineFile, baseline))
+        return 1;
+
+    int regressions = 0;
+    for (const BenchmarkResult &result : results) {
+        auto it = baseline.find(result.name);
+        if (it == baseline.end() || it->second == 0)
+            continue;
+
+        double change = 100.0 * ((double) result.p50Ns - it->second) /
+                        it->second;
+        if (change > threshold) {
+            fprintf(stderr,
+                    "regression: %s p50 %" PRIu64 " ns vs %" PRIu64 " ns (%+.1f%%)\n",
+                    result.name.c_str(), result.p50Ns, it->second, change);
+            ++regressions;
+        }
+    }
+
+    if (regressions) {
+        fprintf(stderr, "%d benchmarks regressed by more than %.1f%%\n",
+                regressions, threshold);
+        return 1;
+    }
+    return 0;
+}
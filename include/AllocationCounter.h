@@ -0,0 +1,41 @@
+/*
+ * Heap allocation counter.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_ALLOCATION_COUNTER_H
+#define ASMASE_ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+/**
+ * Return whether heap allocations can be counted. This requires overriding
+ * malloc(), which is only done with glibc when asmase is built with
+ * COUNT_ALLOCATIONS=1.
+ */
+bool canCountAllocations();
+
+/**
+ * Get the number of calls to malloc(), calloc(), realloc(), and the aligned
+ * allocation functions (including those made by operator new) since the
+ * program started. This is always zero if allocations can't be counted.
+ */
+uint64_t getAllocationCount();
+
+#endif /* ASMASE_ALLOCATION_COUNTER_H */
@@ -30,11 +30,22 @@ class ARMTracee : public Tracee {
     virtual int setProgramCounter(void *pc);
     virtual int updateRegisters();
 
-    virtual int printGeneralPurposeRegisters();
-    virtual int printConditionCodeRegisters();
+    virtual int readSyscallEntry(SyscallRecord &recordOut);
+    virtual int readSyscallExit(SyscallRecord &recordOut);
+
+    virtual const bytestring &getSyscallInstruction();
+    virtual int saveGeneralRegisters(bytestring &regsOut);
+    virtual int restoreGeneralRegisters(const bytestring &regs);
+    virtual int setSyscallRegisters(const SyscallRecord &call);
+    virtual int setCallRegisters(const FunctionCall &call, void *stackTop,
+                                 void *returnAddress);
+    virtual int readCallReturn(FunctionCall &callOut);
 
 public:
-    ARMTracee(pid_t pid, void *sharedMemory, size_t sharedSize);
+    ARMTracee(pid_t pid, const TraceeMemory &memory);
+
+    virtual int saveRegisterContext(bytestring &contextOut);
+    virtual int restoreRegisterContext(const bytestring &context);
 
     virtual void printInstruction(const bytestring &machineCode);
 };
@@ -29,12 +29,20 @@ class X86Tracee : public Tracee {
 
     virtual int setProgramCounter(void *pc);
     virtual int updateRegisters();
+    virtual void *getFetchedProgramCounter();
 
-    virtual int printGeneralPurposeRegisters();
-    virtual int printConditionCodeRegisters();
-    virtual int printSegmentationRegisters();
-    virtual int printFloatingPointRegisters();
-    virtual int printExtraRegisters();
+    virtual int readSyscallEntry(SyscallRecord &recordOut);
+    virtual int readSyscallExit(SyscallRecord &recordOut);
+
+    virtual const bytestring &getSyscallInstruction();
+    virtual const bytestring &getTimedCallStub();
+    virtual int saveGeneralRegisters(bytestring &regsOut);
+    virtual int restoreGeneralRegisters(const bytestring &regs);
+    virtual int setSyscallRegisters(const SyscallRecord &call);
+    virtual int setCallRegisters(const FunctionCall &call, void *stackTop,
+                                 void *returnAddress);
+    virtual int readCallReturn(FunctionCall &callOut);
+    virtual int skipRedZone();
 
     /**
      * ptrace returns the floating point tag word as a simple bitmap of valid
@@ -44,7 +52,12 @@ class X86Tracee : public Tracee {
     void reconstructTagWord();
 
 public:
-    X86Tracee(pid_t pid, void *sharedMemory, size_t sharedSize);
+    X86Tracee(pid_t pid, const TraceeMemory &memory);
+
+    virtual int saveRegisterContext(bytestring &contextOut);
+    virtual int restoreRegisterContext(const bytestring &context);
+
+    virtual int scrambleBranchPredictors(unsigned long iterations);
 };
 
 #endif /* ASMASE_ARCH_X86_X86TRACEE_H */
@@ -22,12 +22,119 @@
 #ifndef ASMASE_ASSEMBLER_H
 #define ASMASE_ASSEMBLER_H
 
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "Support.h"
 
+class AssemblyCache;
 class Inputter;
 
+/** Segments of assembled code which are placed in the tracee separately. */
+enum class Segment {
+    /** Machine code from the text section. */
+    CODE,
+
+    /** Contents of all other allocated sections (.data, .bss, etc.). */
+    DATA,
+};
+
+/** A label defined by assembled code. */
+class Label {
+public:
+    /** Name of the label. */
+    std::string name;
+
+    /** Segment containing the label. */
+    Segment segment;
+
+    /** Offset of the label from the start of its segment. */
+    size_t offset;
+
+    Label(const std::string &name, Segment segment, size_t offset)
+        : name{name}, segment{segment}, offset{offset} {}
+};
+
+/**
+ * A field in assembled code which refers to a symbol and must be patched once
+ * the address of the code and the value of the symbol are known.
+ */
+class Fixup {
+public:
+    /**
+     * Name of the referenced symbol. If this is empty, the fixup refers to
+     * the start of the target segment.
+     */
+    std::string symbol;
+
+    /** Segment referred to if there is no symbol name. */
+    Segment target;
+
+    /** Segment containing the field. */
+    Segment segment;
+
+    /** Offset of the field from the start of its segment. */
+    size_t offset;
+
+    /** Size of the field in bytes. */
+    size_t size;
+
+    /** Whether the field is relative to its own address. */
+    bool pcRelative;
+
+    /** Whether the field is sign-extended when it is used. */
+    bool isSigned;
+
+    /** Constant to add to the value of the symbol. */
+    int64_t addend;
+};
+
+/** Machine code and the symbol information needed to link it. */
+class AssembledCode {
+public:
+    /** The machine code. */
+    bytestring machineCode;
+
+    /** The data. */
+    bytestring data;
+
+    /** Required alignment of the data. */
+    size_t dataAlignment;
+
+    /** Labels defined by the code. */
+    std::vector<Label> labels;
+
+    /** Fields which need to be patched when the code is linked. */
+    std::vector<Fixup> fixups;
+
+    /**
+     * Whether the host CPU supports the machine code. This is only false when
+     * assembling for a different CPU or feature set than the host's.
+     */
+    bool hostSupported;
+
+    AssembledCode() : dataAlignment{1}, hostSupported{true} {}
+
+    /** Reset to empty while keeping the allocated buffers for reuse. */
+    void clear()
+    {
+        machineCode.clear();
+        data.clear();
+        dataAlignment = 1;
+        labels.clear();
+        fixups.clear();
+        hostSupported = true;
+    }
+
+    /** Get the contents of a segment. */
+    bytestring &getSegment(Segment segment)
+    {
+        return segment == Segment::CODE ? machineCode : data;
+    }
+};
+
 /** Opaque handle for an assembler context. */
 class AssemblerContext;
 
@@ -36,25 +143,87 @@ class Assembler {
     /** The assembler context for this assembler. */
     const std::shared_ptr<AssemblerContext> context;
 
+    /** Cache to consult before assembling anything, or nullptr. */
+    AssemblyCache *cache;
+
+    // Buffers which are reused from line to line to avoid allocations
+
+    /** Key of the current line in the cache. */
+    std::string cacheKey;
+
+    /** Source text handed to LLVM. */
+    std::string source;
+
+    /** Output of checking a line against the host CPU. */
+    AssembledCode hostCode;
+
+    /**
+     * Return whether a line consists only of directives (and labels), e.g.,
+     * ".quad 1" or "table: .byte 1, 2, 3". Such lines are assembled into the
+     * data section instead of the text section so that they don't get
+     * executed.
+     */
+    bool isDataLine(const std::string &instruction) const;
+
+    /**
+     * Fill in the size and kind of a fixup from a relocation type for the host
+     * platform.
+     * @return Zero on success, nonzero if the relocation is unsupported.
+     */
+    static int decodePlatformRelocation(uint32_t type, Fixup &fixup);
+
+    /**
+     * Extract the machine code, data, labels, and fixups from the object file
+     * generated by the assembler.
+     * @return Zero on success, nonzero on failure.
+     */
+    static int extractCode(const void *objectFile, size_t size,
+                           AssembledCode &codeOut);
+
+    /**
+     * Assemble an instruction for the given CPU and features.
+     * @param inputter Used for reporting diagnostics. If nullptr, diagnostics
+     * are discarded.
+     * @return Zero on success, nonzero on failure.
+     */
+    int assemble(const std::string &instruction, const std::string &mcpu,
+                 const std::string &features, AssembledCode &codeOut,
+                 const Inputter *inputter);
+
 public:
-    /** Create an assembler in the given context. */
-    Assembler(std::shared_ptr<AssemblerContext> &context)
-        : context{context} {}
+    /**
+     * Create an assembler in the given context.
+     * @param cache Optional cache of assembled code, which must outlive the
+     * assembler.
+     */
+    Assembler(std::shared_ptr<AssemblerContext> &context,
+              AssemblyCache *cache = nullptr)
+        : context{context}, cache{cache} {}
 
     /**
-     * Assemble the given assembly instruction to machine code.
+     * Assemble the given assembly instruction to machine code. The output of
+     * data sections (e.g., after a .data directive) is returned separately
+     * from the machine code. References to symbols which are not defined by
+     * the instruction itself are left as fixups to be resolved by a
+     * SymbolTable. If the assembler context targets a CPU other than the
+     * host, the code is also checked against the host CPU.
      * @return Zero on success, nonzero on failure.
      */
     int assembleInstruction(const std::string &instruction,
-                            bytestring &machineCodeOut,
+                            AssembledCode &codeOut,
                             const Inputter &inputter);
 
     /**
      * Create an assembler context which can be used to construct an
      * assembler.
+     * @param mcpu CPU to assemble for, or empty to detect the host CPU.
+     * @param mattr Comma-separated list of features to enable ("+feature") or
+     * disable ("-feature") on top of the CPU's features.
      * @return nullptr on error.
      */
-    static std::shared_ptr<AssemblerContext> createAssemblerContext();
+    static std::shared_ptr<AssemblerContext>
+    createAssemblerContext(const std::string &mcpu = "",
+                           const std::string &mattr = "");
 };
 
 #endif /* ASMASE_ASSEMBLER_H */
@@ -0,0 +1,110 @@
+/*
+ * AssemblyCache class.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_ASSEMBLY_CACHE_H
+#define ASMASE_ASSEMBLY_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class AssembledCode;
+
+/**
+ * On-disk cache of assembled code which persists across runs. The key is
+ * opaque to the cache; the assembler is responsible for putting everything
+ * that affects the output (the input text, LLVM version, target, CPU, and
+ * features) into it.
+ *
+ * The file is a fixed-size hash table of offsets followed by entries which
+ * are only ever appended, so it can be read through a shared mapping. Readers
+ * take a shared flock() and writers an exclusive one, so any number of
+ * processes can use the same file at once. Everything read from the file is
+ * bounds-checked. The cache is best-effort: once the table is mostly full or
+ * the file reaches its size limit, new entries are silently dropped.
+ */
+class AssemblyCache {
+    /** File descriptor of the cache file. */
+    int fd;
+
+    /** Name of the cache file for error messages. */
+    std::string filename;
+
+    /** Mapping of the cache file. */
+    const unsigned char *map;
+
+    /** Size of the mapping. */
+    size_t mapSize;
+
+    AssemblyCache(int fd, const std::string &filename)
+        : fd{fd}, filename{filename}, map{nullptr}, mapSize{0} {}
+
+    /**
+     * Make sure the whole file is mapped. This must be called with the lock
+     * held.
+     * @return Zero on success, nonzero on failure.
+     */
+    int remap();
+
+    /**
+     * Find the bucket for the given key. This must be called with the lock
+     * held and the file mapped.
+     * @param offsetOut Set to the offset of the matching entry, or zero if
+     * there is none and the bucket is free.
+     * @return The index of the bucket, or -1 if the key isn't there and the
+     * table is full.
+     */
+    int64_t findBucket(uint64_t hash, const std::string &key,
+                       uint64_t &offsetOut) const;
+
+    /**
+     * Get the value of the entry at the given offset.
+     * @return nullptr if the entry is malformed.
+     */
+    const unsigned char *getValue(uint64_t offset, uint32_t &sizeOut) const;
+
+public:
+    ~AssemblyCache();
+
+    AssemblyCache(const AssemblyCache &) = delete;
+    AssemblyCache &operator=(const AssemblyCache &) = delete;
+
+    /**
+     * Look up cached code.
+     * @return Zero if the code was found, nonzero otherwise.
+     */
+    int lookup(const std::string &key, AssembledCode &codeOut);
+
+    /**
+     * Add code to the cache.
+     * @return Zero on success (including if the cache is full), nonzero on
+     * failure.
+     */
+    int insert(const std::string &key, const AssembledCode &code);
+
+    /**
+     * Open a cache file, creating it if it doesn't exist.
+     * @return nullptr on error.
+     */
+    static std::unique_ptr<AssemblyCache> open(const std::string &filename);
+};
+
+#endif /* ASMASE_ASSEMBLY_CACHE_H */
@@ -22,7 +22,13 @@
 #ifndef ASMASE_BUILTINS_H
 #define ASMASE_BUILTINS_H
 
+class AssembledCode;
+class Assembler;
 class Inputter;
+class Profiler;
+class SessionLog;
+class SymbolTable;
+class TemplateTable;
 class Tracee;
 
 /**
@@ -31,10 +37,27 @@ class Tracee;
  */
 bool isBuiltin(const std::string &str);
 
+/**
+ * Return whether the given built-in defines a template. Since the definition
+ * may go on for several lines and has to be replayed without assembling it,
+ * the built-in records itself in the session log along with its code instead
+ * of being logged as a line of input.
+ */
+bool definesTemplate(const std::string &str);
+
 /**
  * Run a command line built-in.
+ * @param assembler Assembler for built-ins which assemble code, or nullptr
+ * if there isn't one.
+ * @param log Log to record templates in, or nullptr.
+ * @param recordedCode Code recorded along with the built-in when replaying a
+ * session, or nullptr.
  * @return Positive on error, 0 on success, negative on exit.
  */
-int runBuiltin(const std::string &str, Tracee &tracee, Inputter &inputter);
+int runBuiltin(const std::string &str, Tracee &tracee, SymbolTable &symbols,
+               Profiler &profiler, TemplateTable &templates,
+               Assembler *assembler, Inputter &inputter,
+               SessionLog *log = nullptr,
+               const AssembledCode *recordedCode = nullptr);
 
 #endif /* ASMASE_BUILTINS_H */
@@ -26,13 +26,18 @@
 #include <string>
 #include <vector>
 
+#include "Recycled.h"
+
 namespace Builtins {
 
 class Environment;
 class ValueAST;
 
-/** Base class AST for all expressions. */
-class ExprAST {
+/**
+ * Base class AST for all expressions. Expressions only live as long as the
+ * line they were parsed from, so they are recycled.
+ */
+class ExprAST : public Recycled {
     /** Bounds of the token in the input. */
     int columnStart, columnEnd;
 
@@ -81,6 +86,19 @@ public:
     virtual ValueAST *eval(Environment &env) const;
 };
 
+/** The address of a symbol, e.g., &memcpy, to be looked up later. */
+class SymbolExpr : public ExprAST {
+    /** The name of the symbol. */
+    std::string name;
+
+public:
+    SymbolExpr(int columnStart, int columnEnd, const std::string &name)
+        : ExprAST{columnStart, columnEnd}, name{name} {}
+
+    /** Evaluate the address of the symbol by looking it up. */
+    virtual ValueAST *eval(Environment &env) const;
+};
+
 /** Opcodes for unary operators. */
 enum UnaryOpcode {
     NONE,
@@ -138,7 +156,7 @@ public:
 };
 
 /** Full command line (not an expression). */
-class CommandAST {
+class CommandAST : public Recycled {
     /** The command name itself. */
     std::string command;
 
@@ -146,7 +164,7 @@ class CommandAST {
     int commandStart, commandEnd;
 
     /** The argument expressions. */
-    std::vector<std::unique_ptr<ExprAST>> args; // Owned pointers
+    RecycledVector<std::unique_ptr<ExprAST>> args; // Owned pointers
 
 public:
     CommandAST(const std::string &command, int commandStart, int commandEnd)
@@ -155,11 +173,11 @@ public:
     const std::string &getCommand() const { return command; }
     int getCommandStart() const { return commandStart; }
     int getCommandEnd() const { return commandEnd; }
-    const std::vector<std::unique_ptr<ExprAST>> &getArgs() const { return args; }
-    std::vector<std::unique_ptr<ExprAST>> &getArgs() { return args; }
+    const std::vector<std::unique_ptr<ExprAST>> &getArgs() const { return *args; }
+    std::vector<std::unique_ptr<ExprAST>> &getArgs() { return *args; }
 
-    std::vector<std::unique_ptr<ExprAST>>::iterator begin() { return args.begin(); }
-    std::vector<std::unique_ptr<ExprAST>>::iterator end() { return args.end(); }
+    std::vector<std::unique_ptr<ExprAST>>::iterator begin() { return args->begin(); }
+    std::vector<std::unique_ptr<ExprAST>>::iterator end() { return args->end(); }
 };
 
 }
@@ -42,10 +42,38 @@ typedef int (*BuiltinFunc)(const std::vector<std::unique_ptr<Builtins::ValueAST>
         const std::string &commandName, int commandStart, int commandEnd, \
         Builtins::Environment &env)
 
+/**
+ * Built-in command function pointer type for built-ins which parse the rest of
+ * the line themselves instead of taking expressions. They are given the text
+ * after the command name, its column, the command name, and its column.
+ */
+typedef int (*RawBuiltinFunc)(const char *, int, const std::string &, int,
+                              Builtins::Environment &);
+
+/** Declare a built-in command function which parses its own arguments. */
+#define RAW_BUILTIN_FUNC(func) int builtin_##func(\
+        const char *text, int textStart, const std::string &commandName, \
+        int commandStart, Builtins::Environment &env)
+
 BUILTIN_FUNC(print);
+BUILTIN_FUNC(cachesim);
+BUILTIN_FUNC(call);
+BUILTIN_FUNC(cmpf);
+BUILTIN_FUNC(corun);
+RAW_BUILTIN_FUNC(def);
+BUILTIN_FUNC(dlopen);
+BUILTIN_FUNC(gen);
 BUILTIN_FUNC(source);
+BUILTIN_FUNC(save_session);
+BUILTIN_FUNC(stats);
+BUILTIN_FUNC(syscalls);
+BUILTIN_FUNC(profile);
+BUILTIN_FUNC(time);
 BUILTIN_FUNC(memory);
+BUILTIN_FUNC(memstats);
+BUILTIN_FUNC(numa);
 BUILTIN_FUNC(registers);
+RAW_BUILTIN_FUNC(run);
 BUILTIN_FUNC(warranty);
 BUILTIN_FUNC(copying);
 
@@ -25,8 +25,14 @@
 #include <string>
 #include <sys/types.h>
 
-class Tracee;
+class AssembledCode;
+class Assembler;
 class Inputter;
+class Profiler;
+class SessionLog;
+class SymbolTable;
+class TemplateTable;
+class Tracee;
 
 namespace Builtins {
 
@@ -38,14 +44,47 @@ class Environment {
 public:
     Tracee &tracee;
 
+    /** Labels defined so far in the session. */
+    SymbolTable &symbols;
+
+    /** Execution counts of instrumented code. */
+    Profiler &profiler;
+
+    /** Templates of code defined so far in the session. */
+    TemplateTable &templates;
+
+    /**
+     * Assembler for built-ins which assemble code, or nullptr when replaying
+     * a session, which doesn't assemble anything.
+     */
+    Assembler *assembler;
+
     /** Inputter which gave us the input being run. */
     Inputter &inputter;
 
     /** Error context for the input being run. */
     ErrorContext &errorContext;
 
-    Environment(Tracee &tracee, Inputter &inputter, ErrorContext &errorContext)
-        : tracee(tracee), inputter(inputter), errorContext(errorContext) {}
+    /**
+     * Log which built-ins that assemble code record it in, or nullptr if the
+     * session isn't being recorded.
+     */
+    SessionLog *log;
+
+    /**
+     * Code which was recorded for the built-in being replayed, or nullptr if
+     * it isn't being replayed.
+     */
+    const AssembledCode *recordedCode;
+
+    Environment(Tracee &tracee, SymbolTable &symbols, Profiler &profiler,
+                TemplateTable &templates, Assembler *assembler,
+                Inputter &inputter, ErrorContext &errorContext,
+                SessionLog *log, const AssembledCode *recordedCode)
+        : tracee(tracee), symbols(symbols), profiler(profiler),
+          templates(templates), assembler{assembler}, inputter(inputter),
+          errorContext(errorContext), log{log},
+          recordedCode{recordedCode} {}
 
     /**
      * Look up a variable in the environment.
@@ -53,6 +92,13 @@ public:
      * and errorMsg is set.
      */
     ValueAST *lookupVariable(const std::string &var, std::string &errorMsg);
+
+    /**
+     * Look up the address of a symbol (a label or a library symbol).
+     * @return The address on success, null pointer on failure and errorMsg
+     * is set.
+     */
+    ValueAST *lookupSymbol(const std::string &name, std::string &errorMsg);
 };
 
 }
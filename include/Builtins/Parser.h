@@ -74,6 +74,7 @@ class Parser {
      *                | float_expr
      *                | string_expr
      *                | variable_expr
+     *                | symbol_expr
      *                | paren_expr
      */
     ExprAST *parsePrimaryExpr();
@@ -93,6 +94,9 @@ class Parser {
     /** variable_expr ::= variable */
     ExprAST *parseVariableExpr();
 
+    /** symbol_expr ::= "&" identifier */
+    ExprAST *parseSymbolExpr();
+
     /** paren_expr ::= "(" expression ")" */
     ExprAST *parseParenExpr();
 
@@ -22,6 +22,8 @@
 #ifndef ASMASE_BUILTINS_SCANNER_H
 #define ASMASE_BUILTINS_SCANNER_H
 
+#include <cstddef>
+
 #include "Builtins/Token.h"
 
 typedef void* yyscan_t; // XXX: can we assume this?
@@ -39,6 +41,15 @@ class Scanner {
     /** The position in the input. */
     int currentColumn;
 
+    /**
+     * Memory for the flex state and its copy of the line, so that scanning a
+     * line of a reasonable length doesn't touch the heap.
+     */
+    alignas(std::max_align_t) char arena[1024];
+
+    /** Number of bytes of the arena handed out so far. */
+    size_t arenaUsed;
+
 public:
     /** Create a new scanner (lexer) over a line. */
     Scanner(const char *line);
@@ -61,6 +72,26 @@ public:
      * @note This is only for use by yylex().
      */
     void skipWhitespace();
+
+    /**
+     * Allocate memory for flex from the arena, or from the heap if the arena
+     * is full.
+     * @note This is only for use by yyalloc() and yyrealloc().
+     */
+    void *allocate(size_t size);
+
+    /**
+     * Grow memory returned by allocate().
+     * @note This is only for use by yyrealloc().
+     */
+    void *reallocate(void *ptr, size_t size);
+
+    /**
+     * Free memory returned by allocate(). Only memory which came from the heap
+     * is actually freed; the arena goes away with the scanner.
+     * @note This is only for use by yyfree().
+     */
+    static void deallocate(void *ptr);
 };
 
 }
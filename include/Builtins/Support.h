@@ -22,15 +22,25 @@
 #ifndef ASMASE_BUILTINS_SUPPORT_H
 #define ASMASE_BUILTINS_SUPPORT_H
 
+#include <cstddef>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace Builtins {
 
+class Environment;
 class ErrorContext;
 class ValueAST;
 enum class ValueType;
 
+/** Types of the elements of an array in memory. */
+enum class ElementType {
+    INT8, INT16, INT32, INT64,
+    UINT8, UINT16, UINT32, UINT64,
+    FLOAT32, FLOAT64,
+};
+
 /**
  * Find the value with the given key in the map object, returning the given
  * defaut value if it is not found.
@@ -55,6 +65,46 @@ bool checkValueType(const ValueAST &value, ValueType type,
 
 bool wantsHelp(const std::vector<std::unique_ptr<ValueAST>> &args);
 
+/**
+ * Get an address from a value, which is either an integer or the name of a
+ * label. If it is neither, print an error message.
+ * @return True if there was an error, false otherwise.
+ */
+bool checkAddress(const ValueAST &value, Environment &env, void *&addressOut);
+
+/**
+ * Get a number from a value, which is either an integer or a float. If it is
+ * neither, print the given error message.
+ * @return True if there was an error, false otherwise.
+ */
+bool checkNumber(const ValueAST &value, const char *errorMsg,
+                 ErrorContext &errorContext, double &numberOut);
+
+/**
+ * Get an element type from a value, which is an identifier like i32, u8, or
+ * f64. If it isn't, print an error message.
+ * @param allowIntegers Whether integer types are accepted.
+ * @return True if there was an error, false otherwise.
+ */
+bool checkElementType(const ValueAST &value, ErrorContext &errorContext,
+                      ElementType &typeOut, bool allowIntegers = true);
+
+/** Get the size in bytes of an element type. */
+size_t getElementSize(ElementType type);
+
+/** Return whether an element type is a floating point type. */
+inline bool isFloatType(ElementType type)
+{
+    return type == ElementType::FLOAT32 || type == ElementType::FLOAT64;
+}
+
+/** Return whether an element type is a signed integer type. */
+inline bool isSignedType(ElementType type)
+{
+    return type == ElementType::INT8 || type == ElementType::INT16 ||
+           type == ElementType::INT32 || type == ElementType::INT64;
+}
+
 /** Return the escaped version of a character. */
 std::string escapeCharacter(char c,
     bool escapeSingleQuote = false, bool escapeDoubleQuote = false,
@@ -0,0 +1,162 @@
+/*
+ * Cache and TLB simulation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_CACHE_MODEL_H
+#define ASMASE_CACHE_MODEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/** Shape of a set-associative cache or TLB. */
+class CacheGeometry {
+public:
+    /** Name to print, e.g., "L1". */
+    std::string name;
+
+    /** Number of lines (or TLB entries). */
+    size_t lines;
+
+    /** Number of lines in each set. */
+    size_t ways;
+
+    /** Size of a line (or page) in bytes, which must be a power of two. */
+    size_t lineSize;
+
+    CacheGeometry(const std::string &name, size_t lines, size_t ways,
+                  size_t lineSize)
+        : name{name}, lines{lines}, ways{ways}, lineSize{lineSize} {}
+};
+
+/** A set-associative cache with least recently used replacement. */
+class SetAssociativeCache {
+    /** Number of sets and lines in each set. */
+    size_t sets, ways;
+
+    /** log2 of the line size. */
+    unsigned lineShift;
+
+    /** Line number held by each way of each set, or EMPTY. */
+    std::vector<uint64_t> tags;
+
+    /** When each way of each set was last used. */
+    std::vector<uint64_t> lastUsed;
+
+    /** Number of accesses so far, used as a timestamp. */
+    uint64_t clock;
+
+public:
+    static const uint64_t EMPTY = UINT64_MAX;
+
+    explicit SetAssociativeCache(const CacheGeometry &geometry);
+
+    /**
+     * Access the line containing an address, replacing the least recently
+     * used line in its set if it isn't there.
+     * @return True if it was a hit, false if it was a miss.
+     */
+    bool access(uint64_t address);
+};
+
+/**
+ * Tracks the reuse distance of accesses to cache lines, i.e., the number of
+ * distinct other lines accessed since the line was last accessed. A fully
+ * associative LRU cache of N lines hits exactly when the distance is less than
+ * N. Each access takes logarithmic time in the number of accesses so far.
+ */
+class ReuseDistanceTracker {
+    /** When each line was last accessed. */
+    std::unordered_map<uint64_t, uint64_t> lastAccess;
+
+    /**
+     * Fenwick tree over the access times which has a one at the last access
+     * of every line and zeroes elsewhere, so that counting the distinct lines
+     * accessed in a period is a range sum.
+     */
+    std::vector<uint32_t> tree;
+
+    /** Sum of the first count entries of the tree. */
+    uint64_t prefixSum(size_t count) const;
+
+    /** Add to the entry for the given time. */
+    void add(size_t time, int delta);
+
+public:
+    /** Reuse distance of the first access to a line. */
+    static const uint64_t COLD = UINT64_MAX;
+
+    /**
+     * Access a line.
+     * @return The reuse distance, or COLD.
+     */
+    uint64_t access(uint64_t line);
+};
+
+/** Where an access was found in the hierarchy. */
+class CacheAccessResult {
+public:
+    /** Index of the first level which hit, or the number of levels. */
+    size_t level;
+
+    /** Whether the TLB (if any) hit. */
+    bool tlbHit;
+
+    /** Reuse distance in lines, or ReuseDistanceTracker::COLD. */
+    uint64_t reuseDistance;
+};
+
+/**
+ * A hierarchy of caches which are filled on every miss (i.e., non-exclusive
+ * and write-allocate), plus an optional TLB in front of them. Loads and stores
+ * are treated the same.
+ */
+class CacheModel {
+    std::vector<SetAssociativeCache> levels;
+    std::vector<SetAssociativeCache> tlb;
+    ReuseDistanceTracker reuse;
+    unsigned lineShift;
+
+public:
+    /**
+     * @param levels Geometry of each level from the closest to the farthest,
+     * which must all have the given line size.
+     * @param tlb Geometry of the TLB, or nullptr for none.
+     * @param lineSize Size of the lines that reuse distances are counted in.
+     */
+    CacheModel(const std::vector<CacheGeometry> &levels,
+               const CacheGeometry *tlb, size_t lineSize);
+
+    /** Number of levels of cache. */
+    size_t numLevels() const { return levels.size(); }
+
+    /**
+     * Simulate an access to the line containing an address. An access which
+     * straddles two lines has to be split by the caller.
+     */
+    CacheAccessResult access(uint64_t address);
+};
+
+/** Return the base two logarithm of a power of two. */
+unsigned log2PowerOfTwo(size_t x);
+
+#endif /* ASMASE_CACHE_MODEL_H */
@@ -0,0 +1,142 @@
+/*
+ * Disassembler class.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_DISASSEMBLER_H
+#define ASMASE_DISASSEMBLER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class MCInst;
+class MCInstrInfo;
+class MCRegisterInfo;
+}
+
+/**
+ * A memory access made by an instruction, described in terms of the registers
+ * it is computed from. The address is
+ * segment base + base + index * scale + displacement.
+ */
+class MemoryOperand {
+public:
+    /**
+     * Names of the registers (as the tracee calls them) holding the base,
+     * index, and segment base, or empty if the address doesn't use one.
+     */
+    std::string base, index, segment;
+
+    /** Multiplier of the index register. */
+    int64_t scale;
+
+    /** Constant offset. */
+    int64_t displacement;
+
+    /**
+     * Whether the base is the program counter, which is relative to the end
+     * of the instruction rather than its start.
+     */
+    bool pcRelative;
+
+    /**
+     * Size of the address in bytes if it is narrower than a register and
+     * has to be truncated, or zero.
+     */
+    size_t addressSize;
+
+    /** Number of bytes accessed. */
+    size_t size;
+
+    /** Whether the instruction reads and/or writes the memory. */
+    bool isLoad, isStore;
+
+    MemoryOperand()
+        : scale{1}, displacement{0}, pcRelative{false}, addressSize{0},
+          size{0}, isLoad{false}, isStore{false} {}
+};
+
+/** A single instruction decoded from machine code. */
+class DecodedInstruction {
+public:
+    /** Length of the instruction in bytes. */
+    size_t length;
+
+    /** Assembly text of the instruction. */
+    std::string text;
+
+    /** Memory read or written by the instruction, including the stack. */
+    std::vector<MemoryOperand> memoryOperands;
+
+    /** Whether the instruction is a jump (conditional or not). */
+    bool isBranch;
+
+    /** Whether the instruction is a jump which may fall through. */
+    bool isConditionalBranch;
+
+    /** Whether the instruction is a call. */
+    bool isCall;
+
+    /** Whether the instruction is a return. */
+    bool isReturn;
+};
+
+/** Opaque handle for the LLVM state used by a disassembler. */
+class DisassemblerContext;
+
+/** Class providing disassembly of individual instructions for the host. */
+class Disassembler {
+    const std::unique_ptr<DisassemblerContext> context;
+
+    explicit Disassembler(DisassemblerContext *context);
+
+    /**
+     * Fill in the memory operands of a decoded instruction for the host
+     * platform.
+     * @return Zero on success, nonzero if the architecture isn't supported.
+     */
+    static int decodePlatformMemoryOperands(
+        const llvm::MCInst &inst, const llvm::MCInstrInfo &instrInfo,
+        const llvm::MCRegisterInfo &registerInfo,
+        DecodedInstruction &instructionOut);
+
+public:
+    ~Disassembler();
+
+    /**
+     * Decode the instruction at the start of the given machine code.
+     * @param address Address of the machine code in the tracee, which
+     * PC-relative operands are printed relative to.
+     * @return Zero on success, nonzero if the code isn't a valid instruction
+     * or its memory operands can't be decoded.
+     */
+    int disassemble(const unsigned char *machineCode, size_t size,
+                    uintptr_t address, DecodedInstruction &instructionOut);
+
+    /**
+     * Create a disassembler for the host CPU.
+     * @return nullptr on error.
+     */
+    static std::shared_ptr<Disassembler> createDisassembler();
+};
+
+#endif /* ASMASE_DISASSEMBLER_H */
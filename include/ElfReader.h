@@ -0,0 +1,133 @@
+/*
+ * Minimal reader for ELF files of the host's native class.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_ELF_READER_H
+#define ASMASE_ELF_READER_H
+
+#include <cstddef>
+
+#include <elf.h>
+#include <link.h>
+
+// Native-class versions of the symbol and relocation info accessors, in the
+// spirit of ElfW()
+#if __ELF_NATIVE_CLASS == 64
+#define ELF_NATIVE_CLASS ELFCLASS64
+#define ElfW_ST_TYPE ELF64_ST_TYPE
+#define ElfW_ST_BIND ELF64_ST_BIND
+#define ElfW_R_SYM ELF64_R_SYM
+#define ElfW_R_TYPE ELF64_R_TYPE
+#else
+#define ELF_NATIVE_CLASS ELFCLASS32
+#define ElfW_ST_TYPE ELF32_ST_TYPE
+#define ElfW_ST_BIND ELF32_ST_BIND
+#define ElfW_R_SYM ELF32_R_SYM
+#define ElfW_R_TYPE ELF32_R_TYPE
+#endif
+
+/**
+ * Read-only view of an ELF file in memory. Nothing is copied, so the buffer
+ * must outlive the reader. All accesses are bounds-checked against the
+ * buffer, so it is safe to use on untrusted input.
+ */
+class ElfReader {
+    /** The ELF file. */
+    const unsigned char *data;
+
+    /** Size of the ELF file. */
+    size_t size;
+
+    /** The ELF header, or nullptr if the file is invalid. */
+    const ElfW(Ehdr) *header;
+
+    /** The section header table. */
+    const ElfW(Shdr) *sections;
+
+    /** The program header table. */
+    const ElfW(Phdr) *segments;
+
+public:
+    /** Create a reader for the given buffer. */
+    ElfReader(const void *data, size_t size);
+
+    /** Return whether the buffer is a valid ELF file for the host. */
+    bool isValid() const { return header != nullptr; }
+
+    /** Get the ELF header. */
+    const ElfW(Ehdr) &getHeader() const { return *header; }
+
+    /** Get the number of sections. */
+    size_t numSections() const { return sections ? header->e_shnum : 0; }
+
+    /** Get the section header at the given index. */
+    const ElfW(Shdr) &getSection(size_t index) const { return sections[index]; }
+
+    /** Get the number of segments (i.e., program headers). */
+    size_t numSegments() const { return segments ? header->e_phnum : 0; }
+
+    /** Get the program header at the given index. */
+    const ElfW(Phdr) &getSegment(size_t index) const { return segments[index]; }
+
+    /**
+     * Get the contents of a section.
+     * @return nullptr if the section has no contents in the file (e.g., it is
+     * SHT_NOBITS) or is out of bounds.
+     */
+    const unsigned char *getContents(const ElfW(Shdr) &section) const;
+
+    /**
+     * Get the name of a section.
+     * @return An empty string if the name cannot be found.
+     */
+    const char *getSectionName(const ElfW(Shdr) &section) const;
+
+    /**
+     * Get a string from the string table section with the given index.
+     * @return An empty string if the string cannot be found.
+     */
+    const char *getString(size_t strtab, size_t offset) const;
+
+    /**
+     * Get the number of entries in a table section (e.g., symbols or
+     * relocations).
+     * @tparam T The entry type, e.g., ElfW(Sym) or ElfW(Rela).
+     * @return Zero if the section isn't a table of T.
+     */
+    template <typename T>
+    size_t numEntries(const ElfW(Shdr) &section) const
+    {
+        if (section.sh_entsize != sizeof(T) || !getContents(section))
+            return 0;
+        return section.sh_size / sizeof(T);
+    }
+
+    /**
+     * Get the entry at the given index in a table section. The index must be
+     * less than numEntries<T>().
+     */
+    template <typename T>
+    const T &getEntry(const ElfW(Shdr) &section, size_t index) const
+    {
+        return reinterpret_cast<const T *>(getContents(section))[index];
+    }
+};
+
+#endif /* ASMASE_ELF_READER_H */
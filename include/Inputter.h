@@ -78,6 +78,12 @@ public:
      */
     std::string readLine(const std::string &prompt);
 
+    /**
+     * Like readLine(), but read into an existing string so that its buffer is
+     * reused.
+     */
+    void readLine(const char *prompt, std::string &lineOut);
+
     /** Return the name of the file we last read from. */
     const std::string &currentFilename() const;
 
@@ -0,0 +1,154 @@
+/*
+ * Timing code in the tracee.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_MEASUREMENT_H
+#define ASMASE_MEASUREMENT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class Tracee;
+
+/**
+ * Bitmask-able ways of putting the machine into a known state before each
+ * measured run.
+ */
+enum class Precondition : int {
+    NONE              = 0x0,
+    /** Run the code once (untimed) right before. */
+    WARM              = 0x1,
+    /** Flush the code, data, and scratch regions from the caches. */
+    COLD_CACHE        = 0x2,
+    /** Flush the TLB entries for the data and scratch regions. */
+    FLUSH_TLB         = 0x4,
+    /** Run a stub full of unpredictable branches. */
+    SCRAMBLE_BRANCHES = 0x8,
+};
+
+inline Precondition operator|(Precondition lhs, Precondition rhs)
+{
+    return (Precondition) ((int) lhs | (int) rhs);
+}
+
+inline Precondition operator&(Precondition lhs, Precondition rhs)
+{
+    return (Precondition) ((int) lhs & (int) rhs);
+}
+
+/** Return whether any bit in the precondition set is set. */
+inline bool any(Precondition x)
+{
+    return x != Precondition::NONE;
+}
+
+/** How to measure code. */
+class MeasurementOptions {
+public:
+    /** Number of measured runs. */
+    size_t repeat;
+
+    /** What to do before each run. */
+    Precondition preconditions;
+
+    /** Iterations of the branch scrambling stub. */
+    unsigned long branchIterations;
+
+    MeasurementOptions()
+        : repeat{1}, preconditions{Precondition::NONE},
+          branchIterations{10000} {}
+};
+
+/** Results of measuring code. */
+class MeasurementResult {
+public:
+    /**
+     * Time of each run in nanoseconds, with the overhead of getting in and
+     * out of the tracee subtracted.
+     */
+    std::vector<uint64_t> samplesNs;
+
+    /** Median time of running nothing but a trap. */
+    uint64_t overheadNs;
+};
+
+/** Results of running two functions at the same time on two CPUs. */
+class CoRunResult {
+public:
+    /** CPU that each function ran on. */
+    int cpus[2];
+
+    /** Median ticks of the timestamp counter taken by each run alone. */
+    uint64_t aloneTicks[2];
+
+    /** Median ticks taken by each run when both ran at the same time. */
+    uint64_t togetherTicks[2];
+};
+
+/**
+ * Put the machine into the state given by the preconditions for running the
+ * code at the given address.
+ * @return Zero on success, nonzero on failure.
+ */
+int precondition(Tracee &tracee, void *address,
+                 const MeasurementOptions &options);
+
+/**
+ * Measure the overhead of getting in and out of the tracee by timing runs
+ * which do nothing but trap.
+ * @param runs Number of runs to take the median of.
+ * @return Zero on success, positive on error, negative on fatal error.
+ */
+int measureOverhead(Tracee &tracee, size_t runs, uint64_t &overheadOut);
+
+/**
+ * Time running the code at the given address until the next trap (i.e., to
+ * the end of the code so far), preconditioning before each run. The time is
+ * measured from outside of the tracee, so it is only meaningful for code that
+ * takes longer than the overhead of a round trip through ptrace.
+ * @return Zero on success, positive on error, negative on fatal error.
+ */
+int measureExecution(Tracee &tracee, void *address,
+                     const MeasurementOptions &options,
+                     MeasurementResult &resultOut);
+
+/** Print the minimum, median, and mean of a measurement. */
+void printMeasurement(FILE *file, const MeasurementResult &result);
+
+/**
+ * Time calling each of two functions with no arguments the given number of
+ * times, first alone and then at the same time. The first function runs in
+ * the given tracee pinned to the first CPU and the second function runs in a
+ * sibling tracee pinned to the second CPU; the sibling is killed and the
+ * tracee's CPUs are restored afterwards. The calls are timed inside of the
+ * tracees, so they don't include the overhead of ptrace.
+ * @param repeat Number of runs to take the medians of.
+ * @return Zero on success, positive on error, negative on fatal error.
+ */
+int measureCoRun(Tracee &tracee, const uintptr_t functions[2],
+                 unsigned long count, const int cpus[2], size_t repeat,
+                 CoRunResult &resultOut);
+
+/** Print the times and slowdowns of measureCoRun(). */
+void printCoRun(FILE *file, const char * const names[2],
+                const CoRunResult &result);
+
+#endif /* ASMASE_MEASUREMENT_H */
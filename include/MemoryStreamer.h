@@ -26,18 +26,18 @@
 #include <cstdio>
 #include <cstring>
 
-#include <sys/ptrace.h>
-#include <sys/types.h>
+#include "Stats.h"
+#include "Tracee.h"
 
 /** Class for reading memory from a tracee element by element. */
 class MemoryStreamer {
-    /** PID of the tracee. */
-    pid_t pid;
+    /** The tracee to read from. */
+    Tracee &tracee;
 
-    /** Last word read by ptrace. */
+    /** Last word read from the tracee. */
     long _buffer;
 
-    /** Pointer to last word read by ptrace. */
+    /** Pointer to last word read from the tracee. */
     unsigned char *buffer;
 
     /** Next address at which to read. */
@@ -51,8 +51,8 @@ public:
      * Create a memory streamer for the given process starting at the given
      * address.
      */
-    MemoryStreamer(pid_t pid, void *address)
-        : pid{pid},
+    MemoryStreamer(Tracee &tracee, void *address)
+        : tracee(tracee),
           buffer{reinterpret_cast<unsigned char *>(&_buffer)},
           address{static_cast<unsigned char *>(address)}, offset{0} {}
 
@@ -70,10 +70,8 @@ public:
         size_t outOffset = 0;
         while (outOffset < sizeof(T)) {
             if (offset % sizeof(long) == 0) {
-                errno = 0;
-                _buffer = ptrace(PTRACE_PEEKDATA, pid, address + outOffset,
-                                 nullptr);
-                if (errno) {
+                PhaseTimer timer{StatsPhase::MEMORY};
+                if (tracee.peekWord(address + outOffset, _buffer)) {
                     printf("\ncannot access memory at address %p\n",
                            static_cast<void *>(address + outOffset));
                     return 1;
@@ -0,0 +1,261 @@
+/*
+ * In-process mock tracee. This should be included by the architecture
+ * implementation of a tracee after its UserRegisters definition.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_MOCK_TRACEE_H
+#define ASMASE_MOCK_TRACEE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "RegisterInfo.h"
+#include "Tracee.h"
+
+/**
+ * Tracee which has no process behind it. Registers live in the UserRegisters
+ * structure and start out zeroed; memory is the (private) regions mapped by
+ * Tracee::createMockTracee() plus any pages mapped with mapPages(). Accessing
+ * anything else fails like it would for an unmapped address in a real tracee.
+ * Executing code only moves the program counter, and injected system calls
+ * fail with ENOSYS.
+ *
+ * Everything that isn't tied to ptrace, like register printing, is inherited
+ * from the real platform tracee so that it gets exercised as-is.
+ */
+template <typename PlatformTracee>
+class MockTracee : public PlatformTracee {
+    /** Name of the program counter register. */
+    const char *pcName;
+
+    /** Pages outside of the regions which have been mapped. */
+    std::map<uintptr_t, bytestring> pages;
+
+    static uintptr_t pageSize()
+    {
+        return sysconf(_SC_PAGESIZE);
+    }
+
+    /** Get the raw storage of a register in the UserRegisters structure. */
+    unsigned char *findRegister(const std::string &name, size_t &sizeOut)
+    {
+        const auto &regs = this->regInfo.registers;
+        auto reg = std::find_if(std::begin(regs), std::end(regs),
+            [&name](const RegisterDesc &reg) { return reg.name == name; });
+        if (reg == std::end(regs))
+            return nullptr;
+
+        sizeOut = reg->getSize();
+        return reinterpret_cast<unsigned char *>(this->registers.get()) +
+               reg->offset;
+    }
+
+    /**
+     * Find the byte at the given address outside of the regions.
+     * @return nullptr if it isn't mapped.
+     */
+    unsigned char *findByte(uintptr_t address)
+    {
+        uintptr_t page = address & ~(pageSize() - 1);
+        auto it = pages.find(page);
+        if (it == pages.end())
+            return nullptr;
+        return &it->second[address - page];
+    }
+
+    virtual int setProgramCounter(void *pc)
+    {
+        return setRegister(pcName, reinterpret_cast<uintptr_t>(pc));
+    }
+
+    virtual int updateRegisters()
+    {
+        return 0;
+    }
+
+    virtual int saveGeneralRegisters(bytestring &regsOut)
+    {
+        auto raw = reinterpret_cast<const unsigned char *>(
+            this->registers.get());
+        regsOut.assign(raw, sizeof(UserRegisters));
+        return 0;
+    }
+
+    virtual int restoreGeneralRegisters(const bytestring &regs)
+    {
+        if (regs.size() != sizeof(UserRegisters)) {
+            fprintf(stderr, "saved registers are the wrong size\n");
+            return 1;
+        }
+        memcpy(this->registers.get(), regs.data(), sizeof(UserRegisters));
+        return 0;
+    }
+
+    // Everything outside of the regions goes word by word
+    virtual size_t writeDirect(void *, const void *, size_t)
+    {
+        return 0;
+    }
+
+    virtual size_t readDirect(const void *, void *, size_t)
+    {
+        return 0;
+    }
+
+    // There is no kernel to make system calls to
+    virtual int setSyscallRegisters(const SyscallRecord &)
+    {
+        return 0;
+    }
+
+    virtual int readSyscallExit(SyscallRecord &recordOut)
+    {
+        recordOut.ret = -ENOSYS;
+        return 0;
+    }
+
+public:
+    MockTracee(const TraceeMemory &memory, const char *pcName)
+        : PlatformTracee{-1, memory}, pcName{pcName}
+    {
+        memset(this->registers.get(), 0, sizeof(UserRegisters));
+    }
+
+    virtual ~MockTracee()
+    {
+        // The regions are laid out back to back in one mapping
+        const TraceeMemory &memory = this->memory;
+        munmap(memory.code.address,
+               memory.code.size + memory.stubs.size + memory.data.size +
+               memory.scratch.size);
+    }
+
+    /**
+     * Map zeroed memory covering the given range (in addition to the code,
+     * data, and scratch regions). Pages which are already mapped are left
+     * alone.
+     */
+    void mapPages(const void *address, size_t size)
+    {
+        auto start = reinterpret_cast<uintptr_t>(address) & ~(pageSize() - 1);
+        auto end = reinterpret_cast<uintptr_t>(address) + size;
+        for (uintptr_t page = start; page < end; page += pageSize()) {
+            if (!pages.count(page))
+                pages.emplace(page, bytestring(pageSize(), 0));
+        }
+    }
+
+    /**
+     * Set a register by name. Registers wider than 64 bits have their upper
+     * bits cleared.
+     * @return Zero on success, nonzero if there is no such register.
+     */
+    int setRegister(const std::string &name, uint64_t value)
+    {
+        size_t size;
+        unsigned char *raw = findRegister(name, size);
+        if (!raw)
+            return 1;
+
+        memset(raw, 0, size);
+        memcpy(raw, &value, std::min(size, sizeof(value)));
+        return 0;
+    }
+
+    virtual int executeInstruction(void *address)
+    {
+        return setProgramCounter(address);
+    }
+
+    virtual int peekWord(const void *address, long &wordOut)
+    {
+        if (this->memory.contains(address, sizeof(long))) {
+            memcpy(&wordOut, address, sizeof(long));
+            return 0;
+        }
+
+        auto start = reinterpret_cast<uintptr_t>(address);
+        auto word = reinterpret_cast<unsigned char *>(&wordOut);
+        for (size_t i = 0; i < sizeof(long); i++) {
+            unsigned char *byte = findByte(start + i);
+            if (!byte) {
+                errno = EFAULT;
+                return 1;
+            }
+            word[i] = *byte;
+        }
+        return 0;
+    }
+
+    virtual int pokeWord(void *address, long word)
+    {
+        if (this->memory.contains(address, sizeof(long))) {
+            memcpy(address, &word, sizeof(long));
+            return 0;
+        }
+
+        // Check the whole word first so that a failed write changes nothing
+        auto start = reinterpret_cast<uintptr_t>(address);
+        for (size_t i = 0; i < sizeof(long); i++) {
+            if (!findByte(start + i)) {
+                errno = EFAULT;
+                return 1;
+            }
+        }
+
+        auto bytes = reinterpret_cast<const unsigned char *>(&word);
+        for (size_t i = 0; i < sizeof(long); i++)
+            *findByte(start + i) = bytes[i];
+        return 0;
+    }
+
+    virtual int saveRegisterContext(bytestring &contextOut)
+    {
+        auto raw = reinterpret_cast<const unsigned char *>(
+            this->registers.get());
+        contextOut.assign(raw, sizeof(UserRegisters));
+        return 0;
+    }
+
+    virtual int restoreRegisterContext(const bytestring &context)
+    {
+        if (context.size() != sizeof(UserRegisters)) {
+            fprintf(stderr, "register context is the wrong size\n");
+            return 1;
+        }
+
+        // Like the real tracees, leave the program counter alone
+        size_t pcSize;
+        unsigned char *pc = findRegister(pcName, pcSize);
+        bytestring savedPc{pc, pcSize};
+        memcpy(this->registers.get(), context.data(), sizeof(UserRegisters));
+        memcpy(pc, savedPc.data(), pcSize);
+        return 0;
+    }
+};
+
+#endif /* ASMASE_MOCK_TRACEE_H */
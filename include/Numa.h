@@ -0,0 +1,149 @@
+/*
+ * NUMA and SMT topology, memory placement, and thread placement.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_NUMA_H
+#define ASMASE_NUMA_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+class MemoryRegion;
+
+/** A NUMA node of the host. */
+class NumaNode {
+public:
+    /** Node number. */
+    int id;
+
+    /** CPUs on the node. */
+    std::vector<int> cpus;
+};
+
+/** Latency and bandwidth of memory on one node from the CPUs of a node. */
+class NumaAccessResult {
+public:
+    /** Node whose CPUs accessed the memory. */
+    int cpuNode;
+
+    /** Node the memory was on. */
+    int memoryNode;
+
+    /** Average time of a dependent load which misses the caches. */
+    double latencyNs;
+
+    /** Sequential read bandwidth of a single thread in GB/s. */
+    double bandwidthGBs;
+};
+
+/**
+ * Get the NUMA nodes of the host from sysfs. On a machine without NUMA
+ * support, all of the CPUs that we can run on are on node 0.
+ * @return Zero on success, nonzero on failure.
+ */
+int getNumaNodes(std::vector<NumaNode> &nodesOut);
+
+/** Format a list of CPUs the way the kernel does, e.g., "0-3,8". */
+std::string formatCpuList(const std::vector<int> &cpus);
+
+/**
+ * Let a thread run only on the CPUs of the given node, or on the CPUs of
+ * every node if node is nullptr.
+ * @param tid Thread to pin, or zero for the calling thread.
+ * @return Zero on success, nonzero on failure.
+ */
+int pinToNumaNode(pid_t tid, const NumaNode *node,
+                  const std::vector<NumaNode> &nodes);
+
+/**
+ * Get the CPUs which a thread is allowed to run on.
+ * @return Zero on success, nonzero on failure.
+ */
+int getAllowedCpus(pid_t tid, std::vector<int> &cpusOut);
+
+/**
+ * Let a thread run only on the given CPUs.
+ * @param tid Thread to pin, or zero for the calling thread.
+ * @return Zero on success, nonzero on failure.
+ */
+int pinToCpus(pid_t tid, const std::vector<int> &cpus);
+
+/**
+ * Get the sets of CPUs which are hardware threads of the same core (i.e., SMT
+ * siblings) from sysfs. Only CPUs that we can run on are included, and cores
+ * with only one of those are left out.
+ * @return Zero on success, nonzero on failure.
+ */
+int getSmtSiblings(std::vector<std::vector<int>> &siblingsOut);
+
+/**
+ * Get the node to whose CPUs a thread is pinned.
+ * @param nodeOut Set to the node number, or -1 if the thread can run on the
+ * CPUs of more than one node.
+ * @return Zero on success, nonzero on failure.
+ */
+int getPinnedNumaNode(pid_t tid, const std::vector<NumaNode> &nodes,
+                      int &nodeOut);
+
+/**
+ * Allocate the memory of a region from the given node from now on and move
+ * the pages which are already allocated if the kernel lets us. If node is
+ * -1, go back to the default policy of allocating from the node of the CPU
+ * which touches the memory first.
+ * @return Zero on success, nonzero on failure.
+ */
+int bindToNumaNode(const MemoryRegion &region, int node);
+
+/**
+ * Get the node a region is bound to with bindToNumaNode().
+ * @param nodeOut Set to the node number, or -1 if it isn't bound to one node.
+ * @return Zero on success, nonzero on failure (with errno set).
+ */
+int getBoundNumaNode(const MemoryRegion &region, int &nodeOut);
+
+/**
+ * Count the pages of a region shared with a process which are on each node.
+ * Pages which neither of us has touched yet aren't counted.
+ * @param countsOut Indexed by node number.
+ * @return Zero on success, nonzero on failure (with errno set).
+ */
+int countNumaPages(pid_t pid, const MemoryRegion &region,
+                   std::vector<size_t> &countsOut);
+
+/**
+ * Measure the latency and bandwidth of memory on every node from the CPUs of
+ * every node. A buffer of the given size is allocated from each node in turn
+ * and accessed from our own process while it is pinned to each node; the
+ * pinning is undone afterwards. On a machine with one node, this just
+ * measures local memory.
+ * @return Zero on success, nonzero on failure.
+ */
+int measureNumaAccess(const std::vector<NumaNode> &nodes, size_t size,
+                      std::vector<NumaAccessResult> &resultsOut);
+
+/** Print a table of the results of measureNumaAccess(). */
+void printNumaAccess(FILE *file,
+                     const std::vector<NumaAccessResult> &results);
+
+#endif /* ASMASE_NUMA_H */
@@ -0,0 +1,62 @@
+/*
+ * Splitting work across threads.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_PARALLEL_H
+#define ASMASE_PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/**
+ * Get the number of threads to split count items of work across, such that
+ * each thread gets at least minPerThread of them.
+ */
+inline unsigned getParallelism(size_t count, size_t minPerThread)
+{
+    unsigned cpus = std::max(std::thread::hardware_concurrency(), 1U);
+    size_t threads = std::max<size_t>(count / std::max<size_t>(minPerThread, 1),
+                                      1);
+    return std::min<size_t>(threads, cpus);
+}
+
+/**
+ * Split [0, count) into numThreads contiguous ranges and call
+ * func(begin, end, index) for each range on its own thread. The calling
+ * thread takes the first range.
+ */
+template <typename Func>
+void parallelFor(size_t count, unsigned numThreads, Func func)
+{
+    std::vector<std::thread> threads;
+    size_t perThread = (count + numThreads - 1) / std::max(numThreads, 1U);
+    for (unsigned i = 1; i < numThreads; i++) {
+        size_t begin = std::min(count, i * perThread);
+        size_t end = std::min(count, begin + perThread);
+        threads.emplace_back(func, begin, end, i);
+    }
+    func(0, std::min(count, perThread), 0U);
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+#endif /* ASMASE_PARALLEL_H */
@@ -101,25 +101,35 @@ public:
     ProcessorFlags(std::initializer_list<ProcessorFlag<T>> flags)
         : flags{flags} {}
 
-    /** Pretty-print the set of flags for the given register value. */
-    void printFlags(T reg)
+    /**
+     * Pretty-print the set of flags for the given register value, appending
+     * to a buffer.
+     */
+    void formatFlags(T reg, std::string &out) const
     {
-        printf("[");
+        out += '[';
 
         for (const ProcessorFlag<T> &flag : flags) {
             T flagValue = flag.getValue(reg);
 
             if (flag.alwaysPrint) {
-                if (flagValue != flag.expected)
-                    printf(" %s = %lld",
-                        flag.name.c_str(), (long long) flagValue);
+                if (flagValue != flag.expected) {
+                    char value[32];
+                    snprintf(value, sizeof(value), " = %lld",
+                             (long long) flagValue);
+                    out += ' ';
+                    out += flag.name;
+                    out += value;
+                }
             } else {
-                if (flagValue == flag.expected)
-                    printf(" %s", flag.name.c_str());
+                if (flagValue == flag.expected) {
+                    out += ' ';
+                    out += flag.name;
+                }
             }
         }
 
-        printf(" ]");
+        out += " ]";
     }
 };
 
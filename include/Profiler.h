@@ -0,0 +1,148 @@
+/*
+ * Execution counts from instrumented code.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_PROFILER_H
+#define ASMASE_PROFILER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Assembler.h"
+#include "Support.h"
+
+class Disassembler;
+class Tracee;
+
+/**
+ * Profiler which counts how many times each line of code runs by adding
+ * counter increments to the code as it is placed in the tracee. A counter is
+ * only added at the start of each basic block, i.e., a line which defines a
+ * label or follows a jump or return. Lines ending in a conditional jump get
+ * a second counter after the jump for the edge that falls through, which
+ * gives the number of times the jump was taken, too. The counters are an
+ * array of 64-bit integers at the end of the scratch region.
+ */
+class Profiler {
+    /** A line of code which was placed while profiling. */
+    class ProfiledLine {
+    public:
+        /** Source of the line. */
+        std::string line;
+
+        /** Address of the line in the tracee, including instrumentation. */
+        void *address;
+
+        /** Counter of the basic block containing the line. */
+        size_t block;
+
+        /**
+         * Counter for falling through the conditional jump at the end of the
+         * line, or NO_COUNTER.
+         */
+        size_t fallthrough;
+
+        ProfiledLine(const std::string &line, void *address, size_t block,
+                     size_t fallthrough)
+            : line{line}, address{address}, block{block},
+              fallthrough{fallthrough} {}
+    };
+
+    std::vector<ProfiledLine> lines;
+
+    /** Whether new code is instrumented. */
+    bool enabled;
+
+    /** Number of counters handed out so far. */
+    size_t numCounters;
+
+    /**
+     * Address right after the last instrumented line, or nullptr if the
+     * next line starts a new block regardless.
+     */
+    void *blockEnd;
+
+    /** Created the first time profiling is turned on. */
+    std::shared_ptr<Disassembler> disassembler;
+
+    /** Machine code of the original line, reused from line to line. */
+    bytestring original;
+
+    /**
+     * Append code which increments a counter, leaving all registers and
+     * flags as they were. The address of the counter is left as a fixup
+     * against COUNTER_SYMBOL.
+     * @return Zero on success, nonzero if this isn't supported on the host.
+     */
+    static int appendPlatformCounterIncrement(size_t counter,
+                                              AssembledCode &code);
+
+public:
+    /** Maximum number of counters. */
+    static const size_t MAX_COUNTERS = 65536;
+
+    /** Symbol defined as the address of the counter array. */
+    static const char * const COUNTER_SYMBOL;
+
+    /** Value of lines that don't have a fall through counter. */
+    static const size_t NO_COUNTER = SIZE_MAX;
+
+    Profiler() : enabled{false}, numCounters{0}, blockEnd{nullptr} {}
+
+    /** Get the address of the counter array in a tracee. */
+    static uintptr_t getCounterAddress(const Tracee &tracee);
+
+    /**
+     * Turn instrumentation of new code on or off. Code which was already
+     * instrumented keeps counting.
+     * @return Zero on success, nonzero on failure.
+     */
+    int setEnabled(bool enabled);
+
+    bool isEnabled() const { return enabled; }
+
+    /**
+     * Add counters to assembled code which is about to be placed in the
+     * tracee, if profiling is on. Labels and fixups are moved to match.
+     * @param originalOffsetOut Set to the offset of the original machine code
+     * in the instrumented code.
+     * @return Zero on success, nonzero on failure (in which case the code is
+     * left alone).
+     */
+    int instrument(Tracee &tracee, const std::string &line,
+                   AssembledCode &code, size_t &originalOffsetOut);
+
+    /**
+     * Zero all of the counters in the tracee.
+     * @return Zero on success, nonzero on failure.
+     */
+    int reset(Tracee &tracee);
+
+    /**
+     * Print the execution count of every instrumented line.
+     * @return Zero on success, nonzero on failure.
+     */
+    int printCounts(Tracee &tracee);
+};
+
+#endif /* ASMASE_PROFILER_H */
@@ -0,0 +1,87 @@
+/*
+ * Recycling allocation for objects which live for one line of input.
+ *
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_RECYCLED_H
+#define ASMASE_RECYCLED_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Allocate a small object which will be freed soon. Freed objects are kept on
+ * a free list for their size and handed out again instead of going back to
+ * the heap, so objects which are created and destroyed for every line only
+ * allocate until the free lists have filled up.
+ */
+void *recycledAlloc(size_t size);
+
+/** Free an object allocated with recycledAlloc() of the same size. */
+void recycledFree(void *ptr, size_t size);
+
+/**
+ * Base class for objects allocated with recycledAlloc(). Classes which are
+ * deleted through a pointer to a base class must have a virtual destructor
+ * so that the size of the most derived class is passed back.
+ */
+class Recycled {
+public:
+    static void *operator new(size_t size) { return recycledAlloc(size); }
+    static void operator delete(void *ptr, size_t size)
+    {
+        recycledFree(ptr, size);
+    }
+};
+
+/**
+ * A vector which takes its storage from the last one to be destroyed, so that
+ * a vector which is filled for every line only reallocates when it needs more
+ * room than it has ever needed before.
+ */
+template <typename T>
+class RecycledVector {
+    /** Storage left behind by the last vector. */
+    static thread_local std::vector<T> spare;
+
+    std::vector<T> vec;
+
+public:
+    RecycledVector() { vec.swap(spare); }
+    ~RecycledVector()
+    {
+        vec.clear();
+        if (vec.capacity() > spare.capacity())
+            vec.swap(spare);
+    }
+
+    RecycledVector(const RecycledVector &) = delete;
+    RecycledVector &operator=(const RecycledVector &) = delete;
+
+    std::vector<T> &operator*() { return vec; }
+    const std::vector<T> &operator*() const { return vec; }
+    std::vector<T> *operator->() { return &vec; }
+    const std::vector<T> *operator->() const { return &vec; }
+};
+
+template <typename T>
+thread_local std::vector<T> RecycledVector<T>::spare;
+
+#endif /* ASMASE_RECYCLED_H */
@@ -22,11 +22,20 @@
 #ifndef ASMASE_REGISTER_DESC_H
 #define ASMASE_REGISTER_DESC_H
 
+#include <string>
+
 #include "RegisterCategory.h"
 #include "RegisterValue.h"
 
 class UserRegisters;
 
+/**
+ * Function which appends a description of a register's value to what is
+ * printed for it, e.g., the flags which are set.
+ */
+typedef void (*RegisterAnnotator)(const UserRegisters &regs,
+                                  std::string &out);
+
 /** Register descriptor. */
 class RegisterDesc {
 public:
@@ -48,16 +57,34 @@ public:
     /** Offset of the register value in the UserRegisters structure. */
     size_t offset;
 
+    /** Annotator for the printed value, or nullptr. */
+    RegisterAnnotator annotate;
+
+    /**
+     * Whether the register is left out when printing, e.g., because it is
+     * another name for a register which is printed.
+     */
+    bool alias;
+
     RegisterDesc(RegisterType type, RegisterCategory category,
                  const std::string &prefix, const std::string &name,
-                 size_t offset)
+                 size_t offset, RegisterAnnotator annotate = nullptr)
         : type{type}, category{category}, prefix{prefix}, name{name},
-          offset{offset} {}
+          offset{offset}, annotate{annotate}, alias{false} {}
 
     /** Empty prefix constructor. */
     RegisterDesc(RegisterType type, RegisterCategory category,
-                 const std::string &name, size_t offset)
-        : RegisterDesc{type, category, "", name, offset} {}
+                 const std::string &name, size_t offset,
+                 RegisterAnnotator annotate = nullptr)
+        : RegisterDesc{type, category, "", name, offset, annotate} {}
+
+    /** Get a copy of the descriptor which is marked as an alias. */
+    RegisterDesc asAlias() const
+    {
+        RegisterDesc desc{*this};
+        desc.alias = true;
+        return desc;
+    }
 
     /** Get the value of the register from the UserRegisters structure. */
     RegisterValue *getValue(const UserRegisters &regs) const
@@ -84,6 +111,32 @@ public:
         }
     }
 
+    /** Get the size of the register value in the UserRegisters structure. */
+    size_t getSize() const
+    {
+        switch (type) {
+            case RegisterType::INT8:
+                return sizeof(uint8_t);
+            case RegisterType::INT16:
+                return sizeof(uint16_t);
+            case RegisterType::INT32:
+                return sizeof(uint32_t);
+            case RegisterType::INT64:
+                return sizeof(uint64_t);
+            case RegisterType::INT128:
+                return sizeof(my_uint128);
+            case RegisterType::FLOAT:
+                return sizeof(float);
+            case RegisterType::DOUBLE:
+                return sizeof(double);
+            case RegisterType::LONG_DOUBLE:
+                // Only the 80 bits that hold the value; the rest is padding
+                return 10;
+            default:
+                return 0;
+        }
+    }
+
 private:
     template <typename T>
     T getRaw(const UserRegisters &regs) const
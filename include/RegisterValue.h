@@ -25,6 +25,8 @@
 #include <cassert>
 #include <cinttypes>
 
+#include "Recycled.h"
+
 enum class RegisterType {
     INT8,
     INT16,
@@ -42,8 +44,11 @@ struct my_uint128 {
 
 static_assert(sizeof(my_uint128) == 16, "my_uint128 is not packed");
 
-/** Value of a register with a runtime type. */
-class RegisterValue {
+/**
+ * Value of a register with a runtime type. These are fetched for variables in
+ * built-ins, so they are recycled.
+ */
+class RegisterValue : public Recycled {
 public:
     RegisterType type;
 
@@ -51,6 +56,8 @@ protected:
     RegisterValue(RegisterType type) : type{type} {}
 
 public:
+    virtual ~RegisterValue() {}
+
     // Cast to the runtime type and get the value.
     uint8_t getInt8() const;
     uint16_t getInt16() const;
@@ -0,0 +1,182 @@
+/*
+ * Binary serialization helpers.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_SERIALIZATION_H
+#define ASMASE_SERIALIZATION_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "Support.h"
+
+class AssembledCode;
+class Fixup;
+
+/**
+ * Appends values to a buffer in a fixed little-endian format. Strings are
+ * stored with a 32-bit length prefix.
+ */
+class ByteWriter {
+public:
+    /** The serialized output. */
+    bytestring buffer;
+
+    void putU8(uint8_t value) { buffer.push_back(value); }
+
+    void putU32(uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            buffer.push_back((value >> (8 * i)) & 0xff);
+    }
+
+    void putU64(uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+            buffer.push_back((value >> (8 * i)) & 0xff);
+    }
+
+    void putBytes(const void *data, size_t size)
+    {
+        buffer.append(static_cast<const unsigned char *>(data), size);
+    }
+
+    void putString(const std::string &str)
+    {
+        putU32(str.size());
+        putBytes(str.data(), str.size());
+    }
+
+    void putString(const bytestring &str)
+    {
+        putU32(str.size());
+        putBytes(str.data(), str.size());
+    }
+};
+
+/**
+ * Reads values written by a ByteWriter. All reads are bounds-checked; once a
+ * read runs past the end of the buffer, the reader is marked as failed and
+ * every later read returns zero or an empty string.
+ */
+class ByteReader {
+    const unsigned char *pos, *end;
+    bool failed;
+
+    /** Consume the given number of bytes, or fail if there aren't enough. */
+    const unsigned char *take(size_t size)
+    {
+        if (failed || size > static_cast<size_t>(end - pos)) {
+            failed = true;
+            return nullptr;
+        }
+        const unsigned char *result = pos;
+        pos += size;
+        return result;
+    }
+
+public:
+    ByteReader(const void *data, size_t size)
+        : pos{static_cast<const unsigned char *>(data)}, end{pos + size},
+          failed{false} {}
+
+    /** Return whether any read has failed. */
+    bool hasFailed() const { return failed; }
+
+    /** Return whether the whole buffer has been consumed. */
+    bool atEnd() const { return pos == end; }
+
+    uint8_t getU8()
+    {
+        const unsigned char *p = take(1);
+        return p ? p[0] : 0;
+    }
+
+    uint32_t getU32()
+    {
+        const unsigned char *p = take(4);
+        uint32_t value = 0;
+        for (int i = 0; p && i < 4; ++i)
+            value |= static_cast<uint32_t>(p[i]) << (8 * i);
+        return value;
+    }
+
+    uint64_t getU64()
+    {
+        const unsigned char *p = take(8);
+        uint64_t value = 0;
+        for (int i = 0; p && i < 8; ++i)
+            value |= static_cast<uint64_t>(p[i]) << (8 * i);
+        return value;
+    }
+
+    bool getBytes(void *data, size_t size)
+    {
+        const unsigned char *p = take(size);
+        if (p)
+            memcpy(data, p, size);
+        return p != nullptr;
+    }
+
+    template <typename String>
+    String getString()
+    {
+        String str;
+        getString(str);
+        return str;
+    }
+
+    /** Read a string into an existing one, reusing its buffer. */
+    template <typename String>
+    void getString(String &strOut)
+    {
+        uint32_t size = getU32();
+        const unsigned char *p = take(size);
+        if (!p) {
+            strOut.clear();
+            return;
+        }
+        strOut.assign(reinterpret_cast<const typename String::value_type *>(p),
+                      size);
+    }
+};
+
+/** Serialize a single fixup. */
+void serializeFixup(ByteWriter &writer, const Fixup &fixup);
+
+/**
+ * Deserialize a fixup written by serializeFixup(), rejecting field sizes other
+ * than 1, 2, 4, or 8 bytes. The caller must check that the field lies inside
+ * of the code it belongs to.
+ * @return Zero on success, nonzero if the input is malformed.
+ */
+int deserializeFixup(ByteReader &reader, Fixup &fixupOut);
+
+/** Serialize assembled code (before it is linked). */
+void serializeCode(ByteWriter &writer, const AssembledCode &code);
+
+/**
+ * Deserialize assembled code written by serializeCode().
+ * @return Zero on success, nonzero if the input is malformed.
+ */
+int deserializeCode(ByteReader &reader, AssembledCode &codeOut);
+
+#endif /* ASMASE_SERIALIZATION_H */
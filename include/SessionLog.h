@@ -0,0 +1,120 @@
+/*
+ * SessionLog class.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_SESSION_LOG_H
+#define ASMASE_SESSION_LOG_H
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "Assembler.h"
+#include "Support.h"
+
+/** Kinds of records in a session log. */
+enum class SessionRecordType {
+    /** An assembled line. */
+    INSTRUCTION = 1,
+
+    /** A built-in command. */
+    BUILTIN = 2,
+
+    /** Register state after the preceding instruction was executed. */
+    STATE = 3,
+
+    /**
+     * A template defined with :def, with the code assembled with the
+     * parameters left undefined.
+     */
+    TEMPLATE = 4,
+};
+
+/** A single entry in a session log. */
+class SessionRecord {
+public:
+    SessionRecordType type;
+
+    /**
+     * Input text of an instruction or built-in. The definition of a template
+     * may span several lines.
+     */
+    std::string line;
+
+    /** Assembled code of an instruction or template, before it was linked. */
+    AssembledCode code;
+
+    /** Register state snapshot from Tracee::getRegisterState(). */
+    bytestring state;
+};
+
+/**
+ * Binary log of a session. The log stores the machine code of every line
+ * rather than just the input text so that a session can be replayed without
+ * assembling anything.
+ */
+class SessionLog {
+    /** The log file. */
+    FILE *file;
+
+    /** Name of the log file for error messages. */
+    std::string filename;
+
+    SessionLog(FILE *file, const std::string &filename)
+        : file{file}, filename{filename} {}
+
+public:
+    ~SessionLog();
+
+    SessionLog(const SessionLog &) = delete;
+    SessionLog &operator=(const SessionLog &) = delete;
+
+    /**
+     * Append a record to the log.
+     * @return Zero on success, nonzero on failure.
+     */
+    int writeRecord(const SessionRecord &record);
+
+    /**
+     * Read the next record from the log.
+     * @return Zero on success, positive at the end of the log, negative if
+     * the log is malformed or can't be read.
+     */
+    int readRecord(SessionRecord &recordOut);
+
+    /**
+     * Create a new log for writing.
+     * @param codeAddress Address of the tracee's code region, which is saved
+     * so that a replay can try to use the same addresses.
+     * @return nullptr on error.
+     */
+    static std::unique_ptr<SessionLog> create(const std::string &filename,
+                                              const void *codeAddress);
+
+    /**
+     * Open an existing log for reading.
+     * @param codeAddressOut Set to the saved address of the code region.
+     * @return nullptr on error.
+     */
+    static std::unique_ptr<SessionLog> open(const std::string &filename,
+                                            void *&codeAddressOut);
+};
+
+#endif /* ASMASE_SESSION_LOG_H */
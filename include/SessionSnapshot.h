@@ -0,0 +1,70 @@
+/*
+ * Session snapshots.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_SESSION_SNAPSHOT_H
+#define ASMASE_SESSION_SNAPSHOT_H
+
+#include <string>
+
+class SymbolTable;
+class TemplateTable;
+class Tracee;
+
+/**
+ * A snapshot holds everything needed to pick a session back up later: the
+ * register context, the symbol table, the templates defined with :def, and the
+ * contents of the code, data, and scratch regions. Unlike a session log,
+ * nothing is re-executed on restore.
+ *
+ * The file starts with a header and a table of sections, and every section is
+ * page-aligned so that the file can be mapped and copied straight into the
+ * tracee's memory. Only the parts of the scratch region which have been
+ * touched and aren't all zeroes are saved.
+ */
+
+/**
+ * Save a snapshot of the session.
+ * @return Zero on success, nonzero on failure.
+ */
+int saveSessionSnapshot(const std::string &filename, Tracee &tracee,
+                        const SymbolTable &symbols,
+                        const TemplateTable &templates);
+
+/**
+ * Read the address of the code region saved in a snapshot so that the tracee
+ * can be created at the same address.
+ * @return Zero on success, nonzero on failure.
+ */
+int readSessionSnapshotAddress(const std::string &filename,
+                               void *&codeAddressOut);
+
+/**
+ * Restore a snapshot into a newly created tracee, an empty symbol table, and
+ * an empty template table.
+ * If the tracee's memory isn't at the same address as when the snapshot was
+ * saved, the symbols are moved to match, but absolute addresses in the saved
+ * memory and registers are not.
+ * @return Zero on success, nonzero on failure.
+ */
+int restoreSessionSnapshot(const std::string &filename, Tracee &tracee,
+                           SymbolTable &symbols, TemplateTable &templates);
+
+#endif /* ASMASE_SESSION_SNAPSHOT_H */
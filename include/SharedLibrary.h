@@ -0,0 +1,123 @@
+/*
+ * Loading shared libraries into the tracee.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_SHARED_LIBRARY_H
+#define ASMASE_SHARED_LIBRARY_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class SymbolTable;
+class Tracee;
+
+/** A symbol exported by a shared library. */
+class ExportedSymbol {
+public:
+    /** Name of the symbol, without a version. */
+    std::string name;
+
+    /** Value of the symbol relative to the library's load address. */
+    uintptr_t value;
+
+    /**
+     * Whether the symbol is an indirect function (e.g., memcpy() in glibc),
+     * in which case the value is the address of a resolver which picks the
+     * implementation at runtime instead of the function itself.
+     */
+    bool isIndirect;
+
+    /** Whether the symbol is weak, i.e., other definitions override it. */
+    bool isWeak;
+};
+
+/**
+ * Read the functions and objects exported by a shared library from its
+ * dynamic symbol table. Only the default version of a versioned symbol is
+ * included, since that is what the dynamic linker binds new references to.
+ * @param firstAddressOut Set to the page-aligned address of the file's first
+ * loadable segment. The load bias of the file is the difference between where
+ * that segment was mapped and this.
+ * @return Zero on success, nonzero on failure.
+ */
+int readExportedSymbols(const std::string &path,
+                        std::vector<ExportedSymbol> &symbolsOut,
+                        uintptr_t &firstAddressOut);
+
+/**
+ * Load a shared library into the tracee by calling dlopen() in it and define
+ * the symbols which the library exports so that they can be used in
+ * assembly and expressions.
+ * @param library Path or name of the library, as for dlopen().
+ * @return Zero on success, nonzero on failure.
+ */
+int loadSharedLibrary(Tracee &tracee, SymbolTable &symbols,
+                      const std::string &library);
+
+/**
+ * Index of the symbols exported by the libraries (and executable) which were
+ * already mapped into the tracee when it started, e.g., libc. The index is
+ * built from /proc/pid/maps and the files' dynamic symbol tables the first
+ * time it is used, so every lookup after that is a hash table lookup.
+ */
+class LibraryIndex {
+    /** An indexed symbol. */
+    class Entry {
+    public:
+        /** Address of the symbol in the tracee. */
+        uintptr_t address;
+
+        /**
+         * Whether the address is still that of an indirect function's
+         * resolver. These are resolved the first time they are looked up.
+         */
+        bool isIndirect;
+
+        /** Whether the symbol is weak. */
+        bool isWeak;
+    };
+
+    Tracee &tracee;
+
+    /** Whether build() has been called. */
+    bool built;
+
+    /** Symbols by name. */
+    std::unordered_map<std::string, Entry> index;
+
+    /**
+     * Index the files mapped into the tracee. Files which can't be read are
+     * skipped.
+     */
+    void build();
+
+public:
+    explicit LibraryIndex(Tracee &tracee) : tracee(tracee), built{false} {}
+
+    /**
+     * Look up a symbol, building the index first if need be.
+     * @return True if the symbol was found, false otherwise.
+     */
+    bool lookup(const std::string &name, uintptr_t &addressOut);
+};
+
+#endif /* ASMASE_SHARED_LIBRARY_H */
@@ -0,0 +1,111 @@
+/*
+ * Per-phase timing and syscall statistics.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_STATS_H
+#define ASMASE_STATS_H
+
+#include <cstdint>
+#include <cstdio>
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/**
+ * Phases of handling a line that time is charged to. Time is exclusive: while
+ * a phase is nested in another (e.g., reading registers for a built-in), it
+ * isn't charged to the outer one.
+ */
+enum class StatsPhase {
+    /** Anything not covered by another phase, e.g., printing results. */
+    OTHER,
+
+    /** Reading input. */
+    INPUT,
+
+    /** Assembling with LLVM (or looking up the cache). */
+    ASSEMBLE,
+
+    /** Linking and placing code and data in the tracee. */
+    LINK,
+
+    /** Running code in the tracee. */
+    EXECUTE,
+
+    /** Fetching registers from the tracee. */
+    REGISTERS,
+
+    /** Reading memory from the tracee. */
+    MEMORY,
+
+    /** Lexing, parsing, evaluating, and printing built-in commands. */
+    BUILTIN,
+
+    NUM_PHASES,
+};
+
+/**
+ * Charges time, allocations, and system calls to a phase for as long as it is
+ * in scope.
+ */
+class PhaseTimer {
+    /** Phase which was active before this one. */
+    StatsPhase previous;
+
+public:
+    explicit PhaseTimer(StatsPhase phase);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+};
+
+/** Count a ptrace() call, and the bytes it read, against the current phase. */
+void countPtrace(enum __ptrace_request request);
+
+/** Count a waitpid() call against the current phase. */
+void countWaitpid();
+
+/** ptrace() which is counted in the statistics. */
+static inline long countedPtrace(enum __ptrace_request request, pid_t pid,
+                                 void *addr, void *data)
+{
+    countPtrace(request);
+    return ptrace(request, pid, addr, data);
+}
+
+/** waitpid() which is counted in the statistics. */
+static inline pid_t countedWaitpid(pid_t pid, int *status, int options)
+{
+    countWaitpid();
+    return waitpid(pid, status, options);
+}
+
+/** Get the current time of the monotonic clock in nanoseconds. */
+uint64_t getMonotonicNs();
+
+/** Print the statistics gathered so far as a table. */
+void printStats(FILE *file);
+
+/** Reset all of the statistics to zero. */
+void resetStats();
+
+#endif /* ASMASE_STATS_H */
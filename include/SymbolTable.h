@@ -0,0 +1,156 @@
+/*
+ * SymbolTable class.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_SYMBOL_TABLE_H
+#define ASMASE_SYMBOL_TABLE_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include "Assembler.h"
+
+class ByteReader;
+class ByteWriter;
+class Tracee;
+
+/**
+ * Table of labels defined over the course of a session. Each line is assembled
+ * on its own, so references to labels on other lines are left as fixups by the
+ * assembler; the symbol table resolves them against the addresses at which the
+ * code was placed in the tracee. References to labels which haven't been
+ * defined yet are remembered and patched once the label is defined.
+ */
+class SymbolTable {
+    /** A fixup in code in the tracee waiting for its symbol to be defined. */
+    class PendingFixup {
+    public:
+        /** Address of the segment containing the fixup. */
+        uintptr_t address;
+
+        /** The fixup itself. */
+        Fixup fixup;
+
+        PendingFixup(uintptr_t address, const Fixup &fixup)
+            : address{address}, fixup(fixup) {}
+    };
+
+    /** Defined symbols and their addresses in the tracee. */
+    std::unordered_map<std::string, uintptr_t> symbols;
+
+    /**
+     * Symbols exported by shared libraries loaded into the tracee. Labels
+     * take precedence over these.
+     */
+    std::unordered_map<std::string, uintptr_t> externals;
+
+    /** Resolver for names which are neither labels nor externals. */
+    std::function<bool(const std::string &, uintptr_t &)> fallback;
+
+    /** Fixups waiting on an undefined symbol, keyed by the symbol name. */
+    std::unordered_multimap<std::string, PendingFixup> pending;
+
+    /** Patch the code and data waiting on a symbol which was just defined. */
+    void resolvePending(Tracee &tracee, const std::string &name,
+                        uintptr_t value);
+
+public:
+    /**
+     * Patch a fixup in a buffer with the given symbol value.
+     * @param field Pointer to the field to patch.
+     * @param address Address of the segment containing the fixup in the
+     * tracee.
+     * @return Zero on success, nonzero if the value doesn't fit in the field.
+     */
+    static int applyFixup(unsigned char *field, uintptr_t address,
+                          const Fixup &fixup, uintptr_t value);
+
+    /**
+     * Look up the value of a symbol. Labels come first, then symbols from
+     * shared libraries, then the fallback resolver.
+     * @return True if the symbol is defined, false otherwise.
+     */
+    bool lookup(const std::string &name, uintptr_t &valueOut) const;
+
+    /**
+     * Set a resolver to try for names which aren't defined otherwise, e.g., a
+     * LibraryIndex. It is called every time such a name is looked up, so it
+     * should be fast.
+     */
+    void setFallback(
+        const std::function<bool(const std::string &, uintptr_t &)> &resolver)
+    {
+        fallback = resolver;
+    }
+
+    /**
+     * Define a symbol which doesn't come from assembled code.
+     * @return Zero on success, nonzero if the symbol is already defined.
+     */
+    int define(const std::string &name, uintptr_t value);
+
+    /**
+     * Define a symbol exported by a shared library loaded into the tracee and
+     * patch anything waiting on it. If a library already defined the symbol,
+     * the first definition is kept, like the dynamic linker does. Labels with
+     * the same name can still be defined and shadow it.
+     * @return True if the symbol was newly defined, false otherwise.
+     */
+    bool defineExternal(Tracee &tracee, const std::string &name,
+                        uintptr_t value);
+
+    /**
+     * Link code and data which will be placed at the given addresses in the
+     * tracee: define their labels, patch the fixups which can be resolved, and
+     * remember the ones which can't. Pending fixups already in the tracee
+     * which refer to the new labels are patched, too.
+     * @param unresolvedOut Set to the number of fixups in the machine code
+     * left unresolved. Unresolved fixups in the data don't stop the code from
+     * running.
+     * @return Zero on success, nonzero on failure (in which case nothing is
+     * defined).
+     */
+    int link(Tracee &tracee, void *codeAddress, void *dataAddress,
+             AssembledCode &code, size_t &unresolvedOut);
+
+    /**
+     * Serialize the defined symbols and pending fixups. Symbols from shared
+     * libraries are left out since the libraries don't come along.
+     */
+    void serialize(ByteWriter &writer) const;
+
+    /**
+     * Replace the contents of the table with a table written by serialize().
+     * @return Zero on success, nonzero if the input is malformed (in which
+     * case the table is left untouched).
+     */
+    int deserialize(ByteReader &reader);
+
+    /**
+     * Move every symbol and pending fixup which lies in [start, end) by the
+     * given amount, e.g., after the tracee's memory was restored at a
+     * different address.
+     */
+    void relocate(uintptr_t start, uintptr_t end, uintptr_t delta);
+};
+
+#endif /* ASMASE_SYMBOL_TABLE_H */
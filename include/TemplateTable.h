@@ -0,0 +1,119 @@
+/*
+ * Templates of code with parameters patched into the machine code.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_TEMPLATE_TABLE_H
+#define ASMASE_TEMPLATE_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Assembler.h"
+#include "Support.h"
+
+class ByteReader;
+class ByteWriter;
+class SymbolTable;
+class Tracee;
+
+/**
+ * A block of code with parameters which has been assembled once and placed
+ * in the tracee. The parameters are assembled as undefined symbols, so each
+ * use of one is a field which the assembler left as a fixup; running the
+ * template with arguments patches those fields in place instead of
+ * assembling it again.
+ */
+class CodeTemplate {
+public:
+    /** Names of the parameters. */
+    std::vector<std::string> params;
+
+    /** Machine code, with everything but the parameters linked. */
+    bytestring machineCode;
+
+    /** Fields which refer to a parameter. */
+    std::vector<Fixup> fields;
+
+    /** Index of the parameter which each field refers to. */
+    std::vector<size_t> fieldParams;
+
+    /** Address of the code in the tracee. It is followed by a trap. */
+    void *address;
+};
+
+/**
+ * Templates defined over the course of a session. A parameter can go anywhere
+ * that a label could, e.g., in an immediate or a displacement, but not where
+ * its value would change the size of the code (e.g., as a .rept count). The
+ * assembler can't pick a short encoding for a value it doesn't know, so each
+ * field is as wide as the instruction allows, and an argument which doesn't
+ * fit in it is an error.
+ */
+class TemplateTable {
+    std::unordered_map<std::string, CodeTemplate> templates;
+
+public:
+    /**
+     * Define a template from code assembled with the parameters left
+     * undefined and place it in the tracee, replacing any template with the
+     * same name. Everything other than the parameters is linked right away,
+     * so it must already be defined. Labels defined by the code are local to
+     * the template.
+     * @return Zero on success, nonzero on failure.
+     */
+    int define(Tracee &tracee, const SymbolTable &symbols,
+               const std::string &name,
+               const std::vector<std::string> &params,
+               const AssembledCode &code);
+
+    /** Get a template, or nullptr if there is no template with that name. */
+    const CodeTemplate *lookup(const std::string &name) const;
+
+    /**
+     * Patch arguments into the code of a template in the tracee. Nothing is
+     * patched if any of the arguments doesn't fit in its fields.
+     * @return Zero on success, nonzero on failure.
+     */
+    int instantiate(Tracee &tracee, const std::string &name,
+                    const std::vector<uint64_t> &args);
+
+    /**
+     * Serialize the templates. Their code is in the tracee's code region, so
+     * only the table is written.
+     */
+    void serialize(ByteWriter &writer) const;
+
+    /**
+     * Replace the contents of the table with a table written by serialize().
+     * @return Zero on success, nonzero if the input is malformed (in which
+     * case the table is left untouched).
+     */
+    int deserialize(ByteReader &reader);
+
+    /**
+     * Move every template which lies in [start, end) by the given amount,
+     * e.g., after the tracee's memory was restored at a different address.
+     */
+    void relocate(uintptr_t start, uintptr_t end, uintptr_t delta);
+};
+
+#endif /* ASMASE_TEMPLATE_TABLE_H */
@@ -22,8 +22,11 @@
 #ifndef ASMASE_TRACEE_H
 #define ASMASE_TRACEE_H
 
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include <sys/types.h>
 
@@ -42,18 +45,211 @@ class RegisterValue;
  */
 class UserRegisters;
 
+/** A region of memory in the tracee which is filled in from start to end. */
+class MemoryRegion {
+public:
+    /** Start of the region. */
+    void *address;
+
+    /** Size of the region. */
+    size_t size;
+
+    /** Number of bytes at the start of the region that are in use. */
+    size_t used;
+
+    MemoryRegion(void *address = nullptr, size_t size = 0)
+        : address{address}, size{size}, used{0} {}
+
+    /** Return whether the given range lies entirely in the region. */
+    bool contains(const void *start, size_t length) const
+    {
+        auto base = static_cast<const unsigned char *>(address);
+        auto p = static_cast<const unsigned char *>(start);
+        return p >= base && length <= size &&
+               static_cast<size_t>(p - base) <= size - length;
+    }
+
+    /**
+     * Get the address at which the given number of bytes with the given
+     * alignment would be placed next.
+     * @return nullptr if there is no room left.
+     */
+    void *nextAddress(size_t length, size_t alignment = 1) const
+    {
+        size_t offset = (used + alignment - 1) / alignment * alignment;
+        if (offset > size || length > size - offset)
+            return nullptr;
+        return static_cast<unsigned char *>(address) + offset;
+    }
+};
+
+/** A system call made by the tracee while syscall tracing is enabled. */
+class SyscallRecord {
+public:
+    /** System call number. */
+    long number;
+
+    /** Arguments, whether or not the system call uses all of them. */
+    unsigned long args[6];
+
+    /** Return value (a negative errno on failure). */
+    long ret;
+
+    /**
+     * Time between the entry and exit stops, which includes the overhead of
+     * getting the tracee to and from the stops.
+     */
+    uint64_t latencyNs;
+};
+
+/** A function call made in the tracee on our behalf. */
+class FunctionCall {
+public:
+    /** Address of the function. */
+    uintptr_t function;
+
+    /** Integer or pointer arguments. */
+    std::vector<unsigned long> args;
+
+    /** Integer or pointer return value. */
+    unsigned long ret;
+
+    /**
+     * Floating point arguments. These are kept apart from the integer
+     * arguments since calling conventions pass them in their own registers.
+     * Not every architecture supports them.
+     */
+    std::vector<double> floatArgs;
+
+    /** Floating point return value, if hasFloatRet is set. */
+    double floatRet;
+
+    /** Whether the architecture gave a floating point return value. */
+    bool hasFloatRet;
+
+    /** Whether to record the registers which the function changed. */
+    bool trackClobbered;
+
+    /**
+     * Names of the registers which were different when the function returned
+     * than when it was entered, if trackClobbered is set.
+     */
+    std::vector<std::string> clobbered;
+
+    /**
+     * Time from resuming the tracee at the function until it returned,
+     * including the round trip through ptrace.
+     */
+    uint64_t elapsedNs;
+};
+
+/**
+ * Memory shared between us and the tracee. All of the regions are carved out
+ * of one mapping so that code can refer to data with 32-bit displacements.
+ */
+class TraceeMemory {
+public:
+    /** Executable region for instructions. */
+    MemoryRegion code;
+
+    /**
+     * Small executable region right after the code region for helper code
+     * which we run in the tracee ourselves, e.g., to make system calls.
+     */
+    MemoryRegion stubs;
+
+    /** Writable region for data. */
+    MemoryRegion data;
+
+    /**
+     * Large writable region for buffers which the user manages directly. It
+     * is only backed by memory once it is touched.
+     */
+    MemoryRegion scratch;
+
+    /** Return whether the given range lies entirely in one of the regions. */
+    bool contains(const void *start, size_t length) const
+    {
+        return code.contains(start, length) ||
+               stubs.contains(start, length) || data.contains(start, length) ||
+               scratch.contains(start, length);
+    }
+};
+
 /**
  * Class encapsulating a tracee process. This process is used to execute
  * instructions given by the user.
  */
 class Tracee {
-    typedef int (Tracee::*RegisterCategoryPrinter)();
-    static std::vector<std::pair<RegisterCategory, RegisterCategoryPrinter>>
-        categoryPrinters;
-
     /** Create the tracee for the host platform. */
-    static Tracee *createPlatformTracee(pid_t pid, void *sharedMemory,
-                                        size_t sharedSize);
+    static Tracee *createPlatformTracee(pid_t pid, const TraceeMemory &memory);
+
+    /** Create a mock tracee for the host platform. */
+    static Tracee *createPlatformMockTracee(const TraceeMemory &memory);
+
+    /**
+     * Run helper code in the stubs region with the general-purpose registers
+     * saved and syscall tracing off. If call is not nullptr, its number and
+     * arguments are loaded first and its return value is read afterwards.
+     * @return Zero on success, nonzero on failure.
+     */
+    int runHelper(void *address, SyscallRecord *call);
+
+    /**
+     * Fork a tracee process and set it up to be traced. The process inherits
+     * our mappings, including the memory shared with tracees.
+     * @return The process ID, or -1 on error.
+     */
+    static pid_t forkTraceeProcess();
+
+    /** Registers saved by startTimedCalls() for finishTimedCalls(). */
+    bytestring timedSavedRegs, timedSavedContext;
+
+    /** Result slot of the timed calls in progress. */
+    unsigned timedIndex;
+
+    /**
+     * Entry point of a process which we didn't fork, or nullptr. The code
+     * there doesn't run again once the program has started, so it is
+     * borrowed to make system calls while our memory isn't mapped into the
+     * process.
+     */
+    void *entryPoint;
+
+    /**
+     * Make a system call with code placed at the given address, which is
+     * left there afterwards.
+     * @return Zero on success, nonzero on failure.
+     */
+    int injectSyscallAt(void *address, SyscallRecord &call);
+
+    /**
+     * Map memory shared with a process which we didn't fork by creating it
+     * ourselves and having the process map it at the same address.
+     * @param address Address hint, as for createTracee().
+     * @return Zero on success, nonzero on failure.
+     */
+    int mapSharedMemory(void *address);
+
+    /**
+     * Unmap our memory and the call stack from a process which we didn't
+     * fork.
+     * @return Zero on success, nonzero on failure.
+     */
+    int unmapSharedMemory();
+
+    /**
+     * Run a process which was just started up to its entry point.
+     * @return Zero on success, nonzero on failure.
+     */
+    int runToEntryPoint();
+
+    /**
+     * Create a tracee for a process which we didn't fork and which is stopped
+     * and set up to be traced. Our memory isn't mapped into it yet.
+     * @return nullptr on error.
+     */
+    static Tracee *adoptProcess(pid_t pid);
 
 protected:
     // Architecture-dependent information
@@ -66,14 +262,42 @@ protected:
      */
     const std::unique_ptr<UserRegisters> registers;
 
+    /** Size of the UserRegisters structure. */
+    const size_t registersSize;
+
+    /**
+     * Copy of the registers from the last snapshotRegisters(), or empty if
+     * there hasn't been one.
+     */
+    bytestring previousRegisters;
+
+    /** Buffer for printRegisters(), reused from call to call. */
+    std::string registerText;
+
     /** PID of the tracee process. */
     pid_t pid;
 
-    /** Start of memory shared with the tracee. */
-    void *sharedMemory;
+    /**
+     * Memory shared with the tracee. Instructions are placed one after
+     * another in the code region so that code from earlier lines stays in
+     * place and can be branched to; likewise for data.
+     */
+    TraceeMemory memory;
+
+    /** Whether executeInstruction() stops at and reports system calls. */
+    bool traceSyscalls;
+
+    /** System calls made by the last executeInstruction(). */
+    std::vector<SyscallRecord> syscalls;
 
-    /** Size of memory shared with the tracee. */
-    size_t sharedSize;
+    /**
+     * Stack for functions called with injectCall(), mapped into the tracee
+     * the first time it is needed.
+     */
+    MemoryRegion callStack;
+
+    /** Signal which stopped the tracee at the end of executeInstruction(). */
+    int stopSignal;
 
     /**
      * Get the instruction to use to trigger a software trap (i.e., a
@@ -93,48 +317,430 @@ protected:
      */
     virtual int updateRegisters() = 0;
 
-    // Register category printers. The default implementations assume that the
-    // architecture does not have registers of that category.
-    virtual int printGeneralPurposeRegisters();
-    virtual int printConditionCodeRegisters();
-    virtual int printSegmentationRegisters();
-    virtual int printFloatingPointRegisters();
-    virtual int printExtraRegisters();
+    /**
+     * Get the program counter from the register values stored by the last
+     * updateRegisters(). The default implementation assumes that the
+     * architecture does not support single-stepping and returns nullptr.
+     */
+    virtual void *getFetchedProgramCounter();
+
+    /**
+     * Read the number and arguments of the system call that the tracee is
+     * stopped at the entry of. The default implementation assumes that the
+     * architecture does not support syscall tracing.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int readSyscallEntry(SyscallRecord &recordOut);
+
+    /**
+     * Read the return value of the system call that the tracee is stopped at
+     * the exit of.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int readSyscallExit(SyscallRecord &recordOut);
+
+    /**
+     * Get the instruction which makes a system call. The default
+     * implementation assumes that the architecture does not support injecting
+     * system calls and returns an empty string.
+     */
+    virtual const bytestring &getSyscallInstruction();
+
+    /**
+     * Get the stub used by startTimedCalls(), which takes the function, the
+     * number of calls, the address of the start barrier, the address of the
+     * result, and the number of parties as its arguments. It increments the
+     * barrier, waits for it to reach the number of parties, calls the
+     * function the given number of times, and stores the elapsed time in
+     * ticks of the processor's timestamp counter. The default implementation
+     * assumes that the architecture does not have such a stub and returns an
+     * empty string.
+     */
+    virtual const bytestring &getTimedCallStub();
+
+    /**
+     * Save the general-purpose registers, including the program counter and
+     * stack pointer, so that helper code can be run without disturbing them.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int saveGeneralRegisters(bytestring &regsOut);
+
+    /**
+     * Restore registers saved with saveGeneralRegisters().
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int restoreGeneralRegisters(const bytestring &regs);
+
+    /**
+     * Load the number and arguments of a system call into the registers
+     * which the system call instruction takes them from.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int setSyscallRegisters(const SyscallRecord &call);
+
+    /**
+     * Set up the registers (and the stack, if needed) for calling a function
+     * following the platform's calling convention.
+     * @param stackTop Top of the stack to use.
+     * @param returnAddress Address that the function should return to.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int setCallRegisters(const FunctionCall &call, void *stackTop,
+                                 void *returnAddress);
+
+    /**
+     * Read the return value of a function called with the registers set up by
+     * setCallRegisters().
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int readCallReturn(FunctionCall &callOut);
+
+    /**
+     * Move the stack pointer below the area which the interrupted code may be
+     * using without having reserved it (e.g., the x86-64 red zone) and align
+     * it, so that code run in a process we attached to doesn't clobber that
+     * process's stack. The default implementation assumes that the
+     * architecture has no such area and does nothing.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int skipRedZone();
+
+    /**
+     * Write as much of a buffer to the tracee's memory as possible in one go,
+     * without ptrace.
+     * @return The number of bytes written, which may be zero.
+     */
+    virtual size_t writeDirect(void *address, const void *buffer, size_t size);
+
+    /**
+     * Read as much of the tracee's memory as possible in one go, without
+     * ptrace.
+     * @return The number of bytes read, which may be zero.
+     */
+    virtual size_t readDirect(const void *address, void *buffer, size_t size);
 
 public:
     Tracee(const RegisterInfo &regInfo, UserRegisters *registers,
-           pid_t pid, void *sharedMemory, size_t sharedSize);
+           pid_t pid, const TraceeMemory &memory);
     virtual ~Tracee();
 
     pid_t getPid() const { return pid; }
 
     /**
-     * Execute the given instruction on the tracee.
+     * Return whether the tracee is a fork of our process, in which case
+     * everything that we had mapped when it was forked (e.g., libc) is at
+     * the same address in it as it is here.
+     */
+    bool isForked() const { return pid != -1 && !entryPoint; }
+
+    /** Get the memory shared with the tracee. */
+    const TraceeMemory &getMemory() const { return memory; }
+    TraceeMemory &getMemory() { return memory; }
+
+    /**
+     * Get the address at which an instruction of the given size would be
+     * placed by writeInstruction().
+     * @return nullptr if there is no room left for it.
+     */
+    void *getCodeAddress(size_t size);
+
+    /**
+     * Place an instruction in the tracee after the previous one, followed by a
+     * trap. The trap is overwritten by the next instruction.
+     * @return The address of the instruction, or nullptr on error.
+     */
+    void *writeInstruction(const bytestring &machineCode);
+
+    /**
+     * Place code in the tracee like writeInstruction(), but keep the trap
+     * after it so that the code can be run on its own later.
+     * @return The address of the code, or nullptr on error.
+     */
+    void *writeIsolatedCode(const bytestring &machineCode);
+
+    /**
+     * Get the address at which data of the given size and alignment would be
+     * placed by writeData().
+     * @return nullptr if there is no room left for it.
+     */
+    void *getDataAddress(size_t size, size_t alignment);
+
+    /**
+     * Place data in the tracee after the previous data.
+     * @return The address of the data, or nullptr on error.
+     */
+    void *writeData(const bytestring &data, size_t alignment);
+
+    /**
+     * Execute code on the tracee starting at the given address until it hits
+     * a trap.
      * @return Zero on success, positive on error, negative on fatal error.
      */
-    int executeInstruction(const bytestring &machineCode);
+    virtual int executeInstruction(void *address);
+
+    /**
+     * Prepare to single-step the code at the given address with
+     * stepInstruction(): set the program counter and fetch the registers so
+     * that they can be read with getFetchedRegister().
+     * @return Zero on success, nonzero on failure.
+     */
+    int startStepping(void *address);
+
+    /**
+     * Execute the instruction at the program counter and nothing else, then
+     * fetch the registers again.
+     * @param pcOut Set to the program counter after the instruction.
+     * @return Zero on success, positive if the tracee stopped for some other
+     * reason (e.g., it crashed), negative on fatal error.
+     */
+    int stepInstruction(void *&pcOut);
+
+    /**
+     * Find a register to read with getFetchedRegister().
+     * @return Zero on success, nonzero if there is no such register.
+     */
+    int findRegister(const std::string &regName, size_t &indexOut) const;
+
+    /**
+     * Get the value of a register found with findRegister() as of the last
+     * time the registers were fetched, without fetching them again. Registers
+     * wider than 64 bits are truncated.
+     */
+    uint64_t getFetchedRegister(size_t index) const;
+
+    /**
+     * Enable or disable syscall tracing. While it is enabled,
+     * executeInstruction() stops the tracee at the entry and exit of every
+     * system call and prints a table of them once the code is done.
+     */
+    void setSyscallTracing(bool enable) { traceSyscalls = enable; }
+
+    /** Return whether syscall tracing is enabled. */
+    bool isTracingSyscalls() const { return traceSyscalls; }
+
+    /** Get the system calls made by the last executeInstruction(). */
+    const std::vector<SyscallRecord> &getSyscalls() const { return syscalls; }
+
+    /** Print a table of the system calls made by the last execution. */
+    void printSyscalls() const;
+
+    /**
+     * Get the address of a trap instruction in the stubs region. Code can
+     * return here to give control back to us.
+     * @return nullptr on error.
+     */
+    void *getTrapAddress();
+
+    /**
+     * Run helper code in the stubs region, followed by a trap. The
+     * general-purpose registers are restored afterwards, but anything else
+     * the code changes isn't.
+     * @return Zero on success, nonzero on failure.
+     */
+    int runStub(const bytestring &code);
+
+    /**
+     * Make a system call from the tracee with the number and arguments in
+     * call and put the return value in call.ret. The registers are left as
+     * they were.
+     * @return Zero on success, nonzero on failure.
+     */
+    int injectSyscall(SyscallRecord &call);
+
+    /**
+     * Get the stack used by injectCall(), mapping it first if need be. The
+     * function only uses the top of the stack, so the bottom of it can hold
+     * anything which needs to be passed by reference, like strings.
+     * @return nullptr on error.
+     */
+    const MemoryRegion *getCallStack();
+
+    /**
+     * Call a function in the tracee with the arguments in call and put the
+     * return values in call. The function runs on its own stack and returns
+     * to a trap in the stubs region; all of the registers are restored
+     * afterwards. Note that if the tracee isForked(), its memory is a copy of
+     * ours from when it was forked, so the address of a function in our own
+     * address space (e.g., from libc) is valid in the tracee, too.
+     * @return Zero on success, nonzero on failure (e.g., if the function
+     * crashed).
+     */
+    int injectCall(FunctionCall &call);
+
+    /**
+     * Run a stub which executes the given number of iterations of
+     * pseudo-randomly taken branches to scramble the tracee's branch
+     * predictor state. The default implementation assumes that the
+     * architecture does not have such a stub.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int scrambleBranchPredictors(unsigned long iterations);
+
+    /**
+     * Start calling a function with no arguments the given number of times
+     * in a row and return without waiting for the calls to finish. The calls
+     * wait at a barrier in the stubs region until the given number of
+     * parties (i.e., tracees sharing this one's memory) have started, so
+     * that calls in sibling tracees run at the same time. The party with
+     * index zero resets the barrier, so it must be started first.
+     * @return Zero on success, nonzero on failure (in which case the other
+     * parties are released).
+     */
+    int startTimedCalls(uintptr_t function, unsigned long count,
+                        unsigned parties, unsigned index);
+
+    /**
+     * Wait for the calls started by startTimedCalls() to finish and restore
+     * the registers.
+     * @param ticksOut Set to the time taken by all of the calls in ticks of
+     * the timestamp counter, as measured inside of the tracee.
+     * @return Zero on success, nonzero on failure.
+     */
+    int finishTimedCalls(uint64_t &ticksOut);
+
+    /**
+     * Read a word from the tracee's memory. The address doesn't need to be
+     * aligned.
+     * @return Zero on success, nonzero on failure (with errno set).
+     */
+    virtual int peekWord(const void *address, long &wordOut);
+
+    /**
+     * Write a word to the tracee's memory.
+     * @return Zero on success, nonzero on failure (with errno set).
+     */
+    virtual int pokeWord(void *address, long word);
+
+    /**
+     * Write the given buffer into the tracee's memory.
+     * @return Zero on success, nonzero on failure.
+     */
+    int writeMemory(void *address, const void *buffer, size_t size);
+
+    /**
+     * Read the tracee's memory into the given buffer.
+     * @return Zero on success, nonzero on failure.
+     */
+    int readMemory(const void *address, void *buffer, size_t size);
+
+    /**
+     * Get a pointer through which size bytes of the tracee's memory can be
+     * read. Memory shared with the tracee is returned directly; anything else
+     * is read into the given buffer. This is meant for reading big arrays a
+     * chunk at a time without copying them when possible.
+     * @return nullptr on error.
+     */
+    const unsigned char *getMemoryView(const void *address, size_t size,
+                                       bytestring &bufferOut);
 
     /** Pretty-print machine code. */
     virtual void printInstruction(const bytestring &machineCode);
 
     /**
      * Print the registers in the given categories (which may be a bitwise OR
-     * of multiple categories).
+     * of multiple categories). Registers which changed since the last
+     * snapshotRegisters() are marked with an asterisk.
+     * @param changedOnly Only print the registers which changed.
      * @return Zero on success, nonzero on failure.
      */
-    int printRegisters(RegisterCategory categories);
+    int printRegisters(RegisterCategory categories, bool changedOnly = false);
+
+    /**
+     * Save a copy of the current registers to compare against when printing
+     * them later. This is done right before running each line of code.
+     * @return Zero on success, nonzero on failure.
+     */
+    int snapshotRegisters();
 
     /**
      * Get the current value of a register.
      * @return nullptr on error.
      */
-    std::shared_ptr<RegisterValue> getRegisterValue(const std::string &regName);
+    std::unique_ptr<RegisterValue> getRegisterValue(const std::string &regName);
+
+    /**
+     * Get a snapshot of the values of all of the registers, leaving out
+     * aliases.
+     * @return Zero on success, nonzero on failure.
+     */
+    int getRegisterState(bytestring &stateOut);
+
+    /**
+     * Compare two snapshots from getRegisterState().
+     * @param differencesOut Set to the names of the registers which differ.
+     * @return Zero on success, nonzero if the snapshots aren't comparable.
+     */
+    int diffRegisterStates(const bytestring &a, const bytestring &b,
+                           std::vector<std::string> &differencesOut) const;
+
+    /**
+     * Save the complete register context, including floating point and vector
+     * state, in an architecture-specific format.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int saveRegisterContext(bytestring &contextOut) = 0;
+
+    /**
+     * Restore a register context from saveRegisterContext(). The stack
+     * pointer, program counter, and anything else tied to the process itself
+     * (e.g., segment and thread pointer registers) are left alone.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int restoreRegisterContext(const bytestring &context) = 0;
 
     /**
      * Create a tracee process.
+     * @param address Address at which to try to map the memory shared with
+     * the tracee, or nullptr to let the kernel choose. This is only a hint.
+     * @return nullptr on error.
+     */
+    static std::shared_ptr<Tracee> createTracee(void *address = nullptr);
+
+    /**
+     * Attach to the main thread of a running process and map the memory
+     * shared with it into the process with injected system calls, so that
+     * code can be run against the process's own data. The other threads of
+     * the process keep running. When the returned tracee is destroyed, our
+     * memory is unmapped from the process, its registers are put back, and it
+     * is detached and left to run as before.
+     * @param address Address hint, as for createTracee().
+     * @return nullptr on error.
+     */
+    static std::shared_ptr<Tracee> attachTracee(pid_t pid,
+                                                void *address = nullptr);
+
+    /**
+     * Start a program and stop it at its entry point, i.e., after the dynamic
+     * loader has loaded its libraries but before any of its own code has
+     * run, and map the memory shared with it like attachTracee() does. The
+     * process is killed when the returned tracee is destroyed.
+     * @param argv Program (which is searched for in the PATH) and arguments,
+     * terminated by nullptr.
+     * @param address Address hint, as for createTracee().
+     * @return nullptr on error.
+     */
+    static std::shared_ptr<Tracee> execTracee(char *const argv[],
+                                              void *address = nullptr);
+
+    /**
+     * Create another tracee process which shares this tracee's code, data,
+     * and scratch regions, e.g., to run code on two CPUs at once. It starts
+     * with none of this tracee's registers and none of the memory which this
+     * tracee mapped on its own (e.g., libraries loaded with :dlopen). The
+     * process is killed when the returned tracee is destroyed.
+     * @return nullptr on error.
+     */
+    std::shared_ptr<Tracee> forkSibling();
+
+    /**
+     * Create a mock tracee which keeps its registers and memory in our own
+     * process instead of a child process. Code is placed in memory but never
+     * run. This is meant for testing and benchmarking everything other than
+     * execution, e.g., built-ins and register printing, without the overhead
+     * of ptrace or the need for it to be allowed at all.
      * @return nullptr on error.
      */
-    static std::shared_ptr<Tracee> createTracee();
+    static std::shared_ptr<Tracee> createMockTracee();
 };
 
 #endif /* ASMASE_TRACEE_H */
@@ -0,0 +1,145 @@
+/*
+ * Heap allocation counter implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+
+#include "AllocationCounter.h"
+
+/** Number of allocations so far. */
+static std::atomic<uint64_t> allocationCount{0};
+
+#if defined(__GLIBC__) && defined(ASMASE_COUNT_ALLOCATIONS)
+
+// glibc exports its allocator under these names, so we can wrap the public
+// ones. Everything else in the process, including operator new, LLVM, and
+// readline, goes through the wrappers. The wrappers are only built with
+// COUNT_ALLOCATIONS=1 so that a normal build doesn't pay for them.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t nmemb, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+extern "C" void *__libc_valloc(size_t size);
+extern "C" void *__libc_pvalloc(size_t size);
+
+static inline void countAllocation()
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline bool isPowerOfTwo(size_t x)
+{
+    return x && !(x & (x - 1));
+}
+
+extern "C" void *malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t nmemb, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    size_t bytes;
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    countAllocation();
+    return __libc_realloc(ptr, bytes);
+}
+
+// glibc's posix_memalign() and aligned_alloc() call its internal memalign
+// rather than the public one, so they need wrappers of their own.
+extern "C" int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (!isPowerOfTwo(alignment) || alignment % sizeof(void *))
+        return EINVAL;
+    countAllocation();
+    void *ptr = __libc_memalign(alignment, size);
+    if (!ptr)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (!isPowerOfTwo(alignment)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size)
+{
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void *valloc(size_t size)
+{
+    countAllocation();
+    return __libc_valloc(size);
+}
+
+extern "C" void *pvalloc(size_t size)
+{
+    countAllocation();
+    return __libc_pvalloc(size);
+}
+
+/* See AllocationCounter.h. */
+bool canCountAllocations()
+{
+    return true;
+}
+
+#else
+
+/* See AllocationCounter.h. */
+bool canCountAllocations()
+{
+    return false;
+}
+
+#endif /* __GLIBC__ && ASMASE_COUNT_ALLOCATIONS */
+
+/* See AllocationCounter.h. */
+uint64_t getAllocationCount()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,39 @@
+/*
+ * ARM memory operand decoding.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+
+#include <llvm/MC/MCInst.h>
+#include <llvm/MC/MCInstrInfo.h>
+#include <llvm/MC/MCRegisterInfo.h>
+using namespace llvm;
+
+#include "Disassembler.h"
+
+/* See Disassembler.h. */
+int Disassembler::decodePlatformMemoryOperands(
+    const MCInst &inst, const MCInstrInfo &instrInfo,
+    const MCRegisterInfo &registerInfo, DecodedInstruction &instructionOut)
+{
+    fprintf(stderr,
+            "decoding memory operands is not supported on this architecture\n");
+    return 1;
+}
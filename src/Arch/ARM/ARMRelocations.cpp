@@ -0,0 +1,47 @@
+/*
+ * ARM relocation types.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <elf.h>
+
+#include "Assembler.h"
+
+/*
+ * See Assembler.h. Only plain data relocations are supported; branch
+ * relocations encode the offset in an instruction-specific bit field, which
+ * doesn't fit the fixup model.
+ */
+int Assembler::decodePlatformRelocation(uint32_t type, Fixup &fixup)
+{
+    switch (type) {
+        case R_ARM_ABS32:
+            fixup.size = 4;
+            fixup.pcRelative = false;
+            fixup.isSigned = false;
+            return 0;
+        case R_ARM_REL32:
+            fixup.size = 4;
+            fixup.pcRelative = true;
+            fixup.isSigned = true;
+            return 0;
+        default:
+            return 1;
+    }
+}
@@ -19,21 +19,30 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <vector>
 
 #include <sys/ptrace.h>
 #include <sys/user.h>
 
 #include "RegisterInfo.h"
+#include "Serialization.h"
+#include "Stats.h"
 #include "Arch/ARM/ARMTracee.h"
 #include "Arch/ARM/UserRegisters.h"
+#include "MockTracee.h"
 
 extern const RegisterInfo ARMRegisters;
 static const bytestring ARMTrapInstruction = {0xf0, 0x01, 0xf0, 0xe7};
+static const bytestring ARMSyscallInstruction = {0x00, 0x00, 0x00, 0xef}; // svc #0
 
-ARMTracee::ARMTracee(pid_t pid, void *sharedMemory, size_t sharedSize)
-    : Tracee{ARMRegisters, new UserRegisters, pid, sharedMemory, sharedSize} {}
+/** Thumb state bit in the CPSR. */
+static const unsigned long CPSR_THUMB = 0x20;
+
+ARMTracee::ARMTracee(pid_t pid, const TraceeMemory &memory)
+    : Tracee{ARMRegisters, new UserRegisters, pid, memory} {}
 
 const bytestring &ARMTracee::getTrapInstruction()
 {
@@ -44,7 +53,7 @@ int ARMTracee::setProgramCounter(void *pc)
 {
     struct user_regs regs;
 
-    if (ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
         perror("ptrace");
         fprintf(stderr, "could not get program counter\n");
         return 1;
@@ -53,10 +62,17 @@ int ARMTracee::setProgramCounter(void *pc)
     // Hack, since we can't include <asm/ptrace.h> because it redefines all of
     // the ptrace requests
 #define ARM_pc uregs[15]
-    regs.ARM_pc = (unsigned long) pc;
+#define ARM_cpsr uregs[16]
+    // Like bx, an odd address switches to Thumb state
+    if (reinterpret_cast<uintptr_t>(pc) & 1)
+        regs.ARM_cpsr |= CPSR_THUMB;
+    else
+        regs.ARM_cpsr &= ~CPSR_THUMB;
+    regs.ARM_pc = reinterpret_cast<uintptr_t>(pc) & ~1UL;
+#undef ARM_cpsr
 #undef ARM_pc
 
-    if (ptrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
         perror("ptrace");
         fprintf(stderr, "could not set program counter\n");
         return 1;
@@ -67,9 +83,10 @@ int ARMTracee::setProgramCounter(void *pc)
 
 int ARMTracee::updateRegisters()
 {
+    PhaseTimer timer{StatsPhase::REGISTERS};
     struct user_regs regs;
 
-    if (ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
         perror("ptrace");
         fprintf(stderr, "could not get registers\n");
         return 1;
@@ -80,6 +97,204 @@ int ARMTracee::updateRegisters()
     return 0;
 }
 
+int ARMTracee::readSyscallEntry(SyscallRecord &recordOut)
+{
+    struct user_regs regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get system call\n");
+        return 1;
+    }
+
+    // EABI: the number is in r7 and the arguments in r0-r5
+    recordOut.number = regs.uregs[7];
+    for (int i = 0; i < 6; i++)
+        recordOut.args[i] = regs.uregs[i];
+
+    return 0;
+}
+
+int ARMTracee::readSyscallExit(SyscallRecord &recordOut)
+{
+    struct user_regs regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get system call return value\n");
+        return 1;
+    }
+
+    recordOut.ret = regs.uregs[0];
+
+    return 0;
+}
+
+const bytestring &ARMTracee::getSyscallInstruction()
+{
+    return ARMSyscallInstruction;
+}
+
+int ARMTracee::saveGeneralRegisters(bytestring &regsOut)
+{
+    struct user_regs regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get registers\n");
+        return 1;
+    }
+
+    regsOut.assign(reinterpret_cast<unsigned char *>(&regs), sizeof(regs));
+    return 0;
+}
+
+int ARMTracee::restoreGeneralRegisters(const bytestring &regs)
+{
+    if (regs.size() != sizeof(struct user_regs)) {
+        fprintf(stderr, "saved registers are the wrong size\n");
+        return 1;
+    }
+
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr,
+                      const_cast<unsigned char *>(regs.data())) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int ARMTracee::setSyscallRegisters(const SyscallRecord &call)
+{
+    struct user_regs regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get registers\n");
+        return 1;
+    }
+
+    regs.uregs[7] = call.number;
+    for (int i = 0; i < 6; i++)
+        regs.uregs[i] = call.args[i];
+
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int ARMTracee::setCallRegisters(const FunctionCall &call, void *stackTop,
+                                void *returnAddress)
+{
+    struct user_regs regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get registers\n");
+        return 1;
+    }
+
+    if (!call.floatArgs.empty()) {
+        fprintf(stderr,
+                "floating point arguments are not supported on this architecture\n");
+        return 1;
+    }
+
+    // The first four arguments go in r0-r3 and the rest on the stack, which
+    // is 8-byte aligned
+    size_t i;
+    for (i = 0; i < call.args.size() && i < 4; i++)
+        regs.uregs[i] = call.args[i];
+    std::vector<unsigned long> stack{call.args.begin() + i, call.args.end()};
+    uintptr_t sp = reinterpret_cast<uintptr_t>(stackTop) -
+                   stack.size() * sizeof(unsigned long);
+    sp &= ~static_cast<uintptr_t>(7);
+    if (!stack.empty() &&
+        writeMemory(reinterpret_cast<void *>(sp), stack.data(),
+                    stack.size() * sizeof(unsigned long)))
+        return 1;
+
+    regs.uregs[13] = sp;
+    regs.uregs[14] = reinterpret_cast<uintptr_t>(returnAddress);
+
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int ARMTracee::readCallReturn(FunctionCall &callOut)
+{
+    struct user_regs regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get function return value\n");
+        return 1;
+    }
+
+    callOut.ret = regs.uregs[0];
+    return 0;
+}
+
+int ARMTracee::saveRegisterContext(bytestring &contextOut)
+{
+    struct user_regs regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get registers\n");
+        return 1;
+    }
+
+    ByteWriter writer;
+    writer.putBytes(&regs, sizeof(regs));
+    contextOut = std::move(writer.buffer);
+
+    return 0;
+}
+
+int ARMTracee::restoreRegisterContext(const bytestring &context)
+{
+    struct user_regs saved, regs;
+
+    ByteReader reader{context.data(), context.size()};
+    reader.getBytes(&saved, sizeof(saved));
+    if (reader.hasFailed() || !reader.atEnd()) {
+        fprintf(stderr, "invalid register context\n");
+        return 1;
+    }
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get registers\n");
+        return 1;
+    }
+
+    // r0-r12, then lr and cpsr; sp and pc stay where they are
+    for (int i = 0; i <= 12; ++i)
+        regs.uregs[i] = saved.uregs[i];
+    regs.uregs[14] = saved.uregs[14];
+    regs.uregs[16] = saved.uregs[16];
+
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
 void ARMTracee::printInstruction(const bytestring &machineCode)
 {
     if (machineCode.size() % 4) {
@@ -99,10 +314,14 @@ void ARMTracee::printInstruction(const bytestring &machineCode)
 }
 
 /* See Tracee.h. */
-Tracee *Tracee::createPlatformTracee(pid_t pid, void *sharedMemory,
-                                     size_t sharedSize)
+Tracee *Tracee::createPlatformTracee(pid_t pid, const TraceeMemory &memory)
+{
+    return new ARMTracee{pid, memory};
+}
+
+Tracee *Tracee::createPlatformMockTracee(const TraceeMemory &memory)
 {
-    return new ARMTracee{pid, sharedMemory, sharedSize};
+    return new MockTracee<ARMTracee>{memory, "pc"};
 }
 
 #include "Tracee.inc"
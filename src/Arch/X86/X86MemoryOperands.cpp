@@ -0,0 +1,301 @@
+/*
+ * x86 memory operand decoding.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include <llvm/MC/MCInst.h>
+#include <llvm/MC/MCInstrDesc.h>
+#include <llvm/MC/MCInstrInfo.h>
+#include <llvm/MC/MCRegisterInfo.h>
+using namespace llvm;
+
+#include "Disassembler.h"
+
+/** Size of a pointer (and thus a stack slot) on the host. */
+static const size_t POINTER_SIZE = sizeof(void *);
+
+/** Find a register by its name in LLVM (e.g., "RSP"). */
+static unsigned findLLVMRegister(const MCRegisterInfo &registerInfo,
+                                 const char *name)
+{
+    for (unsigned reg = 1; reg < registerInfo.getNumRegs(); reg++) {
+        if (strcmp(registerInfo.getName(reg), name) == 0)
+            return reg;
+    }
+    return 0;
+}
+
+/** Get the name of a register in lowercase, like the tracee names them. */
+static std::string getRegisterName(const MCRegisterInfo &registerInfo,
+                                   unsigned reg)
+{
+    std::string name = registerInfo.getName(reg);
+    for (char &c : name)
+        c = tolower(c);
+    return name;
+}
+
+/**
+ * Get the name of the tracee register holding a register used in an address.
+ * On x86-64, a 32-bit address (with an address size override) is computed
+ * from the low halves of the 64-bit registers.
+ */
+static std::string getAddressRegister(const MCRegisterInfo &registerInfo,
+                                      unsigned reg, MemoryOperand &operand)
+{
+#ifdef __x86_64__
+    for (MCSuperRegIterator super{reg, &registerInfo}; super.isValid();
+         ++super) {
+        if (!MCSuperRegIterator{*super, &registerInfo}.isValid()) {
+            reg = *super;
+            operand.addressSize = 4;
+            break;
+        }
+    }
+#endif
+    return getRegisterName(registerInfo, reg);
+}
+
+/**
+ * Get the name of the register holding the base of a segment. Only FS and GS
+ * have a base on x86-64; everything else is flat.
+ */
+static std::string getSegmentBase(const MCRegisterInfo &registerInfo,
+                                  unsigned reg)
+{
+#ifdef __x86_64__
+    std::string name = getRegisterName(registerInfo, reg);
+    if (name == "fs" || name == "gs")
+        return name + ".base";
+#endif
+    return "";
+}
+
+/** Return whether a register is a segment register. */
+static bool isSegmentRegister(const MCRegisterInfo &registerInfo, unsigned reg)
+{
+    static const char *segments[] = {"CS", "DS", "ES", "FS", "GS", "SS"};
+    const char *name = registerInfo.getName(reg);
+    return std::any_of(std::begin(segments), std::end(segments),
+                       [name](const char *segment) {
+                           return strcmp(name, segment) == 0;
+                       });
+}
+
+/** Return whether a register is an SSE or AVX register. */
+static bool isVectorRegister(const MCRegisterInfo &registerInfo, unsigned reg)
+{
+    const char *name = registerInfo.getName(reg);
+    return (name[0] == 'X' || name[0] == 'Y' || name[0] == 'Z') &&
+           strncmp(name + 1, "MM", 2) == 0;
+}
+
+/** Get the size of the registers in a register class, or zero if unknown. */
+static size_t getRegisterClassSize(const MCRegisterInfo &registerInfo,
+                                   int regClass)
+{
+    if (regClass < 0 ||
+        static_cast<unsigned>(regClass) >= registerInfo.getNumRegClasses())
+        return 0;
+#if LLVM_VERSION_MAJOR >= 10
+    return registerInfo.getRegClass(regClass).getSizeInBits() / 8;
+#elif LLVM_VERSION_MAJOR < 7
+    return registerInfo.getRegClass(regClass).getSize();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Get the element size of a string instruction (e.g., MOVSQ) from the last
+ * letter of its name.
+ */
+static size_t getStringElementSize(StringRef name)
+{
+    switch (name.empty() ? '\0' : name.back()) {
+        case 'B':
+            return 1;
+        case 'W':
+            return 2;
+        case 'L':
+        case 'D':
+            return 4;
+        case 'Q':
+            return 8;
+        default:
+            return POINTER_SIZE;
+    }
+}
+
+/*
+ * See Disassembler.h. Explicit memory operands are either a full address (base,
+ * scale, index, displacement, and segment), the register holding the address
+ * of a string instruction, or the absolute offset of a MOV to or from the
+ * accumulator. The size of an access is taken from the widest register
+ * operand since it isn't recorded anywhere else.
+ */
+int Disassembler::decodePlatformMemoryOperands(
+    const MCInst &inst, const MCInstrInfo &instrInfo,
+    const MCRegisterInfo &registerInfo, DecodedInstruction &instructionOut)
+{
+    static const unsigned stackPointer =
+        findLLVMRegister(registerInfo, POINTER_SIZE == 8 ? "RSP" : "ESP");
+
+    const MCInstrDesc &desc = instrInfo.get(inst.getOpcode());
+    StringRef name = instrInfo.getName(inst.getOpcode());
+    bool isPush = name.startswith("PUSH");
+    bool isPop = name.startswith("POP") && !name.startswith("POPCNT");
+
+    // LLVM doesn't mark string instructions as loading or storing, so tell
+    // them apart by name. The first operand of MOVS is its destination.
+    bool isStringStore = false, isStringLoad = false;
+    if (!desc.mayLoad() && !desc.mayStore()) {
+        isStringStore = name.startswith("MOVS") || name.startswith("STOS") ||
+                        name.startswith("INS");
+        isStringLoad = name.startswith("MOVS") || name.startswith("LODS") ||
+                       name.startswith("CMPS") || name.startswith("SCAS") ||
+                       name.startswith("OUTS");
+    }
+    size_t numOperands = std::min<size_t>(inst.getNumOperands(),
+                                          desc.getNumOperands());
+
+    size_t accessSize = 0;
+    for (size_t i = 0; i < numOperands; i++) {
+        const MCOperandInfo &info = desc.OpInfo[i];
+        if (info.OperandType != MCOI::OPERAND_MEMORY &&
+            inst.getOperand(i).isReg())
+            accessSize = std::max(accessSize,
+                                  getRegisterClassSize(registerInfo,
+                                                       info.RegClass));
+    }
+
+    auto isMemory = [&](size_t i) {
+        return i < numOperands &&
+               desc.OpInfo[i].OperandType == MCOI::OPERAND_MEMORY;
+    };
+
+    std::vector<MemoryOperand> &operands = instructionOut.memoryOperands;
+    if (desc.mayLoad() || desc.mayStore() || isStringLoad || isStringStore) {
+        for (size_t i = 0; i < numOperands; i++) {
+            if (!isMemory(i))
+                continue;
+
+            MemoryOperand operand;
+            const MCOperand &first = inst.getOperand(i);
+            if (isMemory(i + 4) && first.isReg() &&
+                inst.getOperand(i + 1).isImm() &&
+                inst.getOperand(i + 2).isReg() &&
+                inst.getOperand(i + 4).isReg()) {
+                unsigned base = first.getReg();
+                unsigned index = inst.getOperand(i + 2).getReg();
+                const MCOperand &displacement = inst.getOperand(i + 3);
+                unsigned segment = inst.getOperand(i + 4).getReg();
+                i += 4;
+
+                // Gathers and scatters have a vector of indices, which we
+                // can't follow
+                if (index && isVectorRegister(registerInfo, index))
+                    continue;
+
+                if (base) {
+                    std::string baseName = getRegisterName(registerInfo, base);
+                    operand.pcRelative = baseName == "rip" ||
+                                         baseName == "eip";
+                    if (!operand.pcRelative)
+                        operand.base = getAddressRegister(registerInfo, base,
+                                                          operand);
+                }
+                if (index)
+                    operand.index = getAddressRegister(registerInfo, index,
+                                                       operand);
+                operand.scale = inst.getOperand(i - 3).getImm();
+                if (displacement.isImm())
+                    operand.displacement = displacement.getImm();
+                if (segment)
+                    operand.segment = getSegmentBase(registerInfo, segment);
+                operand.size = accessSize ? accessSize : POINTER_SIZE;
+            } else if (first.isReg() && first.getReg()) {
+                operand.base = getAddressRegister(registerInfo, first.getReg(),
+                                                  operand);
+                if (isMemory(i + 1) && inst.getOperand(i + 1).isReg() &&
+                    isSegmentRegister(registerInfo,
+                                      inst.getOperand(i + 1).getReg()))
+                    operand.segment = getSegmentBase(
+                        registerInfo, inst.getOperand(++i).getReg());
+                operand.size = getStringElementSize(name);
+            } else if (first.isImm()) {
+                operand.displacement = first.getImm();
+                if (isMemory(i + 1) && inst.getOperand(i + 1).isReg()) {
+                    unsigned segment = inst.getOperand(++i).getReg();
+                    if (segment)
+                        operand.segment = getSegmentBase(registerInfo,
+                                                         segment);
+                }
+                operand.size = accessSize ? accessSize : POINTER_SIZE;
+            } else
+                continue;
+
+            operands.push_back(operand);
+        }
+
+        // A push reads its explicit operand and writes the stack, and a pop
+        // does the opposite. Otherwise, the destination comes first.
+        for (size_t i = 0; i < operands.size(); i++) {
+            if (isStringLoad && isStringStore) {
+                operands[i].isLoad = i > 0;
+                operands[i].isStore = i == 0;
+            } else if (isStringLoad || isStringStore) {
+                operands[i].isLoad = isStringLoad;
+                operands[i].isStore = isStringStore;
+            } else if (isPush || isPop) {
+                operands[i].isLoad = isPush;
+                operands[i].isStore = isPop;
+            } else if (operands.size() > 1 && desc.mayStore()) {
+                operands[i].isLoad = i > 0 && desc.mayLoad();
+                operands[i].isStore = i == 0;
+            } else {
+                operands[i].isLoad = desc.mayLoad();
+                operands[i].isStore = desc.mayStore();
+            }
+        }
+    }
+
+    // Implicit accesses to the stack
+    if (desc.isCall() || desc.isReturn() ||
+        ((isPush || isPop) && stackPointer &&
+         desc.hasImplicitDefOfPhysReg(stackPointer))) {
+        MemoryOperand operand;
+        operand.base = getRegisterName(registerInfo, stackPointer);
+        operand.size = POINTER_SIZE;
+        if (isPush || isPop)
+            operand.size = accessSize ? accessSize : POINTER_SIZE;
+        if (desc.isCall() || isPush) {
+            operand.displacement = -static_cast<int64_t>(operand.size);
+            operand.isStore = true;
+        } else
+            operand.isLoad = true;
+        operands.push_back(operand);
+    }
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * x86 profiling instrumentation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Profiler.h"
+
+#ifdef __x86_64__
+/*
+ * Save the flags after moving the stack pointer past the red zone, which the
+ * code may be using. LEA doesn't touch the flags.
+ */
+static const bytestring X86CounterPrologue = {
+    0x48, 0x8d, 0x64, 0x24, 0x80, // lea -128(%rsp), %rsp
+    0x9c,                         // pushfq
+};
+static const bytestring X86CounterIncrement = {
+    0x48, 0xff, 0x05, 0, 0, 0, 0, // incq counter(%rip)
+};
+static const bytestring X86CounterEpilogue = {
+    0x9d,                                  // popfq
+    0x48, 0x8d, 0xa4, 0x24, 0x80, 0, 0, 0, // lea 128(%rsp), %rsp
+};
+#else
+static const bytestring X86CounterPrologue = {
+    0x9c,                         // pushfl
+};
+static const bytestring X86CounterIncrement = {
+    0x83, 0x05, 0, 0, 0, 0, 0x01, // addl $1, counter
+    0x83, 0x15, 0, 0, 0, 0, 0x00, // adcl $0, counter + 4
+};
+static const bytestring X86CounterEpilogue = {
+    0x9d,                         // popfl
+};
+#endif
+
+/** Add a fixup against the counter array for the field at an offset. */
+static void addCounterFixup(AssembledCode &code, size_t offset,
+                            bool pcRelative, int64_t addend)
+{
+    Fixup fixup;
+    fixup.symbol = Profiler::COUNTER_SYMBOL;
+    fixup.target = Segment::DATA;
+    fixup.segment = Segment::CODE;
+    fixup.offset = offset;
+    fixup.size = 4;
+    fixup.pcRelative = pcRelative;
+    fixup.isSigned = pcRelative;
+    fixup.addend = addend;
+    code.fixups.push_back(fixup);
+}
+
+/* See Profiler.h. */
+int Profiler::appendPlatformCounterIncrement(size_t counter,
+                                             AssembledCode &code)
+{
+    int64_t offset = counter * sizeof(uint64_t);
+
+    code.machineCode += X86CounterPrologue;
+    size_t increment = code.machineCode.size();
+    code.machineCode += X86CounterIncrement;
+#ifdef __x86_64__
+    addCounterFixup(code, increment + 3, true, offset - 4);
+#else
+    addCounterFixup(code, increment + 2, false, offset);
+    addCounterFixup(code, increment + 9, false, offset + 4);
+#endif
+    code.machineCode += X86CounterEpilogue;
+    return 0;
+}
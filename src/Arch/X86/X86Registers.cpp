@@ -31,120 +31,6 @@
 #include "Arch/X86/UserRegisters.h"
 #include "Arch/X86/X86Tracee.h"
 
-#define USER_REGISTER(reg) offsetof(UserRegisters, reg)
-using RT = RegisterType;
-using RC = RegisterCategory;
-extern const RegisterInfo X86Registers = {
-    {
-        // General-purpose
-#ifdef __x86_64__
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rax", USER_REGISTER(rax)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rcx", USER_REGISTER(rcx)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rdx", USER_REGISTER(rdx)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rbx", USER_REGISTER(rbx)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rsp", USER_REGISTER(rsp)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rbp", USER_REGISTER(rbp)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rsi", USER_REGISTER(rsi)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rdi", USER_REGISTER(rdi)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r8",  USER_REGISTER(r8)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r9",  USER_REGISTER(r9)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r10", USER_REGISTER(r10)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r11", USER_REGISTER(r11)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r12", USER_REGISTER(r12)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r13", USER_REGISTER(r13)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r14", USER_REGISTER(r14)},
-        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r15", USER_REGISTER(r15)},
-#else
-        {RT::INT32, RC::GENERAL_PURPOSE, "%", "eax", USER_REGISTER(eax)},
-        {RT::INT32, RC::GENERAL_PURPOSE, "%", "ecx", USER_REGISTER(ecx)},
-        {RT::INT32, RC::GENERAL_PURPOSE, "%", "edx", USER_REGISTER(edx)},
-        {RT::INT32, RC::GENERAL_PURPOSE, "%", "ebx", USER_REGISTER(ebx)},
-        {RT::INT32, RC::GENERAL_PURPOSE, "%", "esp", USER_REGISTER(esp)},
-        {RT::INT32, RC::GENERAL_PURPOSE, "%", "ebp", USER_REGISTER(ebp)},
-        {RT::INT32, RC::GENERAL_PURPOSE, "%", "esi", USER_REGISTER(esi)},
-        {RT::INT32, RC::GENERAL_PURPOSE, "%", "edi", USER_REGISTER(edi)},
-#endif
-
-        // Condition codes
-        {RT::INT32, RC::CONDITION_CODE, "eflags", USER_REGISTER(eflags)},
-
-        // Program counter
-#ifdef __x86_64__
-        {RT::INT64, RC::PROGRAM_COUNTER, "%", "rip", USER_REGISTER(rip)},
-#else
-        {RT::INT32, RC::PROGRAM_COUNTER, "%", "eip", USER_REGISTER(eip)},
-#endif
-
-        // Segmentation
-        {RT::INT16, RC::SEGMENTATION, "%", "cs", USER_REGISTER(cs)},
-        {RT::INT16, RC::SEGMENTATION, "%", "ss", USER_REGISTER(ss)},
-        {RT::INT16, RC::SEGMENTATION, "%", "ds", USER_REGISTER(ds)},
-        {RT::INT16, RC::SEGMENTATION, "%", "es", USER_REGISTER(es)},
-        {RT::INT16, RC::SEGMENTATION, "%", "fs", USER_REGISTER(fs)},
-        {RT::INT16, RC::SEGMENTATION, "%", "gs", USER_REGISTER(gs)},
-#ifdef __x86_64__
-        {RT::INT64, RC::SEGMENTATION, "%", "fs.base", USER_REGISTER(fsBase)},
-        {RT::INT64, RC::SEGMENTATION, "%", "gs.base", USER_REGISTER(gsBase)},
-#endif
-
-        // Floating-point
-        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(0)", USER_REGISTER(st[0])},
-        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(1)", USER_REGISTER(st[1])},
-        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(2)", USER_REGISTER(st[2])},
-        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(3)", USER_REGISTER(st[3])},
-        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(4)", USER_REGISTER(st[4])},
-        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(5)", USER_REGISTER(st[5])},
-        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(6)", USER_REGISTER(st[6])},
-        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(7)", USER_REGISTER(st[7])},
-
-        // Floating-point status
-        {RT::INT16, RC::FLOATING_POINT, "fcw", USER_REGISTER(fcw)},
-        {RT::INT16, RC::FLOATING_POINT, "fsw", USER_REGISTER(fsw)},
-        {RT::INT16, RC::FLOATING_POINT, "ftw", USER_REGISTER(ftw)},
-        {RT::INT16, RC::FLOATING_POINT, "fop", USER_REGISTER(fop)},
-#ifdef __x86_64__
-        {RT::INT64, RC::FLOATING_POINT, "fip", USER_REGISTER(fip)},
-        {RT::INT64, RC::FLOATING_POINT, "fdp", USER_REGISTER(fdp)},
-#else
-        {RT::INT32, RC::FLOATING_POINT, "fip", USER_REGISTER(fip)},
-        {RT::INT32, RC::FLOATING_POINT, "fdp", USER_REGISTER(fdp)},
-#endif
-
-        // Extra (MMX and SSE)
-        {RT::INT64, RC::EXTRA, "%", "mm0", USER_REGISTER(st[0])},
-        {RT::INT64, RC::EXTRA, "%", "mm1", USER_REGISTER(st[1])},
-        {RT::INT64, RC::EXTRA, "%", "mm2", USER_REGISTER(st[2])},
-        {RT::INT64, RC::EXTRA, "%", "mm3", USER_REGISTER(st[3])},
-        {RT::INT64, RC::EXTRA, "%", "mm4", USER_REGISTER(st[4])},
-        {RT::INT64, RC::EXTRA, "%", "mm5", USER_REGISTER(st[5])},
-        {RT::INT64, RC::EXTRA, "%", "mm6", USER_REGISTER(st[6])},
-        {RT::INT64, RC::EXTRA, "%", "mm7", USER_REGISTER(st[7])},
-
-        {RT::INT128, RC::EXTRA, "%", "xmm0",  USER_REGISTER(xmm[0])},
-        {RT::INT128, RC::EXTRA, "%", "xmm1",  USER_REGISTER(xmm[1])},
-        {RT::INT128, RC::EXTRA, "%", "xmm2",  USER_REGISTER(xmm[2])},
-        {RT::INT128, RC::EXTRA, "%", "xmm3",  USER_REGISTER(xmm[3])},
-        {RT::INT128, RC::EXTRA, "%", "xmm4",  USER_REGISTER(xmm[4])},
-        {RT::INT128, RC::EXTRA, "%", "xmm5",  USER_REGISTER(xmm[5])},
-        {RT::INT128, RC::EXTRA, "%", "xmm6",  USER_REGISTER(xmm[6])},
-        {RT::INT128, RC::EXTRA, "%", "xmm7",  USER_REGISTER(xmm[7])},
-#ifdef __x86_64__
-        {RT::INT128, RC::EXTRA, "%", "xmm8",  USER_REGISTER(xmm[8])},
-        {RT::INT128, RC::EXTRA, "%", "xmm9",  USER_REGISTER(xmm[9])},
-        {RT::INT128, RC::EXTRA, "%", "xmm10", USER_REGISTER(xmm[10])},
-        {RT::INT128, RC::EXTRA, "%", "xmm11", USER_REGISTER(xmm[11])},
-        {RT::INT128, RC::EXTRA, "%", "xmm12", USER_REGISTER(xmm[12])},
-        {RT::INT128, RC::EXTRA, "%", "xmm13", USER_REGISTER(xmm[13])},
-        {RT::INT128, RC::EXTRA, "%", "xmm14", USER_REGISTER(xmm[14])},
-        {RT::INT128, RC::EXTRA, "%", "xmm15", USER_REGISTER(xmm[15])},
-#endif
-
-        // Extra status (SSE)
-        {RT::INT32, RC::EXTRA, "mxcsr", USER_REGISTER(mxcsr)},
-    },
-};
-#undef USER_REGISTER
-
 /** Flags in the eflags register. */
 static ProcessorFlags<decltype(UserRegisters::eflags)> eflagsFlags = {
     {"CF", X86_EFLAGS_CF}, // Carry flag
@@ -241,136 +127,186 @@ static ProcessorFlags<decltype(UserRegisters::mxcsr)> mxcsrFlags = {
     {"EF=IE", 0x0001}, // Invalid operation
 };
 
-int X86Tracee::printGeneralPurposeRegisters()
+/** Append the flags which are set in eflags. */
+static void annotateEflags(const UserRegisters &regs, std::string &out)
 {
-#ifdef __x86_64__
-    printf("%%rax = " PRINTFx64 "    %%rcx = " PRINTFx64 "\n"
-           "%%rdx = " PRINTFx64 "    %%rbx = " PRINTFx64 "\n"
-           "%%rsp = " PRINTFx64 "    %%rbp = " PRINTFx64 "\n"
-           "%%rsi = " PRINTFx64 "    %%rdi = " PRINTFx64 "\n"
-           "%%r8  = " PRINTFx64 "    %%r9  = " PRINTFx64 "\n"
-           "%%r10 = " PRINTFx64 "    %%r11 = " PRINTFx64 "\n"
-           "%%r12 = " PRINTFx64 "    %%r13 = " PRINTFx64 "\n"
-           "%%r14 = " PRINTFx64 "    %%r15 = " PRINTFx64 "\n"
-           "%%rip = " PRINTFx64 "\n",
-           registers->rax, registers->rcx, registers->rdx, registers->rbx,
-           registers->rsp, registers->rbp, registers->rsi, registers->rdi,
-           registers->r8,  registers->r9,  registers->r10, registers->r11,
-           registers->r12, registers->r13, registers->r14, registers->r15,
-           registers->rip);
-#else
-    printf("%%eax = " PRINTFx32 "    %%ecx = " PRINTFx32 "\n"
-           "%%edx = " PRINTFx32 "    %%ebx = " PRINTFx32 "\n"
-           "%%esp = " PRINTFx32 "    %%ebp = " PRINTFx32 "\n"
-           "%%esi = " PRINTFx32 "    %%edi = " PRINTFx32 "\n"
-           "%%eip = " PRINTFx32 "\n",
-           registers->eax, registers->ecx, registers->edx, registers->ebx,
-           registers->esp, registers->ebp, registers->esi, registers->edi,
-           registers->eip);
-#endif
-    return 0;
+    out += " = ";
+    eflagsFlags.formatFlags(regs.eflags, out);
 }
 
-int X86Tracee::printConditionCodeRegisters()
+/** Append the flags which are set in fcw. */
+static void annotateFcw(const UserRegisters &regs, std::string &out)
 {
-    printf("eflags = " PRINTFx32 " = ", registers->eflags);
-    eflagsFlags.printFlags(registers->eflags);
-    printf("\n");
-    return 0;
+    out += " = ";
+    fcwFlags.formatFlags(regs.fcw, out);
 }
 
-int X86Tracee::printSegmentationRegisters()
+/** Append the flags which are set in fsw. */
+static void annotateFsw(const UserRegisters &regs, std::string &out)
 {
-    printf("%%ss = " PRINTFx16 "    %%cs = " PRINTFx16 "\n"
-           "%%ds = " PRINTFx16 "    %%es = " PRINTFx16 "\n"
-           "%%fs = " PRINTFx16 "    %%gs = " PRINTFx16 "\n",
-           registers->ss, registers->cs, registers->ds, registers->es,
-           registers->fs, registers->gs);
+    out += " = ";
+    fswFlags.formatFlags(regs.fsw, out);
+}
 
-#ifdef __x86_64__
-    printf("fs.base = " PRINTFx64 "\n"
-           "gs.base = " PRINTFx64 "\n",
-           registers->fsBase, registers->gsBase);
-#endif
+/** Append the flags which are set in mxcsr. */
+static void annotateMxcsr(const UserRegisters &regs, std::string &out)
+{
+    out += " = ";
+    mxcsrFlags.formatFlags(regs.mxcsr, out);
+}
 
-    return 0;
+/**
+ * Append the physical register backing %st(i) and its tag, since the value
+ * of an empty register is meaningless.
+ */
+template <int i>
+static void annotateSt(const UserRegisters &regs, std::string &out)
+{
+    static const char * const tags[] = {"valid", "zero", "special", "empty"};
+    uint16_t physical = x87_log_to_phys(i, x87_st_top(regs.fsw));
+    uint16_t tag = (regs.ftw >> 2 * physical) & 0x3;
+
+    out += " (R";
+    out += '0' + physical;
+    out += ", ";
+    out += tags[tag];
+    out += ')';
 }
 
-int X86Tracee::printFloatingPointRegisters()
+#ifndef __x86_64__
+/** Append the segment selector of fip or fdp. */
+template <uint16_t UserRegisters::*selector>
+static void annotateSelector(const UserRegisters &regs, std::string &out)
 {
-    printf("fcw = " PRINTFx16 " = ", registers->fcw);
-    fcwFlags.printFlags(registers->fcw);
-    printf("\n");
-
-    printf("fsw = " PRINTFx16 " = ", registers->fsw);
-    fswFlags.printFlags(registers->fsw);
-    printf("\n");
-
-    printf("ftw = " PRINTFx16 "\n", registers->ftw);
-    printf("\n");
-
-    uint16_t top = x87_st_top(registers->fsw);
-    for (int16_t physical = 7; physical >= 0; --physical) {
-        uint16_t logical = x87_phys_to_log(physical, top);
-        long double st = registers->st[logical];
-        uint16_t tag = 
-            (registers->ftw & (0x3 << 2 * physical)) >> 2 * physical;
-
-        printf("R%d = ", physical);
-
-        switch (tag) {
-            case 0x0:
-                printf("(valid)   ");
-                break;
-            case 0x1:
-                printf("(zero)    ");
-                break;
-            case 0x2:
-                printf("(special) ");
-                break;
-            case 0x3:
-                printf("(empty)\n");
-                break;
-        }
-
-        if (tag != 0x3)
-            printf("%20.18Lf, %%st(%d)\n", st, logical);
-    }
-    printf("\n");
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), " (" PRINTFx16 ")", regs.*selector);
+    out += buffer;
+}
+#endif
 
+#define USER_REGISTER(reg) offsetof(UserRegisters, reg)
+using RT = RegisterType;
+using RC = RegisterCategory;
+extern const RegisterInfo X86Registers = {
+    {
+        // General-purpose
 #ifdef __x86_64__
-    printf("fip = " PRINTFx64 "    fdp = " PRINTFx64 "\n",
-           registers->fip, registers->fdp);
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rax", USER_REGISTER(rax)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rcx", USER_REGISTER(rcx)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rdx", USER_REGISTER(rdx)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rbx", USER_REGISTER(rbx)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rsp", USER_REGISTER(rsp)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rbp", USER_REGISTER(rbp)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rsi", USER_REGISTER(rsi)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "rdi", USER_REGISTER(rdi)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r8",  USER_REGISTER(r8)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r9",  USER_REGISTER(r9)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r10", USER_REGISTER(r10)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r11", USER_REGISTER(r11)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r12", USER_REGISTER(r12)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r13", USER_REGISTER(r13)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r14", USER_REGISTER(r14)},
+        {RT::INT64, RC::GENERAL_PURPOSE, "%", "r15", USER_REGISTER(r15)},
 #else
-    printf("fip = " PRINTFx16 ":" PRINTFx32 "    "
-           "fdp = " PRINTFx16 ":" PRINTFx32 "\n",
-           registers->fcs, registers->fip, registers->fds, registers->fdp);
+        {RT::INT32, RC::GENERAL_PURPOSE, "%", "eax", USER_REGISTER(eax)},
+        {RT::INT32, RC::GENERAL_PURPOSE, "%", "ecx", USER_REGISTER(ecx)},
+        {RT::INT32, RC::GENERAL_PURPOSE, "%", "edx", USER_REGISTER(edx)},
+        {RT::INT32, RC::GENERAL_PURPOSE, "%", "ebx", USER_REGISTER(ebx)},
+        {RT::INT32, RC::GENERAL_PURPOSE, "%", "esp", USER_REGISTER(esp)},
+        {RT::INT32, RC::GENERAL_PURPOSE, "%", "ebp", USER_REGISTER(ebp)},
+        {RT::INT32, RC::GENERAL_PURPOSE, "%", "esi", USER_REGISTER(esi)},
+        {RT::INT32, RC::GENERAL_PURPOSE, "%", "edi", USER_REGISTER(edi)},
 #endif
-    printf("fop = " PRINTFx16 "\n", registers->fop);
 
-    return 0;
-}
+        // Condition codes
+        {RT::INT32, RC::CONDITION_CODE, "eflags", USER_REGISTER(eflags),
+         annotateEflags},
 
-int X86Tracee::printExtraRegisters()
-{
-    printf("mxcsr = " PRINTFx32 " = ", registers->mxcsr);
-    mxcsrFlags.printFlags(registers->mxcsr);
-    printf("\n");
-
-    for (int i = 0; i < 8; ++i) {
-        if (i % 2 == 0)
-            printf("\n");
-        else
-            printf("    ");
-        uint64_t mm = *reinterpret_cast<uint64_t *>(&registers->st[i]);
-        printf("%%mm%d = " PRINTFx64, i, mm);
-    }
-    printf("\n");
-
-    printf("\n");
-    for (int i = 0; i < UserRegisters::NUM_SSE_REGS; ++i)
-        printf("%%xmm%-2d = 0x%016" PRIx64 "%016" PRIx64 "\n",
-               i, registers->xmm[i].hi, registers->xmm[i].lo);
-
-    return 0;
-}
+        // Program counter
+#ifdef __x86_64__
+        {RT::INT64, RC::PROGRAM_COUNTER, "%", "rip", USER_REGISTER(rip)},
+#else
+        {RT::INT32, RC::PROGRAM_COUNTER, "%", "eip", USER_REGISTER(eip)},
+#endif
+
+        // Segmentation
+        {RT::INT16, RC::SEGMENTATION, "%", "cs", USER_REGISTER(cs)},
+        {RT::INT16, RC::SEGMENTATION, "%", "ss", USER_REGISTER(ss)},
+        {RT::INT16, RC::SEGMENTATION, "%", "ds", USER_REGISTER(ds)},
+        {RT::INT16, RC::SEGMENTATION, "%", "es", USER_REGISTER(es)},
+        {RT::INT16, RC::SEGMENTATION, "%", "fs", USER_REGISTER(fs)},
+        {RT::INT16, RC::SEGMENTATION, "%", "gs", USER_REGISTER(gs)},
+#ifdef __x86_64__
+        {RT::INT64, RC::SEGMENTATION, "%", "fs.base", USER_REGISTER(fsBase)},
+        {RT::INT64, RC::SEGMENTATION, "%", "gs.base", USER_REGISTER(gsBase)},
+#endif
+
+        // Floating-point
+        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(0)", USER_REGISTER(st[0]),
+         annotateSt<0>},
+        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(1)", USER_REGISTER(st[1]),
+         annotateSt<1>},
+        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(2)", USER_REGISTER(st[2]),
+         annotateSt<2>},
+        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(3)", USER_REGISTER(st[3]),
+         annotateSt<3>},
+        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(4)", USER_REGISTER(st[4]),
+         annotateSt<4>},
+        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(5)", USER_REGISTER(st[5]),
+         annotateSt<5>},
+        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(6)", USER_REGISTER(st[6]),
+         annotateSt<6>},
+        {RT::LONG_DOUBLE, RC::FLOATING_POINT, "%", "st(7)", USER_REGISTER(st[7]),
+         annotateSt<7>},
+
+        // Floating-point status
+        {RT::INT16, RC::FLOATING_POINT, "fcw", USER_REGISTER(fcw),
+         annotateFcw},
+        {RT::INT16, RC::FLOATING_POINT, "fsw", USER_REGISTER(fsw),
+         annotateFsw},
+        {RT::INT16, RC::FLOATING_POINT, "ftw", USER_REGISTER(ftw)},
+        {RT::INT16, RC::FLOATING_POINT, "fop", USER_REGISTER(fop)},
+#ifdef __x86_64__
+        {RT::INT64, RC::FLOATING_POINT, "fip", USER_REGISTER(fip)},
+        {RT::INT64, RC::FLOATING_POINT, "fdp", USER_REGISTER(fdp)},
+#else
+        {RT::INT32, RC::FLOATING_POINT, "fip", USER_REGISTER(fip),
+         annotateSelector<&UserRegisters::fcs>},
+        {RT::INT32, RC::FLOATING_POINT, "fdp", USER_REGISTER(fdp),
+         annotateSelector<&UserRegisters::fds>},
+#endif
+
+        // Extra (MMX and SSE)
+        {RT::INT64, RC::EXTRA, "%", "mm0", USER_REGISTER(st[0])},
+        {RT::INT64, RC::EXTRA, "%", "mm1", USER_REGISTER(st[1])},
+        {RT::INT64, RC::EXTRA, "%", "mm2", USER_REGISTER(st[2])},
+        {RT::INT64, RC::EXTRA, "%", "mm3", USER_REGISTER(st[3])},
+        {RT::INT64, RC::EXTRA, "%", "mm4", USER_REGISTER(st[4])},
+        {RT::INT64, RC::EXTRA, "%", "mm5", USER_REGISTER(st[5])},
+        {RT::INT64, RC::EXTRA, "%", "mm6", USER_REGISTER(st[6])},
+        {RT::INT64, RC::EXTRA, "%", "mm7", USER_REGISTER(st[7])},
+
+        {RT::INT128, RC::EXTRA, "%", "xmm0",  USER_REGISTER(xmm[0])},
+        {RT::INT128, RC::EXTRA, "%", "xmm1",  USER_REGISTER(xmm[1])},
+        {RT::INT128, RC::EXTRA, "%", "xmm2",  USER_REGISTER(xmm[2])},
+        {RT::INT128, RC::EXTRA, "%", "xmm3",  USER_REGISTER(xmm[3])},
+        {RT::INT128, RC::EXTRA, "%", "xmm4",  USER_REGISTER(xmm[4])},
+        {RT::INT128, RC::EXTRA, "%", "xmm5",  USER_REGISTER(xmm[5])},
+        {RT::INT128, RC::EXTRA, "%", "xmm6",  USER_REGISTER(xmm[6])},
+        {RT::INT128, RC::EXTRA, "%", "xmm7",  USER_REGISTER(xmm[7])},
+#ifdef __x86_64__
+        {RT::INT128, RC::EXTRA, "%", "xmm8",  USER_REGISTER(xmm[8])},
+        {RT::INT128, RC::EXTRA, "%", "xmm9",  USER_REGISTER(xmm[9])},
+        {RT::INT128, RC::EXTRA, "%", "xmm10", USER_REGISTER(xmm[10])},
+        {RT::INT128, RC::EXTRA, "%", "xmm11", USER_REGISTER(xmm[11])},
+        {RT::INT128, RC::EXTRA, "%", "xmm12", USER_REGISTER(xmm[12])},
+        {RT::INT128, RC::EXTRA, "%", "xmm13", USER_REGISTER(xmm[13])},
+        {RT::INT128, RC::EXTRA, "%", "xmm14", USER_REGISTER(xmm[14])},
+        {RT::INT128, RC::EXTRA, "%", "xmm15", USER_REGISTER(xmm[15])},
+#endif
+
+        // Extra status (SSE)
+        {RT::INT32, RC::EXTRA, "mxcsr", USER_REGISTER(mxcsr), annotateMxcsr},
+    },
+};
+#undef USER_REGISTER
@@ -0,0 +1,92 @@
+/*
+ * x86 relocation types.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <elf.h>
+
+#include "Assembler.h"
+
+/** Set the size and kind of a fixup. */
+static inline void setFixup(Fixup &fixup, size_t size, bool pcRelative,
+                            bool isSigned)
+{
+    fixup.size = size;
+    fixup.pcRelative = pcRelative;
+    fixup.isSigned = isSigned;
+}
+
+/* See Assembler.h. */
+int Assembler::decodePlatformRelocation(uint32_t type, Fixup &fixup)
+{
+    switch (type) {
+#ifdef __x86_64__
+        case R_X86_64_64:
+            setFixup(fixup, 8, false, false);
+            return 0;
+        case R_X86_64_PC64:
+            setFixup(fixup, 8, true, true);
+            return 0;
+        case R_X86_64_32:
+            setFixup(fixup, 4, false, false);
+            return 0;
+        case R_X86_64_32S:
+            setFixup(fixup, 4, false, true);
+            return 0;
+        case R_X86_64_PC32:
+        case R_X86_64_PLT32:
+            setFixup(fixup, 4, true, true);
+            return 0;
+        case R_X86_64_16:
+            setFixup(fixup, 2, false, false);
+            return 0;
+        case R_X86_64_PC16:
+            setFixup(fixup, 2, true, true);
+            return 0;
+        case R_X86_64_8:
+            setFixup(fixup, 1, false, false);
+            return 0;
+        case R_X86_64_PC8:
+            setFixup(fixup, 1, true, true);
+            return 0;
+#else
+        case R_386_32:
+            setFixup(fixup, 4, false, false);
+            return 0;
+        case R_386_PC32:
+        case R_386_PLT32:
+            setFixup(fixup, 4, true, true);
+            return 0;
+        case R_386_16:
+            setFixup(fixup, 2, false, false);
+            return 0;
+        case R_386_PC16:
+            setFixup(fixup, 2, true, true);
+            return 0;
+        case R_386_8:
+            setFixup(fixup, 1, false, false);
+            return 0;
+        case R_386_PC8:
+            setFixup(fixup, 1, true, true);
+            return 0;
+#endif
+        default:
+            return 1;
+    }
+}
@@ -19,21 +19,122 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cerrno>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <vector>
 
+#include <elf.h>
 #include <sys/ptrace.h>
+#include <sys/uio.h>
 #include <sys/user.h>
 
 #include "RegisterInfo.h"
 #include "Arch/X86/X86Tracee.h"
 #include "Arch/X86/UserRegisters.h"
+#include "MockTracee.h"
+
+#include "Serialization.h"
+#include "Stats.h"
+
+// On x86-64, the FXSAVE area is all there is
+#ifdef __x86_64
+#define user_fpxregs_struct user_fpregs_struct
+#define PTRACE_GETFPXREGS PTRACE_GETFPREGS
+#define PTRACE_SETFPXREGS PTRACE_SETFPREGS
+#endif
 
 extern const RegisterInfo X86Registers;
 static const bytestring X86TrapInstruction = {0xcc};
+#ifdef __x86_64__
+static const bytestring X86SyscallInstruction = {0x0f, 0x05}; // syscall
+#else
+static const bytestring X86SyscallInstruction = {0xcd, 0x80}; // int $0x80
+#endif
 
-X86Tracee::X86Tracee(pid_t pid, void *sharedMemory, size_t sharedSize)
-    : Tracee{X86Registers, new UserRegisters, pid, sharedMemory, sharedSize} {}
+/*
+ * Loop of pseudo-random branches seeded from the timestamp counter. The
+ * iteration count is patched in at offset 1.
+ */
+static const bytestring X86BranchScrambleStub = {
+    0xb9, 0x00, 0x00, 0x00, 0x00,       // movl $iterations, %ecx
+    0x0f, 0x31,                         // rdtsc
+    0x69, 0xc0, 0x6d, 0x4e, 0xc6, 0x41, // 1: imull $0x41c64e6d, %eax, %eax
+    0x05, 0x39, 0x30, 0x00, 0x00,       // addl $12345, %eax
+    0xa9, 0x00, 0x00, 0x01, 0x00,       // testl $0x10000, %eax
+    0x74, 0x01,                         // jz 2f
+    0x90,                               // nop
+    0xa9, 0x00, 0x00, 0x04, 0x00,       // 2: testl $0x40000, %eax
+    0x75, 0x01,                         // jnz 3f
+    0x90,                               // nop
+    0xa9, 0x00, 0x00, 0x10, 0x00,       // 3: testl $0x100000, %eax
+    0x74, 0x01,                         // jz 4f
+    0x90,                               // nop
+    0xff, 0xc9,                         // 4: decl %ecx
+    0x75, 0xd9,                         // jnz 1b
+};
+
+/*
+ * Calls to a function between a start barrier and two reads of the timestamp
+ * counter. The state of the loop is kept on the stack, since the function
+ * may not preserve any registers the way the calling convention says it
+ * should.
+ */
+#ifdef __x86_64__
+static const bytestring X86TimedCallStub = {
+    0x48, 0x83, 0xec, 0x28,             // subq $40, %rsp
+    0x48, 0x89, 0x3c, 0x24,             // movq %rdi, (%rsp)
+    0x48, 0x89, 0x74, 0x24, 0x08,       // movq %rsi, 8(%rsp)
+    0x48, 0x89, 0x4c, 0x24, 0x10,       // movq %rcx, 16(%rsp)
+    0xf0, 0xff, 0x02,                   // lock incl (%rdx)
+    0xf3, 0x90,                         // 1: pause
+    0x44, 0x39, 0x02,                   // cmpl %r8d, (%rdx)
+    0x72, 0xf9,                         // jb 1b
+    0x0f, 0x31,                         // rdtsc
+    0x48, 0xc1, 0xe2, 0x20,             // shlq $32, %rdx
+    0x48, 0x09, 0xc2,                   // orq %rax, %rdx
+    0x48, 0x89, 0x54, 0x24, 0x18,       // movq %rdx, 24(%rsp)
+    0xff, 0x14, 0x24,                   // 2: call *(%rsp)
+    0x48, 0xff, 0x4c, 0x24, 0x08,       // decq 8(%rsp)
+    0x75, 0xf6,                         // jnz 2b
+    0x0f, 0x31,                         // rdtsc
+    0x48, 0xc1, 0xe2, 0x20,             // shlq $32, %rdx
+    0x48, 0x09, 0xc2,                   // orq %rax, %rdx
+    0x48, 0x2b, 0x54, 0x24, 0x18,       // subq 24(%rsp), %rdx
+    0x48, 0x8b, 0x4c, 0x24, 0x10,       // movq 16(%rsp), %rcx
+    0x48, 0x89, 0x11,                   // movq %rdx, (%rcx)
+    0x48, 0x83, 0xc4, 0x28,             // addq $40, %rsp
+    0xc3,                               // ret
+};
+#else
+static const bytestring X86TimedCallStub = {
+    0x83, 0xec, 0x0c,                   // subl $12, %esp
+    0x8b, 0x54, 0x24, 0x18,             // movl 24(%esp), %edx
+    0x8b, 0x4c, 0x24, 0x20,             // movl 32(%esp), %ecx
+    0xf0, 0xff, 0x02,                   // lock incl (%edx)
+    0xf3, 0x90,                         // 1: pause
+    0x39, 0x0a,                         // cmpl %ecx, (%edx)
+    0x72, 0xfa,                         // jb 1b
+    0x0f, 0x31,                         // rdtsc
+    0x89, 0x04, 0x24,                   // movl %eax, (%esp)
+    0x89, 0x54, 0x24, 0x04,             // movl %edx, 4(%esp)
+    0xff, 0x54, 0x24, 0x10,             // 2: call *16(%esp)
+    0xff, 0x4c, 0x24, 0x14,             // decl 20(%esp)
+    0x75, 0xf6,                         // jnz 2b
+    0x0f, 0x31,                         // rdtsc
+    0x2b, 0x04, 0x24,                   // subl (%esp), %eax
+    0x1b, 0x54, 0x24, 0x04,             // sbbl 4(%esp), %edx
+    0x8b, 0x4c, 0x24, 0x1c,             // movl 28(%esp), %ecx
+    0x89, 0x01,                         // movl %eax, (%ecx)
+    0x89, 0x51, 0x04,                   // movl %edx, 4(%ecx)
+    0x83, 0xc4, 0x0c,                   // addl $12, %esp
+    0xc3,                               // ret
+};
+#endif
+
+X86Tracee::X86Tracee(pid_t pid, const TraceeMemory &memory)
+    : Tracee{X86Registers, new UserRegisters, pid, memory} {}
 
 const bytestring &X86Tracee::getTrapInstruction()
 {
@@ -44,19 +145,25 @@ int X86Tracee::setProgramCounter(void *pc)
 {
     struct user_regs_struct regs;
 
-    if (ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
         perror("ptrace");
         fprintf(stderr, "could not get program counter\n");
         return 1;
     }
 
+    // If the tracee was stopped in the middle of a system call (e.g., a
+    // process which we attached to), the kernel would restart the system
+    // call instead of running the code at the new program counter unless we
+    // say that it isn't in one
 #ifdef __x86_64__
     regs.rip = (unsigned long long) pc;
+    regs.orig_rax = -1;
 #else
     regs.eip = (long) pc;
+    regs.orig_eax = -1;
 #endif
 
-    if (ptrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
         perror("ptrace");
         fprintf(stderr, "could not set program counter\n");
         return 1;
@@ -73,15 +180,12 @@ inline void copyRegister(T *dest, void *src)
 
 int X86Tracee::updateRegisters()
 {
-#ifdef __x86_64
-#define user_fpxregs_struct user_fpregs_struct
-#define PTRACE_GETFPXREGS PTRACE_GETFPREGS
-#endif
+    PhaseTimer timer{StatsPhase::REGISTERS};
     struct user_regs_struct regs;
     struct user_fpxregs_struct fpxregs;
 
-    if (ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1 ||
-        ptrace(PTRACE_GETFPXREGS, pid, nullptr, &fpxregs) == -1) {
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1 ||
+        countedPtrace(PTRACE_GETFPXREGS, pid, nullptr, &fpxregs) == -1) {
         perror("ptrace");
         fprintf(stderr, "could not get registers\n");
         return 1;
@@ -173,6 +277,428 @@ int X86Tracee::updateRegisters()
     return 0;
 }
 
+void *X86Tracee::getFetchedProgramCounter()
+{
+#ifdef __x86_64__
+    return reinterpret_cast<void *>(registers->rip);
+#else
+    return reinterpret_cast<void *>(registers->eip);
+#endif
+}
+
+/** Formats of the extended state in a saved register context. */
+enum ExtendedStateKind {
+    /** XSAVE area from PTRACE_GETREGSET with NT_X86_XSTATE. */
+    XSTATE = 1,
+
+    /** FXSAVE area from PTRACE_GETFPXREGS. */
+    FXSAVE = 2,
+};
+
+/** Big enough for the XSAVE area of any current processor. */
+static const size_t XSTATE_MAX_SIZE = 16384;
+
+/* See Tracee.h. */
+int X86Tracee::readSyscallEntry(SyscallRecord &recordOut)
+{
+    struct user_regs_struct regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get system call\n");
+        return 1;
+    }
+
+#ifdef __x86_64__
+    recordOut.number = regs.orig_rax;
+    recordOut.args[0] = regs.rdi;
+    recordOut.args[1] = regs.rsi;
+    recordOut.args[2] = regs.rdx;
+    recordOut.args[3] = regs.r10;
+    recordOut.args[4] = regs.r8;
+    recordOut.args[5] = regs.r9;
+#else
+    recordOut.number = regs.orig_eax;
+    recordOut.args[0] = regs.ebx;
+    recordOut.args[1] = regs.ecx;
+    recordOut.args[2] = regs.edx;
+    recordOut.args[3] = regs.esi;
+    recordOut.args[4] = regs.edi;
+    recordOut.args[5] = regs.ebp;
+#endif
+
+    return 0;
+}
+
+int X86Tracee::readSyscallExit(SyscallRecord &recordOut)
+{
+    struct user_regs_struct regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get system call return value\n");
+        return 1;
+    }
+
+#ifdef __x86_64__
+    recordOut.ret = regs.rax;
+#else
+    recordOut.ret = regs.eax;
+#endif
+
+    return 0;
+}
+
+const bytestring &X86Tracee::getSyscallInstruction()
+{
+    return X86SyscallInstruction;
+}
+
+const bytestring &X86Tracee::getTimedCallStub()
+{
+    return X86TimedCallStub;
+}
+
+int X86Tracee::saveGeneralRegisters(bytestring &regsOut)
+{
+    struct user_regs_struct regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get registers\n");
+        return 1;
+    }
+
+    regsOut.assign(reinterpret_cast<unsigned char *>(&regs), sizeof(regs));
+    return 0;
+}
+
+int X86Tracee::restoreGeneralRegisters(const bytestring &regs)
+{
+    if (regs.size() != sizeof(struct user_regs_struct)) {
+        fprintf(stderr, "saved registers are the wrong size\n");
+        return 1;
+    }
+
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr,
+                      const_cast<unsigned char *>(regs.data())) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int X86Tracee::setSyscallRegisters(const SyscallRecord &call)
+{
+    struct user_regs_struct regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get registers\n");
+        return 1;
+    }
+
+#ifdef __x86_64__
+    regs.rax = call.number;
+    regs.rdi = call.args[0];
+    regs.rsi = call.args[1];
+    regs.rdx = call.args[2];
+    regs.r10 = call.args[3];
+    regs.r8 = call.args[4];
+    regs.r9 = call.args[5];
+#else
+    regs.eax = call.number;
+    regs.ebx = call.args[0];
+    regs.ecx = call.args[1];
+    regs.edx = call.args[2];
+    regs.esi = call.args[3];
+    regs.edi = call.args[4];
+    regs.ebp = call.args[5];
+#endif
+
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int X86Tracee::setCallRegisters(const FunctionCall &call, void *stackTop,
+                                void *returnAddress)
+{
+    struct user_regs_struct regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get registers\n");
+        return 1;
+    }
+
+#ifdef __x86_64__
+    // The first six arguments go in registers and the rest on the stack
+    static const size_t numRegisterArgs = 6;
+    unsigned long long *argRegs[numRegisterArgs] = {
+        &regs.rdi, &regs.rsi, &regs.rdx, &regs.rcx, &regs.r8, &regs.r9,
+    };
+    size_t i;
+    for (i = 0; i < call.args.size() && i < numRegisterArgs; i++)
+        *argRegs[i] = call.args[i];
+    std::vector<unsigned long> stack{call.args.begin() + i, call.args.end()};
+#else
+    if (!call.floatArgs.empty()) {
+        fprintf(stderr,
+                "floating point arguments are not supported on 32-bit x86\n");
+        return 1;
+    }
+    std::vector<unsigned long> stack{call.args};
+#endif
+
+    // The stack is 16-byte aligned at the call, which then pushes the return
+    // address
+    uintptr_t sp = reinterpret_cast<uintptr_t>(stackTop) -
+                   stack.size() * sizeof(unsigned long);
+    sp &= ~static_cast<uintptr_t>(15);
+    stack.insert(stack.begin(), reinterpret_cast<uintptr_t>(returnAddress));
+    sp -= sizeof(unsigned long);
+    if (writeMemory(reinterpret_cast<void *>(sp), stack.data(),
+                    stack.size() * sizeof(unsigned long)))
+        return 1;
+
+#ifdef __x86_64__
+    // Floating point arguments go in the low half of xmm0-xmm7
+    static const size_t numFloatArgs = 8;
+    if (call.floatArgs.size() > numFloatArgs) {
+        fprintf(stderr, "too many floating point arguments\n");
+        return 1;
+    }
+    if (!call.floatArgs.empty()) {
+        struct user_fpxregs_struct fpxregs;
+        if (countedPtrace(PTRACE_GETFPXREGS, pid, nullptr, &fpxregs) == -1) {
+            perror("ptrace");
+            fprintf(stderr, "could not get floating point registers\n");
+            return 1;
+        }
+        for (size_t j = 0; j < call.floatArgs.size(); j++) {
+            unsigned char *xmm =
+                reinterpret_cast<unsigned char *>(&fpxregs.xmm_space[4 * j]);
+            memset(xmm, 0, 16);
+            memcpy(xmm, &call.floatArgs[j], sizeof(double));
+        }
+        if (countedPtrace(PTRACE_SETFPXREGS, pid, nullptr, &fpxregs) == -1) {
+            perror("ptrace");
+            fprintf(stderr, "could not set floating point registers\n");
+            return 1;
+        }
+    }
+#endif
+
+    // The direction flag must be clear on function entry
+#ifdef __x86_64__
+    regs.rsp = sp;
+    regs.rax = call.floatArgs.size(); // Vector registers used, for varargs
+    regs.eflags &= ~0x400;
+#else
+    regs.esp = sp;
+    regs.eflags &= ~0x400;
+#endif
+
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int X86Tracee::readCallReturn(FunctionCall &callOut)
+{
+    struct user_regs_struct regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get function return value\n");
+        return 1;
+    }
+
+#ifdef __x86_64__
+    callOut.ret = regs.rax;
+#else
+    callOut.ret = regs.eax;
+#endif
+
+    // Floating point values are returned in xmm0 on x86-64 and in st(0) on
+    // 32-bit x86
+    struct user_fpxregs_struct fpxregs;
+    if (countedPtrace(PTRACE_GETFPXREGS, pid, nullptr, &fpxregs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get floating point return value\n");
+        return 1;
+    }
+#ifdef __x86_64__
+    memcpy(&callOut.floatRet, &fpxregs.xmm_space[0], sizeof(double));
+#else
+    long double st0 = 0;
+    memcpy(&st0, &fpxregs.st_space[0], 10);
+    callOut.floatRet = st0;
+#endif
+    callOut.hasFloatRet = true;
+
+    return 0;
+}
+
+int X86Tracee::skipRedZone()
+{
+    struct user_regs_struct regs;
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get stack pointer\n");
+        return 1;
+    }
+
+    // Leaf functions on x86-64 may keep data in the 128 bytes below the stack
+    // pointer without moving it; 32-bit x86 has no red zone but the stack
+    // should still be 16-byte aligned
+#ifdef __x86_64__
+    regs.rsp = (regs.rsp - 128) & ~15ULL;
+#else
+    regs.esp &= ~15L;
+#endif
+
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set stack pointer\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int X86Tracee::scrambleBranchPredictors(unsigned long iterations)
+{
+    if (iterations == 0 || iterations > UINT32_MAX) {
+        fprintf(stderr, "invalid number of iterations\n");
+        return 1;
+    }
+
+    bytestring stub = X86BranchScrambleStub;
+    uint32_t count = iterations;
+    memcpy(&stub[1], &count, sizeof(count));
+    return runStub(stub);
+}
+
+int X86Tracee::saveRegisterContext(bytestring &contextOut)
+{
+    struct user_regs_struct regs;
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get registers\n");
+        return 1;
+    }
+
+    ByteWriter writer;
+    writer.putBytes(&regs, sizeof(regs));
+
+    // Prefer the XSAVE area so that we get the AVX state, too, but fall back
+    // to FXSAVE on kernels or processors which don't support it
+    bytestring xstate(XSTATE_MAX_SIZE, 0);
+    struct iovec iov = {&xstate[0], xstate.size()};
+    if (countedPtrace(PTRACE_GETREGSET, pid, (void *) NT_X86_XSTATE, &iov) != -1) {
+        xstate.resize(iov.iov_len);
+        writer.putU8(XSTATE);
+        writer.putString(xstate);
+    } else {
+        struct user_fpxregs_struct fpxregs;
+        if (countedPtrace(PTRACE_GETFPXREGS, pid, nullptr, &fpxregs) == -1) {
+            perror("ptrace");
+            fprintf(stderr, "could not get floating point registers\n");
+            return 1;
+        }
+        writer.putU8(FXSAVE);
+        writer.putU32(sizeof(fpxregs));
+        writer.putBytes(&fpxregs, sizeof(fpxregs));
+    }
+
+    contextOut = std::move(writer.buffer);
+    return 0;
+}
+
+/* See Tracee.h. */
+int X86Tracee::restoreRegisterContext(const bytestring &context)
+{
+    struct user_regs_struct saved, regs;
+    ByteReader reader{context.data(), context.size()};
+    reader.getBytes(&saved, sizeof(saved));
+    uint8_t kind = reader.getU8();
+    bytestring extended = reader.getString<bytestring>();
+    if (reader.hasFailed() || !reader.atEnd() ||
+        extended.size() < sizeof(struct user_fpxregs_struct)) {
+        fprintf(stderr, "invalid register context\n");
+        return 1;
+    }
+
+    if (countedPtrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get registers\n");
+        return 1;
+    }
+
+#ifdef __x86_64__
+    regs.rax = saved.rax;
+    regs.rcx = saved.rcx;
+    regs.rdx = saved.rdx;
+    regs.rbx = saved.rbx;
+    regs.rbp = saved.rbp;
+    regs.rsi = saved.rsi;
+    regs.rdi = saved.rdi;
+    regs.r8 = saved.r8;
+    regs.r9 = saved.r9;
+    regs.r10 = saved.r10;
+    regs.r11 = saved.r11;
+    regs.r12 = saved.r12;
+    regs.r13 = saved.r13;
+    regs.r14 = saved.r14;
+    regs.r15 = saved.r15;
+#else
+    regs.eax = saved.eax;
+    regs.ecx = saved.ecx;
+    regs.edx = saved.edx;
+    regs.ebx = saved.ebx;
+    regs.ebp = saved.ebp;
+    regs.esi = saved.esi;
+    regs.edi = saved.edi;
+#endif
+    regs.eflags = saved.eflags;
+
+    if (countedPtrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set registers\n");
+        return 1;
+    }
+
+    // The XSAVE layout can differ between processors; if the kernel won't
+    // take it, the legacy FXSAVE part at the start is still good
+    if (kind == XSTATE) {
+        struct iovec iov = {&extended[0], extended.size()};
+        if (countedPtrace(PTRACE_SETREGSET, pid, (void *) NT_X86_XSTATE, &iov) != -1)
+            return 0;
+        fprintf(stderr, "warning: could not restore extended state; restoring SSE state only\n");
+    }
+
+    if (countedPtrace(PTRACE_SETFPXREGS, pid, nullptr, &extended[0]) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set floating point registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
 /* See X86Tracee.h. */
 void X86Tracee::reconstructTagWord()
 {
@@ -195,10 +721,18 @@ void X86Tracee::reconstructTagWord()
 }
 
 /* See Tracee.h. */
-Tracee *Tracee::createPlatformTracee(pid_t pid, void *sharedMemory,
-                                     size_t sharedSize)
+Tracee *Tracee::createPlatformTracee(pid_t pid, const TraceeMemory &memory)
+{
+    return new X86Tracee{pid, memory};
+}
+
+Tracee *Tracee::createPlatformMockTracee(const TraceeMemory &memory)
 {
-    return new X86Tracee{pid, sharedMemory, sharedSize};
+#ifdef __x86_64__
+    return new MockTracee<X86Tracee>{memory, "rip"};
+#else
+    return new MockTracee<X86Tracee>{memory, "eip"};
+#endif
 }
 
 #include "Tracee.inc"
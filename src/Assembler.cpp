@@ -19,7 +19,15 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
 #include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/MC/MCAsmBackend.h>
 #include <llvm/MC/MCAsmInfo.h>
 #include <llvm/MC/MCContext.h>
@@ -28,12 +36,12 @@
 #include <llvm/MC/MCRegisterInfo.h>
 #include <llvm/MC/MCStreamer.h>
 #include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/SubtargetFeature.h>
 #if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 9)
 #include <llvm/MC/MCParser/MCTargetAsmParser.h>
 #else
 #include <llvm/MC/MCTargetAsmParser.h>
 #endif
-#include <llvm/Object/ObjectFile.h>
 #include <llvm/Support/Host.h>
 #include <llvm/Support/ManagedStatic.h>
 #include <llvm/Support/MemoryBuffer.h>
@@ -48,24 +56,19 @@ using namespace llvm;
 #endif
 
 #if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 5)
-#include <system_error>
 #include <memory>
-using std::error_code;
-using std::error_category;
-using std::system_category;
 #define OwningPtr std::unique_ptr
 #endif
 
 #include "Assembler.h"
+#include "AssemblyCache.h"
+#include "ElfReader.h"
 #include "Inputter.h"
+#include "Stats.h"
 
 /** The reserved size of the output SmallString. */
 static const int OUTPUT_BUFFER_SIZE = 4096;
 
-/** Return the text section (i.e., machine code) for an object file. */
-static error_code getTextSection(object::ObjectFile &objFile,
-                                 StringRef &result);
-
 /**
  * Diagnostic callback. We need this because we read input line by line so we
  * keep track of diagnostic information (filename and line number) on our own.
@@ -73,6 +76,9 @@ static error_code getTextSection(object::ObjectFile &objFile,
  */
 static void asmaseDiagHandler(const SMDiagnostic &diag, void *arg);
 
+/** Diagnostic callback which throws diagnostics away. */
+static void ignoreDiagHandler(const SMDiagnostic &diag, void *arg) {}
+
 /** Context storing LLVM state that can be reused. */
 class AssemblerContext {
     static bool llvmIsInit;
@@ -80,13 +86,25 @@ class AssemblerContext {
 public:
     std::string tripleName;
     Triple triple;
-    std::string cpu;
+
+    /** The CPU and features to assemble for. */
+    std::string cpu, features;
+
+    /** The CPU and features of the host. */
+    std::string hostCpu, hostFeatures;
+
+    /**
+     * Prefix of cache keys, which identifies everything besides the input
+     * that affects the assembled code.
+     */
+    std::string cacheKeyPrefix;
+
     const Target *target;
     OwningPtr<MCRegisterInfo> registerInfo;
     OwningPtr<MCAsmInfo> asmInfo;
     OwningPtr<MCInstrInfo> instrInfo;
 
-    AssemblerContext()
+    AssemblerContext(const std::string &mcpu, const std::string &mattr)
         : tripleName{sys::getDefaultTargetTriple()},
           triple{tripleName}
     {
@@ -112,36 +130,110 @@ public:
 
         instrInfo.reset(target->createMCInstrInfo());
         assert(instrInfo && "Unable to create target instruction info!");
+
+        hostCpu = sys::getHostCPUName();
+        StringMap<bool> hostFeatureMap;
+        if (sys::getHostCPUFeatures(hostFeatureMap)) {
+            SubtargetFeatures featureList;
+            for (auto &feature : hostFeatureMap)
+                featureList.AddFeature(feature.getKey(), feature.getValue());
+            hostFeatures = featureList.getString();
+        }
+
+        // An explicit CPU replaces the host entirely, but explicit features
+        // are applied on top of whatever CPU we're using
+        cpu = mcpu.empty() ? hostCpu : mcpu;
+        features = mcpu.empty() ? hostFeatures : "";
+        if (!mattr.empty())
+            features = features.empty() ? mattr : features + "," + mattr;
+
+        // Whether the host supports the code is part of the result, so the
+        // host goes into the key, too
+        std::string llvmVersion = std::to_string(LLVM_VERSION_MAJOR) + "." +
+                                  std::to_string(LLVM_VERSION_MINOR);
+        for (const std::string &part : {std::string{"asmase " ASMASE_VERSION},
+                                        llvmVersion, tripleName, cpu, features,
+                                        hostCpu, hostFeatures}) {
+            cacheKeyPrefix += part;
+            cacheKeyPrefix += '\0';
+        }
+    }
+
+    /** Return whether we are assembling for something other than the host. */
+    bool isCrossCpu() const
+    {
+        return cpu != hostCpu || features != hostFeatures;
     }
 };
 
 bool AssemblerContext::llvmIsInit = false;
 
 /* See Assembler.h. */
-std::shared_ptr<AssemblerContext> Assembler::createAssemblerContext()
+std::shared_ptr<AssemblerContext>
+Assembler::createAssemblerContext(const std::string &mcpu,
+                                  const std::string &mattr)
 {
-    return std::shared_ptr<AssemblerContext>{new AssemblerContext};
+    return std::shared_ptr<AssemblerContext>{
+        new AssemblerContext{mcpu, mattr}};
 }
 
 /* See Assembler.h. */
 int Assembler::assembleInstruction(const std::string &instruction,
-                                   bytestring &machineCodeOut,
+                                   AssembledCode &codeOut,
                                    const Inputter &inputter)
+{
+    PhaseTimer timer{StatsPhase::ASSEMBLE};
+
+    if (cache) {
+        cacheKey.assign(context->cacheKeyPrefix).append(instruction);
+        if (cache->lookup(cacheKey, codeOut) == 0)
+            return 0;
+    }
+
+    if (assemble(instruction, context->cpu, context->features, codeOut,
+                 &inputter))
+        return 1;
+
+    // If we're targeting a different CPU, the host has to be able to
+    // assemble the instruction, too, or else running it could crash the
+    // tracee with SIGILL
+    if (context->isCrossCpu()) {
+        codeOut.hostSupported = !assemble(instruction, context->hostCpu,
+                                          context->hostFeatures, hostCode,
+                                          nullptr);
+    } else
+        codeOut.hostSupported = true;
+
+    // Failures aren't cached so that their diagnostics are always shown
+    if (cache)
+        cache->insert(cacheKey, codeOut);
+
+    return 0;
+}
+
+/* See Assembler.h. */
+int Assembler::assemble(const std::string &instruction,
+                        const std::string &mcpu, const std::string &features,
+                        AssembledCode &codeOut, const Inputter *inputter)
 {
     const Triple &triple = context->triple;
     const std::string &tripleName = context->tripleName;
-    const std::string &mcpu = context->cpu;
     const Target *target = context->target;
     const MCRegisterInfo *registerInfo = context->registerInfo.get();
     const MCAsmInfo *asmInfo = context->asmInfo.get();
     const MCInstrInfo *instrInfo = context->instrInfo.get();
 
-    // Set up the input
+    // Set up the input. LLVM gets a reference to our buffer rather than a copy
+    // of it.
+    source.assign(isDataLine(instruction) ? ".data\n" : "").append(instruction);
     SourceMgr srcMgr;
-    srcMgr.AddNewSourceBuffer(
-        MemoryBuffer::getMemBufferCopy(instruction, "assembly"), SMLoc{});
-    srcMgr.setDiagHandler(
-        asmaseDiagHandler, const_cast<void *>(static_cast<const void *>(&inputter)));
+    srcMgr.AddNewSourceBuffer(MemoryBuffer::getMemBuffer(source, "assembly"),
+                              SMLoc{});
+    if (inputter)
+        srcMgr.setDiagHandler(
+            asmaseDiagHandler, const_cast<void *>(static_cast<const void *>(inputter)));
+    else
+        srcMgr.setDiagHandler(ignoreDiagHandler, nullptr);
 
     // Set up the output
     SmallString<OUTPUT_BUFFER_SIZE> outputString;
@@ -167,7 +259,6 @@ int Assembler::assembleInstruction(const std::string &instruction,
 
     // Set up the streamer
     OwningPtr<MCSubtargetInfo> subtargetInfo;
-    std::string features;
     subtargetInfo.reset(
         target->createMCSubtargetInfo(tripleName, mcpu, features));
     assert(subtargetInfo && "Unable to create subtarget info!");
@@ -229,74 +320,315 @@ int Assembler::assembleInstruction(const std::string &instruction,
 #if LLVM_VERSION_MAJOR < 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR < 8)
     outputStream.flush();
 #endif
-#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 6)
-    std::unique_ptr<MemoryBuffer> outputBuffer{
-        MemoryBuffer::getMemBuffer(outputString, "machine code", false)};
-    auto objFileErr = object::ObjectFile::createELFObjectFile(outputBuffer->getMemBufferRef());
-    if (error_code err = objFileErr.getError()) {
-        fprintf(stderr, "%s\n", err.message().c_str());
+
+    return extractCode(outputString.data(), outputString.size(), codeOut);
+}
+
+/** Get the addend of a relocation with an explicit addend. */
+static int64_t getAddend(const ElfW(Rela) &reloc, const unsigned char *field,
+                         const Fixup &fixup)
+{
+    return reloc.r_addend;
+}
+
+/** Get the addend of a relocation stored in the field being relocated. */
+static int64_t getAddend(const ElfW(Rel) &reloc, const unsigned char *field,
+                         const Fixup &fixup)
+{
+    switch (fixup.size) {
+        case 1: {
+            int8_t addend;
+            memcpy(&addend, field, sizeof(addend));
+            return addend;
+        }
+        case 2: {
+            int16_t addend;
+            memcpy(&addend, field, sizeof(addend));
+            return addend;
+        }
+        case 4: {
+            int32_t addend;
+            memcpy(&addend, field, sizeof(addend));
+            return addend;
+        }
+        default: {
+            int64_t addend;
+            memcpy(&addend, field, sizeof(addend));
+            return addend;
+        }
+    }
+}
+
+/** Where the contents of a section of the object file ended up. */
+class SectionPlacement {
+public:
+    /** Whether the section was loaded at all. */
+    bool loaded;
+
+    /** The segment the section was placed in. */
+    Segment segment;
+
+    /** Offset of the section in the segment. */
+    size_t offset;
+
+    SectionPlacement() : loaded{false}, segment{Segment::CODE}, offset{0} {}
+};
+
+/**
+ * Convert the relocations in the given section (either SHT_REL or SHT_RELA)
+ * into fixups.
+ * @return Zero on success, nonzero on failure.
+ */
+template <typename Reloc>
+static int extractFixups(const ElfReader &elf, const ElfW(Shdr) &relocSection,
+                         const std::vector<SectionPlacement> &placements,
+                         AssembledCode &codeOut,
+                         int (*decodeRelocation)(uint32_t, Fixup &))
+{
+    if (relocSection.sh_link >= elf.numSections())
         return 1;
+    const ElfW(Shdr) &symtab = elf.getSection(relocSection.sh_link);
+    size_t numSymbols = elf.numEntries<ElfW(Sym)>(symtab);
+    const SectionPlacement &placement = placements[relocSection.sh_info];
+    bytestring &contents = codeOut.getSegment(placement.segment);
+
+    for (size_t i = 0; i < elf.numEntries<Reloc>(relocSection); ++i) {
+        const Reloc &reloc = elf.getEntry<Reloc>(relocSection, i);
+        uint32_t type = ElfW_R_TYPE(reloc.r_info);
+        size_t symIndex = ElfW_R_SYM(reloc.r_info);
+
+        Fixup fixup;
+        fixup.segment = placement.segment;
+        fixup.offset = placement.offset + reloc.r_offset;
+        if (decodeRelocation(type, fixup)) {
+            fprintf(stderr, "unsupported relocation type %" PRIu32 "\n", type);
+            return 1;
+        }
+
+        if (fixup.offset > contents.size() ||
+            fixup.size > contents.size() - fixup.offset ||
+            symIndex >= numSymbols) {
+            fprintf(stderr, "invalid relocation\n");
+            return 1;
+        }
+
+        fixup.addend = getAddend(reloc, &contents[fixup.offset], fixup);
+
+        const ElfW(Sym) &sym = elf.getEntry<ElfW(Sym)>(symtab, symIndex);
+        if (sym.st_shndx == SHN_UNDEF) {
+            fixup.symbol = elf.getString(symtab.sh_link, sym.st_name);
+            if (fixup.symbol.empty()) {
+                fprintf(stderr, "invalid relocation\n");
+                return 1;
+            }
+        } else if (sym.st_shndx < placements.size() &&
+                   placements[sym.st_shndx].loaded) {
+            // Local references are relative to the start of the segment
+            const SectionPlacement &target = placements[sym.st_shndx];
+            fixup.target = target.segment;
+            fixup.addend += target.offset + sym.st_value;
+        } else {
+            fprintf(stderr, "reference to unsupported section\n");
+            return 1;
+        }
+
+        codeOut.fixups.push_back(fixup);
     }
-    std::unique_ptr<object::ObjectFile> objFile{objFileErr->release()};
-#elif LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 5
-    std::unique_ptr<MemoryBuffer> outputBuffer{
-        MemoryBuffer::getMemBuffer(outputString, "machine code", false)};
-    auto objFileErr = object::ObjectFile::createELFObjectFile(outputBuffer);
-    if (error_code err = objFileErr.getError()) {
-        fprintf(stderr, "%s\n", err.message().c_str());
+
+    return 0;
+}
+
+/* See Assembler.h. */
+int Assembler::extractCode(const void *objectFile, size_t size,
+                           AssembledCode &codeOut)
+{
+    ElfReader elf{objectFile, size};
+    if (!elf.isValid()) {
+        fprintf(stderr, "invalid object file\n");
         return 1;
     }
-    auto objFile = *objFileErr;
-#else
-    MemoryBuffer *outputBuffer =
-        MemoryBuffer::getMemBuffer(outputString, "machine code", false);
-    OwningPtr<object::ObjectFile>
-        objFile{object::ObjectFile::createELFObjectFile(outputBuffer)};
-#endif
 
-    StringRef textSection;
-    error_code err;
-    err = getTextSection(*objFile, textSection);
-    if (err) {
-        fprintf(stderr, "%s\n", err.message().c_str());
+    codeOut.machineCode.clear();
+    codeOut.data.clear();
+    codeOut.dataAlignment = 1;
+    codeOut.labels.clear();
+    codeOut.fixups.clear();
+
+    // The first text section is the machine code, and every other allocated
+    // section is laid out one after another as data
+    std::vector<SectionPlacement> placements(elf.numSections());
+    bool foundText = false;
+    for (size_t i = 1; i < elf.numSections(); ++i) {
+        const ElfW(Shdr) &section = elf.getSection(i);
+        SectionPlacement &placement = placements[i];
+
+        if (!(section.sh_flags & SHF_ALLOC))
+            continue;
+
+        const unsigned char *contents = elf.getContents(section);
+        if (!contents && section.sh_type != SHT_NOBITS) {
+            fprintf(stderr, "invalid object file\n");
+            return 1;
+        }
+
+        if (section.sh_flags & SHF_EXECINSTR) {
+            if (foundText)
+                continue;
+            foundText = true;
+            placement.segment = Segment::CODE;
+            placement.offset = 0;
+            codeOut.machineCode.assign(contents, section.sh_size);
+        } else {
+            size_t alignment = section.sh_addralign ? section.sh_addralign : 1;
+            size_t offset = (codeOut.data.size() + alignment - 1) / alignment *
+                            alignment;
+            placement.segment = Segment::DATA;
+            placement.offset = offset;
+            codeOut.data.resize(offset, 0);
+            if (contents)
+                codeOut.data.append(contents, section.sh_size);
+            else
+                codeOut.data.append(section.sh_size, 0);
+            codeOut.dataAlignment = std::max(codeOut.dataAlignment, alignment);
+        }
+        placement.loaded = true;
+    }
+
+    if (!foundText) {
+        fprintf(stderr, "%s\n", strerror(ENOEXEC));
         return 1;
-    } else {
-        auto *buffer = reinterpret_cast<const unsigned char *>(textSection.data());
-        machineCodeOut = bytestring{buffer, textSection.size()};
-        return 0;
     }
+
+    for (size_t i = 1; i < elf.numSections(); ++i) {
+        const ElfW(Shdr) &section = elf.getSection(i);
+
+        if (section.sh_type == SHT_SYMTAB) {
+            for (size_t j = 1; j < elf.numEntries<ElfW(Sym)>(section); ++j) {
+                const ElfW(Sym) &sym = elf.getEntry<ElfW(Sym)>(section, j);
+                int type = ElfW_ST_TYPE(sym.st_info);
+                if (sym.st_shndx >= placements.size() ||
+                    !placements[sym.st_shndx].loaded ||
+                    (type != STT_NOTYPE && type != STT_FUNC &&
+                     type != STT_OBJECT))
+                    continue;
+
+                // Skip assembler-local labels; they can't be referred to by
+                // later lines anyways
+                std::string name = elf.getString(section.sh_link, sym.st_name);
+                if (name.empty() || name.compare(0, 2, ".L") == 0)
+                    continue;
+
+                const SectionPlacement &placement = placements[sym.st_shndx];
+                codeOut.labels.emplace_back(name, placement.segment,
+                                            placement.offset + sym.st_value);
+            }
+        } else if ((section.sh_type == SHT_REL ||
+                    section.sh_type == SHT_RELA) &&
+                   section.sh_info < placements.size() &&
+                   placements[section.sh_info].loaded) {
+            int error;
+            if (section.sh_type == SHT_REL)
+                error = extractFixups<ElfW(Rel)>(elf, section, placements,
+                                                 codeOut,
+                                                 decodePlatformRelocation);
+            else
+                error = extractFixups<ElfW(Rela)>(elf, section, placements,
+                                                  codeOut,
+                                                  decodePlatformRelocation);
+            if (error)
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+/** What a single statement of assembly consists of. */
+enum class StatementKind {
+    /** Nothing but whitespace and labels. */
+    EMPTY,
+
+    /** A directive, possibly preceded by labels. */
+    DIRECTIVE,
+
+    /** Anything else, e.g., an instruction. */
+    OTHER,
+};
+
+/** Classify a statement for Assembler::isDataLine(). */
+static StatementKind classifyStatement(StringRef statement)
+{
+    // Skip leading whitespace and labels
+    size_t start = 0;
+    for (;;) {
+        while (start < statement.size() && isspace(statement[start]))
+            ++start;
+        size_t end = start;
+        while (end < statement.size() &&
+               (isalnum(statement[end]) || statement[end] == '_' ||
+                statement[end] == '.' || statement[end] == '$'))
+            ++end;
+        if (end > start && end < statement.size() && statement[end] == ':')
+            start = end + 1;
+        else
+            break;
+    }
+
+    if (start == statement.size())
+        return StatementKind::EMPTY;
+    return statement[start] == '.' ? StatementKind::DIRECTIVE :
+                                     StatementKind::OTHER;
 }
 
-/* See above. */
-static error_code getTextSection(object::ObjectFile &objFile,
-                                 StringRef &result) {
-    error_code err;
-#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 5)
-    object::section_iterator it = objFile.section_begin();
-    while (it != objFile.section_end()) {
-#else
-    object::section_iterator it = objFile.begin_sections();
-    while (it != objFile.end_sections()) {
-#endif
-        bool isText;
-#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 6)
-        isText = it->isText();
-#else
-        err = it->isText(isText);
-        if (err)
-            return err;
-#endif
-        if (isText)
-            return it->getContents(result);
-#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 5)
-        ++it;
-#else
-        it.increment(err);
-#endif
-        if (err)
-            return err;
+/* See Assembler.h. */
+bool Assembler::isDataLine(const std::string &instruction) const
+{
+    StringRef line{instruction};
+    StringRef commentString = context->asmInfo->getCommentString();
+    StringRef separatorString = context->asmInfo->getSeparatorString();
+
+    // Split the line into statements in place, being careful about comments
+    // and strings. This runs for every line, so it doesn't allocate.
+    bool sawDirective = false;
+    bool inString = false, escape = false;
+    size_t statementStart = 0;
+    for (size_t i = 0; i <= line.size(); ++i) {
+        bool endOfLine = i == line.size();
+        if (!endOfLine) {
+            char c = line[i];
+            if (inString) {
+                if (escape)
+                    escape = false;
+                else if (c == '\\')
+                    escape = true;
+                else if (c == '"')
+                    inString = false;
+                continue;
+            } else if (c == '"') {
+                inString = true;
+                continue;
+            } else if (line.substr(i).startswith(commentString))
+                endOfLine = true;
+            else if (!line.substr(i).startswith(separatorString))
+                continue;
+        }
+
+        switch (classifyStatement(line.slice(statementStart, i))) {
+            case StatementKind::EMPTY:
+                break;
+            case StatementKind::DIRECTIVE:
+                sawDirective = true;
+                break;
+            case StatementKind::OTHER:
+                return false;
+        }
+
+        if (endOfLine)
+            break;
+        statementStart = i + 1;
     }
-    return error_code(ENOEXEC, system_category());
+
+    return sawDirective;
 }
 
 /* See above. */
@@ -0,0 +1,351 @@
+/*
+ * AssemblyCache implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Assembler.h"
+#include "AssemblyCache.h"
+#include "Serialization.h"
+
+/** Magic number at the start of a cache file. */
+static const char CACHE_MAGIC[8] = {'A', 'S', 'M', 'C', 'A', 'C', 'H', 'E'};
+
+/** Version of the cache file format. */
+static const uint32_t CACHE_VERSION = 1;
+
+/** Number of buckets in the hash table. */
+static const uint32_t NUM_BUCKETS = 1 << 16;
+
+/** Stop adding entries once this many buckets are in use. */
+static const uint64_t MAX_ENTRIES = NUM_BUCKETS / 4 * 3;
+
+/** Stop adding entries once the file reaches this size. */
+static const uint64_t MAX_FILE_SIZE = UINT64_C(256) << 20;
+
+/** Layout of the header at the start of a cache file. */
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numBuckets;
+
+    /** Offset at which the next entry will be written. */
+    uint64_t end;
+
+    /** Number of entries. */
+    uint64_t numEntries;
+};
+
+/** Layout of the fixed part of an entry; the key and value follow. */
+struct CacheEntry {
+    uint64_t hash;
+    uint32_t keySize;
+    uint32_t valueSize;
+};
+
+/** Offset of the hash table in the file. */
+static const uint64_t TABLE_OFFSET = sizeof(CacheHeader);
+
+/** Offset of the first entry in the file. */
+static const uint64_t ENTRIES_OFFSET =
+    TABLE_OFFSET + NUM_BUCKETS * sizeof(uint64_t);
+
+/** Holds a flock() on a file for as long as it is in scope. */
+class FileLock {
+    int fd;
+    bool locked;
+
+public:
+    FileLock(int fd, int operation)
+        : fd{fd}, locked{flock(fd, operation) == 0}
+    {
+        if (!locked)
+            perror("flock");
+    }
+
+    ~FileLock()
+    {
+        if (locked)
+            flock(fd, LOCK_UN);
+    }
+
+    bool isLocked() const { return locked; }
+};
+
+/** FNV-1a hash. */
+static uint64_t hashKey(const std::string &key)
+{
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+/** Write the whole buffer at the given offset. */
+static int writeAll(int fd, const void *buffer, size_t size, off_t offset)
+{
+    auto p = static_cast<const unsigned char *>(buffer);
+    while (size) {
+        ssize_t ret = pwrite(fd, p, size, offset);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        p += ret;
+        size -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+/* See AssemblyCache.h. */
+AssemblyCache::~AssemblyCache()
+{
+    if (map)
+        munmap(const_cast<unsigned char *>(map), mapSize);
+    close(fd);
+}
+
+/* See AssemblyCache.h. */
+int AssemblyCache::remap()
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    if (map && size == mapSize)
+        return 0;
+
+    if (map) {
+        munmap(const_cast<unsigned char *>(map), mapSize);
+        map = nullptr;
+        mapSize = 0;
+    }
+
+    if (size < ENTRIES_OFFSET) {
+        fprintf(stderr, "%s: cache file is truncated\n", filename.c_str());
+        return 1;
+    }
+
+    void *newMap = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (newMap == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    map = static_cast<const unsigned char *>(newMap);
+    mapSize = size;
+    return 0;
+}
+
+/* See AssemblyCache.h. */
+const unsigned char *AssemblyCache::getValue(uint64_t offset,
+                                             uint32_t &sizeOut) const
+{
+    CacheEntry entry;
+    if (offset < ENTRIES_OFFSET || offset > mapSize ||
+        mapSize - offset < sizeof(entry))
+        return nullptr;
+    memcpy(&entry, map + offset, sizeof(entry));
+
+    uint64_t valueOffset = offset + sizeof(entry) + entry.keySize;
+    if (valueOffset > mapSize || entry.valueSize > mapSize - valueOffset)
+        return nullptr;
+
+    sizeOut = entry.valueSize;
+    return map + valueOffset;
+}
+
+/* See AssemblyCache.h. */
+int64_t AssemblyCache::findBucket(uint64_t hash, const std::string &key,
+                                  uint64_t &offsetOut) const
+{
+    for (uint32_t i = 0; i < NUM_BUCKETS; ++i) {
+        uint32_t bucket = (hash + i) % NUM_BUCKETS;
+        uint64_t offset;
+        memcpy(&offset, map + TABLE_OFFSET + bucket * sizeof(offset),
+               sizeof(offset));
+
+        // Entries are never removed, so an empty bucket ends the probe
+        if (offset == 0) {
+            offsetOut = 0;
+            return bucket;
+        }
+
+        CacheEntry entry;
+        if (offset < ENTRIES_OFFSET || offset > mapSize ||
+            mapSize - offset < sizeof(entry))
+            continue;
+        memcpy(&entry, map + offset, sizeof(entry));
+        if (entry.hash != hash || entry.keySize != key.size() ||
+            mapSize - offset - sizeof(entry) < entry.keySize)
+            continue;
+
+        if (memcmp(map + offset + sizeof(entry), key.data(), key.size()) == 0) {
+            offsetOut = offset;
+            return bucket;
+        }
+    }
+
+    return -1;
+}
+
+/* See AssemblyCache.h. */
+int AssemblyCache::lookup(const std::string &key, AssembledCode &codeOut)
+{
+    FileLock lock{fd, LOCK_SH};
+    if (!lock.isLocked() || remap())
+        return 1;
+
+    uint64_t offset;
+    if (findBucket(hashKey(key), key, offset) == -1 || offset == 0)
+        return 1;
+
+    uint32_t size;
+    const unsigned char *value = getValue(offset, size);
+    if (!value)
+        return 1;
+
+    ByteReader reader{value, size};
+    return deserializeCode(reader, codeOut) || !reader.atEnd();
+}
+
+/* See AssemblyCache.h. */
+int AssemblyCache::insert(const std::string &key, const AssembledCode &code)
+{
+    FileLock lock{fd, LOCK_EX};
+    if (!lock.isLocked() || remap())
+        return 1;
+
+    CacheHeader header;
+    memcpy(&header, map, sizeof(header));
+
+    // Someone else might have beaten us to it
+    uint64_t hash = hashKey(key);
+    uint64_t offset;
+    int64_t bucket = findBucket(hash, key, offset);
+    if (bucket == -1 || offset != 0)
+        return 0;
+
+    ByteWriter value;
+    serializeCode(value, code);
+
+    CacheEntry entry;
+    entry.hash = hash;
+    entry.keySize = key.size();
+    entry.valueSize = value.buffer.size();
+    uint64_t entrySize = sizeof(entry) + key.size() + value.buffer.size();
+
+    if (header.numEntries >= MAX_ENTRIES || header.end < ENTRIES_OFFSET ||
+        header.end > MAX_FILE_SIZE || entrySize > MAX_FILE_SIZE - header.end)
+        return 0;
+
+    // Write the entry before publishing it in the table so that a crash
+    // can't leave the table pointing at garbage
+    ByteWriter writer;
+    writer.putBytes(&entry, sizeof(entry));
+    writer.putBytes(key.data(), key.size());
+    writer.putBytes(value.buffer.data(), value.buffer.size());
+    offset = header.end;
+    if (writeAll(fd, writer.buffer.data(), writer.buffer.size(), offset) ||
+        writeAll(fd, &offset, sizeof(offset),
+                 TABLE_OFFSET + bucket * sizeof(offset))) {
+        perror("pwrite");
+        fprintf(stderr, "could not write to %s\n", filename.c_str());
+        return 1;
+    }
+
+    header.end += entrySize;
+    ++header.numEntries;
+    if (writeAll(fd, &header, sizeof(header), 0)) {
+        perror("pwrite");
+        fprintf(stderr, "could not write to %s\n", filename.c_str());
+        return 1;
+    }
+
+    return 0;
+}
+
+/* See AssemblyCache.h. */
+std::unique_ptr<AssemblyCache> AssemblyCache::open(const std::string &filename)
+{
+    int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("open");
+        fprintf(stderr, "could not open %s\n", filename.c_str());
+        return {nullptr};
+    }
+    std::unique_ptr<AssemblyCache> cache{new AssemblyCache{fd, filename}};
+
+    FileLock lock{fd, LOCK_EX};
+    if (!lock.isLocked())
+        return {nullptr};
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        return {nullptr};
+    }
+
+    // Initialize a new file. The table is all zeroes, which ftruncate() gives
+    // us for free.
+    if (st.st_size == 0) {
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version = CACHE_VERSION;
+        header.numBuckets = NUM_BUCKETS;
+        header.end = ENTRIES_OFFSET;
+        header.numEntries = 0;
+
+        if (ftruncate(fd, ENTRIES_OFFSET) == -1 ||
+            writeAll(fd, &header, sizeof(header), 0)) {
+            perror("write");
+            fprintf(stderr, "could not initialize %s\n", filename.c_str());
+            return {nullptr};
+        }
+    }
+
+    CacheHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_VERSION || header.numBuckets != NUM_BUCKETS) {
+        fprintf(stderr, "%s is not an asmase cache file\n", filename.c_str());
+        return {nullptr};
+    }
+
+    if (cache->remap())
+        return {nullptr};
+
+    return cache;
+}
@@ -20,8 +20,10 @@
  */
 
 #include <cassert>
+#include <cctype>
 #include <cstdio>
 #include <map>
+#include <set>
 #include <sstream>
 
 #include "Builtins/AST.h"
@@ -33,6 +35,8 @@
 
 #include "Builtins.h"
 #include "Inputter.h"
+#include "Recycled.h"
+#include "Stats.h"
 
 /** Entry for a built-in command. */
 class BuiltinCommand {
@@ -42,6 +46,12 @@ public:
 
     /** Help string documentation. */
     std::string helpString;
+
+    /**
+     * Function to run instead of func for built-ins which parse their own
+     * arguments, or nullptr.
+     */
+    RawBuiltinFunc rawFunc;
 };
 
 static BUILTIN_FUNC(quit)
@@ -60,48 +70,97 @@ static std::map<std::string, BuiltinCommand> commands = {
 
     {"source",    {builtin_source, "redirect input to a given file"}},
 
+    {"save_session", {builtin_save_session, "save the session to a file"}},
+
+    {"dlopen",    {builtin_dlopen, "load a shared library into the tracee"}},
+    {"call",      {builtin_call, "call a function in the tracee"}},
+    {"def",       {nullptr, "define a template of code with parameters",
+                   builtin_def}},
+    {"run",       {nullptr, "run a template with the given arguments",
+                   builtin_run}},
+
     {"memory",    {builtin_memory,    "dump memory contents"}},
+    {"gen",       {builtin_gen,       "fill memory with generated data"}},
+    {"memstats",  {builtin_memstats,  "summarize an array in memory"}},
+    {"cmpf",      {builtin_cmpf,      "compare arrays of floats"}},
     {"registers", {builtin_registers, "dump register contents"}},
 
+    {"stats",     {builtin_stats, "show time and system calls per phase"}},
+    {"syscalls",  {builtin_syscalls, "trace system calls made by code"}},
+    {"time",      {builtin_time, "measure how long code takes to run"}},
+    {"cachesim",  {builtin_cachesim, "simulate the caches on code"}},
+    {"profile",   {builtin_profile, "count how many times code runs"}},
+    {"numa",      {builtin_numa, "place the tracee and scratch on NUMA nodes"}},
+    {"corun",     {builtin_corun, "run two functions on sibling hardware threads"}},
+
     {"warranty",  {builtin_warranty, "show warranty information"}},
     {"copying",   {builtin_copying,  "show copying information"}},
 };
 
 /**
- * Look up the abbreviation for a built-in command.
- * @return Zero on success, nonzero on failure (e.g., ambigious abbreviation).
+ * Commands which keep their abbreviations when a command added later shares
+ * the prefix, so that, e.g., ":mem" still means ":memory" and not ":memstats".
  */
-static int lookupCommand(const std::string &abbrev,
-                         BuiltinCommand &commandOut,
-                         int commandStart,
-                         Builtins::ErrorContext &errorContext)
+static const std::set<std::string> preferredCommands = {
+    "print", "quit", "help", "source", "memory", "registers", "warranty",
+    "copying",
+};
+
+/** Entry in the lookup table. */
+typedef std::pair<const std::string, BuiltinCommand> CommandEntry;
+
+/** Find the built-in commands which an abbreviation matches. */
+static void findCommands(const std::string &abbrev,
+                         std::vector<CommandEntry *> &matchesOut)
 {
-    std::vector<std::string> potentialMatches;
-    for (const std::pair<std::string, BuiltinCommand> &command : commands) {
+    for (CommandEntry &command : commands) {
         if (command.first.compare(0, abbrev.size(), abbrev) == 0) {
             if (abbrev.size() == command.first.size()) {
                 // Allow full matches to bypass the ambiguity check
-                potentialMatches.clear();
-                potentialMatches.push_back(command.first);
-                break;
+                matchesOut.clear();
+                matchesOut.push_back(&command);
+                return;
             } else
-                potentialMatches.push_back(command.first);
+                matchesOut.push_back(&command);
+        }
+    }
+
+    // Resolve an ambiguous abbreviation to the preferred command, if any
+    if (matchesOut.size() > 1) {
+        for (CommandEntry *match : matchesOut) {
+            if (preferredCommands.count(match->first)) {
+                matchesOut.assign(1, match);
+                return;
+            }
         }
     }
+}
+
+/**
+ * Look up the abbreviation for a built-in command.
+ * @return Zero on success, nonzero on failure (e.g., ambigious abbreviation).
+ */
+static int lookupCommand(const std::string &abbrev,
+                         const BuiltinCommand *&commandOut,
+                         int commandStart,
+                         Builtins::ErrorContext &errorContext)
+{
+    RecycledVector<CommandEntry *> potentialMatches;
+    findCommands(abbrev, *potentialMatches);
 
-    if (potentialMatches.empty()) {
+    if (potentialMatches->empty()) {
         errorContext.printMessage("unknown command", commandStart);
         return 1;
-    } else if (potentialMatches.size() > 1) {
+    } else if (potentialMatches->size() > 1) {
         std::stringstream ss;
         ss << "ambigious command; did you mean ";
-        for (size_t i = 0; i < potentialMatches.size() - 1; ++i)
-            ss << '\'' << potentialMatches[i] << "', ";
-        ss << "or '" << potentialMatches.back() << "'?";
+        for (size_t i = 0; i < potentialMatches->size() - 1; ++i)
+            ss << '\'' << (*potentialMatches)[i]->first << "', ";
+        ss << "or '" << potentialMatches->back()->first << "'?";
         errorContext.printMessage(ss.str().c_str(), commandStart);
         return 1;
     } else {
-        commandOut = commands[potentialMatches.front()];
+        commandOut = &potentialMatches->front()->second;
         return 0;
     }
 }
@@ -125,14 +184,14 @@ static BUILTIN_FUNC(help)
 
             const std::string &abbrev = arg->getIdentifier();
 
-            BuiltinCommand builtinCommand;
+            const BuiltinCommand *builtinCommand;
             int error = lookupCommand(abbrev, builtinCommand, arg->getStart(),
                                       env.errorContext);
             if (error)
                 return 1;
 
             maxCommandLength = std::max(abbrev.size(), maxCommandLength);
-            wantedCommands.emplace_back(abbrev, builtinCommand.helpString);
+            wantedCommands.emplace_back(abbrev, builtinCommand->helpString);
         }
     }
 
@@ -154,9 +213,54 @@ bool isBuiltin(const std::string &str)
     return str[i] == ':';
 }
 
+/**
+ * Find the built-in named at the start of the text after the colon if it
+ * parses its own arguments.
+ * @return The command, or nullptr if there isn't exactly one built-in with
+ * the name or it doesn't parse its own arguments.
+ */
+static const BuiltinCommand *findRawCommand(const char *builtin,
+                                            const char *&nameStartOut,
+                                            const char *&nameEndOut)
+{
+    const char *nameStart = builtin, *nameEnd;
+    while (isspace(*nameStart))
+        ++nameStart;
+    for (nameEnd = nameStart; isalnum(*nameEnd) || *nameEnd == '_';
+         ++nameEnd);
+    if (nameEnd == nameStart)
+        return nullptr;
+
+    RecycledVector<CommandEntry *> matches;
+    findCommands(std::string{nameStart, nameEnd}, *matches);
+    if (matches->size() != 1 || !matches->front()->second.rawFunc)
+        return nullptr;
+    nameStartOut = nameStart;
+    nameEndOut = nameEnd;
+    return &matches->front()->second;
+}
+
 /* See Builtins.h. */
-int runBuiltin(const std::string &line, Tracee &tracee, Inputter &inputter)
+bool definesTemplate(const std::string &str)
 {
+    size_t colon = str.find(':');
+    if (colon == std::string::npos)
+        return false;
+
+    const char *nameStart, *nameEnd;
+    const BuiltinCommand *command =
+        findRawCommand(str.c_str() + colon + 1, nameStart, nameEnd);
+    return command && command->rawFunc == builtin_def;
+}
+
+/* See Builtins.h. */
+int runBuiltin(const std::string &line, Tracee &tracee, SymbolTable &symbols,
+               Profiler &profiler, TemplateTable &templates,
+               Assembler *assembler, Inputter &inputter, SessionLog *log,
+               const AssembledCode *recordedCode)
+{
+    PhaseTimer timer{StatsPhase::BUILTIN};
+
     // Make sure we were really given a built-in and trim the leading colon
     const char *builtin = line.c_str();
     int offset = 0;
@@ -172,7 +276,19 @@ int runBuiltin(const std::string &line, Tracee &tracee, Inputter &inputter)
     Builtins::ErrorContext errorContext{inputter.currentFilename().c_str(),
                                         inputter.currentLineno(),
                                         line.c_str(), offset};
-    Builtins::Environment env{tracee, inputter, errorContext};
+    Builtins::Environment env{tracee, symbols, profiler, templates,
+                              assembler, inputter, errorContext, log,
+                              recordedCode};
+
+    // Built-ins which parse their own arguments get the rest of the line as
+    // is, since it may not be made of tokens that we understand
+    const char *nameStart, *nameEnd;
+    const BuiltinCommand *rawCommand =
+        findRawCommand(builtin, nameStart, nameEnd);
+    if (rawCommand)
+        return rawCommand->rawFunc(nameEnd, nameEnd - builtin,
+                                   std::string{nameStart, nameEnd},
+                                   nameStart - builtin, env);
 
     // Lex and parse the input
     Builtins::Scanner scanner{builtin};
@@ -183,13 +299,12 @@ int runBuiltin(const std::string &line, Tracee &tracee, Inputter &inputter)
 
     // Evaluate the input by looping over the command arguments and evaulating
     // each one
-    std::vector<std::unique_ptr<Builtins::ValueAST>> evaledArgs;
-    std::vector<Builtins::ExprAST*>::iterator it;
+    RecycledVector<std::unique_ptr<Builtins::ValueAST>> evaledArgs;
     bool failedEval = false;
     for (auto &expr : *command) {
         Builtins::ValueAST *value = expr->eval(env);
         failedEval |= value == nullptr;
-        evaledArgs.emplace_back(value);
+        evaledArgs->emplace_back(value);
     }
 
     if (failedEval)
@@ -197,13 +312,13 @@ int runBuiltin(const std::string &line, Tracee &tracee, Inputter &inputter)
 
     // Look up the command and execute it
     const std::string &abbrev = command->getCommand();
-    BuiltinCommand builtinCommand;
+    const BuiltinCommand *builtinCommand;
     int error = lookupCommand(abbrev, builtinCommand,
                               command->getCommandStart(), errorContext);
     if (!error)
-        error = builtinCommand.func(evaledArgs, command->getCommand(),
-                                    command->getCommandStart(),
-                                    command->getCommandEnd(), env);
+        error = builtinCommand->func(*evaledArgs, command->getCommand(),
+                                     command->getCommandStart(),
+                                     command->getCommandEnd(), env);
 
     return error;
 }
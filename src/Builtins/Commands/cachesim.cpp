@@ -0,0 +1,507 @@
+/*
+ * Built-in for simulating caches on executed code.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "CacheModel.h"
+#include "Disassembler.h"
+#include "Tracee.h"
+
+/** Longest instruction on any supported architecture. */
+static const size_t MAX_INSTRUCTION_SIZE = 16;
+
+/** Default maximum number of instructions to step through. */
+static const uint64_t DEFAULT_LIMIT = 1000000;
+
+/**
+ * Buckets of the reuse distance histogram: 0, 1, 2-3, 4-7, ..., and one for
+ * anything farther.
+ */
+static const int HISTOGRAM_BUCKETS = 32;
+
+/** Marks a register which an operand doesn't use. */
+static const size_t NO_REGISTER = SIZE_MAX;
+
+/** A memory operand with its registers looked up in the tracee. */
+class ResolvedOperand {
+public:
+    MemoryOperand operand;
+    size_t base, index, segment;
+};
+
+/** What happened to the accesses made by one instruction. */
+class InstructionStats {
+public:
+    std::string text;
+    size_t length;
+    std::vector<ResolvedOperand> operands;
+
+    uint64_t executions;
+
+    /** Accesses to cache lines; one which straddles two lines counts twice. */
+    uint64_t accesses;
+
+    /** Misses in each level of the cache. */
+    std::vector<uint64_t> misses;
+
+    uint64_t tlbMisses;
+
+    /** Accesses to lines which hadn't been accessed before. */
+    uint64_t cold;
+
+    /** Sum of the reuse distances of the other accesses. */
+    uint64_t reuseSum;
+
+    explicit InstructionStats(size_t levels)
+        : length{0}, executions{0}, accesses{0}, misses(levels, 0),
+          tlbMisses{0}, cold{0}, reuseSum{0} {}
+};
+
+/** Geometry of one level given on the command line. */
+class LevelOption {
+public:
+    const char *name;
+    size_t size, ways;
+};
+
+/**
+ * Look up the register with the given name, or leave it as NO_REGISTER if the
+ * name is empty.
+ * @return Zero on success, nonzero if the tracee has no such register.
+ */
+static int resolveRegister(Tracee &tracee, const std::string &name,
+                           size_t &indexOut)
+{
+    indexOut = NO_REGISTER;
+    if (name.empty())
+        return 0;
+    if (tracee.findRegister(name, indexOut)) {
+        fprintf(stderr, "unknown register %s\n", name.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Decode the instruction at the given address.
+ * @return Zero on success, nonzero on failure.
+ */
+static int decodeInstruction(Tracee &tracee, Disassembler &disassembler,
+                             void *address, InstructionStats &statsOut)
+{
+    // Read up to the end of the page first in case the next page isn't
+    // mapped, and then the rest if the instruction may continue there
+    unsigned char machineCode[MAX_INSTRUCTION_SIZE];
+    auto start = reinterpret_cast<uintptr_t>(address);
+    size_t size = std::min<size_t>(MAX_INSTRUCTION_SIZE,
+                                   sysconf(_SC_PAGESIZE) -
+                                       start % sysconf(_SC_PAGESIZE));
+    if (tracee.readMemory(address, machineCode, size))
+        return 1;
+    if (size < MAX_INSTRUCTION_SIZE &&
+        tracee.readMemory(reinterpret_cast<void *>(start + size),
+                          machineCode + size, MAX_INSTRUCTION_SIZE - size) == 0)
+        size = MAX_INSTRUCTION_SIZE;
+
+    DecodedInstruction decoded;
+    if (disassembler.disassemble(machineCode, size,
+                                 reinterpret_cast<uintptr_t>(address),
+                                 decoded)) {
+        fprintf(stderr, "could not decode instruction at %p\n", address);
+        return 1;
+    }
+
+    statsOut.text = decoded.text;
+    statsOut.length = decoded.length;
+    for (const MemoryOperand &operand : decoded.memoryOperands) {
+        ResolvedOperand resolved;
+        resolved.operand = operand;
+        if (resolveRegister(tracee, operand.base, resolved.base) ||
+            resolveRegister(tracee, operand.index, resolved.index) ||
+            resolveRegister(tracee, operand.segment, resolved.segment))
+            return 1;
+        statsOut.operands.push_back(resolved);
+    }
+    return 0;
+}
+
+/** Get the value of a register, or zero for NO_REGISTER. */
+static uint64_t registerOrZero(Tracee &tracee, size_t index)
+{
+    return index == NO_REGISTER ? 0 : tracee.getFetchedRegister(index);
+}
+
+/**
+ * Feed the accesses of an instruction about to be executed into the model,
+ * with the registers as they are before it runs.
+ */
+static void simulateInstruction(Tracee &tracee, CacheModel &model,
+                                uintptr_t pc, unsigned lineShift,
+                                InstructionStats &stats,
+                                std::vector<uint64_t> &histogram)
+{
+    stats.executions++;
+    for (const ResolvedOperand &resolved : stats.operands) {
+        const MemoryOperand &operand = resolved.operand;
+        uint64_t address = operand.pcRelative
+                               ? pc + stats.length
+                               : registerOrZero(tracee, resolved.base);
+        address += registerOrZero(tracee, resolved.index) * operand.scale;
+        address += operand.displacement;
+        if (operand.addressSize)
+            address &= (UINT64_C(1) << (8 * operand.addressSize)) - 1;
+        address += registerOrZero(tracee, resolved.segment);
+
+        uint64_t firstLine = address >> lineShift;
+        uint64_t lastLine = (address + std::max<size_t>(operand.size, 1) - 1) >>
+                            lineShift;
+        for (uint64_t line = firstLine; line <= lastLine; line++) {
+            CacheAccessResult result = model.access(line << lineShift);
+            stats.accesses++;
+            for (size_t level = 0; level < result.level; level++)
+                stats.misses[level]++;
+            if (!result.tlbHit)
+                stats.tlbMisses++;
+
+            int bucket = 0;
+            if (result.reuseDistance == ReuseDistanceTracker::COLD) {
+                stats.cold++;
+                bucket = HISTOGRAM_BUCKETS;
+            } else {
+                stats.reuseSum += result.reuseDistance;
+                while (bucket < HISTOGRAM_BUCKETS - 1 &&
+                       result.reuseDistance >= (UINT64_C(1) << bucket))
+                    bucket++;
+            }
+            histogram[bucket]++;
+        }
+    }
+}
+
+/** Print a row of the table of instructions. */
+static void printRow(const char *address, const InstructionStats &stats,
+                     const char *text)
+{
+    printf("%18s %10" PRIu64 " %10" PRIu64, address, stats.executions,
+           stats.accesses);
+    for (uint64_t misses : stats.misses)
+        printf(" %10" PRIu64, misses);
+    printf(" %10" PRIu64 " %10" PRIu64, stats.tlbMisses, stats.cold);
+    if (stats.accesses > stats.cold)
+        printf(" %10.1f",
+               static_cast<double>(stats.reuseSum) /
+                   (stats.accesses - stats.cold));
+    else
+        printf(" %10s", "-");
+    printf("  %s\n", text);
+}
+
+/** Print the results of a simulation. */
+static void printResults(
+    const std::vector<CacheGeometry> &levels, const CacheGeometry *tlb,
+    uint64_t steps,
+    const std::unordered_map<uintptr_t, InstructionStats> &instructions,
+    const std::vector<uint64_t> &histogram)
+{
+    for (const CacheGeometry &level : levels)
+        printf("%s: %zu bytes, %zu-way, %zu-byte lines\n", level.name.c_str(),
+               level.lines * level.lineSize, level.ways, level.lineSize);
+    if (tlb)
+        printf("%s: %zu entries, %zu-way, %zu-byte pages\n", tlb->name.c_str(),
+               tlb->lines, tlb->ways, tlb->lineSize);
+    printf("executed %" PRIu64 " instructions\n", steps);
+
+    // Only instructions which touched memory are interesting, in address
+    // order
+    std::vector<uintptr_t> addresses;
+    for (const auto &entry : instructions) {
+        if (entry.second.accesses)
+            addresses.push_back(entry.first);
+    }
+    std::sort(addresses.begin(), addresses.end());
+
+    printf("%18s %10s %10s", "address", "count", "accesses");
+    for (const CacheGeometry &level : levels)
+        printf(" %10s", (level.name + " miss").c_str());
+    printf(" %10s %10s %10s  %s\n", "TLB miss", "cold", "reuse",
+           "instruction");
+
+    InstructionStats total{levels.size()};
+    for (uintptr_t address : addresses) {
+        const InstructionStats &stats = instructions.at(address);
+        char label[32];
+        snprintf(label, sizeof(label), "%#" PRIxPTR, address);
+        printRow(label, stats, stats.text.c_str());
+
+        total.executions += stats.executions;
+        total.accesses += stats.accesses;
+        for (size_t i = 0; i < levels.size(); i++)
+            total.misses[i] += stats.misses[i];
+        total.tlbMisses += stats.tlbMisses;
+        total.cold += stats.cold;
+        total.reuseSum += stats.reuseSum;
+    }
+    printRow("total", total, "");
+
+    if (!total.accesses)
+        return;
+    printf("reuse distance histogram (lines):\n");
+    for (int i = 0; i <= HISTOGRAM_BUCKETS; i++) {
+        if (!histogram[i])
+            continue;
+        char label[32];
+        if (i == HISTOGRAM_BUCKETS)
+            snprintf(label, sizeof(label), "cold");
+        else if (i == 0)
+            snprintf(label, sizeof(label), "0");
+        else if (i == HISTOGRAM_BUCKETS - 1)
+            snprintf(label, sizeof(label), ">= %" PRIu64,
+                     UINT64_C(1) << (i - 1));
+        else if (i == 1)
+            snprintf(label, sizeof(label), "1");
+        else
+            snprintf(label, sizeof(label), "%" PRIu64 "-%" PRIu64,
+                     UINT64_C(1) << (i - 1), (UINT64_C(1) << i) - 1);
+        printf("  %-24s %12" PRIu64 "\n", label, histogram[i]);
+    }
+}
+
+/**
+ * Get a positive integer argument.
+ * @return True if there was an error, false otherwise.
+ */
+static bool checkPositive(const Builtins::ValueAST &value, const char *what,
+                          Builtins::Environment &env, size_t &valueOut)
+{
+    std::string errorMsg = std::string{"expected "} + what;
+    if (checkValueType(value, Builtins::ValueType::INTEGER, errorMsg.c_str(),
+                       env.errorContext))
+        return true;
+    if (value.getInteger() <= 0) {
+        errorMsg = std::string{what} + " must be positive";
+        env.errorContext.printMessage(errorMsg.c_str(), value.getStart());
+        return true;
+    }
+    valueOut = value.getInteger();
+    return false;
+}
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName
+       << " address [limit count] [l1|l2|l3 size ways]... [line size]"
+          " [tlb entries ways] [page size]";
+    return ss.str();
+}
+
+BUILTIN_FUNC(cachesim)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf("Single-step code from the given address (or label) to the end of the code\n"
+               "so far, feeding every load and store into a simulated hierarchy of\n"
+               "set-associative LRU caches and a TLB. Prints the accesses, misses at each\n"
+               "level, and mean reuse distance (distinct lines touched in between) of each\n"
+               "instruction, followed by a histogram of reuse distances. A level with a\n"
+               "size of 0 is left out. The defaults are:\n"
+               "  l1 32768 8, l2 1048576 16, l3 8388608 16, line 64,\n"
+               "  tlb 64 4, page 4096, limit 1000000 instructions\n");
+        return 0;
+    }
+
+    if (args.empty()) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    void *address;
+    if (checkAddress(*args[0], env, address))
+        return 1;
+
+    LevelOption levelOptions[] = {
+        {"l1", 32 * 1024, 8},
+        {"l2", 1024 * 1024, 16},
+        {"l3", 8 * 1024 * 1024, 16},
+    };
+    LevelOption tlbOption{"tlb", 64, 4};
+    size_t lineSize = 64, pageSize = 4096, limit = DEFAULT_LIMIT;
+
+    for (size_t i = 1; i < args.size(); i++) {
+        if (checkValueType(*args[i], Builtins::ValueType::IDENTIFIER,
+                           "expected option", env.errorContext))
+            return 1;
+        const std::string &name = args[i]->getIdentifier();
+
+        LevelOption *level = name == "tlb" ? &tlbOption : nullptr;
+        for (LevelOption &option : levelOptions) {
+            if (name == option.name)
+                level = &option;
+        }
+
+        // A level which is left out doesn't need its ways
+        if (level) {
+            if (i + 1 >= args.size()) {
+                env.errorContext.printMessage("expected size",
+                                              args[i]->getStart());
+                return 1;
+            }
+            if (checkValueType(*args[++i], Builtins::ValueType::INTEGER,
+                               "expected size", env.errorContext))
+                return 1;
+            if (args[i]->getInteger() < 0) {
+                env.errorContext.printMessage("size must not be negative",
+                                              args[i]->getStart());
+                return 1;
+            }
+            level->size = args[i]->getInteger();
+            if (!level->size)
+                continue;
+            if (i + 1 >= args.size()) {
+                env.errorContext.printMessage("expected ways",
+                                              args[i]->getStart());
+                return 1;
+            }
+            if (checkPositive(*args[++i], "ways", env, level->ways))
+                return 1;
+            continue;
+        }
+
+        size_t *value;
+        if (name == "line")
+            value = &lineSize;
+        else if (name == "page")
+            value = &pageSize;
+        else if (name == "limit")
+            value = &limit;
+        else {
+            env.errorContext.printMessage("invalid option",
+                                          args[i]->getStart());
+            return 1;
+        }
+        if (i + 1 >= args.size()) {
+            env.errorContext.printMessage("expected value",
+                                          args[i]->getStart());
+            return 1;
+        }
+        if (checkPositive(*args[++i], name.c_str(), env, *value))
+            return 1;
+        if (name != "limit" && (*value & (*value - 1))) {
+            env.errorContext.printMessage("must be a power of two",
+                                          args[i]->getStart());
+            return 1;
+        }
+    }
+
+    // The sizes are in bytes for the caches and in entries for the TLB
+    std::vector<CacheGeometry> levels;
+    for (const LevelOption &option : levelOptions) {
+        if (!option.size)
+            continue;
+        if (option.size % (lineSize * option.ways)) {
+            fprintf(stderr, "%s size must be a multiple of the line size times the ways\n",
+                    option.name);
+            return 1;
+        }
+        std::string levelName = option.name;
+        levelName[0] = 'L';
+        levels.emplace_back(levelName, option.size / lineSize, option.ways,
+                            lineSize);
+    }
+    std::unique_ptr<CacheGeometry> tlb;
+    if (tlbOption.size) {
+        if (tlbOption.size % tlbOption.ways) {
+            fprintf(stderr, "TLB entries must be a multiple of the ways\n");
+            return 1;
+        }
+        tlb.reset(new CacheGeometry{"TLB", tlbOption.size, tlbOption.ways,
+                                    pageSize});
+    }
+
+    static std::shared_ptr<Disassembler> disassembler;
+    if (!disassembler) {
+        disassembler = Disassembler::createDisassembler();
+        if (!disassembler)
+            return 1;
+    }
+
+    Tracee &tracee = env.tracee;
+    const MemoryRegion &code = tracee.getMemory().code;
+    void *end = static_cast<unsigned char *>(code.address) + code.used;
+
+    CacheModel model{levels, tlb.get(), lineSize};
+    unsigned lineShift = log2PowerOfTwo(lineSize);
+    std::unordered_map<uintptr_t, InstructionStats> instructions;
+    std::vector<uint64_t> histogram(HISTOGRAM_BUCKETS + 1, 0);
+    uint64_t steps = 0;
+
+    if (tracee.startStepping(address))
+        return 1;
+
+    int error = 0;
+    void *pc = address;
+    while (pc != end) {
+        if (steps == limit) {
+            printf("stopped after %" PRIu64 " instructions\n", steps);
+            break;
+        }
+
+        auto pcValue = reinterpret_cast<uintptr_t>(pc);
+        auto it = instructions.find(pcValue);
+        if (it == instructions.end()) {
+            it = instructions.emplace(pcValue,
+                                      InstructionStats{levels.size()}).first;
+            if (decodeInstruction(tracee, *disassembler, pc, it->second)) {
+                error = 1;
+                break;
+            }
+        }
+        simulateInstruction(tracee, model, pcValue, lineShift, it->second,
+                            histogram);
+
+        error = tracee.stepInstruction(pc);
+        if (error)
+            break;
+        steps++;
+    }
+    if (error < 0)
+        return -1;
+
+    printResults(levels, tlb.get(), steps, instructions, histogram);
+    return error;
+}
@@ -0,0 +1,154 @@
+/*
+ * call built-in command for calling functions in the tracee.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Measurement.h"
+#include "SymbolTable.h"
+#include "Tracee.h"
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " address [argument...] [repeat count]";
+    return ss.str();
+}
+
+BUILTIN_FUNC(call)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf("Call the function at the given address (or label) with the platform's\n"
+               "calling convention and print what it returned and which registers it\n"
+               "changed. Integers and labels are passed as integers, floats as doubles,\n"
+               "and strings as pointers to a copy of them. With repeat, the function is\n"
+               "called count times and timed like :time does.\n");
+        return 0;
+    }
+
+    if (args.empty()) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    FunctionCall call{};
+    void *address;
+    if (checkAddress(*args[0], env, address))
+        return 1;
+    call.function = reinterpret_cast<uintptr_t>(address);
+
+    size_t numArgs = args.size();
+    size_t repeat = 0;
+    if (numArgs >= 3 &&
+        args[numArgs - 2]->getType() == Builtins::ValueType::IDENTIFIER &&
+        args[numArgs - 2]->getIdentifier() == "repeat") {
+        if (checkValueType(*args[numArgs - 1], Builtins::ValueType::INTEGER,
+                           "expected repeat count", env.errorContext))
+            return 1;
+        if (args[numArgs - 1]->getInteger() <= 0) {
+            env.errorContext.printMessage("repeat count must be positive",
+                                          args[numArgs - 1]->getStart());
+            return 1;
+        }
+        repeat = args[numArgs - 1]->getInteger();
+        numArgs -= 2;
+    }
+
+    // Strings are copied to the bottom of the call stack
+    const MemoryRegion *stack = nullptr;
+    size_t stringsSize = 0;
+    for (size_t i = 1; i < numArgs; i++) {
+        const Builtins::ValueAST &arg = *args[i];
+        switch (arg.getType()) {
+            case Builtins::ValueType::INTEGER:
+                call.args.push_back(arg.getInteger());
+                break;
+            case Builtins::ValueType::FLOAT:
+                call.floatArgs.push_back(arg.getFloat());
+                break;
+            case Builtins::ValueType::IDENTIFIER: {
+                void *label;
+                if (checkAddress(arg, env, label))
+                    return 1;
+                call.args.push_back(reinterpret_cast<uintptr_t>(label));
+                break;
+            }
+            case Builtins::ValueType::STRING: {
+                if (!stack && !(stack = env.tracee.getCallStack()))
+                    return 1;
+                const std::string &str = arg.getString();
+                if (stringsSize + str.size() + 1 > stack->size / 2) {
+                    env.errorContext.printMessage("string is too long",
+                                                  arg.getStart());
+                    return 1;
+                }
+                auto string =
+                    static_cast<unsigned char *>(stack->address) + stringsSize;
+                if (env.tracee.writeMemory(string, str.c_str(),
+                                           str.size() + 1))
+                    return 1;
+                call.args.push_back(reinterpret_cast<uintptr_t>(string));
+                stringsSize += str.size() + 1;
+                break;
+            }
+        }
+    }
+
+    call.trackClobbered = true;
+    if (env.tracee.injectCall(call))
+        return 1;
+
+    printf("returned %ld (%#lx)\n", static_cast<long>(call.ret), call.ret);
+    if (call.hasFloatRet)
+        printf("floating point return: %.17g\n", call.floatRet);
+    printf("changed registers:");
+    for (const std::string &name : call.clobbered)
+        printf(" %s", name.c_str());
+    printf("\n");
+
+    if (!repeat)
+        return 0;
+
+    MeasurementResult result;
+    int error = measureOverhead(env.tracee, std::min<size_t>(repeat, 1000),
+                                result.overheadNs);
+    if (error)
+        return error < 0 ? -1 : 1;
+    call.trackClobbered = false;
+    for (size_t i = 0; i < repeat; i++) {
+        if (env.tracee.injectCall(call))
+            return 1;
+        result.samplesNs.push_back(call.elapsedNs > result.overheadNs ?
+                                   call.elapsedNs - result.overheadNs : 0);
+    }
+    printMeasurement(stdout, result);
+    return 0;
+}
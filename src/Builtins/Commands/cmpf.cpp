@@ -0,0 +1,441 @@
+/*
+ * cmpf built-in command for comparing floating point arrays in memory.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Parallel.h"
+#include "Tracee.h"
+
+using Builtins::ElementType;
+
+/** Size of the chunks that memory is read in. */
+static const size_t CHUNK_SIZE = 16 * 1024 * 1024;
+
+/** Minimum number of bytes for each thread to work on. */
+static const size_t MIN_BYTES_PER_THREAD = 1024 * 1024;
+
+/**
+ * Number of bytes of each array which compare() makes all of its passes over
+ * before moving on, so that only the first pass has to go to memory.
+ */
+static const size_t COMPARE_BLOCK_SIZE = 16 * 1024;
+
+/**
+ * Buckets of the ULP error histogram: 0, 1, 2-3, 4-7, ..., and one for
+ * anything at least 2^30 ULPs (or NaN against a number) away.
+ */
+static const int HISTOGRAM_BUCKETS = 32;
+
+/** Distance between two values which can't be compared (e.g., NaN and 1). */
+static const uint64_t INFINITE_ULPS = UINT64_MAX;
+
+/** Integer types with the same size as a floating point type. */
+template <typename T> struct BitsType;
+template <> struct BitsType<float> {
+    typedef int32_t type;
+    typedef uint32_t unsignedType;
+};
+template <> struct BitsType<double> {
+    typedef int64_t type;
+    typedef uint64_t unsignedType;
+};
+
+/** An element which might not be aligned. */
+template <typename T> struct Unaligned {
+    typedef T type __attribute__((aligned(1)));
+};
+
+/**
+ * Get the number of representable values between two floats, given the floats
+ * and their bits. NaNs are only equal to each other, and 0.0 and -0.0 are
+ * equal. Values which can't be compared (e.g., NaN and 1) are the largest
+ * unsigned distance apart, which no two numbers are.
+ *
+ * This only uses bitwise operations and floating point comparisons so that it
+ * can be vectorized without 64-bit integer comparisons, which SSE2 lacks.
+ */
+template <typename T>
+static inline typename BitsType<T>::unsignedType
+ulpDistance(T a, T b, typename BitsType<T>::type ia,
+            typename BitsType<T>::type ib)
+{
+    typedef typename BitsType<T>::type Bits;
+    typedef typename BitsType<T>::unsignedType UBits;
+    const UBits magnitudeMask = std::numeric_limits<Bits>::max();
+    const int signShift = sizeof(T) * 8 - 1;
+
+    // With opposite signs, the distance is the sum of the magnitudes (which
+    // can't overflow, since NaNs were the only values with the top bits set).
+    // With the same sign, it's the absolute difference of the magnitudes.
+    UBits magnitudeA = static_cast<UBits>(ia) & magnitudeMask;
+    UBits magnitudeB = static_cast<UBits>(ib) & magnitudeMask;
+    UBits signsDiffer = static_cast<UBits>((ia ^ ib) >> signShift);
+    UBits difference = magnitudeA - magnitudeB;
+    UBits differenceSign =
+        static_cast<UBits>(static_cast<Bits>(difference) >> signShift);
+    difference = (difference ^ differenceSign) - differenceSign;
+    UBits distance = ((magnitudeA + magnitudeB) & signsDiffer) |
+                     (difference & ~signsDiffer);
+
+    bool nanA = a != a, nanB = b != b;
+    return (nanA | nanB) ?
+           ((nanA & nanB) ? 0 : std::numeric_limits<UBits>::max()) :
+           distance;
+}
+
+/**
+ * Get the relative error between two floats, or NaN where it isn't defined
+ * (see fixRelativeError()). This is kept apart from the special cases so that
+ * the compiler doesn't turn them into branches around the division.
+ */
+template <typename T>
+static inline double rawRelativeError(T a, T b)
+{
+    double x = a, y = b;
+    return std::fabs(x - y) / std::max(std::fabs(x), std::fabs(y));
+}
+
+/**
+ * Fix up the relative error between two floats: equal values (including two
+ * NaNs) have no error, and values which can't be compared have infinite error.
+ */
+template <typename T>
+static inline double fixRelativeError(T a, T b, double relative)
+{
+    bool nanA = a != a, nanB = b != b;
+    return (nanA ^ nanB) ? INFINITY :
+           ((a == b) | (nanA & nanB)) ? 0 : relative;
+}
+
+/** Widen a distance from ulpDistance() to 64 bits. */
+template <typename UBits>
+static inline uint64_t widenUlps(UBits ulps)
+{
+    return ulps == std::numeric_limits<UBits>::max() ? INFINITE_ULPS : ulps;
+}
+
+/** Get the histogram bucket of a distance, i.e., how many bits it needs. */
+static inline int getBucket(uint64_t ulps)
+{
+    if (!ulps)
+        return 0;
+    return std::min(64 - __builtin_clzll(ulps), HISTOGRAM_BUCKETS - 1);
+}
+
+/** Results of comparing part of two arrays. */
+class Comparison {
+public:
+    uint64_t mismatches;
+    uint64_t worstUlps;
+    size_t worstIndex;
+    double worstRelative;
+    size_t worstRelativeIndex;
+    uint64_t histogram[HISTOGRAM_BUCKETS];
+
+    Comparison()
+        : mismatches{0}, worstUlps{0}, worstIndex{0}, worstRelative{0},
+          worstRelativeIndex{0}, histogram{} {}
+
+    void merge(const Comparison &other)
+    {
+        mismatches += other.mismatches;
+        if (other.worstUlps > worstUlps ||
+            (other.worstUlps == worstUlps && other.worstIndex < worstIndex)) {
+            worstUlps = other.worstUlps;
+            worstIndex = other.worstIndex;
+        }
+        if (other.worstRelative > worstRelative) {
+            worstRelative = other.worstRelative;
+            worstRelativeIndex = other.worstRelativeIndex;
+        }
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+            histogram[i] += other.histogram[i];
+    }
+};
+
+/** How much two arrays may differ. */
+class Tolerance {
+public:
+    /** Whether relative is used instead of maxUlps. */
+    bool isRelative;
+    uint64_t maxUlps;
+    double relative;
+};
+
+/**
+ * Compare a block of two arrays. The distances and relative errors are
+ * computed into local arrays in one branch-free pass, and each statistic is
+ * then gathered in its own pass, so that everything but the last pass (which
+ * finds where the worst pairs are and fills in the histogram) can be
+ * vectorized. The loops are marked with "omp simd" (see Summary in
+ * memstats.cpp) since the compiler won't reorder floating point maximums on
+ * its own.
+ */
+template <typename T>
+static void compareBlock(const void *a, const void *b, size_t n,
+                         size_t firstIndex, const Tolerance &tolerance,
+                         Comparison &result)
+{
+    typedef typename BitsType<T>::type Bits;
+    typedef typename BitsType<T>::unsignedType UBits;
+    typedef typename Unaligned<T>::type Element;
+    typedef typename Unaligned<Bits>::type BitsElement;
+    const size_t blockElements = COMPARE_BLOCK_SIZE / sizeof(T);
+
+    auto x = static_cast<const Element *>(a);
+    auto y = static_cast<const Element *>(b);
+    auto xBits = static_cast<const BitsElement *>(a);
+    auto yBits = static_cast<const BitsElement *>(b);
+    UBits ulps[blockElements];
+    double relative[blockElements];
+
+#pragma omp simd
+    for (size_t i = 0; i < n; i++) {
+        ulps[i] = ulpDistance<T>(x[i], y[i], xBits[i], yBits[i]);
+        relative[i] = rawRelativeError(x[i], y[i]);
+    }
+#pragma omp simd
+    for (size_t i = 0; i < n; i++)
+        relative[i] = fixRelativeError(x[i], y[i], relative[i]);
+
+    uint64_t mismatches = 0;
+    if (tolerance.isRelative) {
+        // Counting in a double (exact for any block) vectorizes, unlike
+        // counting the results of double comparisons in an integer
+        double maxRelative = tolerance.relative, count = 0;
+#pragma omp simd reduction(+:count)
+        for (size_t i = 0; i < n; i++)
+            count += !(relative[i] <= maxRelative) ? 1.0 : 0.0;
+        mismatches = count;
+    } else {
+        // Only pairs which can't be compared are further apart than this
+        UBits maxUlps = std::min<uint64_t>(
+            tolerance.maxUlps, std::numeric_limits<UBits>::max() - 1);
+#pragma omp simd reduction(+:mismatches)
+        for (size_t i = 0; i < n; i++)
+            mismatches += ulps[i] > maxUlps;
+    }
+    result.mismatches += mismatches;
+
+    UBits worstUlps = 0;
+#pragma omp simd reduction(max:worstUlps)
+    for (size_t i = 0; i < n; i++)
+        worstUlps = ulps[i] > worstUlps ? ulps[i] : worstUlps;
+
+    // The relative error of infinity against a finite number is NaN, which
+    // never counts as the worst
+    double worstRelative = 0;
+#pragma omp simd reduction(max:worstRelative)
+    for (size_t i = 0; i < n; i++) {
+        double value = relative[i];
+        worstRelative = std::max(worstRelative, value == value ? value : 0);
+    }
+
+    for (size_t i = 0; i < n; i++)
+        result.histogram[getBucket(widenUlps(ulps[i]))]++;
+
+    if (widenUlps(worstUlps) > result.worstUlps) {
+        size_t i = std::find(ulps, ulps + n, worstUlps) - ulps;
+        result.worstUlps = widenUlps(worstUlps);
+        result.worstIndex = firstIndex + i;
+    }
+    if (worstRelative > result.worstRelative) {
+        size_t i = std::find(relative, relative + n, worstRelative) - relative;
+        result.worstRelative = worstRelative;
+        result.worstRelativeIndex = firstIndex + i;
+    }
+}
+
+template <typename T>
+static void compare(const T *a, const T *b, size_t n, size_t firstIndex,
+                    const Tolerance &tolerance, Comparison &result)
+{
+    size_t blockElements = COMPARE_BLOCK_SIZE / sizeof(T);
+    for (size_t i = 0; i < n; i += blockElements) {
+        compareBlock<T>(a + i, b + i, std::min(n - i, blockElements),
+                        firstIndex + i, tolerance, result);
+    }
+}
+
+template <typename T>
+static int compareArrays(Tracee &tracee, const void *addressA,
+                         const void *addressB, size_t count,
+                         const Tolerance &tolerance)
+{
+    static bytestring bufferA, bufferB;
+    unsigned maxThreads = getParallelism(SIZE_MAX, 1);
+    std::vector<Comparison> partial(maxThreads);
+
+    size_t chunkElements = CHUNK_SIZE / sizeof(T);
+    for (size_t done = 0; done < count; ) {
+        size_t n = std::min(count - done, chunkElements);
+        auto a = reinterpret_cast<const T *>(
+            tracee.getMemoryView(static_cast<const T *>(addressA) + done,
+                                 n * sizeof(T), bufferA));
+        auto b = reinterpret_cast<const T *>(
+            tracee.getMemoryView(static_cast<const T *>(addressB) + done,
+                                 n * sizeof(T), bufferB));
+        if (!a || !b)
+            return 1;
+
+        parallelFor(n, getParallelism(n * sizeof(T), MIN_BYTES_PER_THREAD),
+                    [&](size_t begin, size_t end, unsigned thread) {
+            compare(a + begin, b + begin, end - begin, done + begin, tolerance,
+                    partial[thread]);
+        });
+        done += n;
+    }
+
+    Comparison result;
+    for (const Comparison &part : partial)
+        result.merge(part);
+
+    printf("compared: %zu  mismatched: %" PRIu64, count, result.mismatches);
+    if (tolerance.isRelative)
+        printf(" (relative tolerance %g)\n", tolerance.relative);
+    else
+        printf(" (tolerance %" PRIu64 " ulp)\n", tolerance.maxUlps);
+    if (count == 0)
+        return 0;
+
+    // Show the worst pairs
+    T x, y;
+    if (tracee.readMemory(static_cast<const T *>(addressA) + result.worstIndex,
+                          &x, sizeof(T)) ||
+        tracee.readMemory(static_cast<const T *>(addressB) + result.worstIndex,
+                          &y, sizeof(T)))
+        return 1;
+    if (result.worstUlps == INFINITE_ULPS)
+        printf("worst: not comparable");
+    else
+        printf("worst: %" PRIu64 " ulp", result.worstUlps);
+    printf(" at index %zu: %.17g vs %.17g\n", result.worstIndex,
+           static_cast<double>(x), static_cast<double>(y));
+    printf("worst relative error: %g at index %zu\n", result.worstRelative,
+           result.worstRelativeIndex);
+
+    printf("ulp error histogram:\n");
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (!result.histogram[i])
+            continue;
+        char label[32];
+        if (i == 0)
+            snprintf(label, sizeof(label), "0");
+        else if (i == HISTOGRAM_BUCKETS - 1)
+            snprintf(label, sizeof(label), ">= %" PRIu64,
+                     UINT64_C(1) << (i - 1));
+        else if (i == 1)
+            snprintf(label, sizeof(label), "1");
+        else
+            snprintf(label, sizeof(label), "%" PRIu64 "-%" PRIu64,
+                     UINT64_C(1) << (i - 1), (UINT64_C(1) << i) - 1);
+        printf("  %-24s %12" PRIu64 "\n", label, result.histogram[i]);
+    }
+
+    return 0;
+}
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " a b count f32|f64 [tolerance]";
+    return ss.str();
+}
+
+BUILTIN_FUNC(cmpf)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf("Compare two arrays of count floats. An integer tolerance is a number of\n"
+               "units in the last place, and a fractional one (e.g., 1e-6) is a relative\n"
+               "error. The default is 0 ULPs, i.e., exactly equal.\n");
+        return 0;
+    }
+
+    if (args.size() != 4 && args.size() != 5) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    void *addressA, *addressB;
+    if (checkAddress(*args[0], env, addressA) ||
+        checkAddress(*args[1], env, addressB))
+        return 1;
+
+    if (checkValueType(*args[2], Builtins::ValueType::INTEGER,
+                       "expected element count", env.errorContext))
+        return 1;
+    if (args[2]->getInteger() < 0) {
+        env.errorContext.printMessage("element count must not be negative",
+                                      args[2]->getStart());
+        return 1;
+    }
+    size_t count = args[2]->getInteger();
+
+    ElementType type;
+    if (checkElementType(*args[3], env.errorContext, type, false))
+        return 1;
+
+    Tolerance tolerance{false, 0, 0};
+    if (args.size() > 4) {
+        const Builtins::ValueAST &arg = *args[4];
+        if (arg.getType() == Builtins::ValueType::INTEGER) {
+            if (arg.getInteger() < 0) {
+                env.errorContext.printMessage("tolerance must not be negative",
+                                              arg.getStart());
+                return 1;
+            }
+            tolerance.maxUlps = arg.getInteger();
+        } else {
+            if (checkNumber(arg, "expected tolerance", env.errorContext,
+                            tolerance.relative))
+                return 1;
+            if (!(tolerance.relative >= 0)) {
+                env.errorContext.printMessage("tolerance must not be negative",
+                                              arg.getStart());
+                return 1;
+            }
+            tolerance.isRelative = true;
+        }
+    }
+
+    if (type == ElementType::FLOAT32)
+        return compareArrays<float>(env.tracee, addressA, addressB, count,
+                                    tolerance);
+    else
+        return compareArrays<double>(env.tracee, addressA, addressB, count,
+                                     tolerance);
+}
@@ -0,0 +1,172 @@
+/*
+ * Built-in command for running two functions on sibling hardware threads.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Measurement.h"
+#include "Numa.h"
+#include "Tracee.h"
+
+/** Default number of calls to each function in a run. */
+static const unsigned long DEFAULT_COUNT = 10000;
+
+/** Default number of runs to take the median of. */
+static const size_t DEFAULT_REPEAT = 5;
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName
+       << " address address [count N] [repeat N] [cpus CPU CPU]";
+    return ss.str();
+}
+
+/**
+ * Parse a positive integer option.
+ * @return Zero on success, nonzero on failure.
+ */
+static int parsePositive(const Builtins::ValueAST &value, const char *what,
+                         unsigned long &valueOut,
+                         Builtins::ErrorContext &errorContext)
+{
+    std::string message = std::string{"expected "} + what;
+    if (checkValueType(value, Builtins::ValueType::INTEGER, message.c_str(),
+                       errorContext))
+        return 1;
+    if (value.getInteger() <= 0) {
+        message = std::string{what} + " must be positive";
+        errorContext.printMessage(message.c_str(), value.getStart());
+        return 1;
+    }
+    valueOut = value.getInteger();
+    return 0;
+}
+
+BUILTIN_FUNC(corun)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf("Call each of two functions (addresses or labels) with no arguments\n"
+               "count times in a row, first alone and then both at the same time,\n"
+               "and print the slowdown of each from sharing the core. The second\n"
+               "function runs in a copy of the tracee, and the two are pinned to\n"
+               "sibling hardware threads of one core unless other CPUs are given.\n");
+        return 0;
+    }
+
+    if (args.size() < 2) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    uintptr_t functions[2];
+    std::string names[2];
+    for (int i = 0; i < 2; i++) {
+        void *address;
+        if (checkAddress(*args[i], env, address))
+            return 1;
+        functions[i] = reinterpret_cast<uintptr_t>(address);
+        if (args[i]->getType() == Builtins::ValueType::IDENTIFIER) {
+            names[i] = args[i]->getIdentifier();
+        } else {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%p", address);
+            names[i] = buffer;
+        }
+    }
+
+    unsigned long count = DEFAULT_COUNT, repeat = DEFAULT_REPEAT;
+    int cpus[2] = {-1, -1};
+    for (size_t i = 2; i < args.size(); i += 2) {
+        if (checkValueType(*args[i], Builtins::ValueType::IDENTIFIER,
+                           "expected count, repeat, or cpus",
+                           env.errorContext))
+            return 1;
+        const std::string &option = args[i]->getIdentifier();
+        size_t numValues = option == "cpus" ? 2 : 1;
+        if (option != "count" && option != "repeat" && option != "cpus") {
+            env.errorContext.printMessage("expected count, repeat, or cpus",
+                                          args[i]->getStart());
+            return 1;
+        }
+        if (i + numValues >= args.size()) {
+            env.errorContext.printMessage(option == "cpus" ? "expected CPUs" :
+                                          "expected number",
+                                          args[i]->getEnd());
+            return 1;
+        }
+
+        if (option == "count") {
+            if (parsePositive(*args[i + 1], "count", count, env.errorContext))
+                return 1;
+        } else if (option == "repeat") {
+            if (parsePositive(*args[i + 1], "repeat count", repeat,
+                              env.errorContext))
+                return 1;
+        } else {
+            for (int j = 0; j < 2; j++) {
+                const Builtins::ValueAST &cpu = *args[i + 1 + j];
+                if (checkValueType(cpu, Builtins::ValueType::INTEGER,
+                                   "expected CPU", env.errorContext))
+                    return 1;
+                if (cpu.getInteger() < 0) {
+                    env.errorContext.printMessage("invalid CPU",
+                                                  cpu.getStart());
+                    return 1;
+                }
+                cpus[j] = cpu.getInteger();
+            }
+            i++;
+        }
+    }
+
+    if (cpus[0] == -1) {
+        std::vector<std::vector<int>> siblings;
+        if (getSmtSiblings(siblings))
+            return 1;
+        if (siblings.empty()) {
+            fprintf(stderr, "no SMT siblings found; give the CPUs with cpus\n");
+            return 1;
+        }
+        cpus[0] = siblings[0][0];
+        cpus[1] = siblings[0][1];
+    }
+
+    CoRunResult result;
+    int error = measureCoRun(env.tracee, functions, count, cpus, repeat,
+                             result);
+    if (error)
+        return error < 0 ? -1 : 1;
+
+    const char * const resultNames[2] = {names[0].c_str(), names[1].c_str()};
+    printCoRun(stdout, resultNames, result);
+    return 0;
+}
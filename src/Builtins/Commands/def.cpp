@@ -0,0 +1,375 @@
+/*
+ * Built-in commands for defining and running templates of code.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <utility>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Parser.h"
+#include "Builtins/Scanner.h"
+#include "Builtins/Support.h"
+
+#include "Assembler.h"
+#include "Inputter.h"
+#include "SessionLog.h"
+#include "TemplateTable.h"
+#include "Tracee.h"
+
+static std::string getDefUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " name(param, ...) { code }";
+    return ss.str();
+}
+
+static std::string getRunUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " name(argument, ...)";
+    return ss.str();
+}
+
+/** Skip whitespace. */
+static const char *skipSpace(const char *p)
+{
+    while (isspace(*p))
+        ++p;
+    return p;
+}
+
+/**
+ * Parse a template or parameter name, which is made of letters, digits, and
+ * underscores and doesn't start with a digit.
+ * @return Zero on success, nonzero if there is no name at p.
+ */
+static int parseName(const char *&p, std::string &nameOut)
+{
+    if (!isalpha(*p) && *p != '_')
+        return 1;
+    const char *start = p;
+    while (isalnum(*p) || *p == '_')
+        ++p;
+    nameOut.assign(start, p);
+    return 0;
+}
+
+/**
+ * Find the '}' which ends the code of a template, skipping over braces which
+ * the code itself uses in pairs (e.g., ARM register lists like
+ * "push {r4, lr}").
+ * @param depth Number of braces which the code has opened so far, updated as
+ * the text is scanned.
+ * @return The closing '}', or nullptr if the text doesn't have it.
+ */
+static const char *findClosingBrace(const char *p, int &depth)
+{
+    for (; *p; ++p) {
+        if (*p == '{')
+            ++depth;
+        else if (*p == '}') {
+            if (depth == 0)
+                return p;
+            --depth;
+        }
+    }
+    return nullptr;
+}
+
+/** Return whether the arguments of a raw built-in are just "help". */
+static bool askedForHelp(const char *text)
+{
+    text = skipSpace(text);
+    return strncmp(text, "help", 4) == 0 && !*skipSpace(text + 4);
+}
+
+RAW_BUILTIN_FUNC(def)
+{
+    if (askedForHelp(text)) {
+        std::string usage = getDefUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf("Assemble code once with its parameters as placeholders so that it can\n"
+               "be run with different arguments by :run without assembling it again.\n"
+               "Parameters can go anywhere a label can, e.g., in immediates and\n"
+               "displacements. The code ends at the '}' matching the '{' after the\n"
+               "parameters; if it isn't on the first line, the code goes on until the\n"
+               "line with it.\n");
+        return 0;
+    }
+
+    auto column = [&](const char *p) {
+        return textStart + static_cast<int>(p - text);
+    };
+
+    std::string name;
+    const char *p = skipSpace(text);
+    if (parseName(p, name)) {
+        std::string usage = getDefUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    p = skipSpace(p);
+    if (*p != '(') {
+        env.errorContext.printMessage("expected '('", column(p));
+        return 1;
+    }
+    p = skipSpace(p + 1);
+    std::vector<std::string> params;
+    while (*p != ')') {
+        std::string param;
+        const char *paramStart = p;
+        if (parseName(p, param)) {
+            env.errorContext.printMessage("expected parameter name",
+                                          column(p));
+            return 1;
+        }
+        if (std::find(params.begin(), params.end(), param) != params.end()) {
+            env.errorContext.printMessage("duplicate parameter",
+                                          column(paramStart));
+            return 1;
+        }
+        params.push_back(param);
+
+        p = skipSpace(p);
+        if (*p == ',')
+            p = skipSpace(p + 1);
+        else if (*p != ')') {
+            env.errorContext.printMessage("expected ',' or ')'", column(p));
+            return 1;
+        }
+    }
+
+    p = skipSpace(p + 1);
+    if (*p != '{') {
+        env.errorContext.printMessage("expected '{'", column(p));
+        return 1;
+    }
+    ++p;
+
+    if (!env.assembler && !env.recordedCode) {
+        fprintf(stderr, "templates can't be defined without an assembler\n");
+        return 1;
+    }
+
+    // The whole definition is logged so that a replay doesn't have to read
+    // the rest of it from the input; the text starts after the colon
+    std::string definition{":"};
+    definition += text - textStart;
+
+    // The code ends at the matching '}', which may be on a later line (or
+    // later in the text, when replaying)
+    std::string body;
+    int depth = 0;
+    const char *end = findClosingBrace(p, depth);
+    if (end) {
+        body.assign(p, end);
+        if (*skipSpace(end + 1)) {
+            env.errorContext.printMessage("unexpected text after '}'",
+                                          column(end + 1));
+            return 1;
+        }
+    } else {
+        body.assign(p);
+        std::string line;
+        for (;;) {
+            env.inputter.readLine("...> ", line);
+            if (line.empty()) {
+                fprintf(stderr, "template '%s' has no '}'\n", name.c_str());
+                return 1;
+            }
+            if (line.back() == '\n')
+                line.pop_back();
+            definition += '\n';
+            definition += line;
+            body += '\n';
+            const char *close = findClosingBrace(line.c_str(), depth);
+            if (!close) {
+                body += line;
+                continue;
+            }
+            body.append(line.c_str(), close);
+            if (*skipSpace(close + 1)) {
+                fprintf(stderr, "unexpected text after '}'\n");
+                return 1;
+            }
+            break;
+        }
+    }
+
+    SessionRecord record;
+    if (env.recordedCode)
+        record.code = *env.recordedCode;
+    else if (env.assembler->assembleInstruction(body, record.code,
+                                                env.inputter))
+        return 1;
+    if (env.templates.define(env.tracee, env.symbols, name, params,
+                             record.code))
+        return 1;
+
+    // Log the code before it's linked, like any other line
+    if (env.log) {
+        record.type = SessionRecordType::TEMPLATE;
+        record.line = std::move(definition);
+        env.log->writeRecord(record);
+    }
+
+    const CodeTemplate *codeTemplate = env.templates.lookup(name);
+    printf("%s = %p (%zu bytes, %zu field%s to patch)\n", name.c_str(),
+           codeTemplate->address, codeTemplate->machineCode.size(),
+           codeTemplate->fields.size(),
+           codeTemplate->fields.size() == 1 ? "" : "s");
+    return 0;
+}
+
+/**
+ * Evaluate an argument of a template, which is an expression the way it would
+ * be in parentheses in other built-ins.
+ * @param start Offset of the argument in the text.
+ * @param end Offset of the end of the argument in the text.
+ * @return Zero on success, nonzero on failure.
+ */
+static int evalArgument(const char *text, int textStart, size_t start,
+                        size_t end, Builtins::Environment &env,
+                        uint64_t &valueOut)
+{
+    // Parse it as a command with the argument in parentheses, lined up with
+    // the original input so that errors point at the right place
+    std::string line(textStart + start - 1, ' ');
+    line[0] = 'x';
+    line += '(';
+    line.append(text + start, end - start);
+    line += ')';
+
+    Builtins::Scanner scanner{line.c_str()};
+    Builtins::Parser parser{scanner, env.errorContext};
+    std::unique_ptr<Builtins::CommandAST> command{parser.parseCommand()};
+    if (!command)
+        return 1;
+    if (command->getArgs().size() != 1) {
+        env.errorContext.printMessage("expected one expression",
+                                      textStart + start);
+        return 1;
+    }
+
+    std::unique_ptr<Builtins::ValueAST> value{
+        command->getArgs()[0]->eval(env)};
+    if (!value)
+        return 1;
+    if (value->getType() == Builtins::ValueType::IDENTIFIER) {
+        void *address;
+        if (checkAddress(*value, env, address))
+            return 1;
+        valueOut = reinterpret_cast<uintptr_t>(address);
+        return 0;
+    }
+    if (checkValueType(*value, Builtins::ValueType::INTEGER,
+                       "expected integer or label", env.errorContext))
+        return 1;
+    valueOut = value->getInteger();
+    return 0;
+}
+
+RAW_BUILTIN_FUNC(run)
+{
+    if (askedForHelp(text)) {
+        std::string usage = getRunUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf("Patch the arguments into the code of a template defined with :def\n"
+               "and run it. Each argument is an integer expression or a label.\n");
+        return 0;
+    }
+
+    std::string name;
+    const char *p = skipSpace(text);
+    if (parseName(p, name)) {
+        std::string usage = getRunUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+    const CodeTemplate *codeTemplate = env.templates.lookup(name);
+    if (!codeTemplate) {
+        env.errorContext.printMessage("no such template",
+                                      textStart + (skipSpace(text) - text));
+        return 1;
+    }
+
+    // Split the arguments at commas which aren't nested in parentheses
+    std::vector<uint64_t> args;
+    p = skipSpace(p);
+    if (*p == '(') {
+        size_t start = p + 1 - text;
+        int depth = 0;
+        for (++p; *p && (*p != ')' || depth > 0); ++p) {
+            if (*p == '(')
+                ++depth;
+            else if (*p == ')')
+                --depth;
+            else if (*p != ',' || depth > 0)
+                continue;
+            else if (*skipSpace(text + start) == ',') {
+                env.errorContext.printMessage("expected argument",
+                                              textStart + (p - text));
+                return 1;
+            }
+
+            if (*p == ',') {
+                uint64_t value;
+                if (evalArgument(text, textStart, start, p - text, env,
+                                 value))
+                    return 1;
+                args.push_back(value);
+                start = p + 1 - text;
+            }
+        }
+        if (*p != ')') {
+            env.errorContext.printMessage("expected ')'",
+                                          textStart + (p - text));
+            return 1;
+        }
+
+        // "name()" has no arguments, not one empty one
+        if (!args.empty() || skipSpace(text + start) != p) {
+            uint64_t value;
+            if (evalArgument(text, textStart, start, p - text, env, value))
+                return 1;
+            args.push_back(value);
+        }
+        p = skipSpace(p + 1);
+    }
+    if (*p) {
+        env.errorContext.printMessage("unexpected text after arguments",
+                                      textStart + (p - text));
+        return 1;
+    }
+
+    if (env.templates.instantiate(env.tracee, name, args) ||
+        env.tracee.snapshotRegisters())
+        return 1;
+    return env.tracee.executeInstruction(codeTemplate->address);
+}
@@ -0,0 +1,582 @@
+/*
+ * gen built-in command for filling memory with generated data.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Tracee.h"
+
+using Builtins::ElementType;
+
+/** Size of the buffer that data is generated into before it is written. */
+static const size_t CHUNK_SIZE = 1024 * 1024;
+
+/** Kinds of data to generate. */
+enum class Kind {
+    ZEROS,
+    SEQUENTIAL,
+    RANDOM,
+    UNIFORM,
+    NORMAL,
+    ZIPF,
+    RUNS,
+};
+
+static std::map<std::string, Kind> kindMap = {
+    {"zeros",   Kind::ZEROS},
+    {"seq",     Kind::SEQUENTIAL},
+    {"random",  Kind::RANDOM},
+    {"uniform", Kind::UNIFORM},
+    {"normal",  Kind::NORMAL},
+    {"zipf",    Kind::ZIPF},
+    {"runs",    Kind::RUNS},
+};
+
+/** SplitMix64, which is fast and good enough for test data. */
+class Random {
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed) : state{seed} {}
+
+    uint64_t next()
+    {
+        uint64_t z = (state += UINT64_C(0x9e3779b97f4a7c15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+        return z ^ (z >> 31);
+    }
+
+    /** Get a double uniformly distributed in [0, 1). */
+    double nextDouble()
+    {
+        return (next() >> 11) * (1.0 / (UINT64_C(1) << 53));
+    }
+};
+
+/** Generates a stream of elements. */
+class Generator {
+public:
+    virtual ~Generator() {}
+
+    /** Fill the buffer with the next count elements. */
+    virtual void fill(void *out, size_t count) = 0;
+};
+
+/** Convert a random 64-bit value into a random element. */
+template <typename T>
+static T randomElement(uint64_t bits, std::true_type /* floating point */)
+{
+    return static_cast<T>((bits >> 11) * (1.0 / (UINT64_C(1) << 53)));
+}
+
+template <typename T>
+static T randomElement(uint64_t bits, std::false_type /* integer */)
+{
+    return static_cast<T>(bits);
+}
+
+/** Convert a generated value into an element. */
+template <typename T>
+static T toElement(double value, std::true_type /* floating point */)
+{
+    return static_cast<T>(value);
+}
+
+template <typename T>
+static T toElement(double value, std::false_type /* integer */)
+{
+    // Converting a double which is out of range to an integer is undefined,
+    // so clamp it first. The largest 64-bit integers round up to a power of
+    // two as doubles, so those clamp to the largest double below it instead.
+    const int digits = std::numeric_limits<T>::digits;
+    const int doubleDigits = std::numeric_limits<double>::digits;
+    const double lo = std::numeric_limits<T>::lowest();
+    const double hi = digits <= doubleDigits ?
+        static_cast<double>(std::numeric_limits<T>::max()) :
+        std::ldexp(1.0, digits) - std::ldexp(1.0, digits - doubleDigits);
+    return static_cast<T>(std::min(hi, std::max(lo, value)));
+}
+
+template <typename T>
+static T toElement(double value)
+{
+    return toElement<T>(value, std::is_floating_point<T>{});
+}
+
+/** start, start + step, start + 2 * step, ... */
+template <typename T>
+class SequentialGenerator : public Generator {
+    double start, step;
+    size_t index;
+
+public:
+    SequentialGenerator(double start, double step)
+        : start{start}, step{step}, index{0} {}
+
+    virtual void fill(void *out, size_t count)
+    {
+        T *elements = static_cast<T *>(out);
+        // Computed from the index (rather than by adding up) so that floats
+        // don't accumulate error. The offset from the first index is an int
+        // since only 32-bit integers can be converted to floating point in
+        // vector registers everywhere; the sum is exact either way.
+        while (count > 0) {
+            int n = std::min<size_t>(count, INT_MAX);
+            double first = index;
+#pragma omp simd
+            for (int i = 0; i < n; i++)
+                elements[i] = toElement<T>(start + step * (first + i));
+            elements += n;
+            index += n;
+            count -= n;
+        }
+    }
+};
+
+/**
+ * Random bits for integers, or uniformly distributed in [0, 1) for floating
+ * point.
+ */
+template <typename T>
+class RandomGenerator : public Generator {
+    Random random;
+
+public:
+    explicit RandomGenerator(uint64_t seed) : random{seed} {}
+
+    virtual void fill(void *out, size_t count)
+    {
+        T *elements = static_cast<T *>(out);
+        for (size_t i = 0; i < count; i++) {
+            elements[i] = randomElement<T>(random.next(),
+                                           std::is_floating_point<T>{});
+        }
+    }
+};
+
+/** Uniformly distributed in [lo, hi] (or [lo, hi) for floating point). */
+template <typename T>
+class UniformGenerator : public Generator {
+    double lo, hi;
+    Random random;
+
+public:
+    UniformGenerator(double lo, double hi, uint64_t seed)
+        : lo{lo}, hi{hi}, random{seed} {}
+
+    virtual void fill(void *out, size_t count)
+    {
+        T *elements = static_cast<T *>(out);
+        double width = std::is_floating_point<T>::value ? hi - lo :
+                                                          hi - lo + 1;
+        for (size_t i = 0; i < count; i++) {
+            double value = lo + random.nextDouble() * width;
+            if (!std::is_floating_point<T>::value)
+                value = std::floor(value);
+            elements[i] = toElement<T>(value);
+        }
+    }
+};
+
+/** Normally distributed, using the Box-Muller transform. */
+template <typename T>
+class NormalGenerator : public Generator {
+    double mean, stddev;
+    Random random;
+
+public:
+    NormalGenerator(double mean, double stddev, uint64_t seed)
+        : mean{mean}, stddev{stddev}, random{seed} {}
+
+    virtual void fill(void *out, size_t count)
+    {
+        T *elements = static_cast<T *>(out);
+        for (size_t i = 0; i < count; i += 2) {
+            double u1 = 1.0 - random.nextDouble(); // Avoid log(0)
+            double u2 = random.nextDouble();
+            double r = std::sqrt(-2.0 * std::log(u1));
+            elements[i] = toElement<T>(mean + stddev * r *
+                                       std::cos(2 * M_PI * u2));
+            if (i + 1 < count) {
+                elements[i + 1] = toElement<T>(mean + stddev * r *
+                                               std::sin(2 * M_PI * u2));
+            }
+        }
+    }
+};
+
+/**
+ * Ranks from 1 to n following Zipf's law with exponent s, using
+ * rejection-inversion sampling (Hormann and Derflinger), which takes constant
+ * time per element for any n.
+ */
+template <typename T>
+class ZipfGenerator : public Generator {
+    double n, s;
+    double hIntegralX1, hIntegralN, threshold;
+    Random random;
+
+    static double helper1(double x)
+    {
+        return std::fabs(x) > 1e-8 ? std::log1p(x) / x :
+                                     1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+    }
+
+    static double helper2(double x)
+    {
+        return std::fabs(x) > 1e-8 ?
+            std::expm1(x) / x :
+            1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+    }
+
+    double h(double x) const { return std::exp(-s * std::log(x)); }
+
+    double hIntegral(double x) const
+    {
+        double logX = std::log(x);
+        return helper2((1 - s) * logX) * logX;
+    }
+
+    double hIntegralInverse(double x) const
+    {
+        double t = std::max(x * (1 - s), -1.0);
+        return std::exp(helper1(t) * x);
+    }
+
+public:
+    ZipfGenerator(double n, double s, uint64_t seed)
+        : n{n}, s{s}, random{seed}
+    {
+        hIntegralX1 = hIntegral(1.5) - 1;
+        hIntegralN = hIntegral(n + 0.5);
+        threshold = 2 - hIntegralInverse(hIntegral(2.5) - h(2));
+    }
+
+    virtual void fill(void *out, size_t count)
+    {
+        T *elements = static_cast<T *>(out);
+        for (size_t i = 0; i < count; i++) {
+            double k;
+            for (;;) {
+                double u = hIntegralN +
+                           random.nextDouble() * (hIntegralX1 - hIntegralN);
+                double x = hIntegralInverse(u);
+                k = std::min(std::max(std::floor(x + 0.5), 1.0), n);
+                if (k - x <= threshold || u >= hIntegral(k + 0.5) - h(k))
+                    break;
+            }
+            elements[i] = toElement<T>(k);
+        }
+    }
+};
+
+/** Runs of the given length of sorted random elements. */
+template <typename T>
+class RunsGenerator : public Generator {
+    RandomGenerator<T> random;
+    std::vector<T> run;
+    size_t position;
+
+public:
+    RunsGenerator(size_t length, uint64_t seed)
+        : random{seed}, run(length), position{length} {}
+
+    virtual void fill(void *out, size_t count)
+    {
+        T *elements = static_cast<T *>(out);
+        for (size_t i = 0; i < count; i++) {
+            if (position == run.size()) {
+                random.fill(run.data(), run.size());
+                std::sort(run.begin(), run.end());
+                position = 0;
+            }
+            elements[i] = run[position++];
+        }
+    }
+};
+
+/**
+ * A parameter of a kind. Seeds and lengths are integers, which are kept as
+ * they are rather than going through a double.
+ */
+class Param {
+public:
+    double number;
+    uint64_t integer;
+};
+
+/** Return whether a parameter of a kind is a seed. */
+static bool isSeed(Kind kind, size_t i)
+{
+    switch (kind) {
+        case Kind::RANDOM:
+            return i == 0;
+        case Kind::UNIFORM:
+        case Kind::NORMAL:
+        case Kind::ZIPF:
+            return i == 2;
+        case Kind::RUNS:
+            return i == 1;
+        default:
+            return false;
+    }
+}
+
+/** Return whether a parameter of a kind is a run length. */
+static bool isLength(Kind kind, size_t i)
+{
+    return kind == Kind::RUNS && i == 0;
+}
+
+/** Get a parameter or its default value if it wasn't given. */
+static double param(const std::vector<Param> &params, size_t i,
+                    double defaultValue)
+{
+    return i < params.size() ? params[i].number : defaultValue;
+}
+
+/** Get an integer parameter or its default value if it wasn't given. */
+static uint64_t integerParam(const std::vector<Param> &params, size_t i,
+                             uint64_t defaultValue)
+{
+    return i < params.size() ? params[i].integer : defaultValue;
+}
+
+template <typename T>
+static Generator *createGenerator(Kind kind, const std::vector<Param> &params)
+{
+    switch (kind) {
+        case Kind::ZEROS:
+            return new SequentialGenerator<T>{0, 0};
+        case Kind::SEQUENTIAL:
+            return new SequentialGenerator<T>{param(params, 0, 0),
+                                              param(params, 1, 1)};
+        case Kind::RANDOM:
+            return new RandomGenerator<T>{integerParam(params, 0, 0)};
+        case Kind::UNIFORM:
+            return new UniformGenerator<T>{param(params, 0, 0),
+                                           param(params, 1, 1),
+                                           integerParam(params, 2, 0)};
+        case Kind::NORMAL:
+            return new NormalGenerator<T>{param(params, 0, 0),
+                                          param(params, 1, 1),
+                                          integerParam(params, 2, 0)};
+        case Kind::ZIPF:
+            return new ZipfGenerator<T>{param(params, 0, 1000),
+                                        param(params, 1, 1),
+                                        integerParam(params, 2, 0)};
+        case Kind::RUNS:
+            return new RunsGenerator<T>{integerParam(params, 0, 16),
+                                        integerParam(params, 1, 0)};
+    }
+    return nullptr;
+}
+
+static Generator *createGenerator(Kind kind, ElementType type,
+                                  const std::vector<Param> &params)
+{
+    switch (type) {
+        case ElementType::INT8:
+            return createGenerator<int8_t>(kind, params);
+        case ElementType::INT16:
+            return createGenerator<int16_t>(kind, params);
+        case ElementType::INT32:
+            return createGenerator<int32_t>(kind, params);
+        case ElementType::INT64:
+            return createGenerator<int64_t>(kind, params);
+        case ElementType::UINT8:
+            return createGenerator<uint8_t>(kind, params);
+        case ElementType::UINT16:
+            return createGenerator<uint16_t>(kind, params);
+        case ElementType::UINT32:
+            return createGenerator<uint32_t>(kind, params);
+        case ElementType::UINT64:
+            return createGenerator<uint64_t>(kind, params);
+        case ElementType::FLOAT32:
+            return createGenerator<float>(kind, params);
+        case ElementType::FLOAT64:
+            return createGenerator<double>(kind, params);
+    }
+    return nullptr;
+}
+
+/**
+ * Generate count elements at the given address. Memory shared with the tracee
+ * is generated into directly; anything else goes through a buffer.
+ */
+static int generate(Tracee &tracee, void *address, size_t count,
+                    size_t elementSize, Generator &generator)
+{
+    if (count > SIZE_MAX / elementSize) {
+        fprintf(stderr, "too many elements\n");
+        return 1;
+    }
+
+    size_t size = count * elementSize;
+    if (tracee.getMemory().contains(address, size)) {
+        generator.fill(address, count);
+        return 0;
+    }
+
+    static std::vector<unsigned char> chunk(CHUNK_SIZE);
+    size_t chunkElements = CHUNK_SIZE / elementSize;
+    auto dest = static_cast<unsigned char *>(address);
+    while (count > 0) {
+        size_t n = std::min(count, chunkElements);
+        generator.fill(chunk.data(), n);
+        if (tracee.writeMemory(dest, chunk.data(), n * elementSize))
+            return 1;
+        dest += n * elementSize;
+        count -= n;
+    }
+    return 0;
+}
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName
+       << " address count kind [type] [parameters...]";
+    return ss.str();
+}
+
+BUILTIN_FUNC(gen)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf("Fill memory with count elements of the given type (u32 for integer kinds\n"
+               "and f64 for distributions by default) and kind:\n"
+               "  zeros\n"
+               "  seq [start [step]] -- start, start + step, ...\n"
+               "  random [seed] -- random bits, or [0, 1) for floats\n"
+               "  uniform [lo hi [seed]] -- uniformly distributed in [lo, hi]\n"
+               "  normal [mean stddev [seed]] -- normally distributed\n"
+               "  zipf [n [s [seed]]] -- ranks 1 to n following Zipf's law with exponent s\n"
+               "  runs [length [seed]] -- sorted runs of random elements\n"
+               "Types: i8, i16, i32, i64, u8, u16, u32, u64, f32, f64\n");
+        return 0;
+    }
+
+    if (args.size() < 3) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    void *address;
+    if (checkAddress(*args[0], env, address))
+        return 1;
+
+    if (checkValueType(*args[1], Builtins::ValueType::INTEGER,
+                       "expected element count", env.errorContext))
+        return 1;
+    if (args[1]->getInteger() < 0) {
+        env.errorContext.printMessage("element count must not be negative",
+                                      args[1]->getStart());
+        return 1;
+    }
+    size_t count = args[1]->getInteger();
+
+    if (checkValueType(*args[2], Builtins::ValueType::IDENTIFIER,
+                       "expected kind", env.errorContext))
+        return 1;
+    const std::string &kindStr = args[2]->getIdentifier();
+    if (!kindMap.count(kindStr)) {
+        env.errorContext.printMessage("invalid kind", args[2]->getStart());
+        return 1;
+    }
+    Kind kind = kindMap[kindStr];
+
+    size_t i = 3;
+    ElementType type = (kind == Kind::UNIFORM || kind == Kind::NORMAL) ?
+                       ElementType::FLOAT64 : ElementType::UINT32;
+    if (i < args.size() &&
+        args[i]->getType() == Builtins::ValueType::IDENTIFIER) {
+        if (checkElementType(*args[i++], env.errorContext, type))
+            return 1;
+    }
+
+    std::vector<Param> params;
+    for (; i < args.size(); i++) {
+        const Builtins::ValueAST &arg = *args[i];
+        size_t index = params.size();
+        Param value{0, 0};
+        if (isSeed(kind, index)) {
+            if (checkValueType(arg, Builtins::ValueType::INTEGER,
+                               "expected integer seed", env.errorContext))
+                return 1;
+            if (arg.getInteger() < 0) {
+                env.errorContext.printMessage("seed must not be negative",
+                                              arg.getStart());
+                return 1;
+            }
+            value.integer = arg.getInteger();
+        } else if (isLength(kind, index)) {
+            if (checkValueType(arg, Builtins::ValueType::INTEGER,
+                               "expected integer run length",
+                               env.errorContext))
+                return 1;
+            if (arg.getInteger() < 1) {
+                env.errorContext.printMessage("run length must be positive",
+                                              arg.getStart());
+                return 1;
+            }
+            if (static_cast<uint64_t>(arg.getInteger()) > count) {
+                env.errorContext.printMessage(
+                    "run length must not be more than the count",
+                    arg.getStart());
+                return 1;
+            }
+            value.integer = arg.getInteger();
+        } else if (checkNumber(arg, "expected number", env.errorContext,
+                               value.number))
+            return 1;
+        params.push_back(value);
+    }
+
+    if (kind == Kind::ZIPF && (param(params, 0, 1000) < 1 ||
+                               param(params, 1, 1) <= 0)) {
+        env.errorContext.printMessage("zipf needs n >= 1 and s > 0",
+                                      args[2]->getStart());
+        return 1;
+    }
+    std::unique_ptr<Generator> generator{createGenerator(kind, type, params)};
+    return generate(env.tracee, address, count, getElementSize(type),
+                    *generator);
+}
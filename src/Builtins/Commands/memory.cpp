@@ -171,10 +171,10 @@ static int dumpStrings(MemoryStreamer &memStr, size_t repeat)
     return (error) ? 1 : 0;
 }
 
-static int doDump(pid_t pid, Builtins::ErrorContext &errorContext,
+static int doDump(Tracee &tracee, Builtins::ErrorContext &errorContext,
            void *address, size_t repeat, Format format, size_t size)
 {
-    MemoryStreamer memStr{pid, address};
+    MemoryStreamer memStr{tracee, address};
 
     switch (format) {
         case Format::DECIMAL:
@@ -311,11 +311,8 @@ BUILTIN_FUNC(memory)
 
     // Address
     if (args.size() > 0) {
-        if (checkValueType(*args[0], Builtins::ValueType::INTEGER,
-                        "expected address", env.errorContext))
+        if (checkAddress(*args[0], env, address))
             return 1;
-
-        address = reinterpret_cast<void *>(args[0]->getInteger());
     }
 
     // Repeat count
@@ -374,7 +371,7 @@ BUILTIN_FUNC(memory)
         size = sizeMap[sizeStr];
     }
 
-    if (doDump(env.tracee.getPid(), env.errorContext, address, repeat, format, size))
+    if (doDump(env.tracee, env.errorContext, address, repeat, format, size))
         return 1;
 
     return 0;
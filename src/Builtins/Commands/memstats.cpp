@@ -0,0 +1,395 @@
+/*
+ * memstats built-in command for summarizing arrays in memory.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Parallel.h"
+#include "Tracee.h"
+
+using Builtins::ElementType;
+
+/** Size of the chunks that memory is read in. */
+static const size_t CHUNK_SIZE = 16 * 1024 * 1024;
+
+/** Minimum number of bytes for each thread to work on. */
+static const size_t MIN_BYTES_PER_THREAD = 1024 * 1024;
+
+/**
+ * Number of bytes which Summary::add() makes all of its passes over before
+ * moving on, so that only the first pass has to go to memory.
+ */
+static const size_t SUMMARY_BLOCK_SIZE = 16 * 1024;
+
+static const int HISTOGRAM_BUCKETS = 16;
+
+/** Width of the histogram bars. */
+static const int HISTOGRAM_WIDTH = 40;
+
+/**
+ * Type to add up elements in. Small integers are added up in 64 bits so that
+ * the sum can be vectorized without overflowing for any realistic count;
+ * 64-bit integers need more room than that, so their sums aren't vectorized.
+ */
+template <typename T> struct SumType { typedef long double type; };
+template <> struct SumType<int8_t> { typedef int64_t type; };
+template <> struct SumType<int16_t> { typedef int64_t type; };
+template <> struct SumType<int32_t> { typedef int64_t type; };
+template <> struct SumType<uint8_t> { typedef uint64_t type; };
+template <> struct SumType<uint16_t> { typedef uint64_t type; };
+template <> struct SumType<uint32_t> { typedef uint64_t type; };
+template <> struct SumType<float> { typedef double type; };
+template <> struct SumType<double> { typedef double type; };
+
+/** An element which might not be aligned. */
+template <typename T> struct Unaligned {
+    typedef T type __attribute__((aligned(1)));
+};
+
+/** Count the set bits in a buffer a byte at a time so that it vectorizes. */
+static uint64_t countBits(const unsigned char *bytes, size_t size)
+{
+    uint64_t total = 0;
+#pragma omp simd reduction(+:total)
+    for (size_t i = 0; i < size; i++) {
+        unsigned char b = bytes[i];
+        b = b - ((b >> 1) & 0x55);
+        b = (b & 0x33) + ((b >> 2) & 0x33);
+        total += (b + (b >> 4)) & 0x0f;
+    }
+    return total;
+}
+
+/**
+ * Statistics over some elements. NaNs are only counted.
+ *
+ * Each statistic is gathered in its own pass over a block of elements without
+ * any branches so that every pass can be vectorized. The loops are marked with
+ * "omp simd" (which needs -fopenmp-simd but no OpenMP runtime) since the
+ * compiler won't reorder floating point minimums, maximums, and sums on its
+ * own.
+ */
+template <typename T>
+class Summary {
+    typedef typename Unaligned<T>::type Element;
+    typedef typename SumType<T>::type Sum;
+
+    /** Identity of min(), which also stands in for NaNs. */
+    static T highest()
+    {
+        return std::numeric_limits<T>::has_infinity ?
+               std::numeric_limits<T>::infinity() :
+               std::numeric_limits<T>::max();
+    }
+
+    /** Identity of max(), which also stands in for NaNs. */
+    static T lowest()
+    {
+        return std::numeric_limits<T>::has_infinity ?
+               -std::numeric_limits<T>::infinity() :
+               std::numeric_limits<T>::lowest();
+    }
+
+    void addBlock(const Element *x, size_t n)
+    {
+        popcount += countBits(reinterpret_cast<const unsigned char *>(x),
+                              n * sizeof(T));
+
+        uint64_t newNans = 0;
+        if (std::is_floating_point<T>::value) {
+#pragma omp simd reduction(+:newNans)
+            for (size_t i = 0; i < n; i++)
+                newNans += x[i] != x[i];
+        }
+        nans += newNans;
+        count += n - newNans;
+
+        T lo = min, hi = max;
+#pragma omp simd reduction(min:lo) reduction(max:hi)
+        for (size_t i = 0; i < n; i++) {
+            T value = x[i];
+            lo = std::min(lo, value == value ? value : highest());
+            hi = std::max(hi, value == value ? value : lowest());
+        }
+        min = lo;
+        max = hi;
+
+        // Most blocks don't have any NaNs to skip, and without the check,
+        // widening floats to doubles can be vectorized, too
+        Sum total = 0;
+        if (newNans == 0) {
+#pragma omp simd reduction(+:total)
+            for (size_t i = 0; i < n; i++)
+                total += static_cast<Sum>(x[i]);
+        } else {
+#pragma omp simd reduction(+:total)
+            for (size_t i = 0; i < n; i++) {
+                T value = x[i];
+                total += value == value ? static_cast<Sum>(value) : 0;
+            }
+        }
+        sum += total;
+    }
+
+public:
+    uint64_t count, nans, popcount;
+    T min, max;
+    Sum sum;
+
+    Summary()
+        : count{0}, nans{0}, popcount{0}, min{highest()}, max{lowest()},
+          sum{0} {}
+
+    void add(const T *elements, size_t n)
+    {
+        auto x = reinterpret_cast<const Element *>(elements);
+        size_t blockElements = SUMMARY_BLOCK_SIZE / sizeof(T);
+        for (size_t i = 0; i < n; i += blockElements)
+            addBlock(x + i, std::min(n - i, blockElements));
+    }
+
+    void merge(const Summary &other)
+    {
+        count += other.count;
+        nans += other.nans;
+        popcount += other.popcount;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        sum += other.sum;
+    }
+};
+
+/** Get the histogram bucket of an element between min and max. */
+template <typename T>
+static int getBucket(T x, T min, T max)
+{
+    if (max == min)
+        return 0;
+    double fraction = (static_cast<double>(x) - static_cast<double>(min)) /
+                      (static_cast<double>(max) - static_cast<double>(min));
+    return std::min(static_cast<int>(fraction * HISTOGRAM_BUCKETS),
+                    HISTOGRAM_BUCKETS - 1);
+}
+
+/**
+ * Call func(elements, n) for each chunk of count elements at the given
+ * address, splitting every chunk across threads.
+ * @return Zero on success, nonzero on failure.
+ */
+template <typename T, typename Func>
+static int forEachChunk(Tracee &tracee, const void *address, size_t count,
+                        Func func)
+{
+    static bytestring buffer;
+    size_t chunkElements = CHUNK_SIZE / sizeof(T);
+    auto src = static_cast<const unsigned char *>(address);
+    while (count > 0) {
+        size_t n = std::min(count, chunkElements);
+        const unsigned char *view = tracee.getMemoryView(src, n * sizeof(T),
+                                                         buffer);
+        if (!view)
+            return 1;
+
+        unsigned numThreads = getParallelism(n * sizeof(T),
+                                             MIN_BYTES_PER_THREAD);
+        auto elements = reinterpret_cast<const T *>(view);
+        parallelFor(n, numThreads,
+                    [&](size_t begin, size_t end, unsigned thread) {
+            func(elements + begin, end - begin, thread);
+        });
+
+        src += n * sizeof(T);
+        count -= n;
+    }
+    return 0;
+}
+
+template <typename T>
+static void printElement(const char *label, T x)
+{
+    if (std::is_floating_point<T>::value)
+        printf("%s%.9g", label, static_cast<double>(x));
+    else if (std::is_signed<T>::value)
+        printf("%s%" PRId64, label, static_cast<int64_t>(x));
+    else
+        printf("%s%" PRIu64, label, static_cast<uint64_t>(x));
+}
+
+template <typename T>
+static int memoryStats(Tracee &tracee, const void *address, size_t count)
+{
+    // First pass: everything but the histogram
+    unsigned maxThreads = getParallelism(SIZE_MAX, 1);
+    std::vector<Summary<T>> partial(maxThreads);
+    if (forEachChunk<T>(tracee, address, count,
+                        [&](const T *elements, size_t n, unsigned thread) {
+            partial[thread].add(elements, n);
+        }))
+        return 1;
+
+    Summary<T> summary;
+    for (const Summary<T> &part : partial)
+        summary.merge(part);
+
+    printf("count: %" PRIu64, summary.count);
+    if (summary.nans)
+        printf("  nan: %" PRIu64, summary.nans);
+    printf("\n");
+    if (summary.count == 0)
+        return 0;
+
+    printElement("min: ", summary.min);
+    printElement("  max: ", summary.max);
+    printf("\n");
+    if (std::is_floating_point<T>::value)
+        printf("sum: %.9Lg", static_cast<long double>(summary.sum));
+    else
+        printf("sum: %.0Lf", static_cast<long double>(summary.sum));
+    printf("  mean: %.9Lg\n",
+           static_cast<long double>(summary.sum) / summary.count);
+    printf("popcount: %" PRIu64 "\n", summary.popcount);
+
+    // Second pass: the histogram, now that the range is known
+    std::vector<std::vector<uint64_t>> buckets(
+        maxThreads, std::vector<uint64_t>(HISTOGRAM_BUCKETS));
+    T min = summary.min, max = summary.max;
+    if (forEachChunk<T>(tracee, address, count,
+                        [&](const T *elements, size_t n, unsigned thread) {
+            std::vector<uint64_t> &local = buckets[thread];
+            for (size_t i = 0; i < n; i++) {
+                T x;
+                memcpy(&x, &elements[i], sizeof(T));
+                if (x == x)
+                    local[getBucket(x, min, max)]++;
+            }
+        }))
+        return 1;
+
+    std::vector<uint64_t> histogram(HISTOGRAM_BUCKETS);
+    uint64_t biggest = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        for (const std::vector<uint64_t> &local : buckets)
+            histogram[i] += local[i];
+        biggest = std::max(biggest, histogram[i]);
+    }
+
+    double width = (static_cast<double>(max) - static_cast<double>(min)) /
+                   HISTOGRAM_BUCKETS;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (max == min && i > 0)
+            break;
+        printf("  %-12.6g %12" PRIu64 " ", static_cast<double>(min) + i * width,
+               histogram[i]);
+        int bar = biggest ? histogram[i] * HISTOGRAM_WIDTH / biggest : 0;
+        for (int j = 0; j < bar; j++)
+            putchar('#');
+        printf("\n");
+    }
+
+    return 0;
+}
+
+static int memoryStats(Tracee &tracee, const void *address, size_t count,
+                       ElementType type)
+{
+    switch (type) {
+        case ElementType::INT8:
+            return memoryStats<int8_t>(tracee, address, count);
+        case ElementType::INT16:
+            return memoryStats<int16_t>(tracee, address, count);
+        case ElementType::INT32:
+            return memoryStats<int32_t>(tracee, address, count);
+        case ElementType::INT64:
+            return memoryStats<int64_t>(tracee, address, count);
+        case ElementType::UINT8:
+            return memoryStats<uint8_t>(tracee, address, count);
+        case ElementType::UINT16:
+            return memoryStats<uint16_t>(tracee, address, count);
+        case ElementType::UINT32:
+            return memoryStats<uint32_t>(tracee, address, count);
+        case ElementType::UINT64:
+            return memoryStats<uint64_t>(tracee, address, count);
+        case ElementType::FLOAT32:
+            return memoryStats<float>(tracee, address, count);
+        case ElementType::FLOAT64:
+            return memoryStats<double>(tracee, address, count);
+    }
+    return 1;
+}
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " address count type";
+    return ss.str();
+}
+
+BUILTIN_FUNC(memstats)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf("Print the count, minimum, maximum, sum, mean, population count, and a\n"
+               "histogram of an array of count elements of the given type (i8, i16, i32,\n"
+               "i64, u8, u16, u32, u64, f32, or f64).\n");
+        return 0;
+    }
+
+    if (args.size() != 3) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    void *address;
+    if (checkAddress(*args[0], env, address))
+        return 1;
+
+    if (checkValueType(*args[1], Builtins::ValueType::INTEGER,
+                       "expected element count", env.errorContext))
+        return 1;
+    if (args[1]->getInteger() < 0) {
+        env.errorContext.printMessage("element count must not be negative",
+                                      args[1]->getStart());
+        return 1;
+    }
+    size_t count = args[1]->getInteger();
+
+    ElementType type;
+    if (checkElementType(*args[2], env.errorContext, type))
+        return 1;
+
+    return memoryStats(env.tracee, address, count, type);
+}
@@ -0,0 +1,206 @@
+/*
+ * Built-in command for NUMA placement of the tracee and its memory.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Numa.h"
+#include "Tracee.h"
+
+/** Default size of the buffer for measuring access to each node. */
+static const size_t MEASURE_SIZE = 64 << 20;
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " [cpu NODE|any] [scratch NODE|any]\n"
+       << "       " << commandName << " measure [SIZE]";
+    return ss.str();
+}
+
+/**
+ * Parse a node number or "any".
+ * @param nodeOut Set to the node, or nullptr for any node.
+ * @return Zero on success, nonzero on failure.
+ */
+static int parseNode(const Builtins::ValueAST &value,
+                     const std::vector<NumaNode> &nodes,
+                     const NumaNode *&nodeOut,
+                     Builtins::ErrorContext &errorContext)
+{
+    if (value.getType() == Builtins::ValueType::IDENTIFIER &&
+        value.getIdentifier() == "any") {
+        nodeOut = nullptr;
+        return 0;
+    }
+
+    if (checkValueType(value, Builtins::ValueType::INTEGER,
+                       "expected NUMA node or any", errorContext))
+        return 1;
+    for (const NumaNode &node : nodes) {
+        if (node.id == value.getInteger()) {
+            nodeOut = &node;
+            return 0;
+        }
+    }
+    errorContext.printMessage("no such NUMA node", value.getStart());
+    return 1;
+}
+
+/** Print the nodes and where the tracee and its scratch memory are. */
+static void printPlacement(Tracee &tracee, const std::vector<NumaNode> &nodes)
+{
+    for (const NumaNode &node : nodes) {
+        std::string cpus = formatCpuList(node.cpus);
+        printf("node %d: CPUs %s\n", node.id,
+               cpus.empty() ? "(none)" : cpus.c_str());
+    }
+
+    int pinned;
+    if (!getPinnedNumaNode(tracee.getPid(), nodes, pinned)) {
+        if (pinned == -1)
+            printf("tracee runs on any node\n");
+        else
+            printf("tracee runs on node %d\n", pinned);
+    }
+
+    const MemoryRegion &scratch = tracee.getMemory().scratch;
+    int bound;
+    if (getBoundNumaNode(scratch, bound))
+        printf("scratch policy unknown: %s\n", strerror(errno));
+    else if (bound == -1)
+        printf("scratch is allocated on the node which touches it first\n");
+    else
+        printf("scratch is bound to node %d\n", bound);
+
+    std::vector<size_t> counts;
+    if (countNumaPages(tracee.getPid(), scratch, counts)) {
+        printf("scratch placement unknown: %s\n", strerror(errno));
+        return;
+    }
+    bool touched = false;
+    for (size_t node = 0; node < counts.size(); node++) {
+        if (!counts[node])
+            continue;
+        printf("%s%zu page%s on node %zu", touched ? ", " : "scratch has ",
+               counts[node], counts[node] == 1 ? "" : "s", node);
+        touched = true;
+    }
+    printf(touched ? "\n" : "scratch hasn't been touched\n");
+}
+
+BUILTIN_FUNC(numa)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf("With no arguments, list the NUMA nodes and their CPUs, where the tracee\n"
+               "is pinned, where scratch is bound, and which nodes hold its pages. cpu\n"
+               "pins the tracee to the CPUs of a node and scratch binds the scratch\n"
+               "region to the memory of a node, moving pages which are already there;\n"
+               "any undoes either. measure reports the load latency and read bandwidth\n"
+               "of a SIZE-byte buffer (64 MiB by default) on each node from the CPUs of\n"
+               "every node.\n");
+        return 0;
+    }
+
+    std::vector<NumaNode> nodes;
+    if (getNumaNodes(nodes))
+        return 1;
+
+    if (args.empty()) {
+        printPlacement(env.tracee, nodes);
+        return 0;
+    }
+
+    if (checkValueType(*args[0], Builtins::ValueType::IDENTIFIER,
+                       "expected cpu, scratch, or measure", env.errorContext))
+        return 1;
+
+    if (args[0]->getIdentifier() == "measure") {
+        size_t size = MEASURE_SIZE;
+        if (args.size() > 2) {
+            std::string usage = getUsage(commandName);
+            env.errorContext.printMessage(usage.c_str(), commandStart);
+            return 1;
+        }
+        if (args.size() == 2) {
+            if (checkValueType(*args[1], Builtins::ValueType::INTEGER,
+                               "expected size", env.errorContext))
+                return 1;
+            if (args[1]->getInteger() <= 0) {
+                env.errorContext.printMessage("size must be positive",
+                                              args[1]->getStart());
+                return 1;
+            }
+            size = args[1]->getInteger();
+        }
+
+        std::vector<NumaAccessResult> results;
+        if (measureNumaAccess(nodes, size, results))
+            return 1;
+        printNumaAccess(stdout, results);
+        if (nodes.size() == 1)
+            printf("only one NUMA node; all memory is local\n");
+        return 0;
+    }
+
+    for (size_t i = 0; i < args.size(); i += 2) {
+        if (checkValueType(*args[i], Builtins::ValueType::IDENTIFIER,
+                           "expected cpu or scratch", env.errorContext))
+            return 1;
+        const std::string &what = args[i]->getIdentifier();
+        if (what != "cpu" && what != "scratch") {
+            env.errorContext.printMessage("expected cpu or scratch",
+                                          args[i]->getStart());
+            return 1;
+        }
+        if (i + 1 >= args.size()) {
+            env.errorContext.printMessage("expected NUMA node or any",
+                                          args[i]->getEnd());
+            return 1;
+        }
+
+        const NumaNode *node;
+        if (parseNode(*args[i + 1], nodes, node, env.errorContext))
+            return 1;
+
+        if (what == "cpu") {
+            if (pinToNumaNode(env.tracee.getPid(), node, nodes))
+                return 1;
+        } else if (nodes.size() > 1) {
+            if (bindToNumaNode(env.tracee.getMemory().scratch,
+                               node ? node->id : -1))
+                return 1;
+        } else
+            printf("only one NUMA node; scratch is always local\n");
+    }
+
+    return 0;
+}
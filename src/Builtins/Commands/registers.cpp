@@ -64,7 +64,7 @@ static std::unordered_map<std::string, RegisterCategory> categoryMap = {
 static std::string getUsage(const std::string &commandName)
 {
     std::stringstream ss;
-    ss << "usage: " << commandName << " [CATEGORY...]";
+    ss << "usage: " << commandName << " [changed] [CATEGORY...]";
     return ss.str();
 }
 
@@ -75,6 +75,7 @@ BUILTIN_FUNC(registers)
         RegisterCategory::CONDITION_CODE;
 
     RegisterCategory categories = RegisterCategory::NONE;
+    bool changedOnly = false;
 
     if (wantsHelp(args)) {
         std::string usage = getUsage(commandName);
@@ -85,7 +86,10 @@ BUILTIN_FUNC(registers)
             "  cc  -- condition code/status flag registers\n"
             "  fp  -- floating point registers\n"
             "  x   -- extra registers\n"
-            "  seg -- segment registers\n");
+            "  seg -- segment registers\n"
+            "With changed, only the registers which the last line of code "
+            "changed are\n"
+            "printed (from every category unless some are given).\n");
         return 0;
     }
 
@@ -96,6 +100,11 @@ BUILTIN_FUNC(registers)
 
         const std::string &category = arg->getIdentifier();
 
+        if (category == "changed" && &arg == &args.front()) {
+            changedOnly = true;
+            continue;
+        }
+
         RegisterCategory regCat =
             findWithDefault(categoryMap, category, RegisterCategory::NONE);
 
@@ -107,10 +116,12 @@ BUILTIN_FUNC(registers)
             categories = categories | regCat;
     }
 
-    if (!any(categories)) // This will be the case if there weren't any args
-        categories = defaultCategories;
+    if (!any(categories)) { // This will be the case if there weren't any args
+        categories = changedOnly ? ~RegisterCategory::NONE
+                                 : defaultCategories;
+    }
 
-    env.tracee.printRegisters(categories);
+    env.tracee.printRegisters(categories, changedOnly);
 
     return 0;
 }
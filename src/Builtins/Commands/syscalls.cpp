@@ -0,0 +1,76 @@
+/*
+ * syscalls built-in command for tracing system calls made by executed code.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <sstream>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Tracee.h"
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " [on|off]";
+    return ss.str();
+}
+
+BUILTIN_FUNC(syscalls)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        return 0;
+    }
+
+    if (args.size() > 1) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    if (args.size() == 1) {
+        if (checkValueType(*args[0], Builtins::ValueType::IDENTIFIER,
+                           "expected on or off", env.errorContext))
+            return 1;
+        const std::string &setting = args[0]->getIdentifier();
+        if (setting != "on" && setting != "off") {
+            env.errorContext.printMessage("expected on or off",
+                                          args[0]->getStart());
+            return 1;
+        }
+        env.tracee.setSyscallTracing(setting == "on");
+        return 0;
+    }
+
+    // Show the table for the last execution again
+    if (!env.tracee.isTracingSyscalls())
+        printf("syscall tracing is off\n");
+    else if (env.tracee.getSyscalls().empty())
+        printf("no system calls\n");
+    else
+        env.tracee.printSyscalls();
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * time built-in command for measuring how long code takes to run.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <map>
+#include <sstream>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Measurement.h"
+
+static std::map<std::string, Precondition> preconditionMap = {
+    {"warm",     Precondition::WARM},
+    {"cold",     Precondition::COLD_CACHE},
+    {"tlb",      Precondition::FLUSH_TLB},
+    {"branches", Precondition::SCRAMBLE_BRANCHES},
+};
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName
+       << " address [repeat] [warm|cold|tlb|branches [iterations]]...";
+    return ss.str();
+}
+
+BUILTIN_FUNC(time)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf("Run code from the given address (or label) to the end of the code so far\n"
+               "repeat times and print how long it took. Before each run, the\n"
+               "machine can be prepared with:\n"
+               "  warm -- run the code once first\n"
+               "  cold -- flush the code, data, and scratch regions from the caches\n"
+               "  tlb -- flush the TLB entries for the data and scratch regions\n"
+               "  branches -- run a loop of unpredictable branches (10000 iterations\n"
+               "              unless given)\n");
+        return 0;
+    }
+
+    if (args.empty()) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    void *address;
+    if (checkAddress(*args[0], env, address))
+        return 1;
+
+    MeasurementOptions options;
+    size_t i = 1;
+
+    // Repeat count
+    if (i < args.size() &&
+        args[i]->getType() == Builtins::ValueType::INTEGER) {
+        if (args[i]->getInteger() <= 0) {
+            env.errorContext.printMessage("repeat count must be positive",
+                                          args[i]->getStart());
+            return 1;
+        }
+        options.repeat = args[i++]->getInteger();
+    }
+
+    // Preconditions
+    for (; i < args.size(); i++) {
+        if (checkValueType(*args[i], Builtins::ValueType::IDENTIFIER,
+                           "expected precondition", env.errorContext))
+            return 1;
+
+        const std::string &name = args[i]->getIdentifier();
+        if (!preconditionMap.count(name)) {
+            env.errorContext.printMessage("invalid precondition",
+                                          args[i]->getStart());
+            return 1;
+        }
+        options.preconditions = options.preconditions | preconditionMap[name];
+
+        if (name == "branches" && i + 1 < args.size() &&
+            args[i + 1]->getType() == Builtins::ValueType::INTEGER) {
+            if (args[i + 1]->getInteger() <= 0) {
+                env.errorContext.printMessage("iterations must be positive",
+                                              args[i + 1]->getStart());
+                return 1;
+            }
+            options.branchIterations = args[++i]->getInteger();
+        }
+    }
+
+    MeasurementResult result;
+    int error = measureExecution(env.tracee, address, options, result);
+    if (error)
+        return error < 0 ? -1 : 1;
+
+    printMeasurement(stdout, result);
+    return 0;
+}
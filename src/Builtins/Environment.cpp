@@ -24,6 +24,7 @@
 #include "Builtins/AST.h"
 #include "Builtins/Environment.h"
 
+#include "SymbolTable.h"
 #include "Tracee.h"
 #include "RegisterValue.h"
 
@@ -34,7 +35,7 @@ ValueAST *Environment::lookupVariable(const std::string &var,
                                       std::string &errorMsg)
 {
     std::string regName = var.substr(1);
-    std::shared_ptr<RegisterValue> value = tracee.getRegisterValue(regName);
+    std::unique_ptr<RegisterValue> value = tracee.getRegisterValue(regName);
     if (value) {
         switch (value->type) {
             case RegisterType::INT8:
@@ -68,4 +69,16 @@ ValueAST *Environment::lookupVariable(const std::string &var,
     }
 }
 
+// Symbols are labels or symbols from libraries in the tracee.
+ValueAST *Environment::lookupSymbol(const std::string &name,
+                                    std::string &errorMsg)
+{
+    uintptr_t address;
+    if (!symbols.lookup(name, address)) {
+        errorMsg = "unknown symbol";
+        return nullptr;
+    }
+    return new IntegerExpr(0, 0, static_cast<long>(address));
+}
+
 }
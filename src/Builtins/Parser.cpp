@@ -150,6 +150,8 @@ ExprAST *Parser::parsePrimaryExpr()
             return parseStringExpr();
         case TokenType::VARIABLE:
             return parseVariableExpr();
+        case TokenType::AMPERSAND:
+            return parseSymbolExpr();
         case TokenType::OPEN_PAREN:
             return parseParenExpr();
         case TokenType::CLOSE_PAREN:
@@ -214,6 +216,21 @@ ExprAST *Parser::parseVariableExpr()
     return result;
 }
 
+/* See Builtins/Parser.h. */
+ExprAST *Parser::parseSymbolExpr()
+{
+    int ampersandStart = currentStart();
+    consumeToken();
+
+    if (currentType() != TokenType::IDENTIFIER)
+        return error(*currentToken(), "expected symbol name");
+
+    ExprAST *result =
+        new SymbolExpr{ampersandStart, currentEnd(), currentStr()};
+    consumeToken();
+    return result;
+}
+
 /* See Builtins/Parser.h. */
 ExprAST *Parser::parseParenExpr()
 {
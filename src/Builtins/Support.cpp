@@ -19,12 +19,31 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstdint>
+#include <map>
+
 #include "Builtins/AST.h"
+#include "Builtins/Environment.h"
 #include "Builtins/ErrorContext.h"
 #include "Builtins/Support.h"
 
+#include "SymbolTable.h"
+
 namespace Builtins {
 
+static const std::map<std::string, ElementType> elementTypeMap = {
+    {"i8",  ElementType::INT8},
+    {"i16", ElementType::INT16},
+    {"i32", ElementType::INT32},
+    {"i64", ElementType::INT64},
+    {"u8",  ElementType::UINT8},
+    {"u16", ElementType::UINT16},
+    {"u32", ElementType::UINT32},
+    {"u64", ElementType::UINT64},
+    {"f32", ElementType::FLOAT32},
+    {"f64", ElementType::FLOAT64},
+};
+
 bool checkValueType(const ValueAST &value, ValueType type,
                     const char *errorMsg, ErrorContext &errorContext)
 {
@@ -41,6 +60,78 @@ bool wantsHelp(const std::vector<std::unique_ptr<ValueAST>> &args)
            args[0]->getIdentifier() == "help";
 }
 
+bool checkAddress(const ValueAST &value, Environment &env, void *&addressOut)
+{
+    if (value.getType() == ValueType::IDENTIFIER) {
+        uintptr_t address;
+        if (!env.symbols.lookup(value.getIdentifier(), address)) {
+            env.errorContext.printMessage("unknown label", value.getStart());
+            return true;
+        }
+        addressOut = reinterpret_cast<void *>(address);
+        return false;
+    }
+
+    if (checkValueType(value, ValueType::INTEGER, "expected address",
+                       env.errorContext))
+        return true;
+    addressOut = reinterpret_cast<void *>(value.getInteger());
+    return false;
+}
+
+bool checkNumber(const ValueAST &value, const char *errorMsg,
+                 ErrorContext &errorContext, double &numberOut)
+{
+    if (value.getType() == ValueType::INTEGER)
+        numberOut = value.getInteger();
+    else if (value.getType() == ValueType::FLOAT)
+        numberOut = value.getFloat();
+    else {
+        errorContext.printMessage(errorMsg, value.getStart());
+        return true;
+    }
+    return false;
+}
+
+bool checkElementType(const ValueAST &value, ErrorContext &errorContext,
+                      ElementType &typeOut, bool allowIntegers)
+{
+    const char *errorMsg = allowIntegers ? "expected element type" :
+                                           "expected f32 or f64";
+    if (checkValueType(value, ValueType::IDENTIFIER, errorMsg, errorContext))
+        return true;
+
+    auto it = elementTypeMap.find(value.getIdentifier());
+    if (it == elementTypeMap.end() ||
+        (!allowIntegers && !isFloatType(it->second))) {
+        errorContext.printMessage(errorMsg, value.getStart());
+        return true;
+    }
+    typeOut = it->second;
+    return false;
+}
+
+size_t getElementSize(ElementType type)
+{
+    switch (type) {
+        case ElementType::INT8:
+        case ElementType::UINT8:
+            return 1;
+        case ElementType::INT16:
+        case ElementType::UINT16:
+            return 2;
+        case ElementType::INT32:
+        case ElementType::UINT32:
+        case ElementType::FLOAT32:
+            return 4;
+        case ElementType::INT64:
+        case ElementType::UINT64:
+        case ElementType::FLOAT64:
+            return 8;
+    }
+    return 0;
+}
+
 std::string escapeCharacter(char c, bool escapeSingleQuote,
                             bool escapeDoubleQuote, bool escapeBackslash)
 {
@@ -0,0 +1,129 @@
+/*
+ * Cache and TLB simulation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CacheModel.h"
+
+const uint64_t SetAssociativeCache::EMPTY;
+const uint64_t ReuseDistanceTracker::COLD;
+
+/* See CacheModel.h. */
+unsigned log2PowerOfTwo(size_t x)
+{
+    unsigned shift = 0;
+    while ((static_cast<size_t>(1) << shift) < x)
+        shift++;
+    return shift;
+}
+
+/* See CacheModel.h. */
+SetAssociativeCache::SetAssociativeCache(const CacheGeometry &geometry)
+    : sets{geometry.lines / geometry.ways}, ways{geometry.ways},
+      lineShift{log2PowerOfTwo(geometry.lineSize)},
+      tags(geometry.lines / geometry.ways * geometry.ways, EMPTY),
+      lastUsed(tags.size(), 0), clock{0} {}
+
+/* See CacheModel.h. */
+bool SetAssociativeCache::access(uint64_t address)
+{
+    uint64_t line = address >> lineShift;
+    size_t first = (line % sets) * ways;
+    size_t victim = first;
+
+    ++clock;
+    for (size_t i = first; i < first + ways; i++) {
+        if (tags[i] == line) {
+            lastUsed[i] = clock;
+            return true;
+        }
+        if (lastUsed[i] < lastUsed[victim])
+            victim = i;
+    }
+
+    tags[victim] = line;
+    lastUsed[victim] = clock;
+    return false;
+}
+
+/* See CacheModel.h. */
+uint64_t ReuseDistanceTracker::prefixSum(size_t count) const
+{
+    uint64_t sum = 0;
+    for (size_t i = count; i > 0; i -= i & -i)
+        sum += tree[i - 1];
+    return sum;
+}
+
+/* See CacheModel.h. */
+void ReuseDistanceTracker::add(size_t time, int delta)
+{
+    for (size_t i = time + 1; i <= tree.size(); i += i & -i)
+        tree[i - 1] += delta;
+}
+
+/* See CacheModel.h. */
+uint64_t ReuseDistanceTracker::access(uint64_t line)
+{
+    size_t now = tree.size();
+    uint64_t distance = COLD;
+
+    auto it = lastAccess.find(line);
+    if (it != lastAccess.end()) {
+        size_t previous = it->second;
+        distance = prefixSum(now) - prefixSum(previous + 1);
+        add(previous, -1);
+        it->second = now;
+    } else
+        lastAccess.emplace(line, now);
+
+    // Append the new access. Entry i of a Fenwick tree covers the range of
+    // times ending at i whose length is the lowest set bit of i + 1.
+    size_t i = now + 1;
+    size_t covered = i & -i;
+    tree.push_back(1 + prefixSum(now) - prefixSum(i - covered));
+    return distance;
+}
+
+/* See CacheModel.h. */
+CacheModel::CacheModel(const std::vector<CacheGeometry> &levels,
+                       const CacheGeometry *tlb, size_t lineSize)
+    : lineShift{log2PowerOfTwo(lineSize)}
+{
+    for (const CacheGeometry &geometry : levels)
+        this->levels.emplace_back(geometry);
+    if (tlb)
+        this->tlb.emplace_back(*tlb);
+}
+
+/* See CacheModel.h. */
+CacheAccessResult CacheModel::access(uint64_t address)
+{
+    CacheAccessResult result;
+
+    result.tlbHit = tlb.empty() || tlb[0].access(address);
+    result.reuseDistance = reuse.access(address >> lineShift);
+
+    // Every level up to the one that hits gets the line
+    for (result.level = 0; result.level < levels.size(); result.level++) {
+        if (levels[result.level].access(address))
+            break;
+    }
+    return result;
+}
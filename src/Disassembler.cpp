@@ -0,0 +1,235 @@
+/*
+ * Disassembler implementation built on the LLVM MC layer.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cctype>
+#include <cstdio>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/MC/MCAsmInfo.h>
+#include <llvm/MC/MCContext.h>
+#include <llvm/MC/MCDisassembler/MCDisassembler.h>
+#include <llvm/MC/MCInst.h>
+#include <llvm/MC/MCInstPrinter.h>
+#include <llvm/MC/MCInstrDesc.h>
+#include <llvm/MC/MCInstrInfo.h>
+#include <llvm/MC/MCRegisterInfo.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#if LLVM_VERSION_MAJOR >= 10
+#include <llvm/MC/MCTargetOptions.h>
+#endif
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/TargetSelect.h>
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR < 6
+#include <llvm/Support/StringRefMemoryObject.h>
+#endif
+using namespace llvm;
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 5)
+#include <memory>
+#define OwningPtr std::unique_ptr
+#endif
+
+#include "Disassembler.h"
+
+/** LLVM state for disassembling code for the host. */
+class DisassemblerContext {
+public:
+    std::string tripleName;
+    Triple triple;
+
+    const Target *target;
+    OwningPtr<MCRegisterInfo> registerInfo;
+    OwningPtr<MCAsmInfo> asmInfo;
+    OwningPtr<MCInstrInfo> instrInfo;
+    OwningPtr<MCSubtargetInfo> subtargetInfo;
+    OwningPtr<MCContext> mcCtx;
+    OwningPtr<MCDisassembler> disassembler;
+    OwningPtr<MCInstPrinter> printer;
+
+    /** Buffer for the text of an instruction. */
+    std::string text;
+
+    DisassemblerContext() : tripleName{sys::getDefaultTargetTriple()},
+                            triple{tripleName}, target{nullptr} {}
+
+    /**
+     * Create everything that we need from LLVM.
+     * @return Zero on success, nonzero on failure.
+     */
+    int init()
+    {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetDisassembler();
+
+        std::string err;
+        target = TargetRegistry::lookupTarget(tripleName, err);
+        if (!target) {
+            fprintf(stderr, "could not get target: %s\n", err.c_str());
+            return 1;
+        }
+
+        // The code runs on the host, so decode whatever the host supports
+        std::string features;
+        StringMap<bool> hostFeatureMap;
+        if (sys::getHostCPUFeatures(hostFeatureMap)) {
+            SubtargetFeatures featureList;
+            for (auto &feature : hostFeatureMap)
+                featureList.AddFeature(feature.getKey(), feature.getValue());
+            features = featureList.getString();
+        }
+
+        registerInfo.reset(target->createMCRegInfo(tripleName));
+#if LLVM_VERSION_MAJOR >= 10
+        if (registerInfo)
+            asmInfo.reset(target->createMCAsmInfo(*registerInfo, tripleName,
+                                                  MCTargetOptions{}));
+#elif LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 4)
+        if (registerInfo)
+            asmInfo.reset(target->createMCAsmInfo(*registerInfo, tripleName));
+#else
+        asmInfo.reset(target->createMCAsmInfo(tripleName));
+#endif
+        instrInfo.reset(target->createMCInstrInfo());
+        subtargetInfo.reset(target->createMCSubtargetInfo(
+            tripleName, sys::getHostCPUName(), features));
+        if (!registerInfo || !asmInfo || !instrInfo || !subtargetInfo) {
+            fprintf(stderr, "could not get target information\n");
+            return 1;
+        }
+
+#if LLVM_VERSION_MAJOR >= 13
+        mcCtx.reset(new MCContext{triple, asmInfo.get(), registerInfo.get(),
+                                  subtargetInfo.get()});
+#elif LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 4)
+        mcCtx.reset(new MCContext{asmInfo.get(), registerInfo.get(), nullptr});
+#else
+        mcCtx.reset(new MCContext{*asmInfo, *registerInfo, nullptr});
+#endif
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 6)
+        disassembler.reset(target->createMCDisassembler(*subtargetInfo,
+                                                        *mcCtx));
+#else
+        disassembler.reset(target->createMCDisassembler(*subtargetInfo));
+#endif
+        if (!disassembler) {
+            fprintf(stderr, "this target does not support disassembly\n");
+            return 1;
+        }
+
+        unsigned dialect = asmInfo->getAssemblerDialect();
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+        printer.reset(target->createMCInstPrinter(triple, dialect, *asmInfo,
+                                                  *instrInfo, *registerInfo));
+#else
+        printer.reset(target->createMCInstPrinter(dialect, *asmInfo,
+                                                  *instrInfo, *registerInfo,
+                                                  *subtargetInfo));
+#endif
+        if (!printer) {
+            fprintf(stderr, "this target does not support printing instructions\n");
+            return 1;
+        }
+
+        return 0;
+    }
+};
+
+Disassembler::Disassembler(DisassemblerContext *context) : context{context} {}
+
+Disassembler::~Disassembler() {}
+
+/* See Disassembler.h. */
+std::shared_ptr<Disassembler> Disassembler::createDisassembler()
+{
+    OwningPtr<DisassemblerContext> context{new DisassemblerContext};
+    if (context->init())
+        return {nullptr};
+    return std::shared_ptr<Disassembler>{new Disassembler{context.release()}};
+}
+
+/* See Disassembler.h. */
+int Disassembler::disassemble(const unsigned char *machineCode, size_t size,
+                              uintptr_t address,
+                              DecodedInstruction &instructionOut)
+{
+    MCInst inst;
+    uint64_t length;
+    MCDisassembler::DecodeStatus status;
+
+#if LLVM_VERSION_MAJOR >= 10
+    status = context->disassembler->getInstruction(
+        inst, length, ArrayRef<uint8_t>{machineCode, size}, address, nulls());
+#elif LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 6)
+    status = context->disassembler->getInstruction(
+        inst, length, ArrayRef<uint8_t>{machineCode, size}, address, nulls(),
+        nulls());
+#else
+    StringRefMemoryObject region{
+        StringRef{reinterpret_cast<const char *>(machineCode), size},
+        address};
+    status = context->disassembler->getInstruction(inst, length, region,
+                                                   address, nulls(), nulls());
+#endif
+    if (status != MCDisassembler::Success)
+        return 1;
+
+    context->text.clear();
+    raw_string_ostream textStream{context->text};
+#if LLVM_VERSION_MAJOR >= 10
+    context->printer->printInst(&inst, address, "", *context->subtargetInfo,
+                                textStream);
+#elif LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 8)
+    context->printer->printInst(&inst, textStream, "",
+                                *context->subtargetInfo);
+#else
+    context->printer->printInst(&inst, textStream, "");
+#endif
+    textStream.flush();
+
+    // The printer indents the instruction and separates its operands with a
+    // tab
+    instructionOut.text.clear();
+    for (char c : context->text) {
+        if (isspace(c)) {
+            if (!instructionOut.text.empty() &&
+                instructionOut.text.back() != ' ')
+                instructionOut.text += ' ';
+        } else
+            instructionOut.text += c;
+    }
+    if (!instructionOut.text.empty() && instructionOut.text.back() == ' ')
+        instructionOut.text.pop_back();
+
+    const MCInstrDesc &desc = context->instrInfo->get(inst.getOpcode());
+    instructionOut.length = length;
+    instructionOut.isBranch = desc.isBranch();
+    instructionOut.isConditionalBranch = desc.isConditionalBranch();
+    instructionOut.isCall = desc.isCall();
+    instructionOut.isReturn = desc.isReturn();
+    instructionOut.memoryOperands.clear();
+    return decodePlatformMemoryOperands(inst, *context->instrInfo,
+                                        *context->registerInfo,
+                                        instructionOut);
+}
@@ -0,0 +1,86 @@
+/*
+ * ELF reader implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "ElfReader.h"
+
+/* See ElfReader.h. */
+ElfReader::ElfReader(const void *data, size_t size)
+    : data{static_cast<const unsigned char *>(data)}, size{size},
+      header{nullptr}, sections{nullptr}, segments{nullptr}
+{
+    if (size < sizeof(ElfW(Ehdr)))
+        return;
+
+    auto ehdr = reinterpret_cast<const ElfW(Ehdr) *>(data);
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELF_NATIVE_CLASS)
+        return;
+
+    header = ehdr;
+
+    // A file without a section header table is still valid, it just doesn't
+    // have any sections
+    if (ehdr->e_shoff && ehdr->e_shentsize == sizeof(ElfW(Shdr)) &&
+        ehdr->e_shoff <= size &&
+        ehdr->e_shnum <= (size - ehdr->e_shoff) / sizeof(ElfW(Shdr)))
+        sections = reinterpret_cast<const ElfW(Shdr) *>(this->data + ehdr->e_shoff);
+
+    // Likewise for the program header table, which only linked files have
+    if (ehdr->e_phoff && ehdr->e_phentsize == sizeof(ElfW(Phdr)) &&
+        ehdr->e_phoff <= size &&
+        ehdr->e_phnum <= (size - ehdr->e_phoff) / sizeof(ElfW(Phdr)))
+        segments = reinterpret_cast<const ElfW(Phdr) *>(this->data + ehdr->e_phoff);
+}
+
+/* See ElfReader.h. */
+const unsigned char *ElfReader::getContents(const ElfW(Shdr) &section) const
+{
+    if (section.sh_type == SHT_NOBITS || section.sh_offset > size ||
+        section.sh_size > size - section.sh_offset)
+        return nullptr;
+    return data + section.sh_offset;
+}
+
+/* See ElfReader.h. */
+const char *ElfReader::getSectionName(const ElfW(Shdr) &section) const
+{
+    return getString(header->e_shstrndx, section.sh_name);
+}
+
+/* See ElfReader.h. */
+const char *ElfReader::getString(size_t strtab, size_t offset) const
+{
+    if (strtab >= numSections())
+        return "";
+
+    const ElfW(Shdr) &section = sections[strtab];
+    const unsigned char *contents = getContents(section);
+    if (!contents || offset >= section.sh_size)
+        return "";
+
+    // Make sure the string is terminated inside of the section
+    const char *str = reinterpret_cast<const char *>(contents + offset);
+    if (!memchr(str, '\0', section.sh_size - offset))
+        return "";
+    return str;
+}
@@ -62,8 +62,16 @@ int Inputter::redirectInput(const std::string &filename)
 std::string Inputter::readLine(const std::string &prompt)
 {
     std::string line;
+    readLine(prompt.c_str(), line);
+    return line;
+}
+
+/* See Inputter.h. */
+void Inputter::readLine(const char *prompt, std::string &lineOut)
+{
     bool gotLine = false;
 
+    lineOut.clear();
     do {
         FILE *file = files.back().file;
         ssize_t size;
@@ -74,16 +82,16 @@ std::string Inputter::readLine(const std::string &prompt)
                     perror("getline");
                 files.pop_back();
             } else {
-                line = std::string{lineBuffer, static_cast<size_t>(size)};
+                lineOut.assign(lineBuffer, size);
                 gotLine = true;
             }
         } else { // stdin sentinel
             char *cline;
-            if ((cline = readline(prompt.c_str()))) {
+            if ((cline = readline(prompt))) {
                 if (*cline) // If the line isn't empty, add it to the history
                     add_history(cline);
-                line = cline;
-                line += '\n';
+                lineOut.assign(cline);
+                lineOut += '\n';
                 free(cline);
             }
             gotLine = true;
@@ -91,7 +99,6 @@ std::string Inputter::readLine(const std::string &prompt)
     } while (!gotLine);
 
     ++files.back().lineno;
-    return line;
 }
 
 /* See Inputter.h. */
@@ -0,0 +1,343 @@
+/*
+ * Timing code in the tracee and preconditioning the machine for it.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <memory>
+#include <numeric>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "Measurement.h"
+#include "Numa.h"
+#include "Stats.h"
+#include "Tracee.h"
+
+#if !defined(__x86_64__) && !defined(__i386__)
+/** Size of the buffer swept to evict the caches without clflush. */
+static const size_t EVICTION_BUFFER_SIZE = 64 * 1024 * 1024;
+#endif
+
+/** Maximum number of runs used to measure the overhead. */
+static const size_t MAX_OVERHEAD_RUNS = 1000;
+
+/**
+ * Turns syscall tracing off for as long as it is in scope, so that runs which
+ * are being timed don't stop at every system call or print a table for it.
+ */
+class SyscallTracingPause {
+    Tracee &tracee;
+    bool wasTracingSyscalls;
+
+public:
+    SyscallTracingPause(Tracee &tracee)
+        : tracee(tracee), wasTracingSyscalls{tracee.isTracingSyscalls()}
+    {
+        tracee.setSyscallTracing(false);
+    }
+
+    ~SyscallTracingPause()
+    {
+        tracee.setSyscallTracing(wasTracingSyscalls);
+    }
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Flush every cache line of a region which is backed by memory. The regions
+ * are shared with the tracee, so flushing them here flushes them for it, too.
+ */
+static int flushRegion(const MemoryRegion &region,
+                       std::vector<unsigned char> &resident)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    long lineSize = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+    if (lineSize <= 0)
+        lineSize = 64;
+
+    size_t numPages = (region.size + pageSize - 1) / pageSize;
+    resident.resize(numPages);
+    if (mincore(region.address, region.size, resident.data()) == -1) {
+        perror("mincore");
+        return 1;
+    }
+
+    auto base = static_cast<unsigned char *>(region.address);
+    for (size_t i = 0; i < numPages; i++) {
+        if (!(resident[i] & 1))
+            continue;
+        for (size_t j = 0; j < pageSize; j += lineSize)
+            __asm__ volatile ("clflush %0" : "+m" (base[i * pageSize + j]));
+    }
+    return 0;
+}
+#endif
+
+/** Get the code, data, and scratch regions out of the caches. */
+static int flushCaches(Tracee &tracee)
+{
+    const TraceeMemory &memory = tracee.getMemory();
+#if defined(__x86_64__) || defined(__i386__)
+    static std::vector<unsigned char> resident;
+    if (flushRegion(memory.code, resident) ||
+        flushRegion(memory.data, resident) ||
+        flushRegion(memory.scratch, resident))
+        return 1;
+    __asm__ volatile ("mfence" ::: "memory");
+#else
+    // Without a way to flush a line, write to a buffer bigger than the caches
+    // instead. This only evicts the caches which we share with the tracee.
+    (void) memory;
+    static std::vector<unsigned char> evictionBuffer(EVICTION_BUFFER_SIZE);
+    for (size_t i = 0; i < evictionBuffer.size(); i += 64)
+        evictionBuffer[i]++;
+#endif
+    return 0;
+}
+
+/**
+ * Flush the tracee's TLB entries for the data and scratch regions by taking
+ * away and giving back write access, which has to be done from inside of the
+ * tracee.
+ */
+static int flushTLB(Tracee &tracee)
+{
+    const TraceeMemory &memory = tracee.getMemory();
+    SyscallRecord call{};
+    call.number = SYS_mprotect;
+    call.args[0] = reinterpret_cast<uintptr_t>(memory.data.address);
+    call.args[1] = memory.data.size + memory.scratch.size;
+
+    call.args[2] = PROT_READ;
+    if (tracee.injectSyscall(call))
+        return 1;
+    call.args[2] = PROT_READ | PROT_WRITE;
+    if (tracee.injectSyscall(call))
+        return 1;
+    if (call.ret != 0) {
+        fprintf(stderr, "mprotect in tracee failed (%ld)\n", call.ret);
+        return 1;
+    }
+    return 0;
+}
+
+/* See Measurement.h. */
+int precondition(Tracee &tracee, void *address,
+                 const MeasurementOptions &options)
+{
+    Precondition preconditions = options.preconditions;
+    SyscallTracingPause pause{tracee};
+
+    // Warm up first so that the others can undo parts of it
+    if (any(preconditions & Precondition::WARM) &&
+        tracee.executeInstruction(address))
+        return 1;
+    if (any(preconditions & Precondition::SCRAMBLE_BRANCHES) &&
+        tracee.scrambleBranchPredictors(options.branchIterations))
+        return 1;
+    if (any(preconditions & Precondition::FLUSH_TLB) && flushTLB(tracee))
+        return 1;
+    if (any(preconditions & Precondition::COLD_CACHE) && flushCaches(tracee))
+        return 1;
+    return 0;
+}
+
+/** Get the median of some samples, reordering them. */
+static uint64_t median(std::vector<uint64_t> &samples)
+{
+    if (samples.empty())
+        return 0;
+    auto middle = samples.begin() + samples.size() / 2;
+    std::nth_element(samples.begin(), middle, samples.end());
+    return *middle;
+}
+
+/* See Measurement.h. */
+int measureOverhead(Tracee &tracee, size_t runs, uint64_t &overheadOut)
+{
+    int error;
+
+    void *trap = tracee.getTrapAddress();
+    if (!trap)
+        return 1;
+    SyscallTracingPause pause{tracee};
+    std::vector<uint64_t> overhead;
+    for (size_t i = 0; i < runs; i++) {
+        uint64_t start = getMonotonicNs();
+        if ((error = tracee.executeInstruction(trap)))
+            return error;
+        overhead.push_back(getMonotonicNs() - start);
+    }
+    overheadOut = median(overhead);
+    return 0;
+}
+
+/* See Measurement.h. */
+int measureExecution(Tracee &tracee, void *address,
+                     const MeasurementOptions &options,
+                     MeasurementResult &resultOut)
+{
+    int error;
+    SyscallTracingPause pause{tracee};
+
+    size_t overheadRuns = std::min(std::max<size_t>(options.repeat, 10),
+                                   MAX_OVERHEAD_RUNS);
+    if ((error = measureOverhead(tracee, overheadRuns, resultOut.overheadNs)))
+        return error;
+
+    resultOut.samplesNs.clear();
+    for (size_t i = 0; i < options.repeat; i++) {
+        if (precondition(tracee, address, options))
+            return 1;
+
+        uint64_t start = getMonotonicNs();
+        if ((error = tracee.executeInstruction(address)))
+            return error;
+        uint64_t elapsed = getMonotonicNs() - start;
+
+        resultOut.samplesNs.push_back(elapsed > resultOut.overheadNs ?
+                                      elapsed - resultOut.overheadNs : 0);
+    }
+
+    return 0;
+}
+
+/* See Measurement.h. */
+void printMeasurement(FILE *file, const MeasurementResult &result)
+{
+    if (result.samplesNs.empty())
+        return;
+
+    std::vector<uint64_t> samples = result.samplesNs;
+    uint64_t min = *std::min_element(samples.begin(), samples.end());
+    double mean = std::accumulate(samples.begin(), samples.end(), 0.0) /
+                  samples.size();
+    uint64_t med = median(samples);
+
+    fprintf(file, "runs: %zu  min: %" PRIu64 " ns  median: %" PRIu64
+            " ns  mean: %.1f ns  (overhead: %" PRIu64 " ns)\n",
+            samples.size(), min, med, mean, result.overheadNs);
+}
+
+/**
+ * Run timed calls to a function in a tracee with no other parties.
+ * @return Zero on success, positive on error, negative on fatal error.
+ */
+static int timeCallsAlone(Tracee &tracee, uintptr_t function,
+                          unsigned long count, uint64_t &ticksOut)
+{
+    if (tracee.startTimedCalls(function, count, 1, 0))
+        return 1;
+    return tracee.finishTimedCalls(ticksOut);
+}
+
+/**
+ * Run timed calls in two tracees at the same time.
+ * @return Zero on success, positive on error, negative on fatal error (of the
+ * first tracee; the second is expendable).
+ */
+static int timeCallsTogether(Tracee * const tracees[2],
+                             const uintptr_t functions[2],
+                             unsigned long count, uint64_t ticksOut[2])
+{
+    int error;
+
+    // The first party resets the barrier, so it has to start first
+    if (tracees[0]->startTimedCalls(functions[0], count, 2, 0))
+        return 1;
+    int siblingError = tracees[1]->startTimedCalls(functions[1], count, 2, 1);
+
+    // If the first tracee fails, the second may never get past the barrier,
+    // so don't wait for it
+    if ((error = tracees[0]->finishTimedCalls(ticksOut[0])))
+        return error;
+    if (siblingError || tracees[1]->finishTimedCalls(ticksOut[1]))
+        return 1;
+    return 0;
+}
+
+/* See Measurement.h. */
+int measureCoRun(Tracee &tracee, const uintptr_t functions[2],
+                 unsigned long count, const int cpus[2], size_t repeat,
+                 CoRunResult &resultOut)
+{
+    std::vector<int> allowed;
+    if (getAllowedCpus(tracee.getPid(), allowed))
+        return 1;
+
+    std::shared_ptr<Tracee> sibling = tracee.forkSibling();
+    if (!sibling)
+        return 1;
+    Tracee * const tracees[2] = {&tracee, sibling.get()};
+
+    int error = 0;
+    for (int i = 0; i < 2 && !error; i++)
+        error = pinToCpus(tracees[i]->getPid(), {cpus[i]});
+
+    std::vector<uint64_t> alone[2], together[2];
+    for (size_t run = 0; run < repeat && !error; run++) {
+        uint64_t ticks[2];
+        for (int i = 0; i < 2 && !error; i++) {
+            error = timeCallsAlone(*tracees[i], functions[i], count,
+                                   ticks[i]);
+            // Losing the sibling isn't fatal
+            if (error && i > 0)
+                error = 1;
+            if (!error)
+                alone[i].push_back(ticks[i]);
+        }
+        if (!error)
+            error = timeCallsTogether(tracees, functions, count, ticks);
+        for (int i = 0; i < 2 && !error; i++)
+            together[i].push_back(ticks[i]);
+    }
+
+    // Only the first tracee outlives this
+    if (pinToCpus(tracee.getPid(), allowed) && !error)
+        error = 1;
+    if (error)
+        return error < 0 ? -1 : 1;
+
+    for (int i = 0; i < 2; i++) {
+        resultOut.cpus[i] = cpus[i];
+        resultOut.aloneTicks[i] = median(alone[i]);
+        resultOut.togetherTicks[i] = median(together[i]);
+    }
+    return 0;
+}
+
+/* See Measurement.h. */
+void printCoRun(FILE *file, const char * const names[2],
+                const CoRunResult &result)
+{
+    fprintf(file, "%-20s %5s %18s %18s %9s\n", "function", "cpu",
+            "alone (ticks)", "together (ticks)", "slowdown");
+    for (int i = 0; i < 2; i++) {
+        double slowdown = result.aloneTicks[i] ?
+                          static_cast<double>(result.togetherTicks[i]) /
+                          result.aloneTicks[i] : 0.0;
+        fprintf(file, "%-20s %5d %18" PRIu64 " %18" PRIu64 " %8.2fx\n",
+                names[i], result.cpus[i], result.aloneTicks[i],
+                result.togetherTicks[i], slowdown);
+    }
+}
@@ -0,0 +1,485 @@
+/*
+ * NUMA and SMT topology, memory placement, and thread placement.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <random>
+
+#include <sched.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "Numa.h"
+#include "Stats.h"
+#include "Tracee.h"
+
+/** Directory describing the host's NUMA nodes. */
+static const char * const NODE_DIRECTORY = "/sys/devices/system/node";
+
+/** Directory describing the host's CPUs. */
+static const char * const CPU_DIRECTORY = "/sys/devices/system/cpu";
+
+/** Number of bits in a node mask passed to the kernel. */
+static const unsigned long MAX_NODES = 1024;
+
+/** Size of a cache line for pointer chasing. */
+static const size_t LINE_SIZE = 64;
+
+/** Number of passes over the buffer when measuring bandwidth. */
+static const int BANDWIDTH_PASSES = 4;
+
+/** Where measurements store their results so they aren't optimized away. */
+static volatile uint64_t numaSink;
+
+typedef unsigned long NodeMask[MAX_NODES / (8 * sizeof(unsigned long))];
+
+/**
+ * Parse a list of CPUs or nodes the way the kernel prints them, e.g.,
+ * "0-3,8".
+ * @return Zero on success, nonzero on failure.
+ */
+static int parseList(const char *list, std::vector<int> &listOut)
+{
+    listOut.clear();
+    while (*list && *list != '\n') {
+        char *end;
+        long first = strtol(list, &end, 10), last = first;
+        if (end == list)
+            return 1;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first)
+                return 1;
+        }
+        for (long i = first; i <= last; i++)
+            listOut.push_back(i);
+        list = end;
+        if (*list == ',')
+            list++;
+    }
+    return 0;
+}
+
+/**
+ * Read a list from a file in sysfs.
+ * @return Zero on success, nonzero on failure.
+ */
+static int readList(const char *path, std::vector<int> &listOut)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return 1;
+
+    char line[4096];
+    int error = !fgets(line, sizeof(line), file) || parseList(line, listOut);
+    fclose(file);
+    return error;
+}
+
+/* See Numa.h. */
+int getNumaNodes(std::vector<NumaNode> &nodesOut)
+{
+    nodesOut.clear();
+
+    char path[128];
+    std::vector<int> online;
+    snprintf(path, sizeof(path), "%s/online", NODE_DIRECTORY);
+    if (!readList(path, online)) {
+        for (int id : online) {
+            NumaNode node;
+            node.id = id;
+            snprintf(path, sizeof(path), "%s/node%d/cpulist", NODE_DIRECTORY,
+                     id);
+            if (readList(path, node.cpus)) {
+                fprintf(stderr, "could not read CPUs of NUMA node %d\n", id);
+                return 1;
+            }
+            nodesOut.push_back(node);
+        }
+        return 0;
+    }
+
+    // Without NUMA support, everything is on node 0
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == -1) {
+        perror("sched_getaffinity");
+        return 1;
+    }
+    NumaNode node;
+    node.id = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpus))
+            node.cpus.push_back(cpu);
+    }
+    nodesOut.push_back(node);
+    return 0;
+}
+
+/* See Numa.h. */
+std::string formatCpuList(const std::vector<int> &cpus)
+{
+    std::string list;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+            j++;
+        if (!list.empty())
+            list += ',';
+        list += std::to_string(cpus[i]);
+        if (j > i)
+            list += '-' + std::to_string(cpus[j]);
+        i = j;
+    }
+    return list;
+}
+
+/* See Numa.h. */
+int pinToNumaNode(pid_t tid, const NumaNode *node,
+                  const std::vector<NumaNode> &nodes)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (const NumaNode &other : nodes) {
+        if (node && other.id != node->id)
+            continue;
+        for (int cpu : other.cpus) {
+            if (cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &cpus);
+        }
+    }
+
+    if (sched_setaffinity(tid, sizeof(cpus), &cpus) == -1) {
+        perror("sched_setaffinity");
+        return 1;
+    }
+    return 0;
+}
+
+/* See Numa.h. */
+int getAllowedCpus(pid_t tid, std::vector<int> &cpusOut)
+{
+    cpu_set_t cpus;
+    if (sched_getaffinity(tid, sizeof(cpus), &cpus) == -1) {
+        perror("sched_getaffinity");
+        return 1;
+    }
+
+    cpusOut.clear();
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpus))
+            cpusOut.push_back(cpu);
+    }
+    return 0;
+}
+
+/* See Numa.h. */
+int pinToCpus(pid_t tid, const std::vector<int> &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            fprintf(stderr, "CPU %d is out of range\n", cpu);
+            return 1;
+        }
+        CPU_SET(cpu, &set);
+    }
+
+    if (sched_setaffinity(tid, sizeof(set), &set) == -1) {
+        perror("sched_setaffinity");
+        return 1;
+    }
+    return 0;
+}
+
+/* See Numa.h. */
+int getSmtSiblings(std::vector<std::vector<int>> &siblingsOut)
+{
+    siblingsOut.clear();
+
+    std::vector<int> allowed;
+    if (getAllowedCpus(0, allowed))
+        return 1;
+
+    // Every sibling lists the whole core, so only look at the first one
+    char path[128];
+    std::vector<bool> seen(CPU_SETSIZE);
+    for (int cpu : allowed) {
+        if (seen[cpu])
+            continue;
+        std::vector<int> core;
+        snprintf(path, sizeof(path), "%s/cpu%d/topology/thread_siblings_list",
+                 CPU_DIRECTORY, cpu);
+        if (readList(path, core))
+            continue;
+
+        std::vector<int> siblings;
+        for (int sibling : core) {
+            if (sibling < CPU_SETSIZE &&
+                std::binary_search(allowed.begin(), allowed.end(), sibling)) {
+                siblings.push_back(sibling);
+                seen[sibling] = true;
+            }
+        }
+        if (siblings.size() > 1)
+            siblingsOut.push_back(siblings);
+    }
+    return 0;
+}
+
+/* See Numa.h. */
+int getPinnedNumaNode(pid_t tid, const std::vector<NumaNode> &nodes,
+                      int &nodeOut)
+{
+    cpu_set_t cpus;
+    if (sched_getaffinity(tid, sizeof(cpus), &cpus) == -1) {
+        perror("sched_getaffinity");
+        return 1;
+    }
+
+    nodeOut = -1;
+    for (const NumaNode &node : nodes) {
+        bool usesNode = std::any_of(std::begin(node.cpus),
+                                    std::end(node.cpus), [&](int cpu) {
+            return cpu < CPU_SETSIZE && CPU_ISSET(cpu, &cpus);
+        });
+        if (!usesNode)
+            continue;
+        if (nodeOut != -1) {
+            nodeOut = -1;
+            break;
+        }
+        nodeOut = node.id;
+    }
+    return 0;
+}
+
+/* See Numa.h. */
+int bindToNumaNode(const MemoryRegion &region, int node)
+{
+    if (node >= static_cast<int>(MAX_NODES)) {
+        fprintf(stderr, "NUMA node %d is out of range\n", node);
+        return 1;
+    }
+
+    long ret;
+    if (node < 0) {
+        ret = syscall(SYS_mbind, region.address, region.size, MPOL_DEFAULT,
+                      nullptr, 0, 0);
+    } else {
+        NodeMask mask = {};
+        mask[node / (8 * sizeof(mask[0]))] |=
+            1UL << (node % (8 * sizeof(mask[0])));
+
+        // Pages which the tracee has touched are mapped by both of us, and
+        // only privileged processes can move pages which are shared
+        ret = syscall(SYS_mbind, region.address, region.size, MPOL_BIND,
+                      mask, MAX_NODES + 1, MPOL_MF_MOVE_ALL);
+        if (ret == -1 && errno == EPERM)
+            ret = syscall(SYS_mbind, region.address, region.size,
+                          MPOL_BIND, mask, MAX_NODES + 1, MPOL_MF_MOVE);
+    }
+    if (ret == -1) {
+        perror("mbind");
+        return 1;
+    }
+    return 0;
+}
+
+/* See Numa.h. */
+int getBoundNumaNode(const MemoryRegion &region, int &nodeOut)
+{
+    int mode;
+    NodeMask mask = {};
+    if (syscall(SYS_get_mempolicy, &mode, mask, MAX_NODES + 1,
+                region.address, MPOL_F_ADDR) == -1)
+        return 1;
+
+    nodeOut = -1;
+    if (mode != MPOL_BIND)
+        return 0;
+    for (unsigned long node = 0; node < MAX_NODES; node++) {
+        if (!(mask[node / (8 * sizeof(mask[0]))] &
+              (1UL << (node % (8 * sizeof(mask[0]))))))
+            continue;
+        if (nodeOut != -1) {
+            nodeOut = -1;
+            break;
+        }
+        nodeOut = node;
+    }
+    return 0;
+}
+
+/* See Numa.h. */
+int countNumaPages(pid_t pid, const MemoryRegion &region,
+                   std::vector<size_t> &countsOut)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t numPages = region.size / pageSize;
+    std::vector<void *> pages(numPages);
+    std::vector<int> status(numPages), ourStatus(numPages);
+    for (size_t i = 0; i < numPages; i++)
+        pages[i] = static_cast<char *>(region.address) + i * pageSize;
+
+    // Without a list of nodes, move_pages() only reports where each page is.
+    // A page only shows up in the processes which have touched it, and we
+    // write to shared memory directly, so check both of us.
+    if (syscall(SYS_move_pages, pid, numPages, pages.data(), nullptr,
+                status.data(), 0) == -1 ||
+        syscall(SYS_move_pages, 0, numPages, pages.data(), nullptr,
+                ourStatus.data(), 0) == -1)
+        return 1;
+
+    countsOut.clear();
+    for (size_t i = 0; i < numPages; i++) {
+        int node = status[i] >= 0 ? status[i] : ourStatus[i];
+        if (node < 0)
+            continue; // Not touched yet
+        if (static_cast<size_t>(node) >= countsOut.size())
+            countsOut.resize(node + 1);
+        countsOut[node]++;
+    }
+    return 0;
+}
+
+/**
+ * Measure memory from the node it was allocated from on the CPU we are
+ * running on. The buffer is linked into a random cycle of cache lines so that
+ * each load depends on the last and can't be prefetched.
+ */
+static void measureBuffer(unsigned char *buffer, size_t size,
+                          const std::vector<size_t> &order,
+                          NumaAccessResult &resultOut)
+{
+    size_t numLines = order.size();
+    for (size_t i = 0; i < numLines; i++) {
+        void **line = reinterpret_cast<void **>(buffer +
+                                                order[i] * LINE_SIZE);
+        *line = buffer + order[(i + 1) % numLines] * LINE_SIZE;
+    }
+
+    void *p = buffer + order[0] * LINE_SIZE;
+    uint64_t start = getMonotonicNs();
+    for (size_t i = 0; i < numLines; i++)
+        p = *static_cast<void **>(p);
+    uint64_t elapsed = getMonotonicNs() - start;
+    resultOut.latencyNs = static_cast<double>(elapsed) / numLines;
+
+    const uint64_t *words = reinterpret_cast<const uint64_t *>(buffer);
+    size_t numWords = size / sizeof(uint64_t);
+    uint64_t sum = reinterpret_cast<uintptr_t>(p);
+    start = getMonotonicNs();
+    for (int pass = 0; pass < BANDWIDTH_PASSES; pass++) {
+        for (size_t i = 0; i < numWords; i++)
+            sum += words[i];
+    }
+    elapsed = getMonotonicNs() - start;
+    resultOut.bandwidthGBs = static_cast<double>(size) * BANDWIDTH_PASSES /
+                             std::max<uint64_t>(elapsed, 1);
+    numaSink = sum;
+}
+
+/* See Numa.h. */
+int measureNumaAccess(const std::vector<NumaNode> &nodes, size_t size,
+                      std::vector<NumaAccessResult> &resultsOut)
+{
+    size = size / LINE_SIZE * LINE_SIZE;
+    if (!size) {
+        fprintf(stderr, "buffer is too small\n");
+        return 1;
+    }
+
+    cpu_set_t originalCpus;
+    if (sched_getaffinity(0, sizeof(originalCpus), &originalCpus) == -1) {
+        perror("sched_getaffinity");
+        return 1;
+    }
+
+    std::vector<size_t> order(size / LINE_SIZE);
+    std::iota(std::begin(order), std::end(order), 0);
+    std::shuffle(std::begin(order), std::end(order), std::mt19937_64{});
+
+    resultsOut.clear();
+    int error = 0;
+    for (const NumaNode &memoryNode : nodes) {
+        void *buffer = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            perror("mmap");
+            error = 1;
+            break;
+        }
+        MemoryRegion region{buffer, size};
+
+        // The first measurement touches the buffer and thus allocates it,
+        // so bind it first. There is no need to with only one node.
+        if (nodes.size() > 1 && bindToNumaNode(region, memoryNode.id)) {
+            munmap(buffer, size);
+            error = 1;
+            break;
+        }
+
+        for (const NumaNode &cpuNode : nodes) {
+            if (cpuNode.cpus.empty())
+                continue; // Memory-only node
+            if (pinToNumaNode(0, &cpuNode, nodes)) {
+                error = 1;
+                break;
+            }
+
+            NumaAccessResult result;
+            result.cpuNode = cpuNode.id;
+            result.memoryNode = memoryNode.id;
+            measureBuffer(static_cast<unsigned char *>(buffer), size, order,
+                          result);
+            resultsOut.push_back(result);
+        }
+        munmap(buffer, size);
+        if (error)
+            break;
+    }
+
+    if (sched_setaffinity(0, sizeof(originalCpus), &originalCpus) == -1) {
+        perror("sched_setaffinity");
+        error = 1;
+    }
+    return error;
+}
+
+/* See Numa.h. */
+void printNumaAccess(FILE *file,
+                     const std::vector<NumaAccessResult> &results)
+{
+    fprintf(file, "%8s %11s %14s %18s\n", "cpu node", "memory node",
+            "latency (ns)", "bandwidth (GB/s)");
+    for (const NumaAccessResult &result : results) {
+        fprintf(file, "%8d %11d %14.1f %18.2f%s\n", result.cpuNode,
+                result.memoryNode, result.latencyNs, result.bandwidthGBs,
+                result.cpuNode == result.memoryNode ? "" : "  (remote)");
+    }
+}
@@ -0,0 +1,198 @@
+/*
+ * Execution counts from instrumented code.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cinttypes>
+#include <cstdio>
+
+#include "Disassembler.h"
+#include "Profiler.h"
+#include "Tracee.h"
+
+const size_t Profiler::MAX_COUNTERS;
+const char * const Profiler::COUNTER_SYMBOL = "asmase_profile";
+const size_t Profiler::NO_COUNTER;
+
+/* See Profiler.h. */
+uintptr_t Profiler::getCounterAddress(const Tracee &tracee)
+{
+    const MemoryRegion &scratch = tracee.getMemory().scratch;
+    return reinterpret_cast<uintptr_t>(scratch.address) + scratch.size -
+           MAX_COUNTERS * sizeof(uint64_t);
+}
+
+/* See Profiler.h. */
+int Profiler::setEnabled(bool enabled)
+{
+    if (enabled && !disassembler) {
+        AssembledCode code;
+        if (appendPlatformCounterIncrement(0, code))
+            return 1;
+        disassembler = Disassembler::createDisassembler();
+        if (!disassembler)
+            return 1;
+    }
+    this->enabled = enabled;
+    return 0;
+}
+
+/* See Profiler.h. */
+int Profiler::instrument(Tracee &tracee, const std::string &line,
+                         AssembledCode &code, size_t &originalOffsetOut)
+{
+    originalOffsetOut = 0;
+    if (!enabled)
+        return 0;
+
+    size_t size = code.machineCode.size();
+    bool labelAtStart = false, labelAtEnd = false;
+    for (const Label &label : code.labels) {
+        if (label.segment != Segment::CODE)
+            continue;
+        if (label.offset == 0)
+            labelAtStart = true;
+        if (label.offset == size)
+            labelAtEnd = true;
+    }
+
+    // A label on a line of its own is the start of the next line
+    if (!size) {
+        if (labelAtStart)
+            blockEnd = nullptr;
+        return 0;
+    }
+
+    void *address = tracee.getCodeAddress(size);
+    if (!address)
+        return 0;
+
+    // Only the last instruction of the line is considered, so jumps within a
+    // line aren't counted
+    DecodedInstruction instruction;
+    bool endsBlock = false, conditional = false;
+    uintptr_t pc = reinterpret_cast<uintptr_t>(address);
+    for (size_t offset = 0; offset < size; offset += instruction.length) {
+        if (disassembler->disassemble(&code.machineCode[offset], size - offset,
+                                      pc + offset, instruction)) {
+            endsBlock = true;
+            conditional = false;
+            break;
+        }
+        endsBlock = instruction.isBranch || instruction.isReturn;
+        conditional = instruction.isConditionalBranch;
+    }
+
+    bool leader = labelAtStart || lines.empty() || address != blockEnd;
+    if (numCounters + leader + conditional > MAX_COUNTERS) {
+        fprintf(stderr, "out of profile counters; turning profiling off\n");
+        enabled = false;
+        return 0;
+    }
+
+    original = code.machineCode;
+    size_t numFixups = code.fixups.size();
+    size_t block = leader ? numCounters++ : lines.back().block;
+    code.machineCode.clear();
+    if (leader && appendPlatformCounterIncrement(block, code))
+        return 1;
+    size_t prefixSize = code.machineCode.size();
+    code.machineCode += original;
+
+    size_t fallthrough = NO_COUNTER;
+    if (conditional) {
+        fallthrough = numCounters++;
+        if (appendPlatformCounterIncrement(fallthrough, code))
+            return 1;
+    }
+
+    // A label at the start still marks the start (and thus the counter) and
+    // one at the end still marks the end
+    auto moveOffset = [&](size_t offset) {
+        if (offset == 0)
+            return offset;
+        else if (offset == size)
+            return code.machineCode.size();
+        else
+            return offset + prefixSize;
+    };
+    for (Label &label : code.labels) {
+        if (label.segment == Segment::CODE)
+            label.offset = moveOffset(label.offset);
+    }
+    for (size_t i = 0; i < numFixups; i++) {
+        Fixup &fixup = code.fixups[i];
+        if (fixup.segment == Segment::CODE)
+            fixup.offset += prefixSize;
+        if (fixup.symbol.empty() && fixup.target == Segment::CODE &&
+            !fixup.pcRelative && fixup.addend >= 0)
+            fixup.addend = moveOffset(fixup.addend);
+    }
+
+    lines.emplace_back(line, address, block, fallthrough);
+    if (endsBlock || labelAtEnd)
+        blockEnd = nullptr;
+    else
+        blockEnd = static_cast<char *>(address) + code.machineCode.size();
+    originalOffsetOut = prefixSize;
+    return 0;
+}
+
+/* See Profiler.h. */
+int Profiler::reset(Tracee &tracee)
+{
+    if (!numCounters)
+        return 0;
+
+    std::vector<uint64_t> zeroes(numCounters);
+    return tracee.writeMemory(reinterpret_cast<void *>(
+                                  getCounterAddress(tracee)),
+                              zeroes.data(), numCounters * sizeof(uint64_t));
+}
+
+/* See Profiler.h. */
+int Profiler::printCounts(Tracee &tracee)
+{
+    if (lines.empty()) {
+        printf("no code has been profiled\n");
+        return 0;
+    }
+
+    std::vector<uint64_t> counts(numCounters);
+    if (tracee.readMemory(reinterpret_cast<void *>(getCounterAddress(tracee)),
+                          counts.data(), numCounters * sizeof(uint64_t)))
+        return 1;
+
+    printf("%18s %10s  %s\n", "address", "count", "line");
+    for (const ProfiledLine &line : lines) {
+        uint64_t count = counts[line.block];
+        printf("%18p %10" PRIu64 "  %s", line.address, count,
+               line.line.c_str());
+        if (line.fallthrough != NO_COUNTER) {
+            // A line which doesn't start its block bumps only the fall
+            // through counter when it runs on its own as it is entered
+            uint64_t fellThrough = counts[line.fallthrough];
+            uint64_t taken = count > fellThrough ? count - fellThrough : 0;
+            printf(" (taken %" PRIu64 ", fell through %" PRIu64 ")", taken,
+                   fellThrough);
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Recycling allocation implementation.
+ *
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <new>
+
+#include "Recycled.h"
+
+/** Sizes are rounded up to a multiple of this. */
+static const size_t GRANULE = alignof(std::max_align_t);
+
+/** Number of free lists; bigger objects go straight to the heap. */
+static const size_t NUM_FREE_LISTS = 16;
+
+/** A freed object on a free list. */
+struct FreeObject {
+    FreeObject *next;
+};
+
+/**
+ * Free lists for objects of each size. These are per-thread so that they
+ * don't need a lock, and they are never freed, since the objects on them
+ * would only go back to the heap when the program exits anyway.
+ */
+static thread_local FreeObject *freeLists[NUM_FREE_LISTS];
+
+/** Get the free list index for a size, or NUM_FREE_LISTS if it's too big. */
+static inline size_t sizeClass(size_t size)
+{
+    if (size == 0)
+        return 0;
+    size_t index = (size - 1) / GRANULE;
+    return index < NUM_FREE_LISTS ? index : NUM_FREE_LISTS;
+}
+
+/* See Recycled.h. */
+void *recycledAlloc(size_t size)
+{
+    size_t index = sizeClass(size);
+    if (index == NUM_FREE_LISTS)
+        return ::operator new(size);
+
+    FreeObject *object = freeLists[index];
+    if (object) {
+        freeLists[index] = object->next;
+        return object;
+    }
+    return ::operator new((index + 1) * GRANULE);
+}
+
+/* See Recycled.h. */
+void recycledFree(void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+
+    size_t index = sizeClass(size);
+    if (index == NUM_FREE_LISTS) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    FreeObject *object = static_cast<FreeObject *>(ptr);
+    object->next = freeLists[index];
+    freeLists[index] = object;
+}
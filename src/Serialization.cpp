@@ -0,0 +1,140 @@
+/*
+ * Serialization of assembled code.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Assembler.h"
+#include "Serialization.h"
+
+/** Largest data alignment we accept from untrusted input. */
+static const size_t MAX_ALIGNMENT = 1 << 16;
+
+/** Flags stored for each fixup. */
+enum FixupFlags {
+    FIXUP_PC_RELATIVE = 1 << 0,
+    FIXUP_SIGNED = 1 << 1,
+};
+
+/** Decode a serialized segment. */
+static int getSegment(ByteReader &reader, Segment &segmentOut)
+{
+    uint8_t segment = reader.getU8();
+    if (segment > static_cast<uint8_t>(Segment::DATA))
+        return 1;
+    segmentOut = static_cast<Segment>(segment);
+    return 0;
+}
+
+/* See Serialization.h. */
+void serializeFixup(ByteWriter &writer, const Fixup &fixup)
+{
+    writer.putString(fixup.symbol);
+    writer.putU8(static_cast<uint8_t>(fixup.target));
+    writer.putU8(static_cast<uint8_t>(fixup.segment));
+    writer.putU64(fixup.offset);
+    writer.putU8(fixup.size);
+    writer.putU8((fixup.pcRelative ? FIXUP_PC_RELATIVE : 0) |
+                 (fixup.isSigned ? FIXUP_SIGNED : 0));
+    writer.putU64(fixup.addend);
+}
+
+/* See Serialization.h. */
+int deserializeFixup(ByteReader &reader, Fixup &fixupOut)
+{
+    fixupOut.symbol = reader.getString<std::string>();
+    if (getSegment(reader, fixupOut.target) ||
+        getSegment(reader, fixupOut.segment))
+        return 1;
+    fixupOut.offset = reader.getU64();
+    fixupOut.size = reader.getU8();
+    uint8_t flags = reader.getU8();
+    fixupOut.pcRelative = flags & FIXUP_PC_RELATIVE;
+    fixupOut.isSigned = flags & FIXUP_SIGNED;
+    fixupOut.addend = reader.getU64();
+
+    // Fields are 1, 2, 4, or 8 bytes; applying any other size would be
+    // undefined
+    return reader.hasFailed() ||
+           (fixupOut.size != 1 && fixupOut.size != 2 && fixupOut.size != 4 &&
+            fixupOut.size != 8);
+}
+
+/* See Serialization.h. */
+void serializeCode(ByteWriter &writer, const AssembledCode &code)
+{
+    writer.putString(code.machineCode);
+    writer.putString(code.data);
+    writer.putU64(code.dataAlignment);
+    writer.putU8(code.hostSupported);
+
+    writer.putU32(code.labels.size());
+    for (const Label &label : code.labels) {
+        writer.putString(label.name);
+        writer.putU8(static_cast<uint8_t>(label.segment));
+        writer.putU64(label.offset);
+    }
+
+    writer.putU32(code.fixups.size());
+    for (const Fixup &fixup : code.fixups)
+        serializeFixup(writer, fixup);
+}
+
+/* See Serialization.h. */
+int deserializeCode(ByteReader &reader, AssembledCode &codeOut)
+{
+    reader.getString(codeOut.machineCode);
+    reader.getString(codeOut.data);
+    codeOut.dataAlignment = reader.getU64();
+    codeOut.hostSupported = reader.getU8();
+
+    codeOut.labels.clear();
+    uint32_t numLabels = reader.getU32();
+    for (uint32_t i = 0; i < numLabels && !reader.hasFailed(); ++i) {
+        std::string name = reader.getString<std::string>();
+        Segment segment;
+        if (getSegment(reader, segment))
+            return 1;
+        size_t offset = reader.getU64();
+        if (offset > codeOut.getSegment(segment).size())
+            return 1;
+        codeOut.labels.emplace_back(name, segment, offset);
+    }
+
+    codeOut.fixups.clear();
+    uint32_t numFixups = reader.getU32();
+    for (uint32_t i = 0; i < numFixups && !reader.hasFailed(); ++i) {
+        Fixup fixup;
+        if (deserializeFixup(reader, fixup))
+            return 1;
+
+        // Don't trust the input to stay inside of the code
+        const bytestring &contents = codeOut.getSegment(fixup.segment);
+        if (fixup.offset > contents.size() ||
+            fixup.size > contents.size() - fixup.offset)
+            return 1;
+        codeOut.fixups.push_back(fixup);
+    }
+
+    // The alignment has to be a reasonably-sized power of two
+    if (codeOut.dataAlignment == 0 || codeOut.dataAlignment > MAX_ALIGNMENT ||
+        (codeOut.dataAlignment & (codeOut.dataAlignment - 1)))
+        return 1;
+
+    return reader.hasFailed();
+}
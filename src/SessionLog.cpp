@@ -0,0 +1,232 @@
+/*
+ * SessionLog implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <sys/utsname.h>
+
+#include "Serialization.h"
+#include "SessionLog.h"
+
+/** Magic number at the start of a session log. */
+static const char LOG_MAGIC[8] = {'A', 'S', 'M', 'A', 'S', 'E', 'L', 'G'};
+
+/** Version of the log format. */
+static const uint32_t LOG_VERSION = 1;
+
+/**
+ * Size of the header of each record: a one-byte type and a four-byte payload
+ * length.
+ */
+static const size_t RECORD_HEADER_SIZE = 5;
+
+/**
+ * Sanity limit on the size of a record; nothing we log comes anywhere close
+ * to it.
+ */
+static const uint32_t MAX_RECORD_SIZE = 16 << 20;
+
+/** Sanity limit on the length of the machine name in the header. */
+static const uint32_t MAX_MACHINE_SIZE = 256;
+
+/** Get the name of the host machine architecture, e.g., "x86_64". */
+static std::string hostMachine()
+{
+    struct utsname name;
+    if (uname(&name) == -1)
+        return "";
+    return name.machine;
+}
+
+/* See SessionLog.h. */
+SessionLog::~SessionLog()
+{
+    fclose(file);
+}
+
+/* See SessionLog.h. */
+int SessionLog::writeRecord(const SessionRecord &record)
+{
+    ByteWriter payload;
+    switch (record.type) {
+        case SessionRecordType::INSTRUCTION:
+        case SessionRecordType::TEMPLATE:
+            payload.putString(record.line);
+            serializeCode(payload, record.code);
+            break;
+        case SessionRecordType::BUILTIN:
+            payload.putString(record.line);
+            break;
+        case SessionRecordType::STATE:
+            payload.putString(record.state);
+            break;
+    }
+
+    ByteWriter writer;
+    writer.putU8(static_cast<uint8_t>(record.type));
+    writer.putU32(payload.buffer.size());
+    writer.putBytes(payload.buffer.data(), payload.buffer.size());
+
+    // Flush every record so that the log survives a crash
+    if (fwrite(writer.buffer.data(), 1, writer.buffer.size(), file) !=
+            writer.buffer.size() || fflush(file) == EOF) {
+        perror("fwrite");
+        fprintf(stderr, "could not write to %s\n", filename.c_str());
+        return 1;
+    }
+
+    return 0;
+}
+
+/* See SessionLog.h. */
+int SessionLog::readRecord(SessionRecord &recordOut)
+{
+    unsigned char header[RECORD_HEADER_SIZE];
+    size_t headerSize = fread(header, 1, sizeof(header), file);
+    if (headerSize == 0 && feof(file))
+        return 1;
+    if (headerSize != sizeof(header)) {
+        fprintf(stderr, "%s: truncated record\n", filename.c_str());
+        return -1;
+    }
+
+    ByteReader headerReader{header, sizeof(header)};
+    uint8_t type = headerReader.getU8();
+    uint32_t size = headerReader.getU32();
+    if (size > MAX_RECORD_SIZE) {
+        fprintf(stderr, "%s: malformed record\n", filename.c_str());
+        return -1;
+    }
+
+    bytestring payload(size, 0);
+    if (size && fread(&payload[0], 1, size, file) != size) {
+        fprintf(stderr, "%s: truncated record\n", filename.c_str());
+        return -1;
+    }
+
+    ByteReader reader{payload.data(), payload.size()};
+    int error = 0;
+    recordOut.type = static_cast<SessionRecordType>(type);
+    switch (recordOut.type) {
+        case SessionRecordType::INSTRUCTION:
+        case SessionRecordType::TEMPLATE:
+            recordOut.line = reader.getString<std::string>();
+            error = deserializeCode(reader, recordOut.code);
+            break;
+        case SessionRecordType::BUILTIN:
+            recordOut.line = reader.getString<std::string>();
+            break;
+        case SessionRecordType::STATE:
+            recordOut.state = reader.getString<bytestring>();
+            break;
+        default:
+            fprintf(stderr, "%s: unknown record type %d\n", filename.c_str(),
+                    static_cast<int>(type));
+            return -1;
+    }
+
+    if (error || reader.hasFailed() || !reader.atEnd()) {
+        fprintf(stderr, "%s: malformed record\n", filename.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+/* See SessionLog.h. */
+std::unique_ptr<SessionLog> SessionLog::create(const std::string &filename,
+                                               const void *codeAddress)
+{
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        perror("fopen");
+        fprintf(stderr, "could not create %s\n", filename.c_str());
+        return {nullptr};
+    }
+
+    ByteWriter writer;
+    writer.putBytes(LOG_MAGIC, sizeof(LOG_MAGIC));
+    writer.putU32(LOG_VERSION);
+    writer.putString(hostMachine());
+    writer.putU64(reinterpret_cast<uintptr_t>(codeAddress));
+
+    if (fwrite(writer.buffer.data(), 1, writer.buffer.size(), file) !=
+            writer.buffer.size() || fflush(file) == EOF) {
+        perror("fwrite");
+        fprintf(stderr, "could not write to %s\n", filename.c_str());
+        fclose(file);
+        return {nullptr};
+    }
+
+    return std::unique_ptr<SessionLog>{new SessionLog{file, filename}};
+}
+
+/* See SessionLog.h. */
+std::unique_ptr<SessionLog> SessionLog::open(const std::string &filename,
+                                             void *&codeAddressOut)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        perror("fopen");
+        fprintf(stderr, "could not open %s\n", filename.c_str());
+        return {nullptr};
+    }
+    std::unique_ptr<SessionLog> log{new SessionLog{file, filename}};
+
+    // Read the fixed part of the header, then the machine name and address
+    unsigned char header[sizeof(LOG_MAGIC) + 8];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a session log\n", filename.c_str());
+        return {nullptr};
+    }
+
+    ByteReader headerReader{header + sizeof(LOG_MAGIC), 8};
+    uint32_t version = headerReader.getU32();
+    uint32_t machineSize = headerReader.getU32();
+    if (machineSize > MAX_MACHINE_SIZE) {
+        fprintf(stderr, "%s: not a session log\n", filename.c_str());
+        return {nullptr};
+    }
+    if (version != LOG_VERSION) {
+        fprintf(stderr, "%s: unsupported log version %" PRIu32 "\n",
+                filename.c_str(), version);
+        return {nullptr};
+    }
+
+    bytestring rest(machineSize + 8, 0);
+    if (fread(&rest[0], 1, rest.size(), file) != rest.size()) {
+        fprintf(stderr, "%s: truncated header\n", filename.c_str());
+        return {nullptr};
+    }
+    std::string machine{reinterpret_cast<const char *>(rest.data()),
+                        machineSize};
+    ByteReader addressReader{rest.data() + machineSize, 8};
+    codeAddressOut = reinterpret_cast<void *>(addressReader.getU64());
+
+    if (machine != hostMachine()) {
+        fprintf(stderr, "warning: %s was recorded on %s, not %s\n",
+                filename.c_str(), machine.c_str(), hostMachine().c_str());
+    }
+
+    return log;
+}
@@ -0,0 +1,533 @@
+/*
+ * Session snapshot implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "Serialization.h"
+#include "SessionSnapshot.h"
+#include "SymbolTable.h"
+#include "TemplateTable.h"
+#include "Tracee.h"
+
+/** Magic number at the start of a snapshot. */
+static const char SNAPSHOT_MAGIC[8] = {'A', 'S', 'M', 'S', 'E', 'S', 'S', 'N'};
+
+/** Version of the snapshot format. */
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+/** Sanity limit on the number of sections. */
+static const uint32_t MAX_SECTIONS = 1 << 16;
+
+/** Kinds of sections in a snapshot. */
+enum class SectionType {
+    /** Register context from Tracee::saveRegisterContext(). */
+    REGISTERS = 1,
+
+    /** Symbol table from SymbolTable::serialize(). */
+    SYMBOLS = 2,
+
+    /** The used part of the code region. */
+    CODE = 3,
+
+    /** The used part of the data region. */
+    DATA = 4,
+
+    /** A run of pages in the scratch region. */
+    SCRATCH = 5,
+
+    /**
+     * Template table from TemplateTable::serialize(). Snapshots saved before
+     * templates existed don't have it.
+     */
+    TEMPLATES = 6,
+};
+
+/** Size of an entry in the section table. */
+static const size_t SECTION_ENTRY_SIZE = 28;
+
+/** A section of a snapshot. */
+struct Section {
+    SectionType type;
+
+    /** Offset of the contents in the memory region it belongs to. */
+    uint64_t regionOffset;
+
+    /** Offset of the contents in the file. */
+    uint64_t fileOffset;
+
+    /** Size of the contents. */
+    uint64_t size;
+
+    /** Contents of the section in memory or in the mapped file. */
+    const void *contents;
+};
+
+/** Get the name of the host machine architecture, e.g., "x86_64". */
+static std::string hostMachine()
+{
+    struct utsname name;
+    if (uname(&name) == -1)
+        return "";
+    return name.machine;
+}
+
+/** Get the size of the span of memory covered by all of the regions. */
+static uint64_t memorySpan(const TraceeMemory &memory)
+{
+    auto base = static_cast<const unsigned char *>(memory.code.address);
+    auto end = static_cast<const unsigned char *>(memory.scratch.address) +
+               memory.scratch.size;
+    return end - base;
+}
+
+/** Round up to a multiple of the page size. */
+static uint64_t pageAlign(uint64_t offset, size_t pageSize)
+{
+    return (offset + pageSize - 1) / pageSize * pageSize;
+}
+
+/** Write the whole buffer at the given offset. */
+static int writeAll(int fd, const void *buffer, size_t size, off_t offset)
+{
+    auto p = static_cast<const unsigned char *>(buffer);
+    while (size) {
+        ssize_t ret = pwrite(fd, p, size, offset);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        p += ret;
+        size -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+/** Return whether a page is all zeroes. */
+static bool isZeroPage(const unsigned char *page, size_t pageSize)
+{
+    for (size_t i = 0; i < pageSize; ++i) {
+        if (page[i])
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Find the runs of pages in the scratch region which need to be saved. Pages
+ * which have never been touched aren't resident, so we can skip them without
+ * reading them (which would allocate them).
+ */
+static void findScratchRuns(const MemoryRegion &scratch, size_t pageSize,
+                            std::vector<Section> &sectionsOut)
+{
+    auto base = static_cast<const unsigned char *>(scratch.address);
+    size_t numPages = scratch.size / pageSize;
+    std::vector<unsigned char> resident(numPages, 1);
+    if (mincore(scratch.address, scratch.size, resident.data()) == -1)
+        std::fill(resident.begin(), resident.end(), 1);
+
+    size_t runStart = 0;
+    bool inRun = false;
+    for (size_t i = 0; i <= numPages; ++i) {
+        bool save = i < numPages && (resident[i] & 1) &&
+                    !isZeroPage(base + i * pageSize, pageSize);
+        if (save && !inRun) {
+            runStart = i;
+            inRun = true;
+        } else if (!save && inRun) {
+            Section section;
+            section.type = SectionType::SCRATCH;
+            section.regionOffset = runStart * pageSize;
+            section.size = (i - runStart) * pageSize;
+            section.contents = base + section.regionOffset;
+            sectionsOut.push_back(section);
+            inRun = false;
+        }
+    }
+}
+
+/* See SessionSnapshot.h. */
+int saveSessionSnapshot(const std::string &filename, Tracee &tracee,
+                        const SymbolTable &symbols,
+                        const TemplateTable &templates)
+{
+    const TraceeMemory &memory = tracee.getMemory();
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    bytestring context;
+    if (tracee.saveRegisterContext(context))
+        return 1;
+
+    ByteWriter symbolWriter;
+    symbols.serialize(symbolWriter);
+
+    ByteWriter templateWriter;
+    templates.serialize(templateWriter);
+
+    std::vector<Section> sections;
+    Section section;
+    section.regionOffset = 0;
+
+    section.type = SectionType::REGISTERS;
+    section.size = context.size();
+    section.contents = context.data();
+    sections.push_back(section);
+
+    section.type = SectionType::SYMBOLS;
+    section.size = symbolWriter.buffer.size();
+    section.contents = symbolWriter.buffer.data();
+    sections.push_back(section);
+
+    section.type = SectionType::TEMPLATES;
+    section.size = templateWriter.buffer.size();
+    section.contents = templateWriter.buffer.data();
+    sections.push_back(section);
+
+    section.type = SectionType::CODE;
+    section.size = memory.code.used;
+    section.contents = memory.code.address;
+    sections.push_back(section);
+
+    section.type = SectionType::DATA;
+    section.size = memory.data.used;
+    section.contents = memory.data.address;
+    sections.push_back(section);
+
+    findScratchRuns(memory.scratch, pageSize, sections);
+
+    // Lay out the sections after the header, each on its own page
+    std::string machine = hostMachine();
+    uint64_t offset = sizeof(SNAPSHOT_MAGIC) + 4 + 4 + machine.size() + 8 + 8 +
+                      4 + sections.size() * SECTION_ENTRY_SIZE;
+    for (auto &section : sections) {
+        offset = pageAlign(offset, pageSize);
+        section.fileOffset = offset;
+        offset += section.size;
+    }
+    uint64_t fileSize = pageAlign(offset, pageSize);
+
+    ByteWriter header;
+    header.putBytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.putU32(SNAPSHOT_VERSION);
+    header.putString(machine);
+    header.putU64(reinterpret_cast<uintptr_t>(memory.code.address));
+    header.putU64(memorySpan(memory));
+    header.putU32(sections.size());
+    for (const auto &section : sections) {
+        header.putU32(static_cast<uint32_t>(section.type));
+        header.putU64(section.regionOffset);
+        header.putU64(section.fileOffset);
+        header.putU64(section.size);
+    }
+
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    if (fd == -1) {
+        perror("open");
+        fprintf(stderr, "could not create %s\n", filename.c_str());
+        return 1;
+    }
+
+    int error = ftruncate(fd, fileSize) == -1 ||
+                writeAll(fd, header.buffer.data(), header.buffer.size(), 0);
+    for (const auto &section : sections) {
+        if (error)
+            break;
+        error = writeAll(fd, section.contents, section.size,
+                         section.fileOffset);
+    }
+    if (error) {
+        perror("write");
+        fprintf(stderr, "could not write to %s\n", filename.c_str());
+    }
+
+    close(fd);
+    return error;
+}
+
+/**
+ * Holds a read-only mapping of a snapshot file for as long as it is in
+ * scope.
+ */
+class SnapshotMapping {
+    void *map;
+    size_t mapSize;
+
+public:
+    SnapshotMapping() : map{nullptr}, mapSize{0} {}
+
+    ~SnapshotMapping()
+    {
+        if (map)
+            munmap(map, mapSize);
+    }
+
+    SnapshotMapping(const SnapshotMapping &) = delete;
+    SnapshotMapping &operator=(const SnapshotMapping &) = delete;
+
+    const unsigned char *data() const
+    {
+        return static_cast<const unsigned char *>(map);
+    }
+
+    size_t size() const { return mapSize; }
+
+    /**
+     * Map the given file.
+     * @return Zero on success, nonzero on failure.
+     */
+    int open(const std::string &filename)
+    {
+        int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror("open");
+            fprintf(stderr, "could not open %s\n", filename.c_str());
+            return 1;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            perror("fstat");
+            close(fd);
+            return 1;
+        }
+        if (st.st_size == 0) {
+            fprintf(stderr, "%s: not a session snapshot\n", filename.c_str());
+            close(fd);
+            return 1;
+        }
+
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            map = nullptr;
+            return 1;
+        }
+        mapSize = st.st_size;
+        return 0;
+    }
+};
+
+/** Parsed snapshot header. */
+struct SnapshotHeader {
+    std::string machine;
+    uintptr_t codeAddress;
+    uint64_t span;
+    std::vector<Section> sections;
+};
+
+/**
+ * Parse and bounds-check the header of a mapped snapshot.
+ * @return Zero on success, nonzero if the snapshot is malformed.
+ */
+static int parseHeader(const std::string &filename,
+                       const SnapshotMapping &mapping,
+                       SnapshotHeader &headerOut)
+{
+    if (mapping.size() < sizeof(SNAPSHOT_MAGIC) ||
+        memcmp(mapping.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a session snapshot\n", filename.c_str());
+        return 1;
+    }
+
+    ByteReader reader{mapping.data() + sizeof(SNAPSHOT_MAGIC),
+                      mapping.size() - sizeof(SNAPSHOT_MAGIC)};
+    uint32_t version = reader.getU32();
+    if (!reader.hasFailed() && version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "%s: unsupported snapshot version %" PRIu32 "\n",
+                filename.c_str(), version);
+        return 1;
+    }
+
+    headerOut.machine = reader.getString<std::string>();
+    headerOut.codeAddress = reader.getU64();
+    headerOut.span = reader.getU64();
+    uint32_t numSections = reader.getU32();
+    if (numSections > MAX_SECTIONS) {
+        fprintf(stderr, "%s: malformed snapshot\n", filename.c_str());
+        return 1;
+    }
+
+    headerOut.sections.clear();
+    for (uint32_t i = 0; i < numSections; ++i) {
+        Section section;
+        section.type = static_cast<SectionType>(reader.getU32());
+        section.regionOffset = reader.getU64();
+        section.fileOffset = reader.getU64();
+        section.size = reader.getU64();
+        section.contents = nullptr;
+        if (reader.hasFailed() || section.fileOffset > mapping.size() ||
+            section.size > mapping.size() - section.fileOffset) {
+            fprintf(stderr, "%s: truncated snapshot\n", filename.c_str());
+            return 1;
+        }
+        section.contents = mapping.data() + section.fileOffset;
+        headerOut.sections.push_back(section);
+    }
+
+    if (reader.hasFailed()) {
+        fprintf(stderr, "%s: truncated snapshot\n", filename.c_str());
+        return 1;
+    }
+
+    return 0;
+}
+
+/* See SessionSnapshot.h. */
+int readSessionSnapshotAddress(const std::string &filename,
+                               void *&codeAddressOut)
+{
+    SnapshotMapping mapping;
+    SnapshotHeader header;
+    if (mapping.open(filename) || parseHeader(filename, mapping, header))
+        return 1;
+
+    codeAddressOut = reinterpret_cast<void *>(header.codeAddress);
+    return 0;
+}
+
+/** Get the region which a section is restored into. */
+static MemoryRegion *sectionRegion(TraceeMemory &memory, SectionType type)
+{
+    switch (type) {
+        case SectionType::CODE:
+            return &memory.code;
+        case SectionType::DATA:
+            return &memory.data;
+        case SectionType::SCRATCH:
+            return &memory.scratch;
+        default:
+            return nullptr;
+    }
+}
+
+/* See SessionSnapshot.h. */
+int restoreSessionSnapshot(const std::string &filename, Tracee &tracee,
+                           SymbolTable &symbols, TemplateTable &templates)
+{
+    SnapshotMapping mapping;
+    SnapshotHeader header;
+    if (mapping.open(filename) || parseHeader(filename, mapping, header))
+        return 1;
+
+    if (header.machine != hostMachine()) {
+        fprintf(stderr, "%s was saved on %s, not %s\n", filename.c_str(),
+                header.machine.c_str(), hostMachine().c_str());
+        return 1;
+    }
+
+    TraceeMemory &memory = tracee.getMemory();
+    if (header.span != memorySpan(memory)) {
+        fprintf(stderr, "%s: memory layout doesn't match\n", filename.c_str());
+        return 1;
+    }
+
+    // Check everything before we touch anything
+    const Section *registers = nullptr, *symbolSection = nullptr;
+    const Section *templateSection = nullptr;
+    for (const auto &section : header.sections) {
+        if (section.type == SectionType::REGISTERS && !registers) {
+            registers = &section;
+            continue;
+        }
+        if (section.type == SectionType::SYMBOLS && !symbolSection) {
+            symbolSection = &section;
+            continue;
+        }
+        if (section.type == SectionType::TEMPLATES && !templateSection) {
+            templateSection = &section;
+            continue;
+        }
+
+        MemoryRegion *region = sectionRegion(memory, section.type);
+        if (!region || section.regionOffset > region->size ||
+            section.size > region->size - section.regionOffset ||
+            (section.type != SectionType::SCRATCH && section.regionOffset)) {
+            fprintf(stderr, "%s: malformed snapshot\n", filename.c_str());
+            return 1;
+        }
+    }
+    if (!registers || !symbolSection) {
+        fprintf(stderr, "%s: malformed snapshot\n", filename.c_str());
+        return 1;
+    }
+
+    ByteReader symbolReader{symbolSection->contents, symbolSection->size};
+    if (symbols.deserialize(symbolReader) || !symbolReader.atEnd()) {
+        fprintf(stderr, "%s: malformed symbol table\n", filename.c_str());
+        return 1;
+    }
+
+    if (templateSection) {
+        ByteReader templateReader{templateSection->contents,
+                                  templateSection->size};
+        if (templates.deserialize(templateReader) ||
+            !templateReader.atEnd()) {
+            fprintf(stderr, "%s: malformed template table\n",
+                    filename.c_str());
+            return 1;
+        }
+    }
+
+    if (tracee.restoreRegisterContext(
+            bytestring{static_cast<const unsigned char *>(registers->contents),
+                       registers->size}))
+        return 1;
+
+    for (const auto &section : header.sections) {
+        MemoryRegion *region = sectionRegion(memory, section.type);
+        if (!region)
+            continue;
+        memcpy(static_cast<unsigned char *>(region->address) +
+                   section.regionOffset,
+               section.contents, section.size);
+        if (section.type != SectionType::SCRATCH)
+            region->used = section.size;
+    }
+
+    uintptr_t base = reinterpret_cast<uintptr_t>(memory.code.address);
+    if (header.codeAddress != base) {
+        fprintf(stderr,
+                "warning: %s was saved at 0x%" PRIxPTR ", not 0x%" PRIxPTR
+                "; absolute addresses in memory and registers are stale\n",
+                filename.c_str(), header.codeAddress, base);
+        symbols.relocate(header.codeAddress, header.codeAddress + header.span,
+                         base - header.codeAddress);
+        templates.relocate(header.codeAddress,
+                           header.codeAddress + header.span,
+                           base - header.codeAddress);
+    }
+
+    return 0;
+}
@@ -0,0 +1,435 @@
+/*
+ * Shared library loading implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "ElfReader.h"
+#include "SharedLibrary.h"
+#include "SymbolTable.h"
+#include "Tracee.h"
+
+/** Bit set in a symbol's version index if it isn't the default version. */
+static const ElfW(Versym) VERSYM_HIDDEN = 0x8000;
+
+/* See SharedLibrary.h. */
+int readExportedSymbols(const std::string &path,
+                        std::vector<ExportedSymbol> &symbolsOut,
+                        uintptr_t &firstAddressOut)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path.c_str());
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        close(fd);
+        return 1;
+    }
+
+    void *file = MAP_FAILED;
+    if (st.st_size > 0)
+        file = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        fprintf(stderr, "could not map %s\n", path.c_str());
+        return 1;
+    }
+
+    ElfReader reader{file, static_cast<size_t>(st.st_size)};
+    if (!reader.isValid()) {
+        fprintf(stderr, "%s is not a valid ELF file\n", path.c_str());
+        munmap(file, st.st_size);
+        return 1;
+    }
+
+    const ElfW(Shdr) *dynsym = nullptr, *versym = nullptr;
+    size_t strtab = 0;
+    for (size_t i = 0; i < reader.numSections(); i++) {
+        const ElfW(Shdr) &section = reader.getSection(i);
+        if (section.sh_type == SHT_DYNSYM) {
+            dynsym = &section;
+            strtab = section.sh_link;
+        } else if (section.sh_type == SHT_GNU_versym)
+            versym = &section;
+    }
+
+    size_t numSymbols = dynsym ? reader.numEntries<ElfW(Sym)>(*dynsym) : 0;
+    if (versym && reader.numEntries<ElfW(Versym)>(*versym) != numSymbols)
+        versym = nullptr;
+
+    symbolsOut.clear();
+    for (size_t i = 1; i < numSymbols; i++) {
+        const ElfW(Sym) &symbol = reader.getEntry<ElfW(Sym)>(*dynsym, i);
+        int type = ElfW_ST_TYPE(symbol.st_info);
+        int binding = ElfW_ST_BIND(symbol.st_info);
+
+        if (symbol.st_shndx == SHN_UNDEF || symbol.st_shndx == SHN_ABS)
+            continue;
+        if (binding != STB_GLOBAL && binding != STB_WEAK &&
+            binding != STB_GNU_UNIQUE)
+            continue;
+        if (type != STT_FUNC && type != STT_OBJECT && type != STT_GNU_IFUNC &&
+            type != STT_NOTYPE)
+            continue;
+        // Older versions of a symbol are only there for old binaries
+        if (versym &&
+            (reader.getEntry<ElfW(Versym)>(*versym, i) & VERSYM_HIDDEN))
+            continue;
+
+        const char *name = reader.getString(strtab, symbol.st_name);
+        if (!*name)
+            continue;
+        symbolsOut.push_back(ExportedSymbol{name, symbol.st_value,
+                                            type == STT_GNU_IFUNC,
+                                            binding == STB_WEAK});
+    }
+
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    firstAddressOut = 0;
+    for (size_t i = 0; i < reader.numSegments(); i++) {
+        const ElfW(Phdr) &segment = reader.getSegment(i);
+        if (segment.p_type == PT_LOAD) {
+            firstAddressOut = segment.p_vaddr & ~(pageSize - 1);
+            break;
+        }
+    }
+
+    munmap(file, st.st_size);
+    return 0;
+}
+
+/**
+ * Read a NUL-terminated string from the tracee without reading past the page
+ * it ends on.
+ * @return Zero on success, nonzero on failure.
+ */
+static int readTraceeString(Tracee &tracee, const void *address,
+                            std::string &strOut)
+{
+    static const size_t maxLength = 4096;
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    auto p = reinterpret_cast<uintptr_t>(address);
+
+    strOut.clear();
+    while (strOut.size() < maxLength) {
+        char buffer[256];
+        size_t size = std::min<uintptr_t>(sizeof(buffer),
+                                          pageSize - p % pageSize);
+        if (tracee.readMemory(reinterpret_cast<void *>(p), buffer, size))
+            return 1;
+        size_t length = strnlen(buffer, size);
+        strOut.append(buffer, length);
+        if (length < size)
+            return 0;
+        p += size;
+    }
+    return 0;
+}
+
+/**
+ * Find where one of the dynamic loader's functions is in the tracee. A tracee
+ * which is a fork of us has it at the same address as we do; otherwise, the
+ * library containing it is looked for in the tracee's mappings by its device
+ * and inode.
+ * @param function Address of the function in our process.
+ * @return Zero on success, nonzero on failure.
+ */
+static int findLoaderFunction(Tracee &tracee, uintptr_t function,
+                              uintptr_t &addressOut)
+{
+    if (tracee.isForked()) {
+        addressOut = function;
+        return 0;
+    }
+
+    Dl_info info;
+    struct stat st;
+    if (!dladdr(reinterpret_cast<void *>(function), &info) ||
+        !info.dli_fname || stat(info.dli_fname, &st) == -1) {
+        fprintf(stderr, "could not find the dynamic loader's library\n");
+        return 1;
+    }
+
+    char mapsPath[64];
+    snprintf(mapsPath, sizeof(mapsPath), "/proc/%d/maps",
+             static_cast<int>(tracee.getPid()));
+    FILE *maps = fopen(mapsPath, "r");
+    if (!maps) {
+        perror(mapsPath);
+        return 1;
+    }
+
+    bool found = false;
+    char line[4096 + 128];
+    while (!found && fgets(line, sizeof(line), maps)) {
+        unsigned long start, offset, inode;
+        unsigned int major, minor;
+        if (sscanf(line, "%lx-%*x %*s %lx %x:%x %lu", &start, &offset, &major,
+                   &minor, &inode) == 5 &&
+            offset == 0 && inode == st.st_ino &&
+            makedev(major, minor) == st.st_dev) {
+            addressOut = start + function -
+                         reinterpret_cast<uintptr_t>(info.dli_fbase);
+            found = true;
+        }
+    }
+    fclose(maps);
+
+    if (!found)
+        fprintf(stderr, "%s isn't loaded in the tracee\n", info.dli_fname);
+    return found ? 0 : 1;
+}
+
+/**
+ * Print the dynamic loader's last error in the tracee.
+ * @param what What failed.
+ */
+static void printLoaderError(Tracee &tracee, const char *what)
+{
+    FunctionCall call{0, {}, 0};
+    std::string error;
+    if (findLoaderFunction(tracee, reinterpret_cast<uintptr_t>(&dlerror),
+                           call.function) == 0 &&
+        tracee.injectCall(call) == 0 && call.ret &&
+        readTraceeString(tracee, reinterpret_cast<void *>(call.ret),
+                         error) == 0)
+        fprintf(stderr, "%s: %s\n", what, error.c_str());
+    else
+        fprintf(stderr, "%s failed\n", what);
+}
+
+/**
+ * Look up a symbol with dlsym() in the tracee, which runs the resolver if it
+ * is an indirect function.
+ * @param handle Handle from dlopen(), or RTLD_DEFAULT.
+ * @param addressOut Set to the address of the symbol, or zero if it wasn't
+ * found.
+ * @return Zero on success, nonzero on failure.
+ */
+static int lookupInTracee(Tracee &tracee, uintptr_t handle,
+                          const std::string &name, uintptr_t &addressOut)
+{
+    const MemoryRegion *stack = tracee.getCallStack();
+    if (!stack)
+        return 1;
+    if (tracee.writeMemory(stack->address, name.c_str(), name.size() + 1))
+        return 1;
+
+    FunctionCall call{0,
+                      {handle, reinterpret_cast<uintptr_t>(stack->address)},
+                      0};
+    if (findLoaderFunction(tracee, reinterpret_cast<uintptr_t>(&dlsym),
+                           call.function) ||
+        tracee.injectCall(call))
+        return 1;
+    addressOut = call.ret;
+    return 0;
+}
+
+/* See SharedLibrary.h. */
+int loadSharedLibrary(Tracee &tracee, SymbolTable &symbols,
+                      const std::string &library)
+{
+    // Arguments passed by reference go at the bottom of the call stack: a
+    // pointer-sized result followed by a string
+    const MemoryRegion *stack = tracee.getCallStack();
+    if (!stack)
+        return 1;
+    auto resultAddress = static_cast<unsigned char *>(stack->address);
+    unsigned char *stringAddress = resultAddress + sizeof(uintptr_t);
+    if (library.size() + 1 > stack->size / 2) {
+        fprintf(stderr, "library name is too long\n");
+        return 1;
+    }
+    if (tracee.writeMemory(stringAddress, library.c_str(),
+                           library.size() + 1))
+        return 1;
+
+    FunctionCall openCall{0,
+                          {reinterpret_cast<uintptr_t>(stringAddress),
+                           RTLD_NOW | RTLD_GLOBAL}, 0};
+    if (findLoaderFunction(tracee, reinterpret_cast<uintptr_t>(&dlopen),
+                           openCall.function) ||
+        tracee.injectCall(openCall))
+        return 1;
+    if (!openCall.ret) {
+        printLoaderError(tracee, "dlopen");
+        return 1;
+    }
+
+    FunctionCall infoCall{0,
+                          {openCall.ret, RTLD_DI_LINKMAP,
+                           reinterpret_cast<uintptr_t>(resultAddress)}, 0};
+    if (findLoaderFunction(tracee, reinterpret_cast<uintptr_t>(&dlinfo),
+                           infoCall.function) ||
+        tracee.injectCall(infoCall))
+        return 1;
+    if (infoCall.ret) {
+        printLoaderError(tracee, "dlinfo");
+        return 1;
+    }
+
+    uintptr_t linkMapAddress;
+    struct link_map linkMap;
+    std::string path;
+    if (tracee.readMemory(resultAddress, &linkMapAddress,
+                          sizeof(linkMapAddress)) ||
+        tracee.readMemory(reinterpret_cast<void *>(linkMapAddress), &linkMap,
+                          sizeof(linkMap)) ||
+        readTraceeString(tracee, linkMap.l_name, path)) {
+        fprintf(stderr, "could not find where the library was loaded\n");
+        return 1;
+    }
+
+    std::vector<ExportedSymbol> exported;
+    uintptr_t firstAddress;
+    if (readExportedSymbols(path, exported, firstAddress))
+        return 1;
+
+    size_t defined = 0;
+    for (const ExportedSymbol &symbol : exported) {
+        uintptr_t value;
+        if (symbols.lookup(symbol.name, value))
+            continue;
+        value = linkMap.l_addr + symbol.value;
+
+        // Let the loader run the resolvers of indirect functions; it knows
+        // what arguments they expect
+        if (symbol.isIndirect) {
+            if (lookupInTracee(tracee, openCall.ret, symbol.name, value))
+                return 1;
+            if (!value)
+                continue;
+        }
+
+        if (symbols.defineExternal(tracee, symbol.name, value))
+            defined++;
+    }
+
+    printf("loaded %s at %p (%zu new symbols)\n", path.c_str(),
+           reinterpret_cast<void *>(linkMap.l_addr), defined);
+    return 0;
+}
+
+/* See SharedLibrary.h. */
+void LibraryIndex::build()
+{
+    built = true;
+
+    char mapsPath[64];
+    snprintf(mapsPath, sizeof(mapsPath), "/proc/%d/maps",
+             static_cast<int>(tracee.getPid()));
+    FILE *maps = fopen(mapsPath, "r");
+    if (!maps) {
+        perror(mapsPath);
+        return;
+    }
+
+    // Each file's mapping at offset zero is where its first loadable segment
+    // was placed
+    std::vector<std::pair<uintptr_t, std::string>> files;
+    char line[4096 + 128];
+    while (fgets(line, sizeof(line), maps)) {
+        unsigned long start, offset;
+        int pathStart = 0;
+        if (sscanf(line, "%lx-%*x %*s %lx %*s %*u %n", &start, &offset,
+                   &pathStart) < 2 || !pathStart)
+            continue;
+
+        std::string path{line + pathStart};
+        if (!path.empty() && path.back() == '\n')
+            path.pop_back();
+        if (offset != 0 || path.empty() || path[0] != '/')
+            continue;
+
+        // Skip anything which isn't an ELF file, e.g., locale archives
+        char magic[SELFMAG];
+        if (tracee.readMemory(reinterpret_cast<void *>(start), magic,
+                              sizeof(magic)) ||
+            memcmp(magic, ELFMAG, SELFMAG) != 0)
+            continue;
+
+        bool seen = false;
+        for (const auto &file : files)
+            seen = seen || file.second == path;
+        if (!seen)
+            files.emplace_back(start, path);
+    }
+    fclose(maps);
+
+    std::vector<ExportedSymbol> exported;
+    for (const auto &file : files) {
+        uintptr_t firstAddress;
+        if (readExportedSymbols(file.second, exported, firstAddress))
+            continue;
+
+        uintptr_t bias = file.first - firstAddress;
+        for (const ExportedSymbol &symbol : exported) {
+            Entry entry{bias + symbol.value, symbol.isIndirect,
+                        symbol.isWeak};
+
+            // Strong definitions override weak ones; otherwise, the first
+            // definition wins
+            auto result = index.emplace(symbol.name, entry);
+            if (!result.second && result.first->second.isWeak &&
+                !entry.isWeak)
+                result.first->second = entry;
+        }
+    }
+}
+
+/* See SharedLibrary.h. */
+bool LibraryIndex::lookup(const std::string &name, uintptr_t &addressOut)
+{
+    if (!built)
+        build();
+
+    auto it = index.find(name);
+    if (it == index.end())
+        return false;
+
+    Entry &entry = it->second;
+    if (entry.isIndirect) {
+        uintptr_t address;
+        if (lookupInTracee(tracee, reinterpret_cast<uintptr_t>(RTLD_DEFAULT),
+                           name, address) ||
+            !address)
+            return false;
+        entry.address = address;
+        entry.isIndirect = false;
+    }
+
+    addressOut = entry.address;
+    return true;
+}
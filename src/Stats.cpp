@@ -0,0 +1,167 @@
+/*
+ * Statistics implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
+
+#include "AllocationCounter.h"
+#include "Stats.h"
+
+static const size_t NUM_PHASES = static_cast<size_t>(StatsPhase::NUM_PHASES);
+
+/** Names of the phases, in the order of StatsPhase. */
+static const char *phaseNames[NUM_PHASES] = {
+    "other",
+    "input",
+    "assemble",
+    "link",
+    "execute",
+    "registers",
+    "memory",
+    "builtin",
+};
+
+/** Counters for a phase. */
+struct PhaseStats {
+    uint64_t calls;
+    uint64_t ns;
+    uint64_t ptraceCalls;
+    uint64_t waitpidCalls;
+    uint64_t bytesRead;
+    uint64_t allocations;
+};
+
+static PhaseStats phases[NUM_PHASES];
+
+/** The phase which time is currently being charged to. */
+static StatsPhase currentPhase = StatsPhase::OTHER;
+
+/** When the current phase was last charged. */
+static uint64_t lastNs;
+static uint64_t lastAllocations;
+
+/* See Stats.h. */
+uint64_t getMonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static PhaseStats &current()
+{
+    return phases[static_cast<size_t>(currentPhase)];
+}
+
+/** Charge everything since the last switch to the current phase. */
+static void charge()
+{
+    uint64_t now = getMonotonicNs();
+    uint64_t allocations = getAllocationCount();
+    if (lastNs) {
+        current().ns += now - lastNs;
+        current().allocations += allocations - lastAllocations;
+    }
+    lastNs = now;
+    lastAllocations = allocations;
+}
+
+/* See Stats.h. */
+PhaseTimer::PhaseTimer(StatsPhase phase)
+    : previous{currentPhase}
+{
+    charge();
+    currentPhase = phase;
+    ++current().calls;
+}
+
+/* See Stats.h. */
+PhaseTimer::~PhaseTimer()
+{
+    charge();
+    currentPhase = previous;
+}
+
+/* See Stats.h. */
+void countPtrace(enum __ptrace_request request)
+{
+    ++current().ptraceCalls;
+    if (request == PTRACE_PEEKDATA || request == PTRACE_PEEKTEXT)
+        current().bytesRead += sizeof(long);
+}
+
+/* See Stats.h. */
+void countWaitpid()
+{
+    ++current().waitpidCalls;
+}
+
+/** Print the allocation column of a row, or a dash if it isn't counted. */
+static void printAllocations(FILE *file, bool counted, uint64_t allocations)
+{
+    if (counted)
+        fprintf(file, "%12" PRIu64 "\n", allocations);
+    else
+        fprintf(file, "%12s\n", "-");
+}
+
+/* See Stats.h. */
+void printStats(FILE *file)
+{
+    charge();
+
+    PhaseStats total;
+    memset(&total, 0, sizeof(total));
+
+    // Without the malloc() wrappers, the allocation counts are meaningless
+    bool allocations = canCountAllocations();
+
+    fprintf(file, "%-10s %8s %12s %8s %8s %12s %12s\n", "phase", "calls",
+            "time (ms)", "ptrace", "waitpid", "bytes read", "allocations");
+    for (size_t i = 0; i < NUM_PHASES; ++i) {
+        const PhaseStats &phase = phases[i];
+        fprintf(file,
+                "%-10s %8" PRIu64 " %12.3f %8" PRIu64 " %8" PRIu64
+                " %12" PRIu64 " ",
+                phaseNames[i], phase.calls, phase.ns / 1e6, phase.ptraceCalls,
+                phase.waitpidCalls, phase.bytesRead);
+        printAllocations(file, allocations, phase.allocations);
+        total.ns += phase.ns;
+        total.ptraceCalls += phase.ptraceCalls;
+        total.waitpidCalls += phase.waitpidCalls;
+        total.bytesRead += phase.bytesRead;
+        total.allocations += phase.allocations;
+    }
+    fprintf(file,
+            "%-10s %8s %12.3f %8" PRIu64 " %8" PRIu64 " %12" PRIu64 " ",
+            "total", "", total.ns / 1e6, total.ptraceCalls, total.waitpidCalls,
+            total.bytesRead);
+    printAllocations(file, allocations, total.allocations);
+}
+
+/* See Stats.h. */
+void resetStats()
+{
+    memset(phases, 0, sizeof(phases));
+    lastNs = getMonotonicNs();
+    lastAllocations = getAllocationCount();
+}
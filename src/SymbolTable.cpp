@@ -0,0 +1,247 @@
+/*
+ * SymbolTable implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "Serialization.h"
+#include "SymbolTable.h"
+#include "Tracee.h"
+
+/* See SymbolTable.h. */
+int SymbolTable::applyFixup(unsigned char *field, uintptr_t address,
+                            const Fixup &fixup, uintptr_t value)
+{
+    uint64_t result = value + fixup.addend;
+    if (fixup.pcRelative)
+        result -= address + fixup.offset;
+
+    // Make sure the value fits in the field
+    if (fixup.size < sizeof(result)) {
+        int bits = 8 * fixup.size;
+        int64_t signedResult = static_cast<int64_t>(result);
+        bool fits;
+        if (fixup.isSigned)
+            fits = signedResult >= -(INT64_C(1) << (bits - 1)) &&
+                   signedResult < (INT64_C(1) << (bits - 1));
+        else
+            fits = result < (UINT64_C(1) << bits);
+        if (!fits)
+            return 1;
+    }
+
+    // Fields are in the host byte order, which is little-endian on all of
+    // our platforms
+    memcpy(field, &result, fixup.size);
+    return 0;
+}
+
+/* See SymbolTable.h. */
+bool SymbolTable::lookup(const std::string &name, uintptr_t &valueOut) const
+{
+    auto it = symbols.find(name);
+    if (it == symbols.end()) {
+        it = externals.find(name);
+        if (it == externals.end())
+            return fallback && fallback(name, valueOut);
+    }
+    valueOut = it->second;
+    return true;
+}
+
+/* See SymbolTable.h. */
+int SymbolTable::define(const std::string &name, uintptr_t value)
+{
+    if (symbols.count(name)) {
+        fprintf(stderr, "symbol '%s' is already defined\n", name.c_str());
+        return 1;
+    }
+    symbols[name] = value;
+    return 0;
+}
+
+/* See SymbolTable.h. */
+bool SymbolTable::defineExternal(Tracee &tracee, const std::string &name,
+                                 uintptr_t value)
+{
+    if (!externals.emplace(name, value).second)
+        return false;
+    if (!symbols.count(name))
+        resolvePending(tracee, name, value);
+    return true;
+}
+
+/* See SymbolTable.h. */
+void SymbolTable::resolvePending(Tracee &tracee, const std::string &name,
+                                 uintptr_t value)
+{
+    auto range = pending.equal_range(name);
+    for (auto it = range.first; it != range.second; ++it) {
+        const PendingFixup &pendingFixup = it->second;
+        unsigned char field[sizeof(uint64_t)];
+        void *fieldAddress =
+            reinterpret_cast<void *>(pendingFixup.address +
+                                     pendingFixup.fixup.offset);
+
+        if (applyFixup(field, pendingFixup.address, pendingFixup.fixup,
+                       value)) {
+            fprintf(stderr, "reference to '%s' at %p is out of range\n",
+                    name.c_str(), fieldAddress);
+            continue;
+        }
+        tracee.writeMemory(fieldAddress, field, pendingFixup.fixup.size);
+    }
+    pending.erase(range.first, range.second);
+}
+
+/* See SymbolTable.h. */
+int SymbolTable::link(Tracee &tracee, void *codeAddress, void *dataAddress,
+                      AssembledCode &code, size_t &unresolvedOut)
+{
+    auto base = [&](Segment segment) {
+        return reinterpret_cast<uintptr_t>(segment == Segment::CODE ?
+                                           codeAddress : dataAddress);
+    };
+
+    for (const Label &label : code.labels) {
+        if (symbols.count(label.name)) {
+            fprintf(stderr, "symbol '%s' is already defined\n",
+                    label.name.c_str());
+            return 1;
+        }
+    }
+
+    // Resolve what we can in the new code before defining anything so that a
+    // failure leaves the table untouched
+    std::vector<const Fixup *> unresolved, tentative;
+    for (const Fixup &fixup : code.fixups) {
+        uintptr_t value;
+        if (fixup.symbol.empty())
+            value = base(fixup.target);
+        else if (!lookup(fixup.symbol, value)) {
+            unresolved.push_back(&fixup);
+            continue;
+        } else if (!symbols.count(fixup.symbol))
+            tentative.push_back(&fixup);
+
+        if (applyFixup(&code.getSegment(fixup.segment)[fixup.offset],
+                       base(fixup.segment), fixup, value)) {
+            fprintf(stderr, "reference to '%s' is out of range\n",
+                    fixup.symbol.empty() ? "." : fixup.symbol.c_str());
+            return 1;
+        }
+    }
+
+    for (const Label &label : code.labels) {
+        uintptr_t value = base(label.segment) + label.offset;
+        symbols[label.name] = value;
+
+        resolvePending(tracee, label.name, value);
+    }
+
+    unresolvedOut = 0;
+    for (const Fixup *fixup : unresolved) {
+        pending.emplace(fixup->symbol,
+                        PendingFixup{base(fixup->segment), *fixup});
+        if (fixup->segment == Segment::CODE)
+            ++unresolvedOut;
+    }
+
+    // References resolved to a library symbol are patched again if a label
+    // with the same name is defined later, since labels take precedence. The
+    // code runs with the library symbol until then, so say which one it got in
+    // case the name was meant to be a label (e.g., a forward jump to "error").
+    for (const Fixup *fixup : tentative) {
+        if (symbols.count(fixup->symbol))
+            continue;
+        pending.emplace(fixup->symbol,
+                        PendingFixup{base(fixup->segment), *fixup});
+        if (fixup->segment == Segment::CODE &&
+            !externals.count(fixup->symbol)) {
+            uintptr_t value = 0;
+            lookup(fixup->symbol, value);
+            fprintf(stderr, "note: '%s' is the library symbol at %p\n",
+                    fixup->symbol.c_str(), reinterpret_cast<void *>(value));
+        }
+    }
+
+    return 0;
+}
+
+/* See SymbolTable.h. */
+void SymbolTable::serialize(ByteWriter &writer) const
+{
+    writer.putU64(symbols.size());
+    for (const auto &symbol : symbols) {
+        writer.putString(symbol.first);
+        writer.putU64(symbol.second);
+    }
+
+    writer.putU64(pending.size());
+    for (const auto &pendingFixup : pending) {
+        writer.putU64(pendingFixup.second.address);
+        serializeFixup(writer, pendingFixup.second.fixup);
+    }
+}
+
+/* See SymbolTable.h. */
+int SymbolTable::deserialize(ByteReader &reader)
+{
+    std::unordered_map<std::string, uintptr_t> newSymbols;
+    std::unordered_multimap<std::string, PendingFixup> newPending;
+
+    uint64_t numSymbols = reader.getU64();
+    for (uint64_t i = 0; i < numSymbols && !reader.hasFailed(); ++i) {
+        std::string name = reader.getString<std::string>();
+        newSymbols[name] = reader.getU64();
+    }
+
+    uint64_t numPending = reader.getU64();
+    for (uint64_t i = 0; i < numPending && !reader.hasFailed(); ++i) {
+        uintptr_t address = reader.getU64();
+        Fixup fixup;
+        if (deserializeFixup(reader, fixup) || fixup.symbol.empty())
+            return 1;
+        newPending.emplace(fixup.symbol, PendingFixup{address, fixup});
+    }
+
+    if (reader.hasFailed())
+        return 1;
+
+    symbols = std::move(newSymbols);
+    pending = std::move(newPending);
+    return 0;
+}
+
+/* See SymbolTable.h. */
+void SymbolTable::relocate(uintptr_t start, uintptr_t end, uintptr_t delta)
+{
+    for (auto &symbol : symbols) {
+        if (symbol.second >= start && symbol.second < end)
+            symbol.second += delta;
+    }
+
+    for (auto &pendingFixup : pending) {
+        uintptr_t &address = pendingFixup.second.address;
+        if (address >= start && address < end)
+            address += delta;
+    }
+}
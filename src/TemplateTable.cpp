@@ -0,0 +1,220 @@
+/*
+ * Templates of code with parameters patched into the machine code.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+#include "Serialization.h"
+#include "SymbolTable.h"
+#include "TemplateTable.h"
+#include "Tracee.h"
+
+/* See TemplateTable.h. */
+int TemplateTable::define(Tracee &tracee, const SymbolTable &symbols,
+                          const std::string &name,
+                          const std::vector<std::string> &params,
+                          const AssembledCode &code)
+{
+    if (!code.hostSupported) {
+        fprintf(stderr, "template is not supported by the host CPU\n");
+        return 1;
+    } else if (!code.data.empty()) {
+        fprintf(stderr, "templates can't contain data\n");
+        return 1;
+    } else if (code.machineCode.empty()) {
+        fprintf(stderr, "template is empty\n");
+        return 1;
+    }
+
+    CodeTemplate codeTemplate;
+    codeTemplate.params = params;
+    codeTemplate.machineCode = code.machineCode;
+
+    // Link the code where it will go before placing it so that a failure
+    // doesn't use up any room
+    void *address = tracee.getCodeAddress(code.machineCode.size());
+    if (!address) {
+        fprintf(stderr, "no room left for template\n");
+        return 1;
+    }
+    uintptr_t base = reinterpret_cast<uintptr_t>(address);
+    std::vector<bool> used(params.size());
+    for (const Fixup &fixup : code.fixups) {
+        auto param = std::find(params.begin(), params.end(), fixup.symbol);
+        if (!fixup.symbol.empty() && param != params.end()) {
+            codeTemplate.fields.push_back(fixup);
+            codeTemplate.fieldParams.push_back(param - params.begin());
+            used[param - params.begin()] = true;
+            continue;
+        }
+
+        uintptr_t value = base;
+        if (!fixup.symbol.empty() && !symbols.lookup(fixup.symbol, value)) {
+            fprintf(stderr, "template refers to undefined symbol '%s'\n",
+                    fixup.symbol.c_str());
+            return 1;
+        }
+        if (SymbolTable::applyFixup(&codeTemplate.machineCode[fixup.offset],
+                                    base, fixup, value)) {
+            fprintf(stderr, "reference to '%s' is out of range\n",
+                    fixup.symbol.empty() ? "." : fixup.symbol.c_str());
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < params.size(); i++) {
+        if (!used[i])
+            fprintf(stderr, "warning: parameter '%s' is never used\n",
+                    params[i].c_str());
+    }
+
+    codeTemplate.address = tracee.writeIsolatedCode(codeTemplate.machineCode);
+    if (!codeTemplate.address)
+        return 1;
+    templates[name] = std::move(codeTemplate);
+    return 0;
+}
+
+/* See TemplateTable.h. */
+const CodeTemplate *TemplateTable::lookup(const std::string &name) const
+{
+    auto it = templates.find(name);
+    return it == templates.end() ? nullptr : &it->second;
+}
+
+/* See TemplateTable.h. */
+int TemplateTable::instantiate(Tracee &tracee, const std::string &name,
+                               const std::vector<uint64_t> &args)
+{
+    auto it = templates.find(name);
+    if (it == templates.end()) {
+        fprintf(stderr, "no template named '%s'\n", name.c_str());
+        return 1;
+    }
+    CodeTemplate &codeTemplate = it->second;
+    if (args.size() != codeTemplate.params.size()) {
+        fprintf(stderr, "template '%s' takes %zu argument%s\n", name.c_str(),
+                codeTemplate.params.size(),
+                codeTemplate.params.size() == 1 ? "" : "s");
+        return 1;
+    }
+
+    // Patch our copy first so that nothing in the tracee changes unless
+    // every argument fits
+    uintptr_t base = reinterpret_cast<uintptr_t>(codeTemplate.address);
+    for (size_t i = 0; i < codeTemplate.fields.size(); i++) {
+        const Fixup &field = codeTemplate.fields[i];
+        size_t param = codeTemplate.fieldParams[i];
+        if (SymbolTable::applyFixup(&codeTemplate.machineCode[field.offset],
+                                    base, field, args[param])) {
+            fprintf(stderr, "argument for '%s' doesn't fit in %zu byte%s\n",
+                    codeTemplate.params[param].c_str(), field.size,
+                    field.size == 1 ? "" : "s");
+            return 1;
+        }
+    }
+
+    auto code = static_cast<unsigned char *>(codeTemplate.address);
+    for (const Fixup &field : codeTemplate.fields) {
+        if (tracee.writeMemory(code + field.offset,
+                               &codeTemplate.machineCode[field.offset],
+                               field.size))
+            return 1;
+    }
+    return 0;
+}
+
+/* See TemplateTable.h. */
+void TemplateTable::serialize(ByteWriter &writer) const
+{
+    writer.putU64(templates.size());
+    for (const auto &entry : templates) {
+        const CodeTemplate &codeTemplate = entry.second;
+        writer.putString(entry.first);
+        writer.putU64(reinterpret_cast<uintptr_t>(codeTemplate.address));
+        writer.putString(codeTemplate.machineCode);
+
+        writer.putU32(codeTemplate.params.size());
+        for (const std::string &param : codeTemplate.params)
+            writer.putString(param);
+
+        writer.putU32(codeTemplate.fields.size());
+        for (size_t i = 0; i < codeTemplate.fields.size(); i++) {
+            serializeFixup(writer, codeTemplate.fields[i]);
+            writer.putU32(codeTemplate.fieldParams[i]);
+        }
+    }
+}
+
+/* See TemplateTable.h. */
+int TemplateTable::deserialize(ByteReader &reader)
+{
+    std::unordered_map<std::string, CodeTemplate> newTemplates;
+
+    uint64_t numTemplates = reader.getU64();
+    for (uint64_t i = 0; i < numTemplates && !reader.hasFailed(); ++i) {
+        std::string name = reader.getString<std::string>();
+        CodeTemplate codeTemplate;
+        codeTemplate.address = reinterpret_cast<void *>(
+            static_cast<uintptr_t>(reader.getU64()));
+        reader.getString(codeTemplate.machineCode);
+
+        uint32_t numParams = reader.getU32();
+        for (uint32_t j = 0; j < numParams && !reader.hasFailed(); ++j)
+            codeTemplate.params.push_back(reader.getString<std::string>());
+
+        uint32_t numFields = reader.getU32();
+        for (uint32_t j = 0; j < numFields && !reader.hasFailed(); ++j) {
+            Fixup field;
+            if (deserializeFixup(reader, field))
+                return 1;
+            uint32_t param = reader.getU32();
+
+            // Patching the field mustn't go outside of our copy of the code
+            if (field.offset > codeTemplate.machineCode.size() ||
+                field.size > codeTemplate.machineCode.size() - field.offset ||
+                param >= codeTemplate.params.size())
+                return 1;
+            codeTemplate.fields.push_back(field);
+            codeTemplate.fieldParams.push_back(param);
+        }
+
+        newTemplates[name] = std::move(codeTemplate);
+    }
+
+    if (reader.hasFailed())
+        return 1;
+
+    templates = std::move(newTemplates);
+    return 0;
+}
+
+/* See TemplateTable.h. */
+void TemplateTable::relocate(uintptr_t start, uintptr_t end, uintptr_t delta)
+{
+    for (auto &entry : templates) {
+        uintptr_t address =
+            reinterpret_cast<uintptr_t>(entry.second.address);
+        if (address >= start && address < end)
+            entry.second.address = reinterpret_cast<void *>(address + delta);
+    }
+}
@@ -21,61 +21,295 @@
  */
 
 #include <algorithm>
+#include <cerrno>
+#include <cinttypes>
 #include <csignal>
 #include <cstdio>
 #include <cstring>
+#include <initializer_list>
 #include <utility>
 
+#include <fcntl.h>
+#include <link.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
 #include "RegisterInfo.h"
+#include "Stats.h"
 #include "Tracee.h"
 
-std::vector<std::pair<RegisterCategory, Tracee::RegisterCategoryPrinter>>
-Tracee::categoryPrinters = {
-    {RegisterCategory::GENERAL_PURPOSE, &Tracee::printGeneralPurposeRegisters},
-    {RegisterCategory::CONDITION_CODE,  &Tracee::printConditionCodeRegisters},
-    {RegisterCategory::FLOATING_POINT,  &Tracee::printFloatingPointRegisters},
-    {RegisterCategory::EXTRA,           &Tracee::printExtraRegisters},
-    {RegisterCategory::SEGMENTATION,    &Tracee::printSegmentationRegisters},
-};
+/** Number of pages of code that can be placed in the tracee. */
+static const size_t CODE_PAGES = 256;
+
+/** Number of pages of data that can be placed in the tracee. */
+static const size_t DATA_PAGES = 256;
+
+/** Size of the scratch region. */
+static const size_t SCRATCH_SIZE = 64 << 20;
+
+/** Size of the stack for functions called with injectCall(). */
+static const size_t CALL_STACK_SIZE = 8 << 20;
+
+/**
+ * Number of bytes borrowed at the entry point of a process which we didn't
+ * fork: a system call instruction followed by a trap, and then a string
+ * argument at ENTRY_STRING_OFFSET.
+ */
+static const size_t ENTRY_STUB_SIZE = 128;
+static const size_t ENTRY_STRING_OFFSET = 32;
 
 /* See Tracee.h. */
-int Tracee::executeInstruction(const bytestring &machineCode)
+void *Tracee::getCodeAddress(size_t size)
 {
-    unsigned char *shared = reinterpret_cast<unsigned char *>(sharedMemory);
     const bytestring &trapInstruction = getTrapInstruction();
+    return memory.code.nextAddress(size + trapInstruction.size());
+}
 
-    if (machineCode.size() + trapInstruction.size() >= sharedSize) {
-        fprintf(stderr, "instruction too long\n");
-        return 1;
+/* See Tracee.h. */
+void *Tracee::writeInstruction(const bytestring &machineCode)
+{
+    const bytestring &trapInstruction = getTrapInstruction();
+
+    unsigned char *shared =
+        static_cast<unsigned char *>(getCodeAddress(machineCode.size()));
+    if (!shared) {
+        fprintf(stderr, "no room left for instruction\n");
+        return nullptr;
     }
 
     memcpy(shared, machineCode.c_str(), machineCode.size());
-    shared += machineCode.size();
-    memcpy(shared, trapInstruction.c_str(), trapInstruction.size());
+    memcpy(shared + machineCode.size(), trapInstruction.c_str(),
+           trapInstruction.size());
+    memory.code.used += machineCode.size();
+
+    return shared;
+}
+
+/* See Tracee.h. */
+void *Tracee::writeIsolatedCode(const bytestring &machineCode)
+{
+    void *address = writeInstruction(machineCode);
+    if (address)
+        memory.code.used += getTrapInstruction().size();
+    return address;
+}
+
+/* See Tracee.h. */
+void *Tracee::getDataAddress(size_t size, size_t alignment)
+{
+    return memory.data.nextAddress(size, alignment);
+}
+
+/* See Tracee.h. */
+void *Tracee::writeData(const bytestring &data, size_t alignment)
+{
+    unsigned char *shared =
+        static_cast<unsigned char *>(getDataAddress(data.size(), alignment));
+    if (!shared) {
+        fprintf(stderr, "no room left for data\n");
+        return nullptr;
+    }
+
+    memcpy(shared, data.c_str(), data.size());
+    memory.data.used =
+        shared - static_cast<unsigned char *>(memory.data.address) + data.size();
+
+    return shared;
+}
+
+/* See Tracee.h. */
+int Tracee::writeMemory(void *address, const void *buffer, size_t size)
+{
+    unsigned char *dest = static_cast<unsigned char *>(address);
+    const unsigned char *src = static_cast<const unsigned char *>(buffer);
+
+    // Memory shared with the tracee can be written directly
+    if (memory.contains(dest, size)) {
+        memcpy(dest, src, size);
+        return 0;
+    }
+
+    // Otherwise, try to write it all at once, and go a word at a time for
+    // whatever is left (e.g., read-only pages, which only ptrace can write),
+    // preserving the bytes around the buffer
+    size_t written = writeDirect(dest, src, size);
+    dest += written;
+    src += written;
+    size -= written;
+
+    while (size > 0) {
+        uintptr_t misalignment = reinterpret_cast<uintptr_t>(dest) % sizeof(long);
+        unsigned char *wordAddress = dest - misalignment;
+        size_t amount = std::min(sizeof(long) - misalignment, size);
+        long word;
+
+        if ((misalignment || amount < sizeof(long)) &&
+            peekWord(wordAddress, word)) {
+            perror("ptrace");
+            fprintf(stderr, "could not read tracee memory\n");
+            return 1;
+        }
+
+        memcpy(reinterpret_cast<unsigned char *>(&word) + misalignment, src,
+               amount);
+        if (pokeWord(wordAddress, word)) {
+            perror("ptrace");
+            fprintf(stderr, "could not write tracee memory\n");
+            return 1;
+        }
+
+        dest += amount;
+        src += amount;
+        size -= amount;
+    }
+
+    return 0;
+}
+
+/* See Tracee.h. */
+int Tracee::readMemory(const void *address, void *buffer, size_t size)
+{
+    auto src = static_cast<const unsigned char *>(address);
+    auto dest = static_cast<unsigned char *>(buffer);
+
+    if (memory.contains(src, size)) {
+        memcpy(dest, src, size);
+        return 0;
+    }
+
+    size_t read = readDirect(src, dest, size);
+    src += read;
+    dest += read;
+    size -= read;
+
+    while (size > 0) {
+        uintptr_t misalignment = reinterpret_cast<uintptr_t>(src) % sizeof(long);
+        size_t amount = std::min(sizeof(long) - misalignment, size);
+        long word;
+
+        if (peekWord(src - misalignment, word)) {
+            perror("ptrace");
+            fprintf(stderr, "could not read tracee memory\n");
+            return 1;
+        }
+        memcpy(dest, reinterpret_cast<unsigned char *>(&word) + misalignment,
+               amount);
+
+        src += amount;
+        dest += amount;
+        size -= amount;
+    }
+
+    return 0;
+}
+
+/* See Tracee.h. */
+const unsigned char *Tracee::getMemoryView(const void *address, size_t size,
+                                           bytestring &bufferOut)
+{
+    if (memory.contains(address, size))
+        return static_cast<const unsigned char *>(address);
+
+    bufferOut.resize(size);
+    if (readMemory(address, &bufferOut[0], size))
+        return nullptr;
+    return bufferOut.data();
+}
 
+/* See Tracee.h. */
+size_t Tracee::readDirect(const void *address, void *buffer, size_t size)
+{
+    struct iovec local = {buffer, size};
+    struct iovec remote = {const_cast<void *>(address), size};
+    ssize_t ret = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    return ret > 0 ? ret : 0;
+}
+
+/* See Tracee.h. */
+size_t Tracee::writeDirect(void *address, const void *buffer, size_t size)
+{
+    struct iovec local = {const_cast<void *>(buffer), size};
+    struct iovec remote = {address, size};
+    ssize_t ret = process_vm_writev(pid, &local, 1, &remote, 1, 0);
+    return ret > 0 ? ret : 0;
+}
+
+/* See Tracee.h. */
+int Tracee::peekWord(const void *address, long &wordOut)
+{
+    if (memory.contains(address, sizeof(long))) {
+        memcpy(&wordOut, address, sizeof(long));
+        return 0;
+    }
+
+    errno = 0;
+    wordOut = countedPtrace(PTRACE_PEEKDATA, pid, const_cast<void *>(address),
+                            nullptr);
+    return errno != 0;
+}
+
+/* See Tracee.h. */
+int Tracee::pokeWord(void *address, long word)
+{
+    if (memory.contains(address, sizeof(long))) {
+        memcpy(address, &word, sizeof(long));
+        return 0;
+    }
+
+    return countedPtrace(PTRACE_POKEDATA, pid, address,
+                         reinterpret_cast<void *>(word)) == -1;
+}
+
+/* See Tracee.h. */
+int Tracee::executeInstruction(void *address)
+{
+    PhaseTimer timer{StatsPhase::EXECUTE};
     int waitStatus;
+    bool inSyscall = false;
+    uint64_t resumeNs = 0;
+    SyscallRecord syscall;
 
-    if (setProgramCounter(sharedMemory))
+    if (setProgramCounter(address))
         return -1;
 
+    syscalls.clear();
+    stopSignal = 0;
+
 retry:
-    if (ptrace(PTRACE_CONT, pid, nullptr, 0) == -1) {
+    resumeNs = getMonotonicNs();
+    if (countedPtrace(traceSyscalls ? PTRACE_SYSCALL : PTRACE_CONT, pid,
+                      nullptr, 0) == -1) {
         perror("ptrace");
         fprintf(stderr, "could not continue tracee\n");
         return -1;
     }
 
-    if (waitpid(pid, &waitStatus, 0) == -1) {
+    if (countedWaitpid(pid, &waitStatus, 0) == -1) {
         perror("waitpid");
         fprintf(stderr, "could not wait for tracee\n");
         return -1;
     }
 
+    // With PTRACE_O_TRACESYSGOOD, syscall stops are SIGTRAP with bit 7 set;
+    // entry and exit stops alternate
+    if (WIFSTOPPED(waitStatus) && WSTOPSIG(waitStatus) == (SIGTRAP | 0x80)) {
+        if (!inSyscall) {
+            if (readSyscallEntry(syscall))
+                return -1;
+        } else {
+            syscall.latencyNs = getMonotonicNs() - resumeNs;
+            if (readSyscallExit(syscall))
+                return -1;
+            syscalls.push_back(syscall);
+        }
+        inSyscall = !inSyscall;
+        goto retry;
+    }
+
     if (WIFEXITED(waitStatus)) {
         fprintf(stderr, "tracee exited with status %d\n",
             WEXITSTATUS(waitStatus));
@@ -86,6 +320,7 @@ retry:
         return -1;
     } else if (WIFSTOPPED(waitStatus)) {
         int signal = WSTOPSIG(waitStatus);
+        stopSignal = signal;
         switch (signal) {
             case SIGTRAP:
                 break;
@@ -106,133 +341,1290 @@ retry:
         return -1;
     }
 
+    if (traceSyscalls)
+        printSyscalls();
+
     return 0;
 }
 
+/*
+ * Layout of the stubs region: a lone trap, the system call instruction
+ * followed by a trap, room for one longer stub, the stub for timed calls, and
+ * the start barrier of timed calls followed by a result for each party.
+ */
+static const size_t TRAP_STUB_OFFSET = 0;
+static const size_t SYSCALL_STUB_OFFSET = 16;
+static const size_t CODE_STUB_OFFSET = 64;
+static const size_t TIMED_CALL_STUB_OFFSET = 2048;
+static const size_t TIMED_CALL_BARRIER_OFFSET = 3072;
+static const size_t TIMED_CALL_RESULT_OFFSET = 3136;
+
 /* See Tracee.h. */
-void Tracee::printInstruction(const bytestring &machineCode)
+int Tracee::startStepping(void *address)
 {
-    printf("[");
-    for (size_t i = 0; i < machineCode.size(); ++i) {
-        if (i > 0)
-            printf(", ");
-        printf(PRINTFx8, machineCode[i]);
+    if (setProgramCounter(address) || updateRegisters())
+        return 1;
+    if (!getFetchedProgramCounter()) {
+        fprintf(stderr,
+                "single-stepping is not supported on this architecture\n");
+        return 1;
     }
-    printf("]");
+    return 0;
 }
 
 /* See Tracee.h. */
-std::shared_ptr<RegisterValue> Tracee::getRegisterValue(const std::string &regName)
+int Tracee::stepInstruction(void *&pcOut)
 {
-    auto registerHasName =
-        [regName](const RegisterDesc &reg) { return reg.name == regName; };
+    int waitStatus;
 
-    auto reg = std::find_if(std::begin(regInfo.registers),
-                            std::end(regInfo.registers),
-                            registerHasName);
+    stopSignal = 0;
 
-    if (reg == std::end(regInfo.registers))
-        return {nullptr};
-    else {
-        updateRegisters();
-        return std::shared_ptr<RegisterValue>{reg->getValue(*registers)};
+retry:
+    if (countedPtrace(PTRACE_SINGLESTEP, pid, nullptr, 0) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not step tracee\n");
+        return -1;
+    }
+
+    if (countedWaitpid(pid, &waitStatus, 0) == -1) {
+        perror("waitpid");
+        fprintf(stderr, "could not wait for tracee\n");
+        return -1;
+    }
+
+    if (WIFEXITED(waitStatus)) {
+        fprintf(stderr, "tracee exited with status %d\n",
+            WEXITSTATUS(waitStatus));
+        return -1;
+    } else if (WIFSIGNALED(waitStatus)) {
+        fprintf(stderr, "tracee was terminated (%s)\n",
+            strsignal(WTERMSIG(waitStatus)));
+        return -1;
+    } else if (!WIFSTOPPED(waitStatus)) {
+        fprintf(stderr, "tracee disappeared\n");
+        return -1;
+    }
+
+    stopSignal = WSTOPSIG(waitStatus);
+    if (stopSignal == SIGWINCH)
+        goto retry;
+
+    if (updateRegisters())
+        return -1;
+    pcOut = getFetchedProgramCounter();
+
+    if (stopSignal != SIGTRAP) {
+        printf("tracee was stopped (%s)\n", strsignal(stopSignal));
+        return 1;
     }
+    return 0;
 }
 
 /* See Tracee.h. */
-int Tracee::printGeneralPurposeRegisters()
+int Tracee::findRegister(const std::string &regName, size_t &indexOut) const
 {
-    fprintf(stderr, "no general-purpose registers on this architecture\n");
+    for (size_t i = 0; i < regInfo.registers.size(); i++) {
+        if (regInfo.registers[i].name == regName) {
+            indexOut = i;
+            return 0;
+        }
+    }
     return 1;
 }
 
 /* See Tracee.h. */
-int Tracee::printConditionCodeRegisters()
+uint64_t Tracee::getFetchedRegister(size_t index) const
 {
-    fprintf(stderr, "no condition code registers on this architecture\n");
-    return 1;
+    const RegisterDesc &reg = regInfo.registers[index];
+    auto regs = reinterpret_cast<const unsigned char *>(registers.get());
+    uint64_t value = 0;
+    memcpy(&value, regs + reg.offset, std::min(reg.getSize(), sizeof(value)));
+    return value;
 }
 
 /* See Tracee.h. */
-int Tracee::printSegmentationRegisters()
+void *Tracee::getTrapAddress()
 {
-    fprintf(stderr, "no segmentation registers on this architecture\n");
-    return 1;
+    const bytestring &trapInstruction = getTrapInstruction();
+    void *address =
+        static_cast<unsigned char *>(memory.stubs.address) + TRAP_STUB_OFFSET;
+    if (writeMemory(address, trapInstruction.data(), trapInstruction.size()))
+        return nullptr;
+    return address;
 }
 
 /* See Tracee.h. */
-int Tracee::printFloatingPointRegisters()
+int Tracee::runHelper(void *address, SyscallRecord *call)
 {
-    fprintf(stderr, "no floating point registers on this architecture\n");
-    return 1;
+    bytestring savedRegs;
+    if (saveGeneralRegisters(savedRegs))
+        return 1;
+
+    int error = call ? setSyscallRegisters(*call) : 0;
+    if (!error) {
+        bool wasTracingSyscalls = traceSyscalls;
+        traceSyscalls = false;
+        error = executeInstruction(address);
+        traceSyscalls = wasTracingSyscalls;
+    }
+    if (!error && stopSignal != SIGTRAP) {
+        fprintf(stderr, "helper code did not finish\n");
+        error = 1;
+    }
+    if (!error && call)
+        error = readSyscallExit(*call);
+
+    if (restoreGeneralRegisters(savedRegs))
+        return 1;
+    return error ? 1 : 0;
 }
 
 /* See Tracee.h. */
-int Tracee::printExtraRegisters()
+int Tracee::runStub(const bytestring &code)
 {
-    fprintf(stderr, "no extra registers on this architecture\n");
-    return 1;
+    const bytestring &trapInstruction = getTrapInstruction();
+    size_t size = code.size() + trapInstruction.size();
+    auto address =
+        static_cast<unsigned char *>(memory.stubs.address) + CODE_STUB_OFFSET;
+    if (size > TIMED_CALL_STUB_OFFSET - CODE_STUB_OFFSET) {
+        fprintf(stderr, "stub is too big\n");
+        return 1;
+    }
+
+    if (writeMemory(address, code.data(), code.size()) ||
+        writeMemory(address + code.size(), trapInstruction.data(),
+                    trapInstruction.size()))
+        return 1;
+
+    return runHelper(address, nullptr);
+}
+
+/* See Tracee.h. */
+int Tracee::injectSyscallAt(void *address, SyscallRecord &call)
+{
+    const bytestring &syscallInstruction = getSyscallInstruction();
+    if (syscallInstruction.empty()) {
+        fprintf(stderr,
+                "injecting system calls is not supported on this architecture\n");
+        return 1;
+    }
+
+    const bytestring &trapInstruction = getTrapInstruction();
+    auto code = static_cast<unsigned char *>(address);
+    if (writeMemory(code, syscallInstruction.data(),
+                    syscallInstruction.size()) ||
+        writeMemory(code + syscallInstruction.size(), trapInstruction.data(),
+                    trapInstruction.size()))
+        return 1;
+
+    return runHelper(address, &call);
 }
 
 /* See Tracee.h. */
-int Tracee::printRegisters(RegisterCategory categories)
+int Tracee::injectSyscall(SyscallRecord &call)
 {
-    bool firstPrinted = true;
-    int all_error = 0;
-    int error;
+    return injectSyscallAt(static_cast<unsigned char *>(memory.stubs.address) +
+                           SYSCALL_STUB_OFFSET, call);
+}
 
-    if (any(categories))
-        updateRegisters();
+/**
+ * Check the return value of a system call made in the tracee and print an
+ * error if it failed.
+ * @return Zero on success, nonzero on failure.
+ */
+static int checkSyscallReturn(const SyscallRecord &call, const char *name)
+{
+    // Errors are -4095 through -1; anything else is a success
+    if (static_cast<unsigned long>(call.ret) > -4096UL) {
+        errno = -call.ret;
+        perror(name);
+        return 1;
+    }
+    return 0;
+}
 
-    for (auto &categoryPrinter : categoryPrinters) {
-        if (any(categories & categoryPrinter.first)) {
-            if (!firstPrinted)
-                printf("\n");
-            firstPrinted = false;
+/* See Tracee.h. */
+const MemoryRegion *Tracee::getCallStack()
+{
+    if (callStack.address)
+        return &callStack;
 
-            if ((error = (this->*categoryPrinter.second)()))
-                all_error = error;
-        }
+    SyscallRecord call{};
+#ifdef SYS_mmap2
+    call.number = SYS_mmap2;
+#else
+    call.number = SYS_mmap;
+#endif
+    call.args[0] = 0;
+    call.args[1] = CALL_STACK_SIZE;
+    call.args[2] = PROT_READ | PROT_WRITE;
+    call.args[3] = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK;
+    call.args[4] = -1;
+    call.args[5] = 0;
+    if (injectSyscall(call))
+        return nullptr;
+    if (checkSyscallReturn(call, "mmap")) {
+        fprintf(stderr, "could not map call stack\n");
+        return nullptr;
     }
 
-    return all_error;
+    callStack = MemoryRegion{reinterpret_cast<void *>(call.ret),
+                             CALL_STACK_SIZE};
+    return &callStack;
 }
 
-/** Entry point for the tracee. Request to be ptraced and trap immediately. */
-static void traceeProcess() __attribute__((noreturn));
+/* See Tracee.h. */
+int Tracee::injectCall(FunctionCall &call)
+{
+    const MemoryRegion *stack = getCallStack();
+    void *trapAddress = getTrapAddress();
+    if (!stack || !trapAddress)
+        return 1;
 
-/** Set up an signal handlers needed by the tracer. */
-static void installTracerSignalHandlers();
+    // The register context covers the floating point and vector registers,
+    // and the general-purpose registers cover the rest
+    bytestring savedRegs, savedContext;
+    if (saveGeneralRegisters(savedRegs) || saveRegisterContext(savedContext))
+        return 1;
+
+    bytestring entryState, exitState;
+    void *stackTop = static_cast<unsigned char *>(stack->address) + stack->size;
+    call.hasFloatRet = false;
+    call.clobbered.clear();
+    int error = setCallRegisters(call, stackTop, trapAddress);
+    if (!error && call.trackClobbered)
+        error = getRegisterState(entryState);
+    if (!error) {
+        bool wasTracingSyscalls = traceSyscalls;
+        traceSyscalls = false;
+        uint64_t startNs = getMonotonicNs();
+        error = executeInstruction(reinterpret_cast<void *>(call.function));
+        call.elapsedNs = getMonotonicNs() - startNs;
+        traceSyscalls = wasTracingSyscalls;
+    }
+    if (!error && stopSignal != SIGTRAP) {
+        fprintf(stderr, "function did not return\n");
+        error = 1;
+    }
+    if (!error)
+        error = readCallReturn(call);
+    if (!error && call.trackClobbered)
+        error = getRegisterState(exitState) ||
+                diffRegisterStates(entryState, exitState, call.clobbered);
+
+    if (restoreRegisterContext(savedContext) ||
+        restoreGeneralRegisters(savedRegs))
+        return 1;
+    return error ? 1 : 0;
+}
 
 /* See Tracee.h. */
-std::shared_ptr<Tracee> Tracee::createTracee()
+int Tracee::startTimedCalls(uintptr_t function, unsigned long count,
+                            unsigned parties, unsigned index)
 {
-    pid_t pid;
-    void *sharedPage;
-    size_t pageSize = sysconf(_SC_PAGESIZE);
+    auto stubs = static_cast<unsigned char *>(memory.stubs.address);
+    void *barrier = stubs + TIMED_CALL_BARRIER_OFFSET;
+    void *result =
+        stubs + TIMED_CALL_RESULT_OFFSET + index * sizeof(uint64_t);
 
-    sharedPage = mmap(nullptr, pageSize, PROT_READ | PROT_WRITE | PROT_EXEC,
-                      MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+    // Whatever goes wrong, don't leave the other parties waiting
+    auto release = [&]() {
+        uint32_t all = parties;
+        writeMemory(barrier, &all, sizeof(all));
+        return 1;
+    };
 
-    if (!sharedPage) {
-        perror("mmap");
-        fprintf(stderr, "could not create shared memory\n");
-        return {nullptr};
+    const bytestring &stub = getTimedCallStub();
+    if (stub.empty()) {
+        fprintf(stderr,
+                "timing calls is not supported on this architecture\n");
+        return release();
+    }
+    if (count == 0 || index >= parties ||
+        !memory.stubs.contains(result, sizeof(uint64_t))) {
+        fprintf(stderr, "invalid timed call\n");
+        return release();
     }
 
-    if ((pid = fork()) == -1) {
-        perror("fork");
-        fprintf(stderr, "could not fork tracee\n");
-        return {nullptr};
+    const MemoryRegion *stack = getCallStack();
+    void *trapAddress = getTrapAddress();
+    void *stubAddress = stubs + TIMED_CALL_STUB_OFFSET;
+    if (!stack || !trapAddress ||
+        writeMemory(stubAddress, stub.data(), stub.size()))
+        return release();
+    if (index == 0) {
+        uint32_t none = 0;
+        if (writeMemory(barrier, &none, sizeof(none)))
+            return release();
     }
 
-    if (pid == 0)
-        traceeProcess(); // This never returns
+    if (saveGeneralRegisters(timedSavedRegs) ||
+        saveRegisterContext(timedSavedContext))
+        return release();
 
-    installTracerSignalHandlers();
+    FunctionCall call{};
+    call.args = {function, count, reinterpret_cast<uintptr_t>(barrier),
+                 reinterpret_cast<uintptr_t>(result), parties};
+    void *stackTop = static_cast<unsigned char *>(stack->address) + stack->size;
+    int error = setCallRegisters(call, stackTop, trapAddress) ||
+                setProgramCounter(stubAddress);
+    if (!error &&
+        countedPtrace(PTRACE_CONT, pid, nullptr, 0) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not continue tracee\n");
+        error = 1;
+    }
+    if (error) {
+        restoreRegisterContext(timedSavedContext);
+        restoreGeneralRegisters(timedSavedRegs);
+        return release();
+    }
 
-    Tracee *platformTracee = createPlatformTracee(pid, sharedPage, pageSize);
-    return std::shared_ptr<Tracee>{platformTracee};
+    timedIndex = index;
+    stopSignal = 0;
+    return 0;
+}
+
+/* See Tracee.h. */
+int Tracee::finishTimedCalls(uint64_t &ticksOut)
+{
+    int waitStatus;
+
+retry:
+    if (countedWaitpid(pid, &waitStatus, 0) == -1) {
+        perror("waitpid");
+        fprintf(stderr, "could not wait for tracee\n");
+        return -1;
+    }
+
+    if (WIFEXITED(waitStatus)) {
+        fprintf(stderr, "tracee exited with status %d\n",
+            WEXITSTATUS(waitStatus));
+        return -1;
+    } else if (WIFSIGNALED(waitStatus)) {
+        fprintf(stderr, "tracee was terminated (%s)\n",
+            strsignal(WTERMSIG(waitStatus)));
+        return -1;
+    } else if (!WIFSTOPPED(waitStatus)) {
+        fprintf(stderr, "tracee disappeared\n");
+        return -1;
+    }
+
+    stopSignal = WSTOPSIG(waitStatus);
+    if (stopSignal == SIGWINCH) {
+        if (countedPtrace(PTRACE_CONT, pid, nullptr, 0) == -1) {
+            perror("ptrace");
+            fprintf(stderr, "could not continue tracee\n");
+            return -1;
+        }
+        goto retry;
+    }
+
+    int error = 0;
+    if (stopSignal != SIGTRAP) {
+        printf("tracee was stopped (%s)\n", strsignal(stopSignal));
+        error = 1;
+    }
+    auto result = static_cast<unsigned char *>(memory.stubs.address) +
+                  TIMED_CALL_RESULT_OFFSET + timedIndex * sizeof(uint64_t);
+    if (!error)
+        error = readMemory(result, &ticksOut, sizeof(ticksOut));
+
+    if (restoreRegisterContext(timedSavedContext) ||
+        restoreGeneralRegisters(timedSavedRegs))
+        return 1;
+    return error ? 1 : 0;
+}
+
+/* See Tracee.h. */
+void *Tracee::getFetchedProgramCounter()
+{
+    return nullptr;
+}
+
+/* See Tracee.h. */
+int Tracee::scrambleBranchPredictors(unsigned long)
+{
+    fprintf(stderr,
+            "scrambling branch predictors is not supported on this architecture\n");
+    return 1;
+}
+
+/* See Tracee.h. */
+const bytestring &Tracee::getSyscallInstruction()
+{
+    static const bytestring none;
+    return none;
+}
+
+/* See Tracee.h. */
+const bytestring &Tracee::getTimedCallStub()
+{
+    static const bytestring none;
+    return none;
+}
+
+/* See Tracee.h. */
+int Tracee::saveGeneralRegisters(bytestring &)
+{
+    fprintf(stderr, "saving registers is not supported on this architecture\n");
+    return 1;
+}
+
+/* See Tracee.h. */
+int Tracee::restoreGeneralRegisters(const bytestring &)
+{
+    fprintf(stderr, "restoring registers is not supported on this architecture\n");
+    return 1;
+}
+
+/* See Tracee.h. */
+int Tracee::setSyscallRegisters(const SyscallRecord &)
+{
+    fprintf(stderr,
+            "injecting system calls is not supported on this architecture\n");
+    return 1;
+}
+
+/* See Tracee.h. */
+int Tracee::setCallRegisters(const FunctionCall &, void *, void *)
+{
+    fprintf(stderr,
+            "calling functions is not supported on this architecture\n");
+    return 1;
+}
+
+/* See Tracee.h. */
+int Tracee::readCallReturn(FunctionCall &)
+{
+    fprintf(stderr,
+            "calling functions is not supported on this architecture\n");
+    return 1;
+}
+
+/* See Tracee.h. */
+int Tracee::skipRedZone()
+{
+    return 0;
+}
+
+/* See Tracee.h. */
+void Tracee::printSyscalls() const
+{
+    if (syscalls.empty())
+        return;
+
+    printf("%6s  %-18s  %12s  %s\n", "number", "return", "latency (us)",
+           "arguments");
+    for (const SyscallRecord &syscall : syscalls) {
+        printf("%6ld  %-18ld  %12.3f ", syscall.number, syscall.ret,
+               syscall.latencyNs / 1000.0);
+        for (unsigned long arg : syscall.args)
+            printf(" %#lx", arg);
+        printf("\n");
+    }
+}
+
+/* See Tracee.h. */
+int Tracee::readSyscallEntry(SyscallRecord &)
+{
+    fprintf(stderr, "syscall tracing is not supported on this architecture\n");
+    return 1;
+}
+
+/* See Tracee.h. */
+int Tracee::readSyscallExit(SyscallRecord &)
+{
+    fprintf(stderr, "syscall tracing is not supported on this architecture\n");
+    return 1;
+}
+
+/* See Tracee.h. */
+void Tracee::printInstruction(const bytestring &machineCode)
+{
+    printf("[");
+    for (size_t i = 0; i < machineCode.size(); ++i) {
+        if (i > 0)
+            printf(", ");
+        printf(PRINTFx8, machineCode[i]);
+    }
+    printf("]");
+}
+
+/* See Tracee.h. */
+std::unique_ptr<RegisterValue> Tracee::getRegisterValue(const std::string &regName)
+{
+    auto registerHasName =
+        [&regName](const RegisterDesc &reg) { return reg.name == regName; };
+
+    auto reg = std::find_if(std::begin(regInfo.registers),
+                            std::end(regInfo.registers),
+                            registerHasName);
+
+    if (reg == std::end(regInfo.registers))
+        return {nullptr};
+    else {
+        updateRegisters();
+        return std::unique_ptr<RegisterValue>{reg->getValue(*registers)};
+    }
+}
+
+/* See Tracee.h. */
+int Tracee::getRegisterState(bytestring &stateOut)
+{
+    if (updateRegisters())
+        return 1;
+
+    auto regs = reinterpret_cast<const unsigned char *>(registers.get());
+    stateOut.clear();
+    for (const RegisterDesc &reg : regInfo.registers) {
+        // Aliases would only report every change twice
+        if (!reg.alias)
+            stateOut.append(regs + reg.offset, reg.getSize());
+    }
+
+    return 0;
+}
+
+/* See Tracee.h. */
+int Tracee::diffRegisterStates(const bytestring &a, const bytestring &b,
+                               std::vector<std::string> &differencesOut) const
+{
+    if (a.size() != b.size()) {
+        fprintf(stderr, "register state is from a different architecture\n");
+        return 1;
+    }
+
+    differencesOut.clear();
+    size_t offset = 0;
+    for (const RegisterDesc &reg : regInfo.registers) {
+        if (reg.alias)
+            continue;
+        size_t size = reg.getSize();
+        if (offset + size > a.size()) {
+            fprintf(stderr, "register state is from a different architecture\n");
+            return 1;
+        }
+        if (a.compare(offset, size, b, offset, size) != 0)
+            differencesOut.push_back(reg.prefix + reg.name);
+        offset += size;
+    }
+
+    return 0;
+}
+
+/**
+ * Groups of register categories in the order they are printed. Groups are
+ * separated by a blank line.
+ */
+static const RegisterCategory categoryGroups[] = {
+    RegisterCategory::GENERAL_PURPOSE | RegisterCategory::PROGRAM_COUNTER,
+    RegisterCategory::CONDITION_CODE,
+    RegisterCategory::FLOATING_POINT,
+    RegisterCategory::EXTRA,
+    RegisterCategory::SEGMENTATION,
+};
+
+/** Format a raw register value of type T with printf. */
+template <typename T>
+static void formatRaw(const unsigned char *value, const char *format,
+                      std::string &out)
+{
+    char buffer[64];
+    T raw;
+    memcpy(&raw, value, sizeof(raw));
+    snprintf(buffer, sizeof(buffer), format, raw);
+    out += buffer;
+}
+
+/** Append the value of a register to a buffer. */
+static void formatRegisterValue(const RegisterDesc &reg,
+                                const unsigned char *regs, std::string &out)
+{
+    const unsigned char *value = regs + reg.offset;
+    switch (reg.type) {
+        case RegisterType::INT8:
+            formatRaw<uint8_t>(value, PRINTFx8, out);
+            break;
+        case RegisterType::INT16:
+            formatRaw<uint16_t>(value, PRINTFx16, out);
+            break;
+        case RegisterType::INT32:
+            formatRaw<uint32_t>(value, PRINTFx32, out);
+            break;
+        case RegisterType::INT64:
+            formatRaw<uint64_t>(value, PRINTFx64, out);
+            break;
+        case RegisterType::INT128: {
+            char buffer[64];
+            my_uint128 raw;
+            memcpy(&raw, value, sizeof(raw));
+            snprintf(buffer, sizeof(buffer), "0x%016" PRIx64 "%016" PRIx64,
+                     raw.hi, raw.lo);
+            out += buffer;
+            break;
+        }
+        case RegisterType::FLOAT:
+            formatRaw<float>(value, "%.9g", out);
+            break;
+        case RegisterType::DOUBLE:
+            formatRaw<double>(value, "%.17g", out);
+            break;
+        case RegisterType::LONG_DOUBLE:
+            formatRaw<long double>(value, "%.18Lf", out);
+            break;
+    }
+}
+
+/**
+ * Return whether a register is printed two to a line: plain integers which
+ * fit in 64 bits.
+ */
+static bool isPairedRegister(const RegisterDesc &reg)
+{
+    if (reg.annotate)
+        return false;
+    switch (reg.type) {
+        case RegisterType::INT8:
+        case RegisterType::INT16:
+        case RegisterType::INT32:
+        case RegisterType::INT64:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* See Tracee.h. */
+int Tracee::snapshotRegisters()
+{
+    if (updateRegisters())
+        return 1;
+
+    previousRegisters.assign(
+        reinterpret_cast<const unsigned char *>(registers.get()),
+        registersSize);
+    return 0;
+}
+
+/*
+ * See Tracee.h. Registers are printed in the order of the register table.
+ * Within a group, each run of registers of the same type is lined up and
+ * separated from the next run by a blank line.
+ */
+int Tracee::printRegisters(RegisterCategory categories, bool changedOnly)
+{
+    if (updateRegisters())
+        return 1;
+
+    auto regs = reinterpret_cast<const unsigned char *>(registers.get());
+    const unsigned char *previous = previousRegisters.data();
+    if (changedOnly) {
+        if (previousRegisters.empty()) {
+            printf("no code has been run yet\n");
+            return 0;
+        }
+
+        // Most lines only touch a few registers, so check everything at once
+        // before going register by register
+        if (memcmp(regs, previous, registersSize) == 0) {
+            printf("no registers changed\n");
+            return 0;
+        }
+    }
+    bool highlight = !changedOnly && !previousRegisters.empty();
+
+    auto isChanged = [&](const RegisterDesc &reg) {
+        return memcmp(regs + reg.offset, previous + reg.offset,
+                      reg.getSize()) != 0;
+    };
+
+    registerText.clear();
+    std::string &out = registerText;
+    bool anyInCategories = false;
+    std::vector<const RegisterDesc *> group;
+
+    // Don't leave the space for highlighting at the end of a line
+    auto endLine = [&out]() {
+        if (out.back() == ' ')
+            out.pop_back();
+        out += '\n';
+    };
+
+    for (RegisterCategory categoryGroup : categoryGroups) {
+        group.clear();
+        for (const RegisterDesc &reg : regInfo.registers) {
+            if (reg.alias || !any(reg.category & categoryGroup & categories))
+                continue;
+            anyInCategories = true;
+            if (!changedOnly || isChanged(reg))
+                group.push_back(&reg);
+        }
+        if (group.empty())
+            continue;
+
+        if (!out.empty())
+            out += '\n';
+
+        size_t runStart = 0;
+        while (runStart < group.size()) {
+            size_t runEnd = runStart, width = 0;
+            while (runEnd < group.size() &&
+                   group[runEnd]->type == group[runStart]->type) {
+                width = std::max(width, group[runEnd]->prefix.size() +
+                                        group[runEnd]->name.size());
+                runEnd++;
+            }
+            if (runStart)
+                out += '\n';
+
+            bool secondColumn = false;
+            for (size_t i = runStart; i < runEnd; i++) {
+                const RegisterDesc &reg = *group[i];
+                bool paired = isPairedRegister(reg);
+                bool changed = highlight && isChanged(reg);
+                if (secondColumn) {
+                    if (paired)
+                        out += highlight ? "   " : "    ";
+                    else
+                        endLine();
+                }
+
+                size_t start = out.size();
+                out += reg.prefix;
+                out += reg.name;
+                out.append(width - (out.size() - start), ' ');
+                out += " = ";
+                formatRegisterValue(reg, regs, out);
+                if (changed)
+                    out += '*';
+                else if (highlight && paired && !secondColumn)
+                    out += ' ';
+                if (reg.annotate)
+                    reg.annotate(*registers, out);
+
+                if (paired && !secondColumn)
+                    secondColumn = true;
+                else {
+                    out += '\n';
+                    secondColumn = false;
+                }
+            }
+            if (secondColumn)
+                endLine();
+
+            runStart = runEnd;
+        }
+    }
+
+    if (!anyInCategories) {
+        fprintf(stderr, "no such registers on this architecture\n");
+        return 1;
+    }
+
+    if (out.empty())
+        printf("no registers changed\n");
+    else
+        fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
+
+/** Entry point for the tracee. Request to be ptraced and trap immediately. */
+static void traceeProcess() __attribute__((noreturn));
+
+/** Set up an signal handlers needed by the tracer. */
+static void installTracerSignalHandlers();
+
+/**
+ * Set the ptrace options of a traced process.
+ * @return Zero on success, nonzero on failure.
+ */
+static int setTraceOptions(pid_t pid, long options)
+{
+    if (countedPtrace(PTRACE_SETOPTIONS, pid, nullptr,
+                      reinterpret_cast<void *>(options)) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set tracee options\n");
+        return 1;
+    }
+    return 0;
+}
+
+/** Kill the process of a tracee which we started and destroy the tracee. */
+static void killTracee(Tracee *tracee)
+{
+    int waitStatus;
+    kill(tracee->getPid(), SIGKILL);
+    countedWaitpid(tracee->getPid(), &waitStatus, 0);
+    delete tracee;
+}
+
+/** Get the entry point of a process from its auxiliary vector. */
+static void *getEntryPoint(pid_t pid)
+{
+    char auxvPath[64];
+    snprintf(auxvPath, sizeof(auxvPath), "/proc/%d/auxv",
+             static_cast<int>(pid));
+    FILE *auxv = fopen(auxvPath, "r");
+    if (!auxv) {
+        perror(auxvPath);
+        return nullptr;
+    }
+
+    ElfW(auxv_t) entry;
+    void *address = nullptr;
+    while (!address && fread(&entry, sizeof(entry), 1, auxv) == 1 &&
+           entry.a_type != AT_NULL) {
+        if (entry.a_type == AT_ENTRY)
+            address = reinterpret_cast<void *>(entry.a_un.a_val);
+    }
+    fclose(auxv);
+
+    if (!address) {
+        fprintf(stderr, "could not find the entry point of process %d\n",
+                static_cast<int>(pid));
+    }
+    return address;
+}
+
+/** Get the size of the mapping which holds all of a tracee's regions. */
+static size_t getTraceeMemorySize()
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    return (CODE_PAGES + DATA_PAGES) * pageSize + SCRATCH_SIZE;
+}
+
+/**
+ * Map the memory for a tracee's code, data, and scratch regions.
+ * @param address Address hint for the mapping, or nullptr.
+ * @param sharing MAP_SHARED for memory shared with a tracee process, or
+ * MAP_PRIVATE for memory only used by us.
+ * @param fd File to map, or -1 for anonymous memory.
+ * @return Zero on success, nonzero on failure.
+ */
+static int mapTraceeMemory(void *address, int sharing, int fd,
+                           TraceeMemory &memoryOut)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t codeSize = CODE_PAGES * pageSize;
+    size_t dataSize = DATA_PAGES * pageSize;
+    size_t scratchSize = SCRATCH_SIZE;
+
+    int flags = sharing | MAP_NORESERVE | (fd == -1 ? MAP_ANONYMOUS : 0);
+    void *sharedPage = mmap(address, getTraceeMemorySize(),
+                            PROT_READ | PROT_WRITE | PROT_EXEC, flags, fd, 0);
+
+    if (sharedPage == MAP_FAILED) {
+        perror("mmap");
+        fprintf(stderr, "could not create shared memory\n");
+        return 1;
+    }
+
+    // The last page of code is set aside for stubs
+    memoryOut.code = MemoryRegion{sharedPage, codeSize - pageSize};
+    memoryOut.stubs =
+        MemoryRegion{static_cast<unsigned char *>(sharedPage) + codeSize -
+                     pageSize, pageSize};
+    memoryOut.data =
+        MemoryRegion{static_cast<unsigned char *>(sharedPage) + codeSize,
+                     dataSize};
+    memoryOut.scratch =
+        MemoryRegion{static_cast<unsigned char *>(memoryOut.data.address) +
+                     dataSize, scratchSize};
+
+    // Data shouldn't be executable
+    if (mprotect(memoryOut.data.address, dataSize + scratchSize,
+                 PROT_READ | PROT_WRITE) == -1) {
+        perror("mprotect");
+        fprintf(stderr, "could not create shared memory\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/* See Tracee.h. */
+pid_t Tracee::forkTraceeProcess()
+{
+    pid_t pid;
+
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        fprintf(stderr, "could not fork tracee\n");
+        return -1;
+    }
+
+    if (pid == 0)
+        traceeProcess(); // This never returns
+
+    // Wait for the tracee to stop itself; until it does, it can't be traced
+    int waitStatus;
+    if (countedWaitpid(pid, &waitStatus, 0) == -1) {
+        perror("waitpid");
+        fprintf(stderr, "could not wait for tracee\n");
+        return -1;
+    }
+    if (!WIFSTOPPED(waitStatus)) {
+        fprintf(stderr, "tracee did not start\n");
+        return -1;
+    }
+
+    // Tell syscall stops apart from breakpoints
+    if (setTraceOptions(pid, PTRACE_O_TRACESYSGOOD))
+        return -1;
+
+    return pid;
+}
+
+/* See Tracee.h. */
+std::shared_ptr<Tracee> Tracee::createTracee(void *address)
+{
+    TraceeMemory memory;
+    if (mapTraceeMemory(address, MAP_SHARED, -1, memory))
+        return {nullptr};
+
+    pid_t pid = forkTraceeProcess();
+    if (pid == -1)
+        return {nullptr};
+
+    installTracerSignalHandlers();
+
+    Tracee *platformTracee = createPlatformTracee(pid, memory);
+    return std::shared_ptr<Tracee>{platformTracee};
+}
+
+/* See Tracee.h. */
+std::shared_ptr<Tracee> Tracee::forkSibling()
+{
+    if (pid == -1) {
+        fprintf(stderr, "mock tracees can't have siblings\n");
+        return {nullptr};
+    }
+
+    // A sibling is a fork of us, so it wouldn't have the other process's
+    // memory
+    if (!isForked()) {
+        fprintf(stderr,
+                "only tracees forked by asmase can have siblings\n");
+        return {nullptr};
+    }
+
+    pid_t siblingPid = forkTraceeProcess();
+    if (siblingPid == -1)
+        return {nullptr};
+
+    Tracee *sibling = createPlatformTracee(siblingPid, memory);
+    return std::shared_ptr<Tracee>{sibling, killTracee};
+}
+
+/* See Tracee.h. */
+int Tracee::mapSharedMemory(void *address)
+{
+    size_t size = getTraceeMemorySize();
+    int fd = memfd_create("asmase", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create");
+        fprintf(stderr, "could not create shared memory\n");
+        return 1;
+    }
+    if (ftruncate(fd, size) == -1) {
+        perror("ftruncate");
+        fprintf(stderr, "could not create shared memory\n");
+        close(fd);
+        return 1;
+    }
+
+    auto stub = static_cast<unsigned char *>(entryPoint);
+    bytestring original(ENTRY_STUB_SIZE, 0);
+    if (readMemory(stub, &original[0], original.size())) {
+        close(fd);
+        return 1;
+    }
+
+    // Make a system call from the entry point; -1 means that it failed
+    auto inject = [&](long number, const char *name,
+                      std::initializer_list<unsigned long> args) {
+        SyscallRecord call{};
+        call.number = number;
+        std::copy(args.begin(), args.end(), call.args);
+        if (injectSyscallAt(stub, call) || checkSyscallReturn(call, name))
+            return -1L;
+        return call.ret;
+    };
+
+    // The process opens the file through our file descriptor and maps it
+    // wherever it has room, and then we map it at the same address
+    char path[ENTRY_STUB_SIZE - ENTRY_STRING_OFFSET];
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", static_cast<int>(getpid()),
+             fd);
+    long remoteFd = -1, remote = -1;
+    if (!writeMemory(stub + ENTRY_STRING_OFFSET, path, strlen(path) + 1)) {
+        remoteFd = inject(SYS_openat, "open", {
+            static_cast<unsigned long>(AT_FDCWD),
+            reinterpret_cast<uintptr_t>(stub + ENTRY_STRING_OFFSET),
+            O_RDWR | O_CLOEXEC});
+    }
+    if (remoteFd != -1) {
+#ifdef SYS_mmap2
+        long mmapNumber = SYS_mmap2;
+#else
+        long mmapNumber = SYS_mmap;
+#endif
+        remote = inject(mmapNumber, "mmap", {
+            reinterpret_cast<uintptr_t>(address), size,
+            PROT_READ | PROT_WRITE | PROT_EXEC, MAP_SHARED | MAP_NORESERVE,
+            static_cast<unsigned long>(remoteFd), 0});
+
+        // The mapping keeps the file open
+        inject(SYS_close, "close", {static_cast<unsigned long>(remoteFd)});
+    }
+
+    TraceeMemory shared;
+    int error = remote == -1;
+    if (!error) {
+        auto remoteAddress = reinterpret_cast<void *>(remote);
+        error = mapTraceeMemory(remoteAddress, MAP_SHARED, fd, shared);
+        if (!error && shared.code.address != remoteAddress) {
+            fprintf(stderr, "%p is already in use here\n", remoteAddress);
+            munmap(shared.code.address, size);
+            error = 1;
+        }
+    }
+    close(fd);
+
+    // Data shouldn't be executable in the process, either
+    if (!error &&
+        inject(SYS_mprotect, "mprotect", {
+            reinterpret_cast<uintptr_t>(shared.data.address),
+            shared.data.size + shared.scratch.size,
+            PROT_READ | PROT_WRITE}) == -1) {
+        munmap(shared.code.address, size);
+        error = 1;
+    }
+    if (error && remote != -1)
+        inject(SYS_munmap, "munmap",
+               {static_cast<unsigned long>(remote), size});
+
+    if (writeMemory(stub, original.data(), original.size()))
+        error = 1;
+    if (error) {
+        fprintf(stderr, "could not map shared memory into process %d\n",
+                static_cast<int>(pid));
+        return 1;
+    }
+
+    memory = shared;
+    return 0;
+}
+
+/* See Tracee.h. */
+int Tracee::unmapSharedMemory()
+{
+    auto stub = static_cast<unsigned char *>(entryPoint);
+    bytestring original(ENTRY_STUB_SIZE, 0);
+    if (readMemory(stub, &original[0], original.size()))
+        return 1;
+
+    int error = 0;
+    SyscallRecord call{};
+    call.number = SYS_munmap;
+    if (callStack.address) {
+        call.args[0] = reinterpret_cast<uintptr_t>(callStack.address);
+        call.args[1] = callStack.size;
+        if (injectSyscallAt(stub, call) || checkSyscallReturn(call, "munmap"))
+            error = 1;
+    }
+    call.args[0] = reinterpret_cast<uintptr_t>(memory.code.address);
+    call.args[1] = getTraceeMemorySize();
+    if (injectSyscallAt(stub, call) || checkSyscallReturn(call, "munmap"))
+        error = 1;
+
+    if (writeMemory(stub, original.data(), original.size()))
+        error = 1;
+    return error;
+}
+
+/* See Tracee.h. */
+int Tracee::runToEntryPoint()
+{
+    const bytestring &trapInstruction = getTrapInstruction();
+    bytestring original(trapInstruction.size(), 0);
+    if (readMemory(entryPoint, &original[0], original.size()) ||
+        writeMemory(entryPoint, trapInstruction.data(),
+                    trapInstruction.size()))
+        return 1;
+
+    if (countedPtrace(PTRACE_CONT, pid, nullptr, 0) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not continue tracee\n");
+        return 1;
+    }
+    int waitStatus;
+    if (countedWaitpid(pid, &waitStatus, 0) == -1) {
+        perror("waitpid");
+        fprintf(stderr, "could not wait for tracee\n");
+        return 1;
+    }
+    if (!WIFSTOPPED(waitStatus) || WSTOPSIG(waitStatus) != SIGTRAP) {
+        fprintf(stderr, "program did not reach its entry point\n");
+        return 1;
+    }
+
+    // Put back the code and go back to the start of it
+    if (writeMemory(entryPoint, original.data(), original.size()) ||
+        setProgramCounter(entryPoint))
+        return 1;
+    return 0;
+}
+
+/* See Tracee.h. */
+Tracee *Tracee::adoptProcess(pid_t pid)
+{
+    void *entryPoint = getEntryPoint(pid);
+    if (!entryPoint)
+        return nullptr;
+
+    installTracerSignalHandlers();
+
+    Tracee *tracee = createPlatformTracee(pid, TraceeMemory{});
+    tracee->entryPoint = entryPoint;
+    return tracee;
+}
+
+/* See Tracee.h. */
+std::shared_ptr<Tracee> Tracee::attachTracee(pid_t pid, void *address)
+{
+    if (countedPtrace(PTRACE_ATTACH, pid, nullptr, nullptr) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not attach to process %d\n",
+                static_cast<int>(pid));
+        return {nullptr};
+    }
+
+    // Wait for the stop from attaching, passing along any other signals
+    // which arrive first
+    int waitStatus;
+    for (;;) {
+        if (countedWaitpid(pid, &waitStatus, 0) == -1) {
+            perror("waitpid");
+            fprintf(stderr, "could not wait for process %d\n",
+                    static_cast<int>(pid));
+            return {nullptr};
+        }
+        if (!WIFSTOPPED(waitStatus)) {
+            fprintf(stderr, "process %d exited\n", static_cast<int>(pid));
+            return {nullptr};
+        }
+        if (WSTOPSIG(waitStatus) == SIGSTOP)
+            break;
+        if (countedPtrace(PTRACE_CONT, pid, nullptr,
+                          reinterpret_cast<void *>(static_cast<uintptr_t>(
+                              WSTOPSIG(waitStatus)))) == -1) {
+            perror("ptrace");
+            fprintf(stderr, "could not continue process %d\n",
+                    static_cast<int>(pid));
+            return {nullptr};
+        }
+    }
+
+    // Save the registers that the process had so that it can pick up where
+    // it left off once we're done
+    Tracee *tracee = nullptr;
+    bytestring savedRegs, savedContext;
+    if (!setTraceOptions(pid, PTRACE_O_TRACESYSGOOD))
+        tracee = adoptProcess(pid);
+    if (tracee && (tracee->saveGeneralRegisters(savedRegs) ||
+                   tracee->saveRegisterContext(savedContext))) {
+        delete tracee;
+        tracee = nullptr;
+    }
+
+    // Code we run mustn't clobber data that the process keeps just below its
+    // stack pointer
+    if (tracee && (tracee->skipRedZone() ||
+                   tracee->mapSharedMemory(address))) {
+        tracee->restoreGeneralRegisters(savedRegs);
+        delete tracee;
+        tracee = nullptr;
+    }
+    if (!tracee) {
+        countedPtrace(PTRACE_DETACH, pid, nullptr, nullptr);
+        return {nullptr};
+    }
+
+    return std::shared_ptr<Tracee>{tracee,
+                                   [savedRegs, savedContext](Tracee *tracee) {
+        tracee->unmapSharedMemory();
+        tracee->restoreRegisterContext(savedContext);
+        tracee->restoreGeneralRegisters(savedRegs);
+        countedPtrace(PTRACE_DETACH, tracee->pid, nullptr, nullptr);
+        delete tracee;
+    }};
+}
+
+/* See Tracee.h. */
+std::shared_ptr<Tracee> Tracee::execTracee(char *const argv[], void *address)
+{
+    pid_t pid;
+
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        fprintf(stderr, "could not fork tracee\n");
+        return {nullptr};
+    }
+
+    if (pid == 0) {
+        if (ptrace(PTRACE_TRACEME, -1, nullptr, nullptr) == -1) {
+            perror("ptrace");
+            _exit(127);
+        }
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    // The program stops with a SIGTRAP once it has been loaded
+    int waitStatus;
+    if (countedWaitpid(pid, &waitStatus, 0) == -1) {
+        perror("waitpid");
+        fprintf(stderr, "could not wait for tracee\n");
+        return {nullptr};
+    }
+    if (!WIFSTOPPED(waitStatus)) {
+        fprintf(stderr, "could not start %s\n", argv[0]);
+        return {nullptr};
+    }
+
+    // If we die, the program shouldn't keep running with our code in it
+    long options = PTRACE_O_TRACESYSGOOD;
+#ifdef PTRACE_O_EXITKILL
+    options |= PTRACE_O_EXITKILL;
+#endif
+    Tracee *tracee = nullptr;
+    if (!setTraceOptions(pid, options))
+        tracee = adoptProcess(pid);
+    if (tracee &&
+        (tracee->runToEntryPoint() || tracee->mapSharedMemory(address))) {
+        delete tracee;
+        tracee = nullptr;
+    }
+    if (!tracee) {
+        kill(pid, SIGKILL);
+        countedWaitpid(pid, &waitStatus, 0);
+        return {nullptr};
+    }
+
+    return std::shared_ptr<Tracee>{tracee, killTracee};
+}
+
+/* See Tracee.h. */
+std::shared_ptr<Tracee> Tracee::createMockTracee()
+{
+    TraceeMemory memory;
+    if (mapTraceeMemory(nullptr, MAP_PRIVATE, -1, memory))
+        return {nullptr};
+
+    return std::shared_ptr<Tracee>{createPlatformMockTracee(memory)};
 }
 
 /* See above. */
@@ -23,18 +23,32 @@
 #include <cstdlib>
 #include <getopt.h>
 #include <iomanip>
+#include <set>
 
 #include "Assembler.h"
+#include "AllocationCounter.h"
+#include "AssemblyCache.h"
 #include "Builtins.h"
 #include "Inputter.h"
+#include "Profiler.h"
+#include "SessionLog.h"
+#include "SessionSnapshot.h"
+#include "SharedLibrary.h"
+#include "Stats.h"
 #include "Support.h"
+#include "SymbolTable.h"
+#include "TemplateTable.h"
 #include "Tracee.h"
 
 static const char *progname;
 
 void usage(bool error)
 {
-    fprintf(error ? stderr : stdout, "Usage: %s [-hv]\n", progname);
+    fprintf(error ? stderr : stdout,
+            "Usage: %s [-hv] [--mcpu=CPU] [--mattr=FEATURES] [--cache=FILE]\n"
+            "          [--record=LOG [--record-state]] [--restore=FILE]\n"
+            "          [--attach=PID | --exec PROGRAM [ARGS...]]\n"
+            "       %s [-hv] --replay=LOG [--verify]\n", progname, progname);
 }
 
 void version()
@@ -47,19 +61,268 @@ void version()
         ASMASE_VERSION);
 }
 
+/**
+ * Place assembled code in the tracee, link it, and run it.
+ * @param executedOut Set to whether the code was executed.
+ * @return Zero on success, positive on error, negative on fatal error.
+ */
+static int runCode(Tracee &tracee, SymbolTable &symbols, Profiler &profiler,
+                   const std::string &line, AssembledCode &code,
+                   bool &executedOut)
+{
+    executedOut = false;
+
+    // Show what the instruction would be, but don't let it anywhere near the
+    // tracee
+    if (!code.hostSupported) {
+        printf("%s = ", line.c_str());
+        tracee.printInstruction(code.machineCode);
+        printf("\n");
+        fprintf(stderr,
+                "not executing; instruction is not supported by the host CPU\n");
+        return 1;
+    }
+
+    // The counters go in first so that the labels and fixups move with them
+    size_t originalOffset, originalSize = code.machineCode.size();
+    if (profiler.instrument(tracee, line, code, originalOffset))
+        return 1;
+
+    void *address = tracee.getCodeAddress(code.machineCode.size());
+    if (!address) {
+        fprintf(stderr, "no room left for instruction\n");
+        return 1;
+    }
+
+    void *dataAddress =
+        tracee.getDataAddress(code.data.size(), code.dataAlignment);
+    if (!dataAddress) {
+        fprintf(stderr, "no room left for data\n");
+        return 1;
+    }
+
+    size_t unresolved;
+    {
+        PhaseTimer timer{StatsPhase::LINK};
+
+        if (symbols.link(tracee, address, dataAddress, code, unresolved))
+            return 1;
+
+        if (!tracee.writeData(code.data, code.dataAlignment))
+            return 1;
+
+        if (!tracee.writeInstruction(code.machineCode))
+            return 1;
+    }
+
+    if (code.machineCode.empty()) {
+        if (!code.data.empty())
+            printf("%s = %p\n", line.c_str(), dataAddress);
+        return 0;
+    }
+
+    printf("%s = ", line.c_str());
+    if (code.machineCode.size() == originalSize)
+        tracee.printInstruction(code.machineCode);
+    else
+        tracee.printInstruction(
+            code.machineCode.substr(originalOffset, originalSize));
+    printf("\n");
+
+    // Code referring to labels which haven't been defined yet stays in place
+    // to be patched later, but it can't be run now
+    if (unresolved) {
+        fprintf(stderr,
+                "not executing; instruction refers to undefined symbols\n");
+        return 1;
+    }
+
+    if (tracee.snapshotRegisters())
+        return 1;
+
+    executedOut = true;
+    return tracee.executeInstruction(address);
+}
+
+/**
+ * Resolve names which aren't otherwise defined against the libraries mapped
+ * into the tracee. The index must outlive the symbol table.
+ */
+static void useLibraryIndex(LibraryIndex &libraries, SymbolTable &symbols)
+{
+    symbols.setFallback([&libraries](const std::string &name,
+                                     uintptr_t &addressOut) {
+        return libraries.lookup(name, addressOut);
+    });
+}
+
+/**
+ * Define the symbols which every session starts out with.
+ * @return Zero on success, nonzero on failure.
+ */
+static int defineInitialSymbols(Tracee &tracee, SymbolTable &symbols)
+{
+    const MemoryRegion &scratch = tracee.getMemory().scratch;
+    return symbols.define("asmase_scratch",
+                          reinterpret_cast<uintptr_t>(scratch.address)) ||
+           symbols.define(Profiler::COUNTER_SYMBOL,
+                          Profiler::getCounterAddress(tracee));
+}
+
+/**
+ * Re-run a recorded session without assembling anything.
+ * @param verify Whether to compare the registers against the states saved in
+ * the log.
+ * @return Exit status for the program.
+ */
+static int replaySession(SessionLog &log, Tracee &tracee, bool verify)
+{
+    Inputter inputter;
+    LibraryIndex libraries{tracee};
+    SymbolTable symbols;
+    Profiler profiler;
+    TemplateTable templates;
+    SessionRecord record;
+    std::string lastLine;
+    bool executed = false;
+    int mismatches = 0;
+    int error;
+
+    // The tracee starts out with whatever was in our registers when it was
+    // forked, so only the registers which the session actually changed can
+    // be expected to match. The first state in the log is the initial one.
+    bytestring initialState;
+    std::set<std::string> changed;
+
+    useLibraryIndex(libraries, symbols);
+    if (defineInitialSymbols(tracee, symbols))
+        return 1;
+
+    while ((error = log.readRecord(record)) == 0) {
+        switch (record.type) {
+            case SessionRecordType::BUILTIN:
+                printf("asmase> %s\n", record.line.c_str());
+                executed = false;
+                if (runBuiltin(record.line, tracee, symbols, profiler,
+                               templates, nullptr, inputter) < 0)
+                    return mismatches ? 1 : 0;
+                break;
+            case SessionRecordType::TEMPLATE:
+                printf("asmase> %s\n", record.line.c_str());
+                executed = false;
+                if (runBuiltin(record.line, tracee, symbols, profiler,
+                               templates, nullptr, inputter, nullptr,
+                               &record.code) < 0)
+                    return mismatches ? 1 : 0;
+                break;
+            case SessionRecordType::INSTRUCTION:
+                lastLine = record.line;
+                if (runCode(tracee, symbols, profiler, record.line,
+                            record.code, executed) < 0)
+                    return 1;
+                break;
+            case SessionRecordType::STATE: {
+                if (initialState.empty()) {
+                    initialState = record.state;
+                    break;
+                }
+                if (!verify)
+                    break;
+
+                std::vector<std::string> differences;
+                if (tracee.diffRegisterStates(initialState, record.state,
+                                              differences))
+                    return 1;
+                changed.insert(differences.begin(), differences.end());
+                if (!executed)
+                    break;
+
+                bytestring state;
+                if (tracee.getRegisterState(state) ||
+                    tracee.diffRegisterStates(record.state, state,
+                                              differences))
+                    return 1;
+
+                bool first = true;
+                for (const std::string &reg : differences) {
+                    if (!changed.count(reg))
+                        continue;
+                    if (first)
+                        printf("state differs after '%s':", lastLine.c_str());
+                    printf(" %s", reg.c_str());
+                    first = false;
+                }
+                if (!first) {
+                    printf("\n");
+                    ++mismatches;
+                }
+                break;
+            }
+        }
+    }
+
+    if (error < 0)
+        return 1;
+    if (mismatches) {
+        fprintf(stderr, "%d instructions did not match the recording\n",
+                mismatches);
+        return 1;
+    }
+    return 0;
+}
+
+/** Values returned by getopt_long() for options without a short version. */
+enum LongOption {
+    OPT_MCPU = 256,
+    OPT_MATTR,
+    OPT_RECORD,
+    OPT_RECORD_STATE,
+    OPT_REPLAY,
+    OPT_VERIFY,
+    OPT_CACHE,
+    OPT_RESTORE,
+    OPT_DEBUG_ALLOC,
+    OPT_STATS,
+    OPT_TRACE_SYSCALLS,
+    OPT_ATTACH,
+    OPT_EXEC,
+};
+
 int main(int argc, char *argv[])
 {
     int c;
+    std::string mcpu, mattr;
+    std::string recordFile, replayFile, cacheFile, restoreFile;
+    bool recordState = false, verify = false, debugAlloc = false;
+    bool stats = false, traceSyscalls = false, exec = false;
+    pid_t attachPid = 0;
+    char *end;
 
     static struct option long_options[] = {
-        {"version", no_argument, nullptr, 'v'},
-        {"help",    no_argument, nullptr, 'h'},
+        {"version", no_argument,       nullptr, 'v'},
+        {"help",    no_argument,       nullptr, 'h'},
+        {"mcpu",    required_argument, nullptr, OPT_MCPU},
+        {"mattr",   required_argument, nullptr, OPT_MATTR},
+        {"record",  required_argument, nullptr, OPT_RECORD},
+        {"record-state", no_argument,  nullptr, OPT_RECORD_STATE},
+        {"replay",  required_argument, nullptr, OPT_REPLAY},
+        {"verify",  no_argument,       nullptr, OPT_VERIFY},
+        {"cache",   required_argument, nullptr, OPT_CACHE},
+        {"restore", required_argument, nullptr, OPT_RESTORE},
+        {"debug-alloc", no_argument,   nullptr, OPT_DEBUG_ALLOC},
+        {"stats",   no_argument,       nullptr, OPT_STATS},
+        {"trace-syscalls", no_argument, nullptr, OPT_TRACE_SYSCALLS},
+        {"attach",  required_argument, nullptr, OPT_ATTACH},
+        {"exec",    no_argument,       nullptr, OPT_EXEC},
+        {nullptr,   0,                 nullptr, 0},
     };
 
     progname = argv[0];
 
+    // Stop at the first argument which isn't an option, since everything
+    // after --exec belongs to the program
     for (;;) {
-        c = getopt_long(argc, argv, "vh", long_options, nullptr);
+        c = getopt_long(argc, argv, "+vh", long_options, nullptr);
         if (c == -1)
             break;
 
@@ -71,8 +334,71 @@ int main(int argc, char *argv[])
             printf("asmase assembly REPL %s\n\n", ASMASE_VERSION);
             usage(false);
             printf("\n");
+            printf("  --mcpu=CPU         assemble for the given CPU instead of the host's\n");
+            printf("  --mattr=FEATURES   enable (+feature) or disable (-feature) CPU features\n");
+            printf("  --cache=FILE       reuse assembled code cached in FILE across runs\n");
+            printf("  --record=LOG       record the session to LOG\n");
+            printf("  --record-state     also record the registers after each instruction\n");
+            printf("  --replay=LOG       re-run a recorded session and exit\n");
+            printf("  --verify           check the registers against the recorded state\n");
+            printf("  --restore=FILE     pick up a session saved with :save_session\n");
+            printf("  --debug-alloc      print the number of heap allocations for each line\n");
+            printf("  --stats            print time and system calls spent in each phase at exit\n");
+            printf("  --trace-syscalls   print the system calls made by each line of code\n");
+            printf("  --attach=PID       run code in a running process instead of a new one\n");
+            printf("  --exec PROGRAM     run code in a new process running PROGRAM (with the\n");
+            printf("                     rest of the arguments), stopped at its entry point\n");
+            printf("\n");
             printf("For more information, type `:help` from within asmase, or consult the README.\n");
             return 0;
+        case OPT_MCPU:
+            mcpu = optarg;
+            break;
+        case OPT_MATTR:
+            mattr = optarg;
+            break;
+        case OPT_RECORD:
+            recordFile = optarg;
+            break;
+        case OPT_RECORD_STATE:
+            recordState = true;
+            break;
+        case OPT_REPLAY:
+            replayFile = optarg;
+            break;
+        case OPT_VERIFY:
+            verify = true;
+            break;
+        case OPT_CACHE:
+            cacheFile = optarg;
+            break;
+        case OPT_RESTORE:
+            restoreFile = optarg;
+            break;
+        case OPT_DEBUG_ALLOC:
+            if (!canCountAllocations()) {
+                fprintf(stderr, "%s: --debug-alloc needs a glibc build "
+                                "with COUNT_ALLOCATIONS=1\n", progname);
+                return 2;
+            }
+            debugAlloc = true;
+            break;
+        case OPT_STATS:
+            stats = true;
+            break;
+        case OPT_TRACE_SYSCALLS:
+            traceSyscalls = true;
+            break;
+        case OPT_ATTACH:
+            attachPid = strtol(optarg, &end, 10);
+            if (*end || attachPid <= 0) {
+                fprintf(stderr, "%s: invalid PID '%s'\n", progname, optarg);
+                return 2;
+            }
+            break;
+        case OPT_EXEC:
+            exec = true;
+            break;
         case '?':
         default:
             usage(true);
@@ -80,22 +406,113 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (!replayFile.empty() && !restoreFile.empty()) {
+        usage(true);
+        return 2;
+    }
+    if (exec != (optind < argc) || (exec && attachPid) ||
+        (!replayFile.empty() && (exec || attachPid))) {
+        usage(true);
+        return 2;
+    }
+
     version();
+    resetStats();
+
+    if (!replayFile.empty()) {
+        void *codeAddress;
+        std::unique_ptr<SessionLog> log{SessionLog::open(replayFile,
+                                                         codeAddress)};
+        if (!log)
+            return 1;
+
+        std::shared_ptr<Tracee> tracee{Tracee::createTracee(codeAddress)};
+        if (!tracee)
+            return 1;
+        if (tracee->getMemory().code.address != codeAddress) {
+            fprintf(stderr,
+                    "warning: could not place code at the recorded address; addresses will differ\n");
+        }
+        tracee->setSyscallTracing(traceSyscalls);
 
-    std::shared_ptr<Tracee> tracee{Tracee::createTracee()};
+        int status = replaySession(*log, *tracee, verify);
+        if (stats)
+            printStats(stderr);
+        return status;
+    }
+
+    // Try to put a restored session's memory back where it was so that
+    // absolute addresses stay valid
+    void *codeAddress = nullptr;
+    if (!restoreFile.empty() &&
+        readSessionSnapshotAddress(restoreFile, codeAddress))
+        return 1;
+
+    std::shared_ptr<Tracee> tracee;
+    if (attachPid)
+        tracee = Tracee::attachTracee(attachPid, codeAddress);
+    else if (exec)
+        tracee = Tracee::execTracee(argv + optind, codeAddress);
+    else
+        tracee = Tracee::createTracee(codeAddress);
     if (!tracee)
         return 1;
+    tracee->setSyscallTracing(traceSyscalls);
+
+    std::unique_ptr<SessionLog> log;
+    if (!recordFile.empty()) {
+        log = SessionLog::create(recordFile, tracee->getMemory().code.address);
+        if (!log)
+            return 1;
+
+        if (recordState) {
+            SessionRecord stateRecord;
+            stateRecord.type = SessionRecordType::STATE;
+            if (tracee->getRegisterState(stateRecord.state) ||
+                log->writeRecord(stateRecord))
+                return 1;
+        }
+    }
 
     Inputter inputter;
 
     std::shared_ptr<AssemblerContext>
-        assemblerContext{Assembler::createAssemblerContext()};
+        assemblerContext{Assembler::createAssemblerContext(mcpu, mattr)};
     if (!assemblerContext)
         return 1;
-    Assembler assembler{assemblerContext};
+    std::unique_ptr<AssemblyCache> cache;
+    if (!cacheFile.empty()) {
+        cache = AssemblyCache::open(cacheFile);
+        if (!cache)
+            return 1;
+    }
+
+    Assembler assembler{assemblerContext, cache.get()};
+    LibraryIndex libraries{*tracee};
+    SymbolTable symbols;
+    Profiler profiler;
+    TemplateTable templates;
+    useLibraryIndex(libraries, symbols);
+
+    // A restored symbol table already has the initial symbols
+    if (!restoreFile.empty()) {
+        if (restoreSessionSnapshot(restoreFile, *tracee, symbols, templates))
+            return 1;
+    } else if (defineInitialSymbols(*tracee, symbols))
+        return 1;
+
+    // The buffers for each line are reused so that once they've grown, a line
+    // of assembly which is already in the cache doesn't allocate anything
+    SessionRecord record;
+    std::string &line = record.line;
 
     for (;;) {
-        std::string line = inputter.readLine("asmase> ");
+        uint64_t allocations = getAllocationCount();
+
+        {
+            PhaseTimer timer{StatsPhase::INPUT};
+            inputter.readLine("asmase> ", line);
+        }
         if (line.empty()) {
             printf("\n");
             break;
@@ -104,24 +521,48 @@ int main(int argc, char *argv[])
         line.resize(line.size() - 1); // Trim off the newline
 
         if (isBuiltin(line)) {
-            if (runBuiltin(line, *tracee, inputter) < 0)
+            if (log && !definesTemplate(line)) {
+                record.type = SessionRecordType::BUILTIN;
+                log->writeRecord(record);
+            }
+
+            if (runBuiltin(line, *tracee, symbols, profiler, templates,
+                           &assembler, inputter, log.get()) < 0)
                 break;
         } else {
-            bytestring machineCode;
+            AssembledCode &code = record.code;
 
-            int error = assembler.assembleInstruction(line, machineCode, inputter);
-            if (error || machineCode.empty())
-                continue;
+            int error = assembler.assembleInstruction(line, code, inputter);
+            if (!error && (!code.machineCode.empty() || !code.data.empty() ||
+                           !code.labels.empty() || code.dataAlignment != 1)) {
+                // Log the code before it's linked; the replay links it again
+                if (log) {
+                    record.type = SessionRecordType::INSTRUCTION;
+                    log->writeRecord(record);
+                }
 
-            printf("%s = ", line.c_str());
-            tracee->printInstruction(machineCode);
-            printf("\n");
+                bool executed;
+                if (runCode(*tracee, symbols, profiler, line, code,
+                            executed) < 0)
+                    break;
 
-            error = tracee->executeInstruction(machineCode);
-            if (error < 0)
-                break;
+                if (log && recordState && executed) {
+                    SessionRecord stateRecord;
+                    stateRecord.type = SessionRecordType::STATE;
+                    if (!tracee->getRegisterState(stateRecord.state))
+                        log->writeRecord(stateRecord);
+                }
+            }
+        }
+
+        if (debugAlloc) {
+            fprintf(stderr, "%" PRIu64 " allocations\n",
+                    getAllocationCount() - allocations);
         }
     }
 
+    if (stats)
+        printStats(stderr);
+
     return 0;
 }